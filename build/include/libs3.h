@@ -0,0 +1 @@
+/root/repo/inc/libs3.h
\ No newline at end of file
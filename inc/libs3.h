@@ -68,7 +68,9 @@ extern "C" {
  *   1. Simple blocking requests, one at a time
  *   2. Multiple threads each making simple blocking requests
  *   3. From a single thread, managing multiple S3 requests simultaneously
- *      using file descriptors and a select()/poll() loop
+ *      using file descriptors and a select()/poll() loop, or using
+ *      S3_process_request_context(), which only visits the connections that
+ *      are ready and so scales to very large numbers of requests
  * - Shut down libs3 at program exit time by calling S3_deinitialize()
  *
  * All functions which send requests to S3 return their results via a set of
@@ -78,7 +80,8 @@ extern "C" {
  * S3RequestContext for the function invocation is passed in as NULL).
  * If an S3RequestContext is used to drive multiple S3 requests
  * simultaneously, then the callbacks will be made from the thread which
- * calls S3_runall_request_context() or S3_runonce_request_context(), or
+ * calls S3_runall_request_context(), S3_runonce_request_context() or
+ * S3_process_request_context(), or
  * possibly from the thread which calls S3_destroy_request_context(), if
  * S3 requests are in progress at the time that this function is called.
  *
@@ -108,6 +111,9 @@ extern "C" {
  *    which invoked them, so the caller of all libs3 functions should not hold
  *    locks that it would try to re-acquire in a callback, as this may
  *    deadlock.
+ * 5. The exception to (4) is an S3WorkerPool, which runs the tasks submitted
+ *    to it, and all callbacks of the requests that those tasks start, on its
+ *    own threads.
  ************************************************************************** **/
 
 
@@ -191,15 +197,58 @@ extern "C" {
 #define S3_MAX_GRANTEE_DISPLAY_NAME_SIZE   128
 
 
+/**
+ * This is the maximum number of characters (including terminating \0) that
+ * libs3 supports in a multipart upload ID as returned by S3.
+ **/
+#define S3_MAX_UPLOAD_ID_SIZE              512
+
+
+/**
+ * This is the maximum number of characters (including terminating \0) that
+ * libs3 supports in the name of a region that requests are signed for with
+ * Signature Version 4.
+ **/
+#define S3_MAX_AUTH_REGION_SIZE            64
+
+
+/**
+ * S3_MULTIPART_MIN_PART_SIZE is the smallest size that S3 accepts for any
+ * part of a multipart upload other than the last one.
+ **/
+#define S3_MULTIPART_MIN_PART_SIZE         (5LL * 1024 * 1024)
+
+
+/**
+ * S3_MULTIPART_MAX_PART_COUNT is the largest number of parts that S3 accepts
+ * in a single multipart upload.  Part numbers run from 1 to this value.
+ **/
+#define S3_MULTIPART_MAX_PART_COUNT        10000
+
+
+/**
+ * S3_CONTENT_LENGTH_UNKNOWN may be given as the content length of a managed
+ * multipart upload whose length is not known in advance, such as that of
+ * data read from a pipe.  The data is then read until the data callback
+ * returns 0, or for S3_put_object_multipart_from_fd(), until the end of the
+ * file.
+ **/
+#define S3_CONTENT_LENGTH_UNKNOWN          ((uint64_t) -1)
+
+
 /**
  * This is the maximum number of characters that will be stored in the
  * return buffer for the utility function which computes an HTTP authenticated
  * query string
  **/
 #define S3_MAX_AUTHENTICATED_QUERY_STRING_SIZE \
-    (sizeof("https:///") + S3_MAX_HOSTNAME_SIZE + (S3_MAX_KEY_SIZE * 3) + \
-     sizeof("?AWSAccessKeyId=") + 32 + sizeof("&Expires=") + 32 + \
-     sizeof("&Signature=") + 28 + 1)
+    (sizeof("https:///") + S3_MAX_HOSTNAME_SIZE + 255 +                   \
+     (S3_MAX_KEY_SIZE * 3) + sizeof("?X-Amz-Algorithm=AWS4-HMAC-SHA256") + \
+     sizeof("&X-Amz-Credential=") + (32 * 3) + sizeof("%2F00000000%2F") +  \
+     (S3_MAX_AUTH_REGION_SIZE * 3) + sizeof("%2Fs3%2Faws4_request") +     \
+     sizeof("&X-Amz-Date=") + 16 + sizeof("&X-Amz-Expires=") + 6 +        \
+     sizeof("&X-Amz-SignedHeaders=host") + sizeof("&X-Amz-Signature=") +   \
+     64 + 1)
 
 
 /**
@@ -281,6 +330,11 @@ typedef enum
     S3StatusServerFailedVerification                        ,
     S3StatusConnectionFailed                                ,
     S3StatusAbortedByCallback                               ,
+    S3StatusUploadIdTooLong                                 ,
+    S3StatusBadPartNumber                                   ,
+    S3StatusBufferTooSmall                                  ,
+    S3StatusAuthRegionTooLong                               ,
+    S3StatusDigestMismatch                                  ,
     
     /**
      * Errors from the S3 service
@@ -413,6 +467,24 @@ typedef enum
 } S3UriStyle;
 
 
+/**
+ * S3SignatureVersion defines how requests are authenticated to Amazon S3:
+ *
+ * Default: the signature version set by S3_set_default_signature_version(),
+ *          which is Signature Version 2 unless it has been changed
+ * V2: the original HMAC-SHA1 signature, which only some regions accept
+ * V4: AWS Signature Version 4 (HMAC-SHA256), which every region accepts and
+ *     which requests must be signed with for the region that they are sent
+ *     to
+ **/
+typedef enum
+{
+    S3SignatureDefault                  = 0,
+    S3SignatureV2                       = 1,
+    S3SignatureV4                       = 2
+} S3SignatureVersion;
+
+
 /**
  * S3GranteeType defines the type of Grantee used in an S3 ACL Grant.
  * Amazon Customer By Email - identifies the Grantee using their Amazon S3
@@ -482,6 +554,27 @@ typedef enum
 } S3CannedAcl;
 
 
+/**
+ * S3HttpVersion selects the version of HTTP used by the requests of an
+ * S3RequestContext.
+ * HTTP 1.1 is the default, and sends each request over a connection of its
+ *     own, so that concurrent requests need one connection each
+ * HTTP 2 is negotiated with the server when using HTTPS, falling back to
+ *     HTTP 1.1 if the server does not support it; requests to the same host
+ *     are then multiplexed over a small number of connections.  Plain HTTP
+ *     requests use HTTP 1.1.
+ * HTTP 2 Prior Knowledge uses HTTP 2 without negotiation, for both HTTP and
+ *     HTTPS; this is needed for HTTP 2 over plain HTTP, but only works with
+ *     servers known to support HTTP 2
+ **/
+typedef enum
+{
+    S3HttpVersion1_1                    = 0,
+    S3HttpVersion2                      = 1,
+    S3HttpVersion2PriorKnowledge        = 2
+} S3HttpVersion;
+
+
 /** **************************************************************************
  * Data Types
  ************************************************************************** **/
@@ -493,6 +586,21 @@ typedef enum
 typedef struct S3RequestContext S3RequestContext;
 
 
+/**
+ * An S3WorkerPool runs S3 requests on a set of threads, each with its own
+ * S3RequestContext; see the S3_XXX_worker_pool functions below for details
+ **/
+typedef struct S3WorkerPool S3WorkerPool;
+
+
+/**
+ * An S3PreparedBucket holds a copy of a bucket context together with the
+ * parts of every request to the bucket which are the same for each request;
+ * see the S3_XXX_prepared_bucket functions below for details
+ **/
+typedef struct S3PreparedBucket S3PreparedBucket;
+
+
 /**
  * S3NameValue represents a single Name - Value pair, used to represent either
  * S3 metadata associated with a key, or S3 error details.
@@ -695,6 +803,26 @@ typedef struct S3BucketContext
      *  The Amazon Secret Access Key to use for access to the bucket
      **/
     const char *secretAccessKey;
+
+    /**
+     * The signature version to sign requests for the bucket with
+     **/
+    S3SignatureVersion signatureVersion;
+
+    /**
+     * The region that the bucket is in, which requests are signed for with
+     * Signature Version 4.  If set to NULL, the default region set by
+     * S3_set_default_signature_version() is used.
+     **/
+    const char *authRegion;
+
+    /**
+     * Set only in the bucket context returned by
+     * S3_get_prepared_bucket_context(), and copies of it, to the
+     * S3PreparedBucket that the work common to every request to the bucket
+     * is taken from.  Must be NULL in any other bucket context.
+     **/
+    const S3PreparedBucket *preparedBucket;
 } S3BucketContext;
 
 
@@ -741,6 +869,109 @@ typedef struct S3ListBucketContent
 } S3ListBucketContent;
 
 
+/**
+ * This gives a batch of the keys listed by a call to S3_list_bucket in
+ * columns rather than as S3ListBucketContent structures, for callers which
+ * process many keys at a time; see listBucketColumnsCallback in
+ * S3ListBucketHandler.  Entry i of each array describes the same key.
+ **/
+typedef struct S3ListBucketColumns
+{
+    /**
+     * This is the number of keys in the batch, and of entries in each array
+     **/
+    int count;
+
+    /**
+     * The keys, ETags, and owner IDs and display names of the batch, each
+     * terminated by a 0, one after the other in no particular order.  The
+     * offsets arrays give where each one starts.
+     **/
+    const char *strings;
+
+    /**
+     * These give the offset of each key and ETag in strings
+     **/
+    const int *keyOffsets;
+    const int *eTagOffsets;
+
+    /**
+     * These give the offset of the ID and display name of the owner of each
+     * key in strings, or -1 if it was not present
+     **/
+    const int *ownerIdOffsets;
+    const int *ownerDisplayNameOffsets;
+
+    /**
+     * This gives the last modified date of each key, in seconds since the
+     * UNIX epoch
+     **/
+    const int64_t *lastModifieds;
+
+    /**
+     * This gives the size in bytes of the object of each key
+     **/
+    const uint64_t *sizes;
+} S3ListBucketColumns;
+
+
+/**
+ * These flags control how S3_crawl_bucket lists a bucket.
+ *
+ * S3_CRAWL_SORTED delivers the keys in order, as S3_list_bucket does; without
+ * it, the keys of different parts of the bucket are delivered interleaved,
+ * as they arrive.
+ *
+ * S3_CRAWL_FETCH_OWNER returns the owner of each key.
+ **/
+#define S3_CRAWL_SORTED                    0x1
+#define S3_CRAWL_FETCH_OWNER               0x2
+
+
+/**
+ * These flags select the digests of the data of a put that libs3 computes
+ * as it sends the data; see S3PayloadDigests.
+ **/
+#define S3_DIGEST_MD5                      0x1
+#define S3_DIGEST_SHA256                   0x2
+#define S3_DIGEST_CRC32C                   0x4
+
+
+/**
+ * S3PayloadDigests requests digests of the data of a put, which libs3
+ * computes as the data passes through it, so that the data need not be read
+ * twice, once to hash it and once to send it.  The digests are filled in
+ * before the complete callback of the put is made, when the put succeeds.
+ *
+ * When an MD5 digest is requested and the server returns an ETag which is
+ * the MD5 of the data, as S3 does for objects and parts which are neither
+ * encrypted with customer-provided or KMS keys nor uploaded in parts, a
+ * mismatch fails the put with S3StatusDigestMismatch.
+ **/
+typedef struct S3PayloadDigests
+{
+    /**
+     * The S3_DIGEST_ flags of the digests to compute; set by the caller
+     **/
+    int digests;
+
+    /**
+     * The MD5 digest of the data, if S3_DIGEST_MD5 was requested
+     **/
+    unsigned char md5[16];
+
+    /**
+     * The SHA-256 digest of the data, if S3_DIGEST_SHA256 was requested
+     **/
+    unsigned char sha256[32];
+
+    /**
+     * The CRC32C (Castagnoli) of the data, if S3_DIGEST_CRC32C was requested
+     **/
+    uint32_t crc32c;
+} S3PayloadDigests;
+
+
 /**
  * S3PutProperties is the set of properties that may optionally be set by the
  * user when putting objects to S3.  Each field of this structure is optional
@@ -822,6 +1053,14 @@ typedef struct S3PutProperties
      * response has the usesServerSideEncryption flag set.
      **/
     char useServerSideEncryption;
+
+    /**
+     * If non-NULL, the digests of the data to compute as it is sent; see
+     * S3PayloadDigests.  For a put made in parts by
+     * S3_put_object_multipart(), each part's MD5 is checked against its
+     * ETag, and the digests are not filled in.
+     **/
+    S3PayloadDigests *payloadDigests;
 } S3PutProperties;
 
 
@@ -865,6 +1104,101 @@ typedef struct S3GetConditions
 } S3GetConditions;
 
 
+/**
+ * S3TransferProperties controls how the managed transfer functions
+ * (S3_put_object_multipart and S3_get_object_parallel) split a single object
+ * transfer into several S3 requests and run them concurrently, and how many
+ * requests S3_crawl_bucket runs at once.  Each field of this structure is
+ * optional; passing a NULL S3TransferProperties selects the defaults for
+ * every field.
+ **/
+typedef struct S3TransferProperties
+{
+    /**
+     * This is the number of bytes transferred by each individual request.
+     * If 0, a default of 8 MB is used.  For uploads, values smaller than
+     * S3_MULTIPART_MIN_PART_SIZE are raised to that size, and the value is
+     * also raised as necessary so that the object fits in
+     * S3_MULTIPART_MAX_PART_COUNT parts.  S3_crawl_bucket does not use this.
+     **/
+    uint64_t partSize;
+
+    /**
+     * This is the maximum number of requests that will be in progress at
+     * the same time for the transfer.  If 0, a default of 4 is used.
+     **/
+    int maxConcurrency;
+
+    /**
+     * This is the number of times that each individual request will be
+     * retried when it fails with a status for which
+     * S3_status_is_retryable() returns nonzero.  Only that request is
+     * retried; parts already transferred are not sent again.  When no
+     * S3TransferProperties is supplied, a default of 3 is used.
+     **/
+    int maxRetries;
+} S3TransferProperties;
+
+
+/**
+ * S3ConnectionStats reports how often requests have been able to re-use an
+ * HTTP connection left open by an earlier request, rather than paying for a
+ * new connection (and for HTTPS, a new TLS handshake).
+ **/
+typedef struct S3ConnectionStats
+{
+    /**
+     * This is the number of requests which have received a response since
+     * S3_initialize() was called
+     **/
+    uint64_t requestCount;
+
+    /**
+     * This is the number of those requests which were sent over an already
+     * established connection
+     **/
+    uint64_t connectionReuseCount;
+} S3ConnectionStats;
+
+
+/**
+ * S3TransportProperties controls how the requests of an S3RequestContext use
+ * their HTTP connections; see S3_set_request_context_transport().  A
+ * zero-filled S3TransportProperties gives the default behavior.
+ **/
+typedef struct S3TransportProperties
+{
+    /**
+     * This is the version of HTTP to use
+     **/
+    S3HttpVersion httpVersion;
+
+    /**
+     * If nonzero, requests which send a body are sent without an
+     * "Expect: 100-continue" header, so that the body is sent immediately
+     * instead of after the server has accepted the request headers.  This
+     * saves a round trip per upload, at the cost of sending the whole body
+     * of a request which the server then rejects.
+     **/
+    int disableExpectContinue;
+
+    /**
+     * If nonzero, this is the maximum number of connections that will be
+     * opened to any one host; requests beyond what these connections can
+     * carry wait until a connection is free.  With HTTP 2, this bounds the
+     * number of connections over which requests are multiplexed.
+     **/
+    int maxConnectionsPerHost;
+
+    /**
+     * If nonzero, this is the maximum number of requests which are
+     * multiplexed over a single HTTP 2 connection at once; if zero, a
+     * default of 100 is used
+     **/
+    int maxStreamsPerConnection;
+} S3TransportProperties;
+
+
 /**
  * S3ErrorDetails provides detailed information describing an S3 error.  This
  * is only presented when the error is an S3-generated error (i.e. one of the
@@ -984,7 +1318,9 @@ typedef S3Status (S3ListServiceCallback)(const char *ownerId,
  * @param nextMarker if present, gives the largest (alphabetically) key
  *        returned in the response, which, if isTruncated is true, may be used
  *        as the marker in a subsequent list buckets operation to continue
- *        listing
+ *        listing.  For S3_list_bucket_v2, this instead gives the continuation
+ *        token to pass to the next S3_list_bucket_v2 call when isTruncated is
+ *        true.
  * @param contentsCount is the number of ListBucketContent structures in the
  *        contents parameter
  * @param contents is an array of ListBucketContent structures, each one
@@ -1008,6 +1344,28 @@ typedef S3Status (S3ListBucketCallback)(int isTruncated,
                                         int commonPrefixesCount,
                                         const char **commonPrefixes,
                                         void *callbackData);
+
+
+/**
+ * This callback is made instead of the S3ListBucketCallback when an
+ * S3ListBucketHandler gives one.  It reports the same keys, as columns, so
+ * that a whole batch can be processed with tight loops over arrays.
+ *
+ * @param isTruncated is as for S3ListBucketCallback
+ * @param nextMarker is as for S3ListBucketCallback
+ * @param columns gives the keys of the batch
+ * @param commonPrefixesCount is as for S3ListBucketCallback
+ * @param commonPrefixes is as for S3ListBucketCallback
+ * @param callbackData is the callback data as specified when the request
+ *        was issued.
+ * @return S3StatusOK to continue processing the request, anything else to
+ *         immediately abort the request with a status which will be
+ *         passed to the S3ResponseCompleteCallback for this request.
+ **/
+typedef S3Status (S3ListBucketColumnsCallback)
+    (int isTruncated, const char *nextMarker,
+     const S3ListBucketColumns *columns, int commonPrefixesCount,
+     const char **commonPrefixes, void *callbackData);
                                        
 
 /**
@@ -1052,6 +1410,45 @@ typedef int (S3PutObjectDataCallback)(int bufferSize, char *buffer,
  **/
 typedef S3Status (S3GetObjectDataCallback)(int bufferSize, const char *buffer,
                                            void *callbackData);
+
+
+/**
+ * This callback is made during a parallel get object operation which does
+ * not deliver the object contents in order, to provide the next chunk of
+ * data available from one of the ranges of the object being fetched.  Chunks
+ * arrive in no particular order, but every byte of the object is passed
+ * through this callback exactly once, at its offset.
+ *
+ * @param offset gives the offset within the object of the first byte of
+ *        buffer
+ * @param bufferSize gives the number of bytes in buffer
+ * @param buffer is the data being passed into the callback
+ * @param callbackData is the callback data as specified when the request
+ *        was issued.
+ * @return S3StatusOK to continue processing the request, anything else to
+ *         abort the whole operation with a status which will be passed to
+ *         the S3ResponseCompleteCallback for it.
+ **/
+typedef S3Status (S3GetObjectRangeDataCallback)(uint64_t offset,
+                                                int bufferSize,
+                                                const char *buffer,
+                                                void *callbackData);
+
+
+/**
+ * This callback is made on one of the threads of an S3WorkerPool to run a
+ * task which was submitted to it.  The task starts its requests by passing
+ * requestContext to the libs3 request functions, and must not run
+ * requestContext itself; all of the callbacks of those requests are then
+ * made on the same thread.
+ *
+ * @param requestContext is the S3RequestContext of the worker thread running
+ *        the task
+ * @param callbackData is the callback data as specified when the task was
+ *        submitted.
+ **/
+typedef void (S3WorkerPoolTask)(S3RequestContext *requestContext,
+                                void *callbackData);
                                        
 
 /** **************************************************************************
@@ -1119,6 +1516,21 @@ typedef struct S3ListBucketHandler
      * operation.
      **/
     S3ListBucketCallback *listBucketCallback;
+
+    /**
+     * The most keys, and the most common prefixes, to report in each call
+     * to listBucketCallback or listBucketColumnsCallback.  If 0, up to 32
+     * keys and 8 common prefixes are reported at a time.  A batchSize at
+     * least as large as the maxkeys of the request reports each response in
+     * a single call; only as much memory as the response needs is used.
+     **/
+    int batchSize;
+
+    /**
+     * If non-NULL, this is called instead of listBucketCallback, reporting
+     * the keys in columns
+     **/
+    S3ListBucketColumnsCallback *listBucketColumnsCallback;
 } S3ListBucketHandler;
 
 
@@ -1165,6 +1577,36 @@ typedef struct S3GetObjectHandler
 } S3GetObjectHandler;
 
 
+/**
+ * An S3GetObjectParallelHandler defines the callbacks which are made for
+ * S3_get_object_parallel requests.  Exactly one of the data callbacks should
+ * be non-NULL; it determines whether the object contents are delivered in
+ * order or by offset.
+ **/
+typedef struct S3GetObjectParallelHandler
+{
+    /**
+     * responseHandler provides the properties and complete callback
+     **/
+    S3ResponseHandler responseHandler;
+
+    /**
+     * If non-NULL, the getObjectDataCallback is called with the contents of
+     * the object in order, exactly as for S3_get_object.  Ranges which
+     * arrive ahead of their turn are buffered until they can be delivered.
+     **/
+    S3GetObjectDataCallback *getObjectDataCallback;
+
+    /**
+     * If non-NULL, the getObjectRangeDataCallback is called with the
+     * contents of the object as they arrive, along with their offsets, and
+     * nothing is buffered.  This suits writing the object directly into a
+     * file at each offset.
+     **/
+    S3GetObjectRangeDataCallback *getObjectRangeDataCallback;
+} S3GetObjectParallelHandler;
+
+
 /** **************************************************************************
  * General Library Functions
  ************************************************************************** **/
@@ -1313,6 +1755,78 @@ S3Status S3_convert_acl(char *aclXml, char *ownerId, char *ownerDisplayName,
 int S3_status_is_retryable(S3Status status);
 
 
+/**
+ * Parses an ISO 8601 time, such as 2025-10-01T12:00:00.000Z, as returned in
+ * the LastModified values of S3 listings.  Milliseconds are ignored, and a
+ * time zone offset, if present, is applied; otherwise the time is taken as
+ * UTC, whatever the local time zone is.
+ *
+ * @param str is the time to parse
+ * @return the time in seconds since the UNIX epoch, or a negative value if
+ *         str is not a valid ISO 8601 time
+ **/
+int64_t S3_parse_iso8601_time(const char *str);
+
+
+/**
+ * Returns statistics describing how well libs3 has been able to re-use HTTP
+ * connections.  Connections are kept open between requests, and each curl
+ * handle that libs3 keeps for re-use keeps its connections, so a request
+ * which follows another to the same host will normally re-use the earlier
+ * request's connection.  This function is thread-safe.
+ *
+ * @param statsReturn returns the statistics
+ **/
+void S3_get_connection_stats(S3ConnectionStats *statsReturn);
+
+
+/**
+ * Sets how many completed requests, along with their curl handles and the
+ * connections that those keep open, libs3 keeps for re-use by later
+ * requests.  Each thread which makes requests keeps up to threadCacheSize of
+ * them for itself, which it re-uses without any locking; beyond that, up to
+ * sharedCacheSize more are kept in a cache shared by all threads, and any
+ * more are destroyed.  Programs running many requests concurrently should
+ * make these large enough to hold the handles of all of them, so that
+ * handles and their connections are not constantly destroyed and
+ * re-created.  The defaults are 4 and 32.
+ *
+ * The new sizes take effect at the next call to S3_initialize, and this
+ * function is subject to the same threading restrictions as S3_initialize.
+ *
+ * @param threadCacheSize gives the number of requests each thread keeps for
+ *        itself; 0 disables the per-thread caches
+ * @param sharedCacheSize gives the number of requests kept in the shared
+ *        cache, which is rounded up to a power of 2; 0 disables the shared
+ *        cache
+ **/
+void S3_set_request_cache_size(int threadCacheSize, int sharedCacheSize);
+
+
+/**
+ * Sets how requests are signed when their bucket context gives
+ * S3SignatureDefault as its signature version, and the region that they are
+ * signed for when it gives no region.  The same applies to the service and
+ * bucket functions which take no bucket context, except that
+ * S3_create_bucket() signs for the location constraint of the bucket that it
+ * creates, if one is given.  The defaults are Signature Version 2 and
+ * "us-east-1".
+ *
+ * This function is subject to the same threading restrictions as
+ * S3_initialize.
+ *
+ * @param signatureVersion gives the default signature version; if
+ *        S3SignatureDefault, the default is left unchanged
+ * @param authRegion gives the default region, or NULL for "us-east-1"
+ * @return One of:
+ *         S3StatusAuthRegionTooLong if authRegion is
+ *             S3_MAX_AUTH_REGION_SIZE characters or longer
+ *         S3StatusOK on success
+ **/
+S3Status S3_set_default_signature_version(S3SignatureVersion signatureVersion,
+                                          const char *authRegion);
+
+
 /** **************************************************************************
  * Request Context Management Functions
  ************************************************************************** **/
@@ -1439,6 +1953,225 @@ S3Status S3_get_request_context_fdsets(S3RequestContext *requestContext,
 int64_t S3_get_request_context_timeout(S3RequestContext *requestContext);
 
 
+/**
+ * Waits for I/O on the requests within the S3RequestContext and processes
+ * the requests which have I/O available, making callbacks on them and
+ * possibly completing them.  Unlike S3_runonce_request_context, which
+ * examines every connection in the S3RequestContext on each call, this
+ * function is driven by notifications of which connections are ready, so that
+ * the cost of each call is proportional to the number of connections with
+ * I/O available rather than to the number of requests in the
+ * S3RequestContext.  This is the means by which S3_runall_request_context
+ * runs requests, and should be preferred over S3_runonce_request_context for
+ * S3RequestContexts holding many requests.  On platforms without epoll
+ * support, this function falls back to waiting on the fdsets of the
+ * S3RequestContext followed by S3_runonce_request_context.
+ *
+ * Requests added to the S3RequestContext from within the callbacks of other
+ * requests are started on the next call to this function.
+ *
+ * @param requestContext is the S3RequestContext to process
+ * @param timeout is the maximum number of milliseconds to wait for I/O; 0
+ *        means to process only the I/O which is immediately available
+ *        without waiting, and -1 means to wait until there is some I/O or
+ *        internal timeout to process.  This function may return before this
+ *        timeout expires even if no requests have completed.
+ * @param requestsRemainingReturn returns the number of requests remaining
+ *            and not yet completed within the S3RequestContext after this
+ *            function returns.
+ * @return One of:
+ *         S3StatusOK if request processing proceeded without error
+ *         S3StatusInternalError if an internal error prevented the
+ *             S3RequestContext from running one or more requests
+ *         S3StatusOutOfMemory if requests could not be processed due to
+ *             an out of memory error
+ **/
+S3Status S3_process_request_context(S3RequestContext *requestContext,
+                                    int timeout, int *requestsRemainingReturn);
+
+
+/**
+ * Returns an epoll file descriptor which becomes readable whenever any of
+ * the requests within the S3RequestContext has I/O available, allowing the
+ * S3RequestContext to be included in an epoll-based event loop of the
+ * caller's.  When this file descriptor becomes readable, or when the timeout
+ * returned by S3_get_request_context_timeout expires,
+ * S3_process_request_context should be called with a timeout of 0.  The
+ * returned file descriptor is owned by the S3RequestContext and must not be
+ * closed by the caller.
+ *
+ * @param requestContext is the S3RequestContext to get the file descriptor
+ *        of
+ * @return the epoll file descriptor of the S3RequestContext, or -1 on
+ *         platforms without epoll support
+ **/
+int S3_get_request_context_epoll_fd(S3RequestContext *requestContext);
+
+
+/**
+ * Sets how the requests of an S3RequestContext use their HTTP connections.
+ * The properties apply to requests added to the S3RequestContext after this
+ * function returns; requests already in progress are unaffected.  Requests
+ * which are not made with an S3RequestContext always use the defaults.
+ *
+ * @param requestContext is the S3RequestContext to set the transport
+ *        properties of
+ * @param transportProperties gives the transport properties to use; if NULL,
+ *        the defaults are restored
+ * @return One of:
+ *         S3StatusOK if the transport properties were set
+ *         S3StatusInternalError if the installed version of libcurl does not
+ *             support the requested properties
+ **/
+S3Status S3_set_request_context_transport
+    (S3RequestContext *requestContext,
+     const S3TransportProperties *transportProperties);
+
+
+/** **************************************************************************
+ * Worker Pool Functions
+ ************************************************************************** **/
+
+/**
+ * An S3WorkerPool runs S3 requests on several threads at once, each of which
+ * drives its own S3RequestContext, so that the work done in request
+ * callbacks (parsing responses, computing checksums, copying data and so
+ * on) is spread across multiple CPUs rather than holding up the I/O of every
+ * other request.  Work is submitted to the pool as tasks, each of which is
+ * run on the thread which has the fewest tasks and requests outstanding and
+ * starts one or more requests on that thread's S3RequestContext.  The
+ * completion of those requests is reported through their own callbacks, on
+ * the same thread.  S3_initialize must have been called before an
+ * S3WorkerPool is created.
+ *
+ * S3WorkerPools are not supported on Windows.
+ *
+ * @param threadCount gives the number of threads in the pool; values less
+ *        than 1 are treated as 1
+ * @param workerPoolReturn returns the newly-created S3WorkerPool, which if
+ *        successfully returned, must be destroyed via a call to
+ *        S3_destroy_worker_pool when it is no longer needed
+ * @return One of:
+ *         S3StatusOK if the worker pool was successfully created
+ *         S3StatusOutOfMemory if the worker pool could not be created due to
+ *             an out of memory error
+ *         S3StatusInternalError if the threads of the worker pool could not
+ *             be created
+ **/
+S3Status S3_create_worker_pool(int threadCount,
+                               S3WorkerPool **workerPoolReturn);
+
+
+/**
+ * Destroys an S3WorkerPool which was created with S3_create_worker_pool.
+ * Tasks which have been submitted but not yet run are run first, and then any
+ * requests still in progress are aborted and their request completed
+ * callbacks made with the status S3StatusInterrupted, exactly as for
+ * S3_destroy_request_context.  Call S3_wait_worker_pool first to let them
+ * complete instead.  This function must not be called from a task or request
+ * callback running on the pool.
+ *
+ * @param workerPool is the S3WorkerPool to destroy
+ **/
+void S3_destroy_worker_pool(S3WorkerPool *workerPool);
+
+
+/**
+ * Submits a task to an S3WorkerPool.  This function may be called from any
+ * thread, including from the tasks and request callbacks running on the pool
+ * itself, and returns without waiting for the task to be run.
+ *
+ * @param workerPool is the S3WorkerPool to submit the task to
+ * @param task is the callback which will be made on one of the pool's
+ *        threads to run the task
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        the task callback
+ * @return One of:
+ *         S3StatusOK if the task was submitted; the task callback will
+ *             always be made
+ *         S3StatusOutOfMemory if the task could not be submitted due to an
+ *             out of memory error
+ *         S3StatusInterrupted if the S3WorkerPool is being destroyed
+ **/
+S3Status S3_submit_worker_pool_task(S3WorkerPool *workerPool,
+                                    S3WorkerPoolTask *task,
+                                    void *callbackData);
+
+
+/**
+ * Waits until an S3WorkerPool is idle, that is, until every task submitted to
+ * it has been run and every request started on its threads has completed,
+ * including tasks submitted and requests started while waiting.  This
+ * function must not be called from a task or request callback running on
+ * the pool.
+ *
+ * @param workerPool is the S3WorkerPool to wait for
+ **/
+void S3_wait_worker_pool(S3WorkerPool *workerPool);
+
+
+/** **************************************************************************
+ * Prepared Bucket Functions
+ ************************************************************************** **/
+
+/**
+ * Creates an S3PreparedBucket, which does once, for a bucket context, the
+ * work that every request made with the bucket context would otherwise do
+ * for itself: validating the bucket name, working out the signature version
+ * and region, composing the start of the URI, the canonical resource and
+ * Host header, and computing the signing key.  Requests are then made by
+ * passing the bucket context returned by S3_get_prepared_bucket_context to
+ * any of the functions which take a bucket context, which then only have to
+ * add the key and the headers of each request.
+ *
+ * The strings of the bucket context are copied, so need not outlive this
+ * call.  The default signature version and region are those in effect when
+ * this function is called.
+ *
+ * @param bucketContext gives the bucket context to prepare; its
+ *        preparedBucket must be NULL
+ * @param preparedBucketReturn returns the newly-created S3PreparedBucket,
+ *        which if successfully returned, must be destroyed via a call to
+ *        S3_destroy_prepared_bucket when it is no longer needed
+ * @return One of:
+ *         S3StatusOK if the prepared bucket was successfully created
+ *         S3StatusOutOfMemory if the prepared bucket could not be created
+ *             due to an out of memory error
+ *         Any status that S3_validate_bucket_name may return for the bucket
+ *             name
+ *         S3StatusAuthRegionTooLong if the region to sign for is
+ *             S3_MAX_AUTH_REGION_SIZE characters or longer
+ *         S3StatusUriTooLong if the host name and bucket name are too long
+ *             to make a URI of
+ **/
+S3Status S3_create_prepared_bucket(const S3BucketContext *bucketContext,
+                                   S3PreparedBucket **preparedBucketReturn);
+
+
+/**
+ * Destroys an S3PreparedBucket which was created with
+ * S3_create_prepared_bucket.  No request may be in progress with its bucket
+ * context, or any copy of it.
+ *
+ * @param preparedBucket is the S3PreparedBucket to destroy
+ **/
+void S3_destroy_prepared_bucket(S3PreparedBucket *preparedBucket);
+
+
+/**
+ * Returns the bucket context of an S3PreparedBucket, to pass to the libs3
+ * functions which take a bucket context.  It remains valid until the
+ * S3PreparedBucket is destroyed, and must not be modified; copies of it may
+ * be made, but likewise must not be modified.
+ *
+ * @param preparedBucket is the S3PreparedBucket to return the bucket context
+ *        of
+ * @return the bucket context of the S3PreparedBucket
+ **/
+const S3BucketContext *S3_get_prepared_bucket_context
+    (const S3PreparedBucket *preparedBucket);
+
+
 /** **************************************************************************
  * S3 Utility Functions
  ************************************************************************** **/
@@ -1458,7 +2191,9 @@ int64_t S3_get_request_context_timeout(S3RequestContext *requestContext);
  * @param expires gives the number of seconds since Unix epoch for the
  *        expiration date of the request; after this time, the request will
  *        no longer be valid.  If this value is negative, the largest
- *        expiration date possible is used (currently, Jan 19, 2038).
+ *        expiration date possible is used (currently, Jan 19, 2038).  A
+ *        query string signed with Signature Version 4 is valid for at most
+ *        a week, so expires at the earlier of this and a week from now.
  * @param resource gives a sub-resource to be fetched for the request, or NULL
  *        for none.  This should be of the form "?<resource>", i.e. 
  *        "?torrent".
@@ -1466,6 +2201,8 @@ int64_t S3_get_request_context_timeout(S3RequestContext *requestContext);
  *         S3StatusUriTooLong if, due to an internal error, the generated URI
  *             is longer than S3_MAX_AUTHENTICATED_QUERY_STRING_SIZE bytes in
  *             length and thus will not fit into the supplied buffer
+ *         S3StatusAuthRegionTooLong if the region to sign for is
+ *             S3_MAX_AUTH_REGION_SIZE characters or longer
  *         S3StatusOK on success
  **/
 S3Status S3_generate_authenticated_query_string
@@ -1473,6 +2210,52 @@ S3Status S3_generate_authenticated_query_string
      const char *key, int64_t expires, const char *resource);
 
 
+/**
+ * Generates the HTTP authenticated query strings of many keys of one bucket,
+ * as S3_generate_authenticated_query_string does for each of them, but much
+ * faster: everything except encoding and signing each key, including the
+ * signing key, is worked out just once, and the keys may be shared out among
+ * the threads of an S3WorkerPool.
+ *
+ * This function is not supported on Windows.
+ *
+ * @param arena is the buffer that the query strings are written to, each
+ *        terminated, in no particular order.  Each query string takes at
+ *        most S3_MAX_AUTHENTICATED_QUERY_STRING_SIZE bytes, but usually
+ *        much less.
+ * @param arenaSize gives the number of bytes in arena
+ * @param queryStringsReturn must have keyCount entries, and returns, for
+ *        each key, a pointer to its query string in arena, or NULL if its
+ *        query string could not be generated or did not fit in arena
+ * @param bucketContext gives the bucket and associated parameters for the
+ *        requests to generate.
+ * @param keyCount gives the number of keys
+ * @param keys gives the keys which the authenticated requests will GET
+ * @param expires gives the expiration date of the requests, as for
+ *        S3_generate_authenticated_query_string.  Signature Version 4 query
+ *        strings are all dated as of the call.
+ * @param resource gives a sub-resource to be fetched for every request, or
+ *        NULL for none, as for S3_generate_authenticated_query_string
+ * @param workerPool if non-NULL, gives the S3WorkerPool whose threads help
+ *        the calling thread to generate the query strings.  The function
+ *        still returns once every query string has been generated, and may
+ *        be called from a task of the same pool.
+ * @return One of:
+ *         S3StatusOK if every query string was generated
+ *         S3StatusOutOfMemory if the batch could not be set up
+ *         S3StatusBufferTooSmall if arena ran out of room; queryStringsReturn
+ *             is NULL for every key whose query string did not fit, and the
+ *             others are valid
+ *         Any other status that S3_generate_authenticated_query_string may
+ *             return, either for every key, or for one of the keys
+ *             whose query strings could not be generated
+ **/
+S3Status S3_generate_authenticated_query_strings
+    (char *arena, uint64_t arenaSize, char **queryStringsReturn,
+     const S3BucketContext *bucketContext, int keyCount, const char **keys,
+     int64_t expires, const char *resource, S3WorkerPool *workerPool);
+
+
 /** **************************************************************************
  * Service Functions
  ************************************************************************** **/
@@ -1630,14 +2413,104 @@ void S3_list_bucket(const S3BucketContext *bucketContext,
                     const S3ListBucketHandler *handler, void *callbackData);
 
 
+/**
+ * Lists keys within a bucket using version 2 of the list objects API, which
+ * continues a listing with an opaque continuation token rather than a key
+ * marker.  A continuation token is returned in every truncated response,
+ * whether or not a delimiter is used, and owners are left out of the response
+ * unless asked for, making it smaller to transfer and to parse.  The contents
+ * are reported through the same handler as for S3_list_bucket, the
+ * nextMarker parameter of its callbacks giving the continuation token.
+ *
+ * @param bucketContext gives the bucket and associated parameters for this
+ *        request
+ * @param prefix if present, gives a prefix for matching keys
+ * @param continuationToken if present, gives the nextMarker reported by the
+ *        truncated response of a previous S3_list_bucket_v2 call, continuing
+ *        that listing
+ * @param startAfter if present, only keys occuring after this value will be
+ *        listed; ignored by S3 when continuationToken is present
+ * @param delimiter if present, causes keys that contain the same string
+ *        between the prefix and the first occurrence of the delimiter to be
+ *        rolled up into a single result element
+ * @param maxkeys is the maximum number of keys to return
+ * @param fetchOwner if nonzero, the owner of each key is returned; if zero,
+ *        ownerId and ownerDisplayName will be NULL
+ * @param requestContext if non-NULL, gives the S3RequestContext to add this
+ *        request to, and does not perform the request immediately.  If NULL,
+ *        performs the request immediately and synchronously.
+ * @param handler gives the callbacks to call as the request is processed and
+ *        completed 
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this request
+ **/
+void S3_list_bucket_v2(const S3BucketContext *bucketContext,
+                       const char *prefix, const char *continuationToken,
+                       const char *startAfter, const char *delimiter,
+                       int maxkeys, int fetchOwner,
+                       S3RequestContext *requestContext,
+                       const S3ListBucketHandler *handler, void *callbackData);
+
+
+/**
+ * Lists every key under a prefix using several concurrent list requests,
+ * for buckets too large to list one page at a time.  The keys are divided
+ * into ranges, each listed with S3_list_bucket_v2 independently of the
+ * others.  The first ranges are divided at the common prefixes returned by a
+ * listing of the prefix with the delimiter, if one is given.  Then, whenever
+ * fewer than maxConcurrency requests would be in progress, a range which has
+ * more keys to list is split in two, at a key estimated from how closely
+ * together the keys of its last page lay, so that the ranges follow the way
+ * the keys are actually spread through the bucket.  A page which fails with a
+ * retryable status is listed again from the key after the last one
+ * delivered, so no key is delivered twice.
+ *
+ * The keys are delivered through the listBucketCallback or
+ * listBucketColumnsCallback of the handler, in batches of at most batchSize
+ * keys, with isTruncated always 0 and nextMarker and the common prefixes
+ * always NULL; the keys of the whole crawl are listed without a delimiter.
+ * With S3_CRAWL_SORTED, the batches of a range are buffered until every
+ * range before it has been delivered, up to 32 MB in all, past which only the
+ * first range is listed until the buffered keys have been delivered.
+ *
+ * The handler's propertiesCallback is made once, with the properties of the
+ * first response, and its completeCallback is made once when every key has
+ * been delivered or the operation has failed.
+ *
+ * @param bucketContext gives the bucket and associated parameters for this
+ *        request
+ * @param prefix if present, gives a prefix for matching keys
+ * @param delimiter if present, gives the delimiter at which the keys of the
+ *        prefix are first divided into ranges; "/" suits most buckets
+ * @param flags is a bitmask of S3_CRAWL_XXX flags, or 0
+ * @param transferProperties optionally controls the concurrency and retries
+ *        of the requests
+ * @param requestContext if non-NULL, gives the S3RequestContext to add the
+ *        requests of this operation to, and does not perform the operation
+ *        immediately; it is complete when its complete callback has been
+ *        made.  If NULL, performs the operation immediately and
+ *        synchronously.
+ * @param handler gives the callbacks to call as the operation is processed
+ *        and completed
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this operation
+ **/
+void S3_crawl_bucket(const S3BucketContext *bucketContext,
+                     const char *prefix, const char *delimiter, int flags,
+                     const S3TransferProperties *transferProperties,
+                     S3RequestContext *requestContext,
+                     const S3ListBucketHandler *handler, void *callbackData);
+
+
 /** **************************************************************************
  * Object Functions
  ************************************************************************** **/
 
 /**
  * Puts object data to S3.  This overwrites any existing object at that key;
- * note that S3 currently only supports full-object upload.  The data to
- * upload will be acquired by calling the handler's putObjectDataCallback.
+ * the whole object is sent in a single request (see
+ * S3_put_object_multipart() for uploading large objects in parts).  The data
+ * to upload will be acquired by calling the handler's putObjectDataCallback.
  *
  * @param bucketContext gives the bucket and associated parameters for this
  *        request
@@ -1659,6 +2532,43 @@ void S3_put_object(const S3BucketContext *bucketContext, const char *key,
                    const S3PutProperties *putProperties,
                    S3RequestContext *requestContext,
                    const S3PutObjectHandler *handler, void *callbackData);
+
+
+/**
+ * Puts object data to S3 from a range of an open file.  This is the same as
+ * S3_put_object(), except that instead of being acquired through a data
+ * callback, the data is read from the file directly into the buffers from
+ * which it is sent, with no intermediate copy.  The file is read at explicit
+ * offsets, so its file offset is not used or changed, and the request can be
+ * retried simply by calling this function again.
+ *
+ * @param bucketContext gives the bucket and associated parameters for this
+ *        request
+ * @param key is the key of the object to put to
+ * @param fd is the file descriptor of the file to read the data from, which
+ *        must remain open until the request has completed, and must support
+ *        reading at an offset (a regular file rather than a pipe)
+ * @param offset gives the offset within the file of the first byte to put
+ * @param contentLength gives the number of bytes of the file to put;
+ *        the request fails with S3StatusErrorIncompleteBody if the file ends
+ *        before this many bytes have been read
+ * @param putProperties optionally provides additional properties to apply to
+ *        the object that is being put to
+ * @param requestContext if non-NULL, gives the S3RequestContext to add this
+ *        request to, and does not perform the request immediately.  If NULL,
+ *        performs the request immediately and synchronously.
+ * @param handler gives the callbacks to call as the request is processed and
+ *        completed 
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this request
+ **/
+void S3_put_object_from_fd(const S3BucketContext *bucketContext,
+                           const char *key, int fd, uint64_t offset,
+                           uint64_t contentLength,
+                           const S3PutProperties *putProperties,
+                           S3RequestContext *requestContext,
+                           const S3ResponseHandler *handler,
+                           void *callbackData);
                         
 
 /**
@@ -1732,6 +2642,197 @@ void S3_get_object(const S3BucketContext *bucketContext, const char *key,
                    const S3GetObjectHandler *handler, void *callbackData);
 
 
+/**
+ * Gets an object from S3 straight into a buffer of the caller's.  The
+ * contents of the object are copied from the network buffers into
+ * [buffer] at their offset in the range being fetched, so that each byte is
+ * copied once and there is no data callback.  If the contents do not fit in
+ * the buffer, the request fails with S3StatusBufferTooSmall.  The number of
+ * bytes fetched is the contentLength given to the handler's
+ * propertiesCallback.
+ *
+ * @param bucketContext gives the bucket and associated parameters for this
+ *        request
+ * @param key is the key of the object to get
+ * @param getConditions if non-NULL, gives a set of conditions which must be
+ *        met in order for the request to succeed
+ * @param startByte gives the start byte for the byte range of the contents
+ *        to be returned
+ * @param byteCount gives the number of bytes to return; a value of 0
+ *        indicates that the contents up to the end should be returned
+ * @param bufferSize gives the number of bytes in buffer
+ * @param buffer is where the contents are stored; it must not be touched
+ *        until the request has completed
+ * @param requestContext if non-NULL, gives the S3RequestContext to add this
+ *        request to, and does not perform the request immediately.  If NULL,
+ *        performs the request immediately and synchronously.
+ * @param handler gives the callbacks to call as the request is processed and
+ *        completed 
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this request
+ **/
+void S3_get_object_to_buffer(const S3BucketContext *bucketContext,
+                             const char *key,
+                             const S3GetConditions *getConditions,
+                             uint64_t startByte, uint64_t byteCount,
+                             uint64_t bufferSize, char *buffer,
+                             S3RequestContext *requestContext,
+                             const S3ResponseHandler *handler,
+                             void *callbackData);
+
+
+/**
+ * Gets an object from S3 straight into a file.  The contents of the object
+ * are written at [offset] in the file, gathered into writes of about a
+ * megabyte which are made with pwrite(), so that the file offset of [fd] is
+ * not used or moved and there is no data callback.  The file is not
+ * truncated.  If the file cannot be written, the request fails with
+ * S3StatusAbortedByCallback.
+ *
+ * @param bucketContext gives the bucket and associated parameters for this
+ *        request
+ * @param key is the key of the object to get
+ * @param getConditions if non-NULL, gives a set of conditions which must be
+ *        met in order for the request to succeed
+ * @param startByte gives the start byte for the byte range of the contents
+ *        to be returned
+ * @param byteCount gives the number of bytes to return; a value of 0
+ *        indicates that the contents up to the end should be returned
+ * @param fd is a file descriptor open for writing, which must remain open
+ *        until the request has completed
+ * @param offset is the offset in the file at which to write the contents
+ * @param requestContext if non-NULL, gives the S3RequestContext to add this
+ *        request to, and does not perform the request immediately.  If NULL,
+ *        performs the request immediately and synchronously.
+ * @param handler gives the callbacks to call as the request is processed and
+ *        completed 
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this request
+ **/
+void S3_get_object_to_fd(const S3BucketContext *bucketContext,
+                         const char *key,
+                         const S3GetConditions *getConditions,
+                         uint64_t startByte, uint64_t byteCount, int fd,
+                         uint64_t offset, S3RequestContext *requestContext,
+                         const S3ResponseHandler *handler,
+                         void *callbackData);
+
+
+/**
+ * Gets an object from S3 using several concurrent ranged requests.  The
+ * object is first HEADed to learn its size and ETag, and is then fetched in
+ * ranges of partSize bytes, up to maxConcurrency of them at once.  Each
+ * range is fetched on the condition that the object still has the ETag
+ * returned by the HEAD, so that a concurrently replaced object fails with
+ * S3StatusErrorPreconditionFailed instead of being delivered in pieces of
+ * different versions.  A range which fails with a retryable status is
+ * resumed from the first byte not yet received.
+ *
+ * When the contents are delivered in order, at most
+ * (partSize * maxConcurrency) bytes are buffered.
+ *
+ * The handler's propertiesCallback is made once, with the properties
+ * returned by the HEAD, and its completeCallback is made once when the whole
+ * object has been fetched or the operation has failed.
+ *
+ * @param bucketContext gives the bucket and associated parameters for this
+ *        request
+ * @param key is the key of the object to get
+ * @param getConditions if non-NULL, gives a set of conditions which must be
+ *        met in order for the request to succeed
+ * @param transferProperties optionally controls the range size, concurrency
+ *        and retries of the requests
+ * @param requestContext if non-NULL, gives the S3RequestContext to add the
+ *        requests of this operation to, and does not perform the operation
+ *        immediately; it is complete when its complete callback has been
+ *        made.  If NULL, performs the operation immediately and
+ *        synchronously.
+ * @param handler gives the callbacks to call as the operation is processed
+ *        and completed
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this operation
+ **/
+void S3_get_object_parallel(const S3BucketContext *bucketContext,
+                            const char *key,
+                            const S3GetConditions *getConditions,
+                            const S3TransferProperties *transferProperties,
+                            S3RequestContext *requestContext,
+                            const S3GetObjectParallelHandler *handler,
+                            void *callbackData);
+
+
+/**
+ * Gets an object from S3 using several concurrent ranged requests, as
+ * S3_get_object_parallel() does, straight into a buffer of the caller's.
+ * Each range is copied into [buffer] at its offset in the object as it
+ * arrives, so nothing is buffered and each byte is copied once.  If the
+ * object does not fit in the buffer, the operation fails with
+ * S3StatusBufferTooSmall before any range is fetched.
+ *
+ * @param bucketContext gives the bucket and associated parameters for this
+ *        request
+ * @param key is the key of the object to get
+ * @param getConditions if non-NULL, gives a set of conditions which must be
+ *        met in order for the request to succeed
+ * @param transferProperties optionally controls the range size, concurrency
+ *        and retries of the requests
+ * @param bufferSize gives the number of bytes in buffer
+ * @param buffer is where the contents are stored; it must not be touched
+ *        until the operation has completed
+ * @param requestContext if non-NULL, gives the S3RequestContext to add the
+ *        requests of this operation to, and does not perform the operation
+ *        immediately; it is complete when its complete callback has been
+ *        made.  If NULL, performs the operation immediately and
+ *        synchronously.
+ * @param handler gives the callbacks to call as the operation is processed
+ *        and completed
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this operation
+ **/
+void S3_get_object_parallel_to_buffer
+    (const S3BucketContext *bucketContext, const char *key,
+     const S3GetConditions *getConditions,
+     const S3TransferProperties *transferProperties, uint64_t bufferSize,
+     char *buffer, S3RequestContext *requestContext,
+     const S3ResponseHandler *handler, void *callbackData);
+
+
+/**
+ * Gets an object from S3 using several concurrent ranged requests, as
+ * S3_get_object_parallel() does, straight into a file.  Each range is
+ * written at its offset in the file, in writes of about a megabyte made with
+ * pwrite(), so nothing is delivered in order and the file offset of [fd] is
+ * not used or moved.  The file is not truncated.  If the file cannot be
+ * written, the operation fails with S3StatusAbortedByCallback.
+ *
+ * @param bucketContext gives the bucket and associated parameters for this
+ *        request
+ * @param key is the key of the object to get
+ * @param getConditions if non-NULL, gives a set of conditions which must be
+ *        met in order for the request to succeed
+ * @param transferProperties optionally controls the range size, concurrency
+ *        and retries of the requests
+ * @param fd is a file descriptor open for writing, which must remain open
+ *        until the operation has completed
+ * @param offset is the offset in the file at which to write the contents
+ * @param requestContext if non-NULL, gives the S3RequestContext to add the
+ *        requests of this operation to, and does not perform the operation
+ *        immediately; it is complete when its complete callback has been
+ *        made.  If NULL, performs the operation immediately and
+ *        synchronously.
+ * @param handler gives the callbacks to call as the operation is processed
+ *        and completed
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this operation
+ **/
+void S3_get_object_parallel_to_fd
+    (const S3BucketContext *bucketContext, const char *key,
+     const S3GetConditions *getConditions,
+     const S3TransferProperties *transferProperties, int fd, uint64_t offset,
+     S3RequestContext *requestContext, const S3ResponseHandler *handler,
+     void *callbackData);
+
+
 /**
  * Gets the response properties for the object, but not the object contents.
  *
@@ -1769,6 +2870,223 @@ void S3_delete_object(const S3BucketContext *bucketContext, const char *key,
                       const S3ResponseHandler *handler, void *callbackData);
 
 
+/** **************************************************************************
+ * Multipart Upload Functions
+ ************************************************************************** **/
+
+/**
+ * Starts a multipart upload of an object.  The upload ID returned by S3
+ * identifies the upload in all subsequent S3_upload_part(),
+ * S3_complete_multipart_upload() and S3_abort_multipart_upload() calls.
+ *
+ * @param bucketContext gives the bucket and associated parameters for this
+ *        request
+ * @param key is the key of the object to upload
+ * @param putProperties optionally provides additional properties to apply to
+ *        the object once the upload is completed.  The md5 field is ignored,
+ *        since it cannot apply to the object as a whole.
+ * @param uploadIdReturn must be passed in as a buffer of at least
+ *        S3_MAX_UPLOAD_ID_SIZE bytes, and will be filled in with the upload
+ *        ID before the complete callback is made
+ * @param requestContext if non-NULL, gives the S3RequestContext to add this
+ *        request to, and does not perform the request immediately.  If NULL,
+ *        performs the request immediately and synchronously.
+ * @param handler gives the callbacks to call as the request is processed and
+ *        completed
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this request
+ **/
+void S3_initiate_multipart(const S3BucketContext *bucketContext,
+                           const char *key,
+                           const S3PutProperties *putProperties,
+                           char *uploadIdReturn,
+                           S3RequestContext *requestContext,
+                           const S3ResponseHandler *handler,
+                           void *callbackData);
+
+
+/**
+ * Uploads one part of a multipart upload.  The data to upload will be
+ * acquired by calling the handler's putObjectDataCallback.  The ETag of the
+ * part, which must be supplied to S3_complete_multipart_upload(), is
+ * reported in the eTag field of the response properties passed to the
+ * handler's propertiesCallback.
+ *
+ * @param bucketContext gives the bucket and associated parameters for this
+ *        request
+ * @param key is the key of the object being uploaded
+ * @param uploadId is the upload ID returned by S3_initiate_multipart()
+ * @param partNumber is the number of this part, from 1 to
+ *        S3_MULTIPART_MAX_PART_COUNT; parts are assembled in part number
+ *        order
+ * @param partContentLength is required and gives the total number of bytes
+ *        that will be put for this part
+ * @param requestContext if non-NULL, gives the S3RequestContext to add this
+ *        request to, and does not perform the request immediately.  If NULL,
+ *        performs the request immediately and synchronously.
+ * @param handler gives the callbacks to call as the request is processed and
+ *        completed
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this request
+ **/
+void S3_upload_part(const S3BucketContext *bucketContext, const char *key,
+                    const char *uploadId, int partNumber,
+                    uint64_t partContentLength,
+                    S3RequestContext *requestContext,
+                    const S3PutObjectHandler *handler, void *callbackData);
+
+
+/**
+ * Completes a multipart upload, assembling the uploaded parts into the
+ * object.  Note that S3 may report a failure to assemble the parts after it
+ * has already begun its response; such failures are reported through the
+ * complete callback just like any other S3 error.
+ *
+ * @param bucketContext gives the bucket and associated parameters for this
+ *        request
+ * @param key is the key of the object being uploaded
+ * @param uploadId is the upload ID returned by S3_initiate_multipart()
+ * @param partCount is the number of parts in the upload
+ * @param partETags is an array of partCount ETags, where partETags[i] is the
+ *        ETag that S3 returned for part number i + 1
+ * @param eTagReturnSize specifies the number of bytes provided in the
+ *        eTagReturn buffer
+ * @param eTagReturn is a buffer into which the resulting eTag of the
+ *        assembled object will be written
+ * @param requestContext if non-NULL, gives the S3RequestContext to add this
+ *        request to, and does not perform the request immediately.  If NULL,
+ *        performs the request immediately and synchronously.
+ * @param handler gives the callbacks to call as the request is processed and
+ *        completed
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this request
+ **/
+void S3_complete_multipart_upload(const S3BucketContext *bucketContext,
+                                  const char *key, const char *uploadId,
+                                  int partCount, const char **partETags,
+                                  int eTagReturnSize, char *eTagReturn,
+                                  S3RequestContext *requestContext,
+                                  const S3ResponseHandler *handler,
+                                  void *callbackData);
+
+
+/**
+ * Aborts a multipart upload, discarding any parts that have been uploaded.
+ *
+ * @param bucketContext gives the bucket and associated parameters for this
+ *        request
+ * @param key is the key of the object being uploaded
+ * @param uploadId is the upload ID returned by S3_initiate_multipart()
+ * @param requestContext if non-NULL, gives the S3RequestContext to add this
+ *        request to, and does not perform the request immediately.  If NULL,
+ *        performs the request immediately and synchronously.
+ * @param handler gives the callbacks to call as the request is processed and
+ *        completed
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this request
+ **/
+void S3_abort_multipart_upload(const S3BucketContext *bucketContext,
+                               const char *key, const char *uploadId,
+                               S3RequestContext *requestContext,
+                               const S3ResponseHandler *handler,
+                               void *callbackData);
+
+
+/**
+ * Puts object data to S3 using a multipart upload which is managed entirely
+ * by libs3.  The data is acquired by calling the handler's
+ * putObjectDataCallback exactly as for S3_put_object(), and is split into
+ * parts which are uploaded concurrently.  Each part is held in memory until
+ * S3 has accepted it, so at most (partSize * maxConcurrency) bytes are
+ * buffered.  Parts that fail with a retryable status are retried on their
+ * own; if the upload fails, it is aborted so that S3 does not keep the
+ * uploaded parts.  Objects no larger than a single part are put with one
+ * ordinary request.
+ *
+ * The handler's propertiesCallback is made once, with the properties of the
+ * completed object, and its completeCallback is made once when the whole
+ * upload has succeeded or failed.
+ *
+ * @param bucketContext gives the bucket and associated parameters for this
+ *        request
+ * @param key is the key of the object to put to
+ * @param contentLength gives the total number of bytes that will be put, or
+ *        S3_CONTENT_LENGTH_UNKNOWN if this is not known.  Data of unknown
+ *        length is always uploaded in parts, which start out partSize bytes
+ *        long and double in size every 1000 parts, so that the upload can
+ *        reach the largest object size that S3 accepts while memory use
+ *        stays bounded; the upload starts as soon as the first part has
+ *        been read.  Data which does not fit in S3_MULTIPART_MAX_PART_COUNT
+ *        parts fails with S3StatusErrorEntityTooLarge, and the upload is
+ *        then aborted.
+ * @param putProperties optionally provides additional properties to apply to
+ *        the object that is being put to.  The md5 field is only used if the
+ *        object is put with a single request.
+ * @param transferProperties optionally controls the part size, concurrency
+ *        and retries of the upload
+ * @param requestContext if non-NULL, gives the S3RequestContext to add the
+ *        requests of this upload to, and does not perform the upload
+ *        immediately; the upload is complete when its complete callback has
+ *        been made.  If NULL, performs the upload immediately and
+ *        synchronously.
+ * @param handler gives the callbacks to call as the upload is processed and
+ *        completed
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this upload
+ **/
+void S3_put_object_multipart(const S3BucketContext *bucketContext,
+                             const char *key, uint64_t contentLength,
+                             const S3PutProperties *putProperties,
+                             const S3TransferProperties *transferProperties,
+                             S3RequestContext *requestContext,
+                             const S3PutObjectHandler *handler,
+                             void *callbackData);
+
+
+/**
+ * Puts object data to S3 from a range of an open file, using a multipart
+ * upload which is managed entirely by libs3.  This is the same as
+ * S3_put_object_multipart(), except that each part is read from the file
+ * at its own offset as it is sent, exactly as for S3_put_object_from_fd(),
+ * so that no part is ever held in memory and parts which fail are simply
+ * read again when they are retried.
+ *
+ * @param bucketContext gives the bucket and associated parameters for this
+ *        request
+ * @param key is the key of the object to put to
+ * @param fd is the file descriptor of the file to read the data from, which
+ *        must remain open until the upload has completed, and must support
+ *        reading at an offset (a regular file rather than a pipe)
+ * @param offset gives the offset within the file of the first byte to put
+ * @param contentLength gives the number of bytes of the file to put;
+ *        the upload fails with S3StatusErrorIncompleteBody if the file ends
+ *        before this many bytes have been read.  If
+ *        S3_CONTENT_LENGTH_UNKNOWN, the file is put up to its end, with
+ *        each part read into memory first as for S3_put_object_multipart().
+ * @param putProperties optionally provides additional properties to apply to
+ *        the object that is being put to.  The md5 field is only used if the
+ *        object is put with a single request.
+ * @param transferProperties optionally controls the part size, concurrency
+ *        and retries of the upload
+ * @param requestContext if non-NULL, gives the S3RequestContext to add the
+ *        requests of this upload to, and does not perform the upload
+ *        immediately; the upload is complete when its complete callback has
+ *        been made.  If NULL, performs the upload immediately and
+ *        synchronously.
+ * @param handler gives the callbacks to call as the upload is processed and
+ *        completed
+ * @param callbackData will be passed in as the callbackData parameter to
+ *        all callbacks for this upload
+ **/
+void S3_put_object_multipart_from_fd
+    (const S3BucketContext *bucketContext, const char *key, int fd,
+     uint64_t offset, uint64_t contentLength,
+     const S3PutProperties *putProperties,
+     const S3TransferProperties *transferProperties,
+     S3RequestContext *requestContext, const S3ResponseHandler *handler,
+     void *callbackData);
+
+
 /** **************************************************************************
  * Access Control List Functions
  ************************************************************************** **/
@@ -42,4 +42,13 @@ int pthread_mutex_lock(pthread_mutex_t *mutex);
 int pthread_mutex_unlock(pthread_mutex_t *mutex);
 int pthread_mutex_destroy(pthread_mutex_t *mutex);
 
+// Thread-specific data destructors are not supported; the data of exited
+// threads is only cleaned up by S3_deinitialize
+typedef DWORD pthread_key_t;
+
+int pthread_key_create(pthread_key_t *key, void (*destructor)(void *));
+int pthread_key_delete(pthread_key_t key);
+void *pthread_getspecific(pthread_key_t key);
+int pthread_setspecific(pthread_key_t key, const void *value);
+
 #endif /* PTHREAD_H */
@@ -39,7 +39,8 @@ typedef enum
     HttpRequestTypeHEAD,
     HttpRequestTypePUT,
     HttpRequestTypeCOPY,
-    HttpRequestTypeDELETE
+    HttpRequestTypeDELETE,
+    HttpRequestTypePOST
 } HttpRequestType;
 
 
@@ -60,7 +61,7 @@ typedef struct RequestParams
     // Query params - ready to append to URI (i.e. ?p1=v1?p2=v2)
     const char *queryParams;
 
-    // sub resource, like ?acl, ?location, ?torrent, ?logging
+    // sub resource, like ?acl, ?location, ?torrent, ?logging, ?uploads
     const char *subResource;
 
     // If this is a copy operation, this gives the source bucket
@@ -139,6 +140,16 @@ typedef struct Request
     // Number of bytes total that readCallback has left to supply
     int64_t toS3CallbackBytesRemaining;
 
+    // If non-NULL, where to report the digests of the data supplied by
+    // toS3Callback, which are computed in these as it is sent
+    S3PayloadDigests *payloadDigests;
+
+    MD5Context md5Context;
+
+    SHA256Context sha256Context;
+
+    uint32_t crc32c;
+
     // Callback to be made that supplies data read from S3.
     // Might not be called.
     S3GetObjectDataCallback *fromS3Callback;
@@ -161,6 +172,90 @@ typedef struct Request
 } Request;
 
 
+// The parts of every request to a bucket which are the same for each
+// request, worked out once by S3_create_prepared_bucket
+struct S3PreparedBucket
+{
+    // The bucket context returned by S3_get_prepared_bucket_context, whose
+    // preparedBucket is this, and whose strings follow this structure
+    S3BucketContext bucketContext;
+
+    // The signature version and region resolved from the bucket context
+    S3SignatureVersion signatureVersion;
+
+    char authRegion[S3_MAX_AUTH_REGION_SIZE];
+
+    // The URI up to the key: http[s]://${HOST}/[${BUCKET}/]
+    char uriPrefix[MAX_URI_SIZE + 1];
+
+    int uriPrefixLen;
+
+    // The canonicalized resource of Signature Version 2 up to the key:
+    // /[${BUCKET}/]
+    char resourcePrefix[1 + 255 + 1 + 1];
+
+    int resourcePrefixLen;
+
+    // The canonical URI of Signature Version 4 up to the key, which leaves
+    // out the bucket of a virtual host style URI, and the Host header that
+    // it signs
+    char canonicalUriPrefix[1 + 255 + 1 + 1];
+
+    char host[S3_MAX_HOSTNAME_SIZE + 255 + 2];
+
+    // The Signature Version 2 signing key
+    HMACSHA1Key signingKey;
+};
+
+
+// The parts of the authenticated query strings of a bucket's keys which are
+// the same for every key, so that generating the query string of each key
+// only has to encode the key and sign it.  Filled in by
+// request_presigner_initialize.
+typedef struct RequestPresigner
+{
+    // The signature version resolved from the bucket context
+    S3SignatureVersion signatureVersion;
+
+    // The URI up to the key: http[s]://${HOST}/[${BUCKET}/]
+    char uriPrefix[MAX_URI_SIZE + 1];
+
+    int uriPrefixLen;
+
+    // The URI after the key, up to the signature: the sub resource and the
+    // authentication parameters
+    char uriSuffix[S3_MAX_AUTHENTICATED_QUERY_STRING_SIZE];
+
+    int uriSuffixLen;
+
+    // What is signed before and after the key: the string to sign for
+    // Signature Version 2, and the canonical request for 4
+    char signPrefix[MAX_CANONICALIZED_RESOURCE_SIZE + 64];
+
+    int signPrefixLen;
+
+    char signSuffix[MAX_URI_SIZE + 1];
+
+    int signSuffixLen;
+
+    // The Signature Version 2 signing key
+    HMACSHA1Key hmacKey;
+
+    // For Signature Version 4: signPrefix, already hashed
+    SHA256Context canonicalRequestPrefix;
+
+    // The string to sign, up to the hash of the canonical request
+    char stringToSignPrefix[sizeof("AWS4-HMAC-SHA256\n") + 16 + 1 + 8 + 1 +
+                            S3_MAX_AUTH_REGION_SIZE +
+                            sizeof("/s3/aws4_request\n")];
+
+    int stringToSignPrefixLen;
+
+    // And the signing key
+    HMACSHA256Key v4SigningKey;
+} RequestPresigner;
+
+
 // Request functions
 // ----------------------------------------------------------------------------
 
@@ -182,5 +277,19 @@ void request_finish(Request *request);
 // Convert a CURLE code to an S3Status
 S3Status request_curl_code_to_status(CURLcode code);
 
+// Fills in [presigner] for generating authenticated query strings for keys
+// of the bucket of [bucketContext], as S3_generate_authenticated_query_string
+// does with [expires] and [resource]
+S3Status request_presigner_initialize(RequestPresigner *presigner,
+                                      const S3BucketContext *bucketContext,
+                                      int64_t expires, const char *resource);
+
+// Generates the authenticated query string for [key] (which may be 0) into
+// the [bufferSize] bytes of [buffer], returning its length in [*lenReturn]
+// if [lenReturn] is non-zero.  [presigner] is only read, so may be used by
+// several threads at once.
+S3Status request_presign(const RequestPresigner *presigner, const char *key,
+                         char *buffer, int bufferSize, int *lenReturn);
+
 
 #endif /* REQUEST_H */
@@ -34,6 +34,21 @@ struct S3RequestContext
     CURLM *curlm;
 
     struct Request *requests;
+
+    // The number of requests in the requests list
+    int requestCount;
+
+    // How requests added to the context use their connections
+    S3TransportProperties transportProperties;
+
+#ifdef __linux__
+    // Holds every socket that curl is using for the requests of this context
+    int epollFd;
+
+    // When curl next wants to be run for its timeouts, in milliseconds since
+    // an arbitrary fixed point, or -1 if it has no timeout pending
+    int64_t timerDeadline;
+#endif
 };
 
 
@@ -41,6 +41,15 @@ typedef struct ResponseHeadersHandler
     // Set to 1 after the done call has been made
     int done;
 
+    // The value of the x-amz-server-side-encryption header, if any; only
+    // AES256 is reported through responseProperties, but an ETag is not the
+    // MD5 of the data for other values
+    char serverSideEncryption[32];
+
+    // Set to 1 if an x-amz-server-side-encryption-customer-algorithm header
+    // was received, as it is for objects encrypted with customer keys
+    int customerEncryption;
+
     // copied into here.  We allow 128 bytes for each header, plus \0 term.
     string_multibuffer(responsePropertyStrings, 5 * 129);
 
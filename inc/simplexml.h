@@ -30,23 +30,112 @@
 #include "libs3.h"
 
 
+// The element paths of the S3 responses which are parsed, each of which is
+// identified by a SimpleXmlPath so that callbacks can switch on it rather
+// than comparing strings.  Each X(id, parent, element) names the path
+// SimpleXmlPath<id>, which is <element> inside of the path
+// SimpleXmlPath<parent>; document elements have the parent None.
+#define SIMPLEXML_PATHS(X)                                                    \
+    X(LocationConstraint, None, "LocationConstraint")                         \
+                                                                              \
+    X(Error, None, "Error")                                                   \
+    X(ErrorCode, Error, "Code")                                               \
+    X(ErrorMessage, Error, "Message")                                         \
+    X(ErrorResource, Error, "Resource")                                       \
+    X(ErrorFurtherDetails, Error, "FurtherDetails")                           \
+                                                                              \
+    X(List, None, "ListBucketResult")                                         \
+    X(ListIsTruncated, List, "IsTruncated")                                   \
+    X(ListNextMarker, List, "NextMarker")                                     \
+    X(ListNextContinuationToken, List, "NextContinuationToken")               \
+    X(ListContents, List, "Contents")                                         \
+    X(ListContentsKey, ListContents, "Key")                                   \
+    X(ListContentsLastModified, ListContents, "LastModified")                 \
+    X(ListContentsETag, ListContents, "ETag")                                 \
+    X(ListContentsSize, ListContents, "Size")                                 \
+    X(ListContentsOwner, ListContents, "Owner")                               \
+    X(ListContentsOwnerID, ListContentsOwner, "ID")                           \
+    X(ListContentsOwnerDisplayName, ListContentsOwner, "DisplayName")         \
+    X(ListCommonPrefixes, List, "CommonPrefixes")                             \
+    X(ListCommonPrefixesPrefix, ListCommonPrefixes, "Prefix")                 \
+                                                                              \
+    X(Service, None, "ListAllMyBucketsResult")                                \
+    X(ServiceOwner, Service, "Owner")                                         \
+    X(ServiceOwnerID, ServiceOwner, "ID")                                     \
+    X(ServiceOwnerDisplayName, ServiceOwner, "DisplayName")                   \
+    X(ServiceBuckets, Service, "Buckets")                                     \
+    X(ServiceBucket, ServiceBuckets, "Bucket")                                \
+    X(ServiceBucketName, ServiceBucket, "Name")                               \
+    X(ServiceBucketCreationDate, ServiceBucket, "CreationDate")               \
+                                                                              \
+    X(Acl, None, "AccessControlPolicy")                                       \
+    X(AclOwner, Acl, "Owner")                                                 \
+    X(AclOwnerID, AclOwner, "ID")                                             \
+    X(AclOwnerDisplayName, AclOwner, "DisplayName")                           \
+    X(AclList, Acl, "AccessControlList")                                      \
+    X(AclGrant, AclList, "Grant")                                             \
+    X(AclGrantee, AclGrant, "Grantee")                                        \
+    X(AclGranteeEmailAddress, AclGrantee, "EmailAddress")                     \
+    X(AclGranteeID, AclGrantee, "ID")                                         \
+    X(AclGranteeDisplayName, AclGrantee, "DisplayName")                       \
+    X(AclGranteeURI, AclGrantee, "URI")                                       \
+    X(AclGrantPermission, AclGrant, "Permission")                             \
+                                                                              \
+    X(Bls, None, "BucketLoggingStatus")                                       \
+    X(BlsLoggingEnabled, Bls, "LoggingEnabled")                               \
+    X(BlsTargetBucket, BlsLoggingEnabled, "TargetBucket")                     \
+    X(BlsTargetPrefix, BlsLoggingEnabled, "TargetPrefix")                     \
+    X(BlsTargetGrants, BlsLoggingEnabled, "TargetGrants")                     \
+    X(BlsGrant, BlsTargetGrants, "Grant")                                     \
+    X(BlsGrantee, BlsGrant, "Grantee")                                        \
+    X(BlsGranteeEmailAddress, BlsGrantee, "EmailAddress")                     \
+    X(BlsGranteeID, BlsGrantee, "ID")                                         \
+    X(BlsGranteeDisplayName, BlsGrantee, "DisplayName")                       \
+    X(BlsGranteeURI, BlsGrantee, "URI")                                       \
+    X(BlsGrantPermission, BlsGrant, "Permission")                             \
+                                                                              \
+    X(Initiate, None, "InitiateMultipartUploadResult")                        \
+    X(InitiateUploadId, Initiate, "UploadId")                                 \
+                                                                              \
+    X(Complete, None, "CompleteMultipartUploadResult")                        \
+    X(CompleteETag, Complete, "ETag")                                         \
+                                                                              \
+    X(CopyObject, None, "CopyObjectResult")                                   \
+    X(CopyObjectLastModified, CopyObject, "LastModified")                     \
+    X(CopyObjectETag, CopyObject, "ETag")
+
+typedef enum
+{
+    // Outside of the document element
+    SimpleXmlPathNone,
+    // Any element path which is not in SIMPLEXML_PATHS
+    SimpleXmlPathUnknown,
+#define SIMPLEXML_PATH_ENUM(id, parent, element) SimpleXmlPath##id,
+    SIMPLEXML_PATHS(SIMPLEXML_PATH_ENUM)
+#undef SIMPLEXML_PATH_ENUM
+    SimpleXmlPathCount
+} SimpleXmlPath;
+
+
 // Simple XML callback.
 //
 // elementPath: is the full "path" of the element; i.e.
 // <foo><bar><baz>data</baz></bar></foo> would have 'data' in the element
 // foo/bar/baz.
+//
+// path: identifies elementPath, if it is one of SIMPLEXML_PATHS; it is
+// SimpleXmlPathUnknown otherwise.
 // 
 // Return of anything other than S3StatusOK causes the calling
 // simplexml_add() function to immediately stop and return the status.
 //
 // data is passed in as 0 on end of element
-typedef S3Status (SimpleXmlCallback)(const char *elementPath, const char *data,
+typedef S3Status (SimpleXmlCallback)(const char *elementPath,
+                                     SimpleXmlPath path, const char *data,
                                      int dataLen, void *callbackData);
 
 typedef struct SimpleXml
 {
-    void *xmlParser;
-
     SimpleXmlCallback *callback;
 
     void *callbackData;
@@ -56,6 +145,34 @@ typedef struct SimpleXml
     int elementPathLen;
 
     S3Status status;
+
+    // The innermost element of elementPath which is in SIMPLEXML_PATHS, and
+    // the number of elements inside of it which are not
+    SimpleXmlPath path;
+
+    int unknownDepth;
+
+    // The tokenizer's state, kept between calls to simplexml_add so that a
+    // document may be split anywhere
+    int state;
+
+    // Per-state progress: where in elementPath the name of a start tag
+    // begins, the position in elementPath matched by an end tag, the number
+    // of ']' or '-' characters just seen, and so on
+    int count;
+
+    // The quote character which closes the current attribute value
+    char quote;
+
+    // Nonzero if a '\r' was just delivered as '\n', so that a following
+    // '\n' must be skipped
+    char skipLineFeed;
+
+    // The name of the entity or character reference being read, and its
+    // length
+    char entity[12];
+
+    int entityLen;
 } SimpleXml;
 
 
@@ -0,0 +1,154 @@
+/** **************************************************************************
+ * transfer.h
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License version 3
+ * along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include "libs3.h"
+#include "string_buffer.h"
+
+
+// Support shared by the managed transfers (S3_put_object_multipart and
+// S3_get_object_parallel), whose requests are issued long after the call
+// which started the transfer has returned.
+
+// Defaults for the fields of S3TransferProperties
+#define DEFAULT_TRANSFER_PART_SIZE (8LL * 1024 * 1024)
+#define DEFAULT_TRANSFER_CONCURRENCY 4
+#define DEFAULT_TRANSFER_RETRIES 3
+
+// The size of the writes into which a TransferSink gathers the data for a
+// file
+#define TRANSFER_SINK_WRITE_SIZE (1024 * 1024)
+
+
+// The first failure of a transfer, which is what the transfer reports once
+// its requests have all finished
+typedef struct TransferError
+{
+    S3Status status;
+
+    // Nonzero if errorDetails holds a copy of the failure's error details
+    int hasErrorDetails;
+
+    S3ErrorDetails errorDetails;
+
+    string_buffer(message, 1024);
+
+    string_buffer(resource, 1024);
+
+    string_buffer(furtherDetails, 1024);
+} TransferError;
+
+
+// Where the data of a get goes when it is put straight into the caller's
+// memory or file, rather than handed to a data callback.  The data is placed
+// by its offset in the object (or range) being fetched, so a sink does not
+// care about the order in which it arrives; the data for a file is gathered
+// into large writes, as long as it arrives contiguously.
+typedef struct TransferSink
+{
+    // The caller's buffer and its size, or NULL when writing to fd
+    char *buffer;
+    uint64_t bufferSize;
+
+    int fd;
+
+    // The offset in the file of the first byte of the data
+    uint64_t fdOffset;
+
+    // Data waiting to be written to fd, which belongs at pendingOffset in the
+    // data; pending is allocated on first use
+    char *pending;
+    int pendingLength;
+    uint64_t pendingOffset;
+} TransferSink;
+
+
+// Fills in the part size, concurrency and retry count of a transfer from
+// [transferProperties], which may be NULL, using defaults for any field that
+// is not set
+void transfer_get_properties(const S3TransferProperties *transferProperties,
+                             uint64_t *partSizeReturn,
+                             int *maxConcurrencyReturn, int *maxRetriesReturn);
+
+// Returns the number of bytes needed by transfer_copy_target() to copy the
+// strings of [bucketContext] and [key]
+int transfer_target_size(const S3BucketContext *bucketContext,
+                         const char *key);
+
+// Copies [bucketContext] and [key] into [bucketContextReturn] and
+// [keyReturn], storing the strings in [strings], which must have at least
+// transfer_target_size() bytes
+void transfer_copy_target(S3BucketContext *bucketContextReturn,
+                          char **keyReturn,
+                          const S3BucketContext *bucketContext,
+                          const char *key, char *strings);
+
+void transfer_error_initialize(TransferError *error);
+
+// Records a failure, unless one has already been recorded.  [errorDetails]
+// may be NULL.
+void transfer_error_set(TransferError *error, S3Status status,
+                        const S3ErrorDetails *errorDetails);
+
+// Returns the error details recorded with the failure, or NULL if there are
+// none
+const S3ErrorDetails *transfer_error_details(const TransferError *error);
+
+// Reads up to [bufferSize] bytes at [offset] in the file open as [fd]
+// straight into [buffer], without moving the file offset of [fd].  Returns
+// the number of bytes read, which is less than [bufferSize] only at the end
+// of the file, or -1 on error.
+int transfer_read_fd(int fd, uint64_t offset, char *buffer, int bufferSize);
+
+// Writes [size] bytes from [buffer] at [offset] in the file open as [fd],
+// without moving the file offset of [fd].  Returns zero on success, or -1 on
+// error.
+int transfer_write_fd(int fd, uint64_t offset, const char *buffer, int size);
+
+// Sets up [sink] to copy the data into [buffer], which has [bufferSize] bytes
+void transfer_sink_initialize_buffer(TransferSink *sink, char *buffer,
+                                     uint64_t bufferSize);
+
+// Sets up [sink] to write the data into the file open as [fd], starting at
+// [offset] in the file
+void transfer_sink_initialize_fd(TransferSink *sink, int fd, uint64_t offset);
+
+// Puts [size] bytes of data, which belong at [offset] in the data, into
+// [sink].  Returns S3StatusBufferTooSmall if they do not fit in the buffer of
+// the sink, or S3StatusAbortedByCallback if the file could not be written.
+S3Status transfer_sink_write(TransferSink *sink, uint64_t offset,
+                             const char *data, int size);
+
+// Writes any data that [sink] is holding back into its file
+S3Status transfer_sink_flush(TransferSink *sink);
+
+// Frees the resources of [sink], without flushing it
+void transfer_sink_deinitialize(TransferSink *sink);
+
+
+#endif /* TRANSFER_H */
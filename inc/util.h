@@ -53,41 +53,169 @@
 // character takes 3 characters: %NN)
 #define MAX_URLENCODED_KEY_SIZE (3 * S3_MAX_KEY_SIZE)
 
+// This is the maximum size of a sub resource; the longest one is that of an
+// upload part request: ?partNumber=${NUMBER}&uploadId=${UPLOAD_ID}
+#define MAX_SUB_RESOURCE_SIZE \
+    ((sizeof("?partNumber=10000&uploadId=") - 1) + S3_MAX_UPLOAD_ID_SIZE)
+
 // This is the maximum size of a URI that could be passed to S3:
 // https://s3.amazonaws.com/${BUCKET}/${KEY}?acl
 // 255 is the maximum bucket length
 #define MAX_URI_SIZE \
     ((sizeof("https:///") - 1) + S3_MAX_HOSTNAME_SIZE + 255 + 1 +       \
-     MAX_URLENCODED_KEY_SIZE + (sizeof("?torrent" - 1)) + 1)
+     MAX_URLENCODED_KEY_SIZE + MAX_SUB_RESOURCE_SIZE + 1)
 
 // Maximum size of a canonicalized resource
 #define MAX_CANONICALIZED_RESOURCE_SIZE \
-    (1 + 255 + 1 + MAX_URLENCODED_KEY_SIZE + (sizeof("?torrent") - 1) + 1)
+    (1 + 255 + 1 + MAX_URLENCODED_KEY_SIZE + MAX_SUB_RESOURCE_SIZE + 1)
 
 
 // Utilities -----------------------------------------------------------------
 
+// Chooses the fastest implementations of the hash functions that the CPU
+// supports.  Called by S3_initialize().
+void util_initialize();
+
 // URL-encodes a string from [src] into [dest].  [dest] must have at least
-// 3x the number of characters that [source] has.   At most [maxSrcSize] bytes
-// from [src] are encoded; if more are present in [src], 0 is returned from
-// urlEncode, else nonzero is returned.
+// 3x the number of characters that [source] has, plus 1 for the
+// terminating 0.  If [src] has more than [maxSrcSize] characters, nothing is
+// encoded and -1 is returned, else the length of [dest] is returned.
 int urlEncode(char *dest, const char *src, int maxSrcSize);
 
-// Returns < 0 on failure >= 0 on success
+// URI-encodes a string from [src] into [dest] as AWS Signature Version 4
+// requires: every character other than the unreserved characters of RFC 3986
+// is %-encoded, and '/' is too if [encodeSlash] is nonzero.  Otherwise as for
+// urlEncode.
+int uriEncode(char *dest, const char *src, int maxSrcSize, int encodeSlash);
+
+// Decodes the [srcLen] characters of [src], as encoded by urlEncode or
+// uriEncode, into [dest], which must have room for (srcLen + 1) characters.
+// '+' becomes ' '; a '%' not followed by two hex digits is left as it is.
+// Returns the length of [dest], which is terminated.
+int urlDecode(char *dest, const char *src, int srcLen);
+
+// Parses an ISO 8601 time such as 2025-10-01T12:00:00.000Z as UTC, whatever
+// the local time zone is.  Returns < 0 on failure >= 0 on success
 int64_t parseIso8601Time(const char *str);
 
+// Writes [t] in the ISO 8601 basic format used by Signature Version 4, e.g.
+// 20251001T120000Z, to [dest], which must have room for 17 characters
+void formatAmzDate(char *dest, int64_t t);
+
+// Writes [t] in the format of HTTP dates, without the time zone, e.g.
+// Wed, 01 Oct 2025 12:00:00, to [dest], which must have room for 26
+// characters
+void formatHttpDate(char *dest, int64_t t);
+
+// Returns the current time, also writing it to [amzDate] as formatAmzDate
+// does and to [httpDate] as formatHttpDate does followed by " GMT"; either
+// may be 0.  [amzDate] must have room for 17 characters and [httpDate] for
+// 30.  Unlike gmtime, this may be called from any thread.
+int64_t currentTime(char *amzDate, char *httpDate);
+
 uint64_t parseUnsignedInt(const char *str);
 
 // base64 encode bytes.  The output buffer must have at least
-// ((4 * (inLen + 1)) / 3) bytes in it.  Returns the number of bytes written
-// to [out].
+// (4 * ((inLen + 2) / 3)) bytes in it.  Returns the number of bytes written
+// to [out], which is not terminated.
 int base64Encode(const unsigned char *in, int inLen, char *out);
 
+// base64 decode [inLen] characters from [in], which may omit the trailing
+// padding.  The output buffer must have at least ((3 * inLen) / 4) bytes in
+// it.  Returns the number of bytes written to [out], or -1 if [in] is not
+// valid base64.
+int base64Decode(const char *in, int inLen, unsigned char *out);
+
 // Compute HMAC-SHA-1 with key [key] and message [message], storing result
 // in [hmac]
 void HMAC_SHA1(unsigned char hmac[20], const unsigned char *key, int key_len,
                const unsigned char *message, int message_len);
 
+// The SHA-1 states of HMAC-SHA-1 after the inner and outer padded keys have
+// been hashed, which are the same for every message signed with a key
+typedef struct HMACSHA1Key
+{
+    uint32_t inner[5];
+    uint32_t outer[5];
+} HMACSHA1Key;
+
+// Computes the HMACSHA1Key for [key]
+void HMAC_SHA1_key_initialize(HMACSHA1Key *hmacKey, const unsigned char *key,
+                              int key_len);
+
+// Compute HMAC-SHA-1 with the key of [hmacKey] and message [message],
+// storing result in [hmac].  This hashes two fewer blocks than HMAC_SHA1.
+void HMAC_SHA1_with_key(unsigned char hmac[20], const HMACSHA1Key *hmacKey,
+                        const unsigned char *message, int message_len);
+
+typedef struct SHA256Context
+{
+    uint32_t state[8];
+
+    // The number of bytes hashed so far
+    uint64_t count;
+
+    unsigned char buffer[64];
+} SHA256Context;
+
+void SHA256_init(SHA256Context *context);
+
+void SHA256_update(SHA256Context *context, const unsigned char *data,
+                   unsigned int len);
+
+void SHA256_final(unsigned char digest[32], SHA256Context *context);
+
+// The HMAC-SHA-256 counterpart of HMACSHA1Key
+typedef struct HMACSHA256Key
+{
+    uint32_t inner[8];
+    uint32_t outer[8];
+} HMACSHA256Key;
+
+void HMAC_SHA256_key_initialize(HMACSHA256Key *hmacKey,
+                                const unsigned char *key, int key_len);
+
+void HMAC_SHA256_with_key(unsigned char hmac[32],
+                          const HMACSHA256Key *hmacKey,
+                          const unsigned char *message, int message_len);
+
+// Compute HMAC-SHA-256 with key [key] and message [message], storing result
+// in [hmac]
+void HMAC_SHA256(unsigned char hmac[32], const unsigned char *key,
+                 int key_len, const unsigned char *message, int message_len);
+
+// Writes [inLen] bytes from [in] as lowercase hex digits to [out], which
+// must have room for (2 * inLen) + 1 characters, and terminates it
+void hexEncode(const unsigned char *in, int inLen, char *out);
+
+// Decodes [inLen] upper or lowercase hex digits from [in] into (inLen / 2)
+// bytes in [out].  Returns (inLen / 2), or -1 if [inLen] is odd or [in] has
+// anything other than hex digits; no more of [in] than the first such
+// character is read.
+int hexDecode(const char *in, int inLen, unsigned char *out);
+
+typedef struct MD5Context
+{
+    uint32_t state[4];
+
+    // The number of bytes hashed so far
+    uint64_t count;
+
+    unsigned char buffer[64];
+} MD5Context;
+
+void MD5_init(MD5Context *context);
+
+void MD5_update(MD5Context *context, const unsigned char *data,
+                unsigned int len);
+
+void MD5_final(unsigned char digest[16], MD5Context *context);
+
+// Continues the CRC32C (Castagnoli) [crc] of earlier data over [len] bytes of
+// [data]; the CRC of no data is 0
+uint32_t crc32c_update(uint32_t crc, const unsigned char *data,
+                       unsigned int len);
+
 // Compute a 64-bit hash values given a set of bytes
 uint64_t hash(const unsigned char *k, int length);
 
@@ -127,7 +127,10 @@ void S3_get_acl(const S3BucketContext *bucketContext, const char *key,
           bucketContext->protocol,                    // protocol
           bucketContext->uriStyle,                    // uriStyle
           bucketContext->accessKeyId,                 // accessKeyId
-          bucketContext->secretAccessKey },           // secretAccessKey
+          bucketContext->secretAccessKey,             // secretAccessKey
+          bucketContext->signatureVersion,            // signatureVersion
+          bucketContext->authRegion,                  // authRegion
+          bucketContext->preparedBucket },            // preparedBucket
         key,                                          // key
         0,                                            // queryParams
         "acl",                                        // subResource
@@ -325,7 +328,10 @@ void S3_set_acl(const S3BucketContext *bucketContext, const char *key,
           bucketContext->protocol,                    // protocol
           bucketContext->uriStyle,                    // uriStyle
           bucketContext->accessKeyId,                 // accessKeyId
-          bucketContext->secretAccessKey },           // secretAccessKey
+          bucketContext->secretAccessKey,             // secretAccessKey
+          bucketContext->signatureVersion,            // signatureVersion
+          bucketContext->authRegion,                  // authRegion
+          bucketContext->preparedBucket },            // preparedBucket
         key,                                          // key
         0,                                            // queryParams
         "acl",                                        // subResource
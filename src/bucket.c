@@ -48,14 +48,16 @@ typedef struct TestBucketData
 
 
 static S3Status testBucketXmlCallback(const char *elementPath,
-                                      const char *data, int dataLen,
-                                      void *callbackData)
+                                      SimpleXmlPath path, const char *data,
+                                      int dataLen, void *callbackData)
 {
+    (void) elementPath;
+
     TestBucketData *tbData = (TestBucketData *) callbackData;
 
     int fit;
 
-    if (data && !strcmp(elementPath, "LocationConstraint")) {
+    if (data && (path == SimpleXmlPathLocationConstraint)) {
         string_buffer_append(tbData->locationConstraint, data, dataLen, fit);
     }
 
@@ -140,7 +142,10 @@ void S3_test_bucket(S3Protocol protocol, S3UriStyle uriStyle,
           protocol,                                   // protocol
           uriStyle,                                   // uriStyle
           accessKeyId,                                // accessKeyId
-          secretAccessKey },                          // secretAccessKey
+          secretAccessKey,                            // secretAccessKey
+          S3SignatureDefault,                         // signatureVersion
+          0,                                          // authRegion
+          0 },                                        // preparedBucket
         0,                                            // key
         0,                                            // queryParams
         "location",                                   // subResource
@@ -254,7 +259,17 @@ void S3_create_bucket(S3Protocol protocol, const char *accessKeyId,
     else {
         cbData->docLen = 0;
     }
+
+    // The bucket is created in the region of its location constraint, so
+    // that is the region which the request is signed for; "EU" is the old
+    // name of eu-west-1
+    const char *authRegion =
+        (locationConstraint && locationConstraint[0]) ? locationConstraint : 0;
+    if (authRegion && !strcmp(authRegion, "EU")) {
+        authRegion = "eu-west-1";
+    }
     
+
     // Set up S3PutProperties
     S3PutProperties properties =
     {
@@ -267,7 +282,8 @@ void S3_create_bucket(S3Protocol protocol, const char *accessKeyId,
         cannedAcl,                               // cannedAcl
         0,                                       // metaDataCount
         0,                                       // metaData
-        0                                        // useServerSideEncryption
+        0,                                       // useServerSideEncryption
+        0                                        // payloadDigests
     };
     
     // Set up the RequestParams
@@ -279,7 +295,10 @@ void S3_create_bucket(S3Protocol protocol, const char *accessKeyId,
           protocol,                                   // protocol
           S3UriStylePath,                             // uriStyle
           accessKeyId,                                // accessKeyId
-          secretAccessKey },                          // secretAccessKey
+          secretAccessKey,                            // secretAccessKey
+          S3SignatureDefault,                         // signatureVersion
+          authRegion,                                 // authRegion
+          0 },                                        // preparedBucket
         0,                                            // key
         0,                                            // queryParams
         0,                                            // subResource
@@ -362,7 +381,10 @@ void S3_delete_bucket(S3Protocol protocol, S3UriStyle uriStyle,
           protocol,                                   // protocol
           uriStyle,                                   // uriStyle
           accessKeyId,                                // accessKeyId
-          secretAccessKey },                          // secretAccessKey
+          secretAccessKey,                            // secretAccessKey
+          S3SignatureDefault,                         // signatureVersion
+          0,                                          // authRegion
+          0 },                                        // preparedBucket
         0,                                            // key
         0,                                            // queryParams
         0,                                            // subResource
@@ -387,31 +409,11 @@ void S3_delete_bucket(S3Protocol protocol, S3UriStyle uriStyle,
 
 // list bucket ----------------------------------------------------------------
 
-typedef struct ListBucketContents
-{
-    string_buffer(key, 1024);
-    string_buffer(lastModified, 256);
-    string_buffer(eTag, 256);
-    string_buffer(size, 24);
-    string_buffer(ownerId, 256);
-    string_buffer(ownerDisplayName, 256);
-} ListBucketContents;
-
-
-static void initialize_list_bucket_contents(ListBucketContents *contents)
-{
-    string_buffer_initialize(contents->key);
-    string_buffer_initialize(contents->lastModified);
-    string_buffer_initialize(contents->eTag);
-    string_buffer_initialize(contents->size);
-    string_buffer_initialize(contents->ownerId);
-    string_buffer_initialize(contents->ownerDisplayName);
-}
-
-// We read up to 32 Contents at a time
-#define MAX_CONTENTS 32
-// We read up to 8 CommonPrefixes at a time
-#define MAX_COMMON_PREFIXES 8
+// We report up to 32 Contents at a time unless the handler says otherwise
+#define DEFAULT_MAX_CONTENTS 32
+// We report up to 8 CommonPrefixes at a time unless the handler says
+// otherwise
+#define DEFAULT_MAX_COMMON_PREFIXES 8
 
 typedef struct ListBucketData
 {
@@ -419,28 +421,189 @@ typedef struct ListBucketData
 
     S3ResponsePropertiesCallback *responsePropertiesCallback;
     S3ListBucketCallback *listBucketCallback;
+    S3ListBucketColumnsCallback *listBucketColumnsCallback;
     S3ResponseCompleteCallback *responseCompleteCallback;
     void *callbackData;
 
     string_buffer(isTruncated, 64);
+    // NextMarker, or NextContinuationToken for S3_list_bucket_v2
     string_buffer(nextMarker, 1024);
 
-    int contentsCount;
-    ListBucketContents contents[MAX_CONTENTS];
-
-    int commonPrefixesCount;
-    char commonPrefixes[MAX_COMMON_PREFIXES][1024];
-    int commonPrefixLens[MAX_COMMON_PREFIXES];
+    // The most Contents and CommonPrefixes reported at a time
+    int maxContents, maxCommonPrefixes;
+
+    // The text of the batch's fields, each terminated by a 0, which grows
+    // as needed.  LastModified and Size are parsed as soon as they are
+    // complete and their text dropped.
+    char *strings;
+    int stringsLen, stringsSize;
+
+    // Where the text of the field being parsed starts in strings, or -1 if
+    // none of it has been parsed yet
+    int fieldStart;
+
+    // The batch's Contents, in columns, with room for contentsSize of them.
+    // contentStarted is nonzero once a field of the Contents at
+    // contentsCount has been parsed.
+    int contentsCount, contentsSize, contentStarted;
+    int *keyOffsets, *eTagOffsets, *ownerIdOffsets, *ownerDisplayNameOffsets;
+    int64_t *lastModifieds;
+    uint64_t *sizes;
+
+    // The batch's Contents as S3ListBucketContent, built just before
+    // listBucketCallback is called
+    S3ListBucketContent *contents;
+
+    // The batch's CommonPrefixes, as offsets into strings and then as the
+    // pointers which are reported, with room for commonPrefixesSize of them
+    int commonPrefixesCount, commonPrefixesSize;
+    int *commonPrefixOffsets;
+    const char **commonPrefixes;
 } ListBucketData;
 
 
 static void initialize_list_bucket_data(ListBucketData *lbData)
 {
+    lbData->stringsLen = 0;
+    lbData->fieldStart = -1;
     lbData->contentsCount = 0;
-    initialize_list_bucket_contents(lbData->contents);
+    lbData->contentStarted = 0;
     lbData->commonPrefixesCount = 0;
-    lbData->commonPrefixes[0][0] = 0;
-    lbData->commonPrefixLens[0] = 0;
+}
+
+
+static void free_list_bucket_data(ListBucketData *lbData)
+{
+    free(lbData->strings);
+    free(lbData->keyOffsets);
+    free(lbData->eTagOffsets);
+    free(lbData->ownerIdOffsets);
+    free(lbData->ownerDisplayNameOffsets);
+    free(lbData->lastModifieds);
+    free(lbData->sizes);
+    free(lbData->contents);
+    free(lbData->commonPrefixOffsets);
+    free(lbData->commonPrefixes);
+    free(lbData);
+}
+
+
+// Reallocates [*array] to have room for [count] elements of [elementSize]
+// bytes, returning zero if there is not enough memory
+static int resize_array(void *array, int count, int elementSize)
+{
+    void *resized = realloc(*((void **) array),
+                            ((size_t) count) * elementSize);
+
+    if (!resized) {
+        return 0;
+    }
+
+    *((void **) array) = resized;
+
+    return 1;
+}
+
+
+// Returns the number of elements to grow an array of [size] elements, none
+// of which are free, to, up to [max]
+static int grown_size(int size, int max)
+{
+    int grown = size ? (size * 2) : 32;
+
+    return ((grown > max) || (grown < size)) ? max : grown;
+}
+
+
+// Makes room for the [len] characters of [data] at the end of strings, and
+// copies them there
+static S3Status append_string(ListBucketData *lbData, const char *data,
+                              int len)
+{
+    if ((lbData->stringsLen + len + 1) > lbData->stringsSize) {
+        int size = lbData->stringsSize ? lbData->stringsSize : 4096;
+        while ((lbData->stringsLen + len + 1) > size) {
+            if (size > (0x7FFFFFFF / 2)) {
+                return S3StatusOutOfMemory;
+            }
+            size *= 2;
+        }
+        if (!resize_array(&(lbData->strings), size, 1)) {
+            return S3StatusOutOfMemory;
+        }
+        lbData->stringsSize = size;
+    }
+
+    memcpy(&(lbData->strings[lbData->stringsLen]), data, len);
+    lbData->stringsLen += len;
+
+    return S3StatusOK;
+}
+
+
+// Appends the [dataLen] characters of [data] to the field being parsed
+static S3Status append_field(ListBucketData *lbData, const char *data,
+                             int dataLen)
+{
+    if (lbData->fieldStart < 0) {
+        lbData->fieldStart = lbData->stringsLen;
+    }
+
+    return append_string(lbData, data, dataLen);
+}
+
+
+// Terminates the field being parsed, setting [*offsetReturn] to where it
+// starts in strings
+static S3Status end_field(ListBucketData *lbData, int *offsetReturn)
+{
+    int offset = (lbData->fieldStart < 0) ? lbData->stringsLen :
+        lbData->fieldStart;
+
+    S3Status status = append_string(lbData, "", 1);
+
+    lbData->fieldStart = -1;
+    *offsetReturn = offset;
+
+    return status;
+}
+
+
+// Makes room for the Contents at contentsCount, if it hasn't been started
+// yet, and sets its fields to their defaults
+static S3Status start_content(ListBucketData *lbData)
+{
+    if (lbData->contentStarted) {
+        return S3StatusOK;
+    }
+
+    if (lbData->contentsCount == lbData->contentsSize) {
+        int size = grown_size(lbData->contentsSize, lbData->maxContents);
+        if (!resize_array(&(lbData->keyOffsets), size, sizeof(int)) ||
+            !resize_array(&(lbData->eTagOffsets), size, sizeof(int)) ||
+            !resize_array(&(lbData->ownerIdOffsets), size, sizeof(int)) ||
+            !resize_array(&(lbData->ownerDisplayNameOffsets), size, 
+                          sizeof(int)) ||
+            !resize_array(&(lbData->lastModifieds), size, sizeof(int64_t)) ||
+            !resize_array(&(lbData->sizes), size, sizeof(uint64_t)) ||
+            (!lbData->listBucketColumnsCallback &&
+             !resize_array(&(lbData->contents), size,
+                           sizeof(S3ListBucketContent)))) {
+            return S3StatusOutOfMemory;
+        }
+        lbData->contentsSize = size;
+    }
+
+    int i = lbData->contentsCount;
+    lbData->keyOffsets[i] = -1;
+    lbData->eTagOffsets[i] = -1;
+    lbData->ownerIdOffsets[i] = -1;
+    lbData->ownerDisplayNameOffsets[i] = -1;
+    lbData->lastModifieds[i] = -1;
+    lbData->sizes[i] = 0;
+    lbData->contentStarted = 1;
+
+    return S3StatusOK;
 }
 
 
@@ -452,142 +615,189 @@ static S3Status make_list_bucket_callback(ListBucketData *lbData)
     int isTruncated = (!strcmp(lbData->isTruncated, "true") ||
                        !strcmp(lbData->isTruncated, "1")) ? 1 : 0;
 
-    // Convert the contents
-    S3ListBucketContent contents[lbData->contentsCount];
-
-    int contentsCount = lbData->contentsCount;
-    for (i = 0; i < contentsCount; i++) {
-        S3ListBucketContent *contentDest = &(contents[i]);
-        ListBucketContents *contentSrc = &(lbData->contents[i]);
-        contentDest->key = contentSrc->key;
-        contentDest->lastModified = 
-            parseIso8601Time(contentSrc->lastModified);
-        contentDest->eTag = contentSrc->eTag;
-        contentDest->size = parseUnsignedInt(contentSrc->size);
-        contentDest->ownerId =
-            contentSrc->ownerId[0] ?contentSrc->ownerId : 0;
-        contentDest->ownerDisplayName = (contentSrc->ownerDisplayName[0] ?
-                                         contentSrc->ownerDisplayName : 0);
-    }
-
     // Make the common prefixes array
     int commonPrefixesCount = lbData->commonPrefixesCount;
-    char *commonPrefixes[commonPrefixesCount];
     for (i = 0; i < commonPrefixesCount; i++) {
-        commonPrefixes[i] = lbData->commonPrefixes[i];
+        lbData->commonPrefixes[i] =
+            &(lbData->strings[lbData->commonPrefixOffsets[i]]);
+    }
+
+    if (lbData->listBucketColumnsCallback) {
+        S3ListBucketColumns columns =
+        {
+            lbData->contentsCount,                    // count
+            lbData->strings,                          // strings
+            lbData->keyOffsets,                       // keyOffsets
+            lbData->eTagOffsets,                      // eTagOffsets
+            lbData->ownerIdOffsets,                   // ownerIdOffsets
+            lbData->ownerDisplayNameOffsets,          // ownerDisplayNameOffsets
+            lbData->lastModifieds,                    // lastModifieds
+            lbData->sizes                             // sizes
+        };
+
+        return (*(lbData->listBucketColumnsCallback))
+            (isTruncated, lbData->nextMarker, &columns, commonPrefixesCount,
+             lbData->commonPrefixes, lbData->callbackData);
+    }
+
+    // Convert the contents
+    int contentsCount = lbData->contentsCount;
+    for (i = 0; i < contentsCount; i++) {
+        S3ListBucketContent *content = &(lbData->contents[i]);
+        const char *strings = lbData->strings;
+        content->key = &(strings[lbData->keyOffsets[i]]);
+        content->lastModified = lbData->lastModifieds[i];
+        content->eTag = &(strings[lbData->eTagOffsets[i]]);
+        content->size = lbData->sizes[i];
+        content->ownerId = (lbData->ownerIdOffsets[i] < 0) ? 0 :
+            &(strings[lbData->ownerIdOffsets[i]]);
+        content->ownerDisplayName = 
+            (lbData->ownerDisplayNameOffsets[i] < 0) ? 0 :
+            &(strings[lbData->ownerDisplayNameOffsets[i]]);
     }
 
     return (*(lbData->listBucketCallback))
         (isTruncated, lbData->nextMarker,
-         contentsCount, contents, commonPrefixesCount, 
-         (const char **) commonPrefixes, lbData->callbackData);
+         contentsCount, lbData->contents, commonPrefixesCount, 
+         lbData->commonPrefixes, lbData->callbackData);
 }
 
 
 static S3Status listBucketXmlCallback(const char *elementPath,
-                                      const char *data, int dataLen,
-                                      void *callbackData)
+                                      SimpleXmlPath path, const char *data,
+                                      int dataLen, void *callbackData)
 {
+    (void) elementPath;
+
     ListBucketData *lbData = (ListBucketData *) callbackData;
 
-    int fit;
+    int i = lbData->contentsCount, fit, offset;
+
+    S3Status status = S3StatusOK;
 
     if (data) {
-        if (!strcmp(elementPath, "ListBucketResult/IsTruncated")) {
+        switch (path) {
+        case SimpleXmlPathListIsTruncated:
             string_buffer_append(lbData->isTruncated, data, dataLen, fit);
-        }
-        else if (!strcmp(elementPath, "ListBucketResult/NextMarker")) {
+            break;
+        case SimpleXmlPathListNextMarker:
+        case SimpleXmlPathListNextContinuationToken:
             string_buffer_append(lbData->nextMarker, data, dataLen, fit);
+            break;
+        case SimpleXmlPathListContentsKey:
+        case SimpleXmlPathListContentsLastModified:
+        case SimpleXmlPathListContentsETag:
+        case SimpleXmlPathListContentsSize:
+        case SimpleXmlPathListContentsOwnerID:
+        case SimpleXmlPathListContentsOwnerDisplayName:
+        case SimpleXmlPathListCommonPrefixesPrefix:
+            status = append_field(lbData, data, dataLen);
+            break;
+        default:
+            break;
         }
-        else if (!strcmp(elementPath, "ListBucketResult/Contents/Key")) {
-            ListBucketContents *contents = 
-                &(lbData->contents[lbData->contentsCount]);
-            string_buffer_append(contents->key, data, dataLen, fit);
+
+        /* Avoid compiler error about variable set but not used */
+        (void) fit;
+
+        return status;
+    }
+
+    switch (path) {
+    case SimpleXmlPathListContentsKey:
+        if (((status = start_content(lbData)) == S3StatusOK) &&
+            ((status = end_field(lbData, &offset)) == S3StatusOK)) {
+            lbData->keyOffsets[i] = offset;
         }
-        else if (!strcmp(elementPath, 
-                         "ListBucketResult/Contents/LastModified")) {
-            ListBucketContents *contents = 
-                &(lbData->contents[lbData->contentsCount]);
-            string_buffer_append(contents->lastModified, data, dataLen, fit);
+        break;
+    case SimpleXmlPathListContentsETag:
+        if (((status = start_content(lbData)) == S3StatusOK) &&
+            ((status = end_field(lbData, &offset)) == S3StatusOK)) {
+            lbData->eTagOffsets[i] = offset;
         }
-        else if (!strcmp(elementPath, "ListBucketResult/Contents/ETag")) {
-            ListBucketContents *contents = 
-                &(lbData->contents[lbData->contentsCount]);
-            string_buffer_append(contents->eTag, data, dataLen, fit);
+        break;
+    case SimpleXmlPathListContentsOwnerID:
+        if (((status = start_content(lbData)) == S3StatusOK) &&
+            ((status = end_field(lbData, &offset)) == S3StatusOK) &&
+            lbData->strings[offset]) {
+            lbData->ownerIdOffsets[i] = offset;
         }
-        else if (!strcmp(elementPath, "ListBucketResult/Contents/Size")) {
-            ListBucketContents *contents = 
-                &(lbData->contents[lbData->contentsCount]);
-            string_buffer_append(contents->size, data, dataLen, fit);
+        break;
+    case SimpleXmlPathListContentsOwnerDisplayName:
+        if (((status = start_content(lbData)) == S3StatusOK) &&
+            ((status = end_field(lbData, &offset)) == S3StatusOK) &&
+            lbData->strings[offset]) {
+            lbData->ownerDisplayNameOffsets[i] = offset;
         }
-        else if (!strcmp(elementPath, "ListBucketResult/Contents/Owner/ID")) {
-            ListBucketContents *contents = 
-                &(lbData->contents[lbData->contentsCount]);
-            string_buffer_append(contents->ownerId, data, dataLen, fit);
+        break;
+    case SimpleXmlPathListContentsLastModified:
+        if (((status = start_content(lbData)) == S3StatusOK) &&
+            ((status = end_field(lbData, &offset)) == S3StatusOK)) {
+            lbData->lastModifieds[i] =
+                parseIso8601Time(&(lbData->strings[offset]));
+            lbData->stringsLen = offset;
         }
-        else if (!strcmp(elementPath, 
-                         "ListBucketResult/Contents/Owner/DisplayName")) {
-            ListBucketContents *contents = 
-                &(lbData->contents[lbData->contentsCount]);
-            string_buffer_append
-                (contents->ownerDisplayName, data, dataLen, fit);
+        break;
+    case SimpleXmlPathListContentsSize:
+        if (((status = start_content(lbData)) == S3StatusOK) &&
+            ((status = end_field(lbData, &offset)) == S3StatusOK)) {
+            lbData->sizes[i] = parseUnsignedInt(&(lbData->strings[offset]));
+            lbData->stringsLen = offset;
         }
-        else if (!strcmp(elementPath, 
-                         "ListBucketResult/CommonPrefixes/Prefix")) {
-            int which = lbData->commonPrefixesCount;
-            lbData->commonPrefixLens[which] +=
-                snprintf(lbData->commonPrefixes[which],
-                         sizeof(lbData->commonPrefixes[which]) -
-                         lbData->commonPrefixLens[which] - 1,
-                         "%.*s", dataLen, data);
-            if (lbData->commonPrefixLens[which] >=
-                (int) sizeof(lbData->commonPrefixes[which])) {
-                return S3StatusXmlParseFailure;
-            }
+        break;
+    case SimpleXmlPathListContents:
+        // Finished a Contents; a key or ETag which was not present is
+        // reported as empty
+        if ((status = start_content(lbData)) != S3StatusOK) {
+            break;
         }
-    }
-    else {
-        if (!strcmp(elementPath, "ListBucketResult/Contents")) {
-            // Finished a Contents
-            lbData->contentsCount++;
-            if (lbData->contentsCount == MAX_CONTENTS) {
-                // Make the callback
-                S3Status status = make_list_bucket_callback(lbData);
-                if (status != S3StatusOK) {
-                    return status;
-                }
-                initialize_list_bucket_data(lbData);
-            }
-            else {
-                // Initialize the next one
-                initialize_list_bucket_contents
-                    (&(lbData->contents[lbData->contentsCount]));
-            }
+        if ((lbData->keyOffsets[i] < 0) &&
+            ((status = end_field(lbData, &(lbData->keyOffsets[i]))) != 
+             S3StatusOK)) {
+            break;
         }
-        else if (!strcmp(elementPath,
-                         "ListBucketResult/CommonPrefixes/Prefix")) {
-            // Finished a Prefix
-            lbData->commonPrefixesCount++;
-            if (lbData->commonPrefixesCount == MAX_COMMON_PREFIXES) {
-                // Make the callback
-                S3Status status = make_list_bucket_callback(lbData);
-                if (status != S3StatusOK) {
-                    return status;
-                }
-                initialize_list_bucket_data(lbData);
-            }
-            else {
-                // Initialize the next one
-                lbData->commonPrefixes[lbData->commonPrefixesCount][0] = 0;
-                lbData->commonPrefixLens[lbData->commonPrefixesCount] = 0;
+        if ((lbData->eTagOffsets[i] < 0) &&
+            ((status = end_field(lbData, &(lbData->eTagOffsets[i]))) != 
+             S3StatusOK)) {
+            break;
+        }
+        lbData->contentsCount++;
+        lbData->contentStarted = 0;
+        if (lbData->contentsCount == lbData->maxContents) {
+            // Make the callback
+            status = make_list_bucket_callback(lbData);
+            initialize_list_bucket_data(lbData);
+        }
+        break;
+    case SimpleXmlPathListCommonPrefixesPrefix:
+        // Finished a Prefix
+        if ((status = end_field(lbData, &offset)) != S3StatusOK) {
+            break;
+        }
+        if (lbData->commonPrefixesCount == lbData->commonPrefixesSize) {
+            int size = grown_size(lbData->commonPrefixesSize,
+                                  lbData->maxCommonPrefixes);
+            if (!resize_array(&(lbData->commonPrefixOffsets), size,
+                              sizeof(int)) ||
+                !resize_array(&(lbData->commonPrefixes), size,
+                              sizeof(const char *))) {
+                status = S3StatusOutOfMemory;
+                break;
             }
+            lbData->commonPrefixesSize = size;
+        }
+        lbData->commonPrefixOffsets[lbData->commonPrefixesCount++] = offset;
+        if (lbData->commonPrefixesCount == lbData->maxCommonPrefixes) {
+            // Make the callback
+            status = make_list_bucket_callback(lbData);
+            initialize_list_bucket_data(lbData);
         }
+        break;
+    default:
+        break;
     }
 
-    /* Avoid compiler error about variable set but not used */
-    (void) fit;
-
-    return S3StatusOK;
+    return status;
 }
 
 
@@ -626,19 +836,13 @@ static void listBucketCompleteCallback(S3Status requestStatus,
 
     simplexml_deinitialize(&(lbData->simpleXml));
 
-    free(lbData);
+    free_list_bucket_data(lbData);
 }
 
 
-void S3_list_bucket(const S3BucketContext *bucketContext, const char *prefix,
-                    const char *marker, const char *delimiter, int maxkeys,
-                    S3RequestContext *requestContext,
-                    const S3ListBucketHandler *handler, void *callbackData)
-{
-    // Compose the query params
-    string_buffer(queryParams, 4096);
-    string_buffer_initialize(queryParams);
-    
+// Appends name=value, URL encoded, to the queryParams string buffer of the
+// calling list function, reporting S3StatusQueryParamsTooLong and returning
+// if it does not fit
 #define safe_append(name, value)                                        \
     do {                                                                \
         int fit;                                                        \
@@ -658,14 +862,14 @@ void S3_list_bucket(const S3BucketContext *bucketContext, const char *prefix,
             return;                                                     \
         }                                                               \
         amp = 1;                                                        \
-        char encoded[3 * 1024];                                         \
-        if (!urlEncode(encoded, value, 1024)) {                         \
+        char encoded[3 * 1024 + 1];                                     \
+        int encodedLen = urlEncode(encoded, value, 1024);               \
+        if (encodedLen < 0) {                                           \
             (*(handler->responseHandler.completeCallback))              \
                 (S3StatusQueryParamsTooLong, 0, callbackData);          \
             return;                                                     \
         }                                                               \
-        string_buffer_append(queryParams, encoded, strlen(encoded),     \
-                             fit);                                      \
+        string_buffer_append(queryParams, encoded, encodedLen, fit);    \
         if (!fit) {                                                     \
             (*(handler->responseHandler.completeCallback))              \
                 (S3StatusQueryParamsTooLong, 0, callbackData);          \
@@ -674,24 +878,14 @@ void S3_list_bucket(const S3BucketContext *bucketContext, const char *prefix,
     } while (0)
 
 
-    int amp = 0;
-    if (prefix) {
-        safe_append("prefix", prefix);
-    }
-    if (marker) {
-        safe_append("marker", marker);
-    }
-    if (delimiter) {
-        safe_append("delimiter", delimiter);
-    }
-    if (maxkeys) {
-        char maxKeysString[64];
-        snprintf(maxKeysString, sizeof(maxKeysString), "%d", maxkeys);
-        safe_append("max-keys", maxKeysString);
-    }
-
+static void list_bucket(const S3BucketContext *bucketContext,
+                        const char *queryParams,
+                        S3RequestContext *requestContext,
+                        const S3ListBucketHandler *handler,
+                        void *callbackData)
+{
     ListBucketData *lbData =
-        (ListBucketData *) malloc(sizeof(ListBucketData));
+        (ListBucketData *) calloc(1, sizeof(ListBucketData));
 
     if (!lbData) {
         (*(handler->responseHandler.completeCallback))
@@ -704,12 +898,21 @@ void S3_list_bucket(const S3BucketContext *bucketContext, const char *prefix,
     lbData->responsePropertiesCallback = 
         handler->responseHandler.propertiesCallback;
     lbData->listBucketCallback = handler->listBucketCallback;
+    lbData->listBucketColumnsCallback = handler->listBucketColumnsCallback;
     lbData->responseCompleteCallback = 
         handler->responseHandler.completeCallback;
     lbData->callbackData = callbackData;
 
     string_buffer_initialize(lbData->isTruncated);
     string_buffer_initialize(lbData->nextMarker);
+    if (handler->batchSize > 0) {
+        lbData->maxContents = handler->batchSize;
+        lbData->maxCommonPrefixes = handler->batchSize;
+    }
+    else {
+        lbData->maxContents = DEFAULT_MAX_CONTENTS;
+        lbData->maxCommonPrefixes = DEFAULT_MAX_COMMON_PREFIXES;
+    }
     initialize_list_bucket_data(lbData);
 
     // Set up the RequestParams
@@ -721,7 +924,10 @@ void S3_list_bucket(const S3BucketContext *bucketContext, const char *prefix,
           bucketContext->protocol,                    // protocol
           bucketContext->uriStyle,                    // uriStyle
           bucketContext->accessKeyId,                 // accessKeyId
-          bucketContext->secretAccessKey },           // secretAccessKey
+          bucketContext->secretAccessKey,             // secretAccessKey
+          bucketContext->signatureVersion,            // signatureVersion
+          bucketContext->authRegion,                  // authRegion
+          bucketContext->preparedBucket },            // preparedBucket
         0,                                            // key
         queryParams[0] ? queryParams : 0,             // queryParams
         0,                                            // subResource
@@ -742,3 +948,72 @@ void S3_list_bucket(const S3BucketContext *bucketContext, const char *prefix,
     // Perform the request
     request_perform(&params, requestContext);
 }
+
+
+void S3_list_bucket(const S3BucketContext *bucketContext, const char *prefix,
+                    const char *marker, const char *delimiter, int maxkeys,
+                    S3RequestContext *requestContext,
+                    const S3ListBucketHandler *handler, void *callbackData)
+{
+    // Compose the query params
+    string_buffer(queryParams, 4096);
+    string_buffer_initialize(queryParams);
+
+    int amp = 0;
+    if (prefix) {
+        safe_append("prefix", prefix);
+    }
+    if (marker) {
+        safe_append("marker", marker);
+    }
+    if (delimiter) {
+        safe_append("delimiter", delimiter);
+    }
+    if (maxkeys) {
+        char maxKeysString[64];
+        snprintf(maxKeysString, sizeof(maxKeysString), "%d", maxkeys);
+        safe_append("max-keys", maxKeysString);
+    }
+
+    list_bucket(bucketContext, queryParams, requestContext, handler,
+                callbackData);
+}
+
+
+void S3_list_bucket_v2(const S3BucketContext *bucketContext,
+                       const char *prefix, const char *continuationToken,
+                       const char *startAfter, const char *delimiter,
+                       int maxkeys, int fetchOwner,
+                       S3RequestContext *requestContext,
+                       const S3ListBucketHandler *handler, void *callbackData)
+{
+    // Compose the query params
+    string_buffer(queryParams, 4096);
+    string_buffer_initialize(queryParams);
+
+    int amp = 0;
+    safe_append("list-type", "2");
+    if (continuationToken) {
+        safe_append("continuation-token", continuationToken);
+    }
+    if (startAfter) {
+        safe_append("start-after", startAfter);
+    }
+    if (prefix) {
+        safe_append("prefix", prefix);
+    }
+    if (delimiter) {
+        safe_append("delimiter", delimiter);
+    }
+    if (maxkeys) {
+        char maxKeysString[64];
+        snprintf(maxKeysString, sizeof(maxKeysString), "%d", maxkeys);
+        safe_append("max-keys", maxKeysString);
+    }
+    if (fetchOwner) {
+        safe_append("fetch-owner", "true");
+    }
+
+    list_bucket(bucketContext, queryParams, requestContext, handler,
+                callbackData);
+}
@@ -0,0 +1,931 @@
+/** **************************************************************************
+ * crawl.c
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License version 3
+ * along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+#include <stdlib.h>
+#include <string.h>
+#include "libs3.h"
+#include "transfer.h"
+
+
+// The crawl is a state machine driven by the completion of its list
+// requests, in the same way as the parallel get: requests are only ever
+// issued from crawl_advance(), and callbacks only record their results and
+// then call crawl_advance().
+//
+// The keys under the prefix are divided into partitions, each a range of
+// keys which is listed page by page independently of the others.  The first
+// partitions are divided at the common prefixes returned by a delimiter
+// listing of the prefix.  After that, whenever a request could be issued but
+// no partition is waiting for one, a partition whose last page was truncated
+// is split in two, at a key estimated from the keys of that page, so that
+// the crawl follows however the keys are actually spread out.
+
+// The most bytes of keys that are buffered for partitions which are not at
+// the head of the line of a sorted crawl, past which those partitions stop
+// listing until they reach the head of the line
+#define CRAWL_MAX_BUFFERED (32 * 1024 * 1024)
+
+// The fewest pages of keys, as estimated from the keys of the last page of a
+// partition, that each piece of a split partition is expected to hold
+#define CRAWL_SPLIT_PAGES 4
+
+typedef struct Crawl Crawl;
+
+// A batch of keys listed by a partition of a sorted crawl before the
+// partition reached the head of the line, copied out of the list response
+// along with its strings
+typedef struct CrawlBatch
+{
+    struct CrawlBatch *next;
+
+    // The number of bytes allocated for the batch
+    int size;
+
+    S3ListBucketColumns columns;
+} CrawlBatch;
+
+
+// The keys after [after], up to and including [hi], or up to the last key
+// under the prefix if there is no hi
+typedef struct CrawlPartition
+{
+    Crawl *crawl;
+
+    struct CrawlPartition *next;
+
+    // Set while a request for the next page of the partition is in progress
+    int requestActive;
+
+    // Set once the partition has been listed completely
+    int finished;
+
+    // The isTruncated of the page being listed, and whether it has listed a
+    // key past hi
+    int truncated, reachedEnd;
+
+    // Set from the completion of a truncated page until the next page is
+    // requested, while pageFirst and after give the range of that page
+    int splittable;
+
+    int retries;
+
+    int hasHi;
+
+    // The last key listed so far, or the key which the partition starts
+    // after; each page starts after this key
+    char after[S3_MAX_KEY_SIZE + 1];
+
+    char hi[S3_MAX_KEY_SIZE + 1];
+
+    // The first key of the page being listed, empty until one is listed
+    char pageFirst[S3_MAX_KEY_SIZE + 1];
+
+    // The batches waiting for the partition to reach the head of the line
+    CrawlBatch *batches, *batchesTail;
+} CrawlPartition;
+
+
+struct Crawl
+{
+    // Copies of the caller's bucket context, prefix and delimiter
+    S3BucketContext bucketContext;
+    char *prefix;
+    char *delimiter;
+
+    int prefixLen;
+
+    int sorted, fetchOwner;
+
+    S3ListBucketCallback *listBucketCallback;
+    S3ListBucketColumnsCallback *listBucketColumnsCallback;
+    S3ResponsePropertiesCallback *responsePropertiesCallback;
+    S3ResponseCompleteCallback *responseCompleteCallback;
+    void *callbackData;
+
+    // The handler of the requests of the partitions
+    S3ListBucketHandler partitionHandler;
+
+    S3RequestContext *requestContext;
+
+    // Set until the delimiter listing has succeeded, and while it is in
+    // progress
+    int fanOutPending, fanOutActive, fanOutRetries;
+
+    // Set once the caller has been given the properties of a response
+    int propertiesReported;
+
+    // Set while crawl_advance() is running, and when it must run again
+    int advancing, advanceAgain;
+
+    // Set once the complete callback has been made
+    int done;
+
+    int maxConcurrency, maxRetries, requestsActive;
+
+    // The partitions in the order of their keys; in a sorted crawl, the first
+    // one is at the head of the line
+    CrawlPartition *partitions;
+
+    // The last partition, to which the delimiter listing adds
+    CrawlPartition *lastPartition;
+
+    // The number of bytes of the batches of all partitions
+    int buffered;
+
+    // The rows made from the columns of a batch for listBucketCallback
+    S3ListBucketContent *contents;
+    int contentsSize;
+
+    TransferError error;
+};
+
+
+static void crawl_advance(Crawl *crawl);
+
+
+// Gives the caller the properties of the first response
+static S3Status report_properties
+    (Crawl *crawl, const S3ResponseProperties *responseProperties)
+{
+    if (crawl->propertiesReported || !crawl->responsePropertiesCallback) {
+        return S3StatusOK;
+    }
+
+    crawl->propertiesReported = 1;
+
+    return (*(crawl->responsePropertiesCallback))
+        (responseProperties, crawl->callbackData);
+}
+
+
+static CrawlPartition *new_partition(Crawl *crawl, const char *after)
+{
+    CrawlPartition *part =
+        (CrawlPartition *) calloc(1, sizeof(CrawlPartition));
+
+    if (part) {
+        part->crawl = crawl;
+        snprintf(part->after, sizeof(part->after), "%s", after);
+    }
+
+    return part;
+}
+
+
+static void free_partition(CrawlPartition *part)
+{
+    while (part->batches) {
+        CrawlBatch *batch = part->batches;
+        part->batches = batch->next;
+        part->crawl->buffered -= batch->size;
+        free(batch);
+    }
+
+    free(part);
+}
+
+
+// delivery ------------------------------------------------------------------
+
+// Passes a batch of keys to the caller
+static S3Status crawl_callback(Crawl *crawl,
+                               const S3ListBucketColumns *columns)
+{
+    if (crawl->listBucketColumnsCallback) {
+        return (*(crawl->listBucketColumnsCallback))
+            (0, 0, columns, 0, 0, crawl->callbackData);
+    }
+
+    int count = columns->count, i;
+
+    if (count > crawl->contentsSize) {
+        S3ListBucketContent *contents = (S3ListBucketContent *)
+            realloc(crawl->contents, count * sizeof(S3ListBucketContent));
+        if (!contents) {
+            return S3StatusOutOfMemory;
+        }
+        crawl->contents = contents;
+        crawl->contentsSize = count;
+    }
+
+    const char *strings = columns->strings;
+    for (i = 0; i < count; i++) {
+        S3ListBucketContent *content = &(crawl->contents[i]);
+        content->key = &(strings[columns->keyOffsets[i]]);
+        content->lastModified = columns->lastModifieds[i];
+        content->eTag = &(strings[columns->eTagOffsets[i]]);
+        content->size = columns->sizes[i];
+        content->ownerId = (columns->ownerIdOffsets[i] < 0) ? 0 :
+            &(strings[columns->ownerIdOffsets[i]]);
+        content->ownerDisplayName =
+            (columns->ownerDisplayNameOffsets[i] < 0) ? 0 :
+            &(strings[columns->ownerDisplayNameOffsets[i]]);
+    }
+
+    return (*(crawl->listBucketCallback))
+        (0, 0, count, crawl->contents, 0, 0, crawl->callbackData);
+}
+
+
+// Copies a batch of keys of [part] to be delivered once it reaches the head
+// of the line
+static S3Status crawl_buffer(Crawl *crawl, CrawlPartition *part,
+                             const S3ListBucketColumns *columns)
+{
+    int count = columns->count, stringsSize = 0, i;
+
+#define string_size(offsets, i)                                         \
+    ((columns->offsets[i] < 0) ? 0 :                                    \
+     (strlen(&(columns->strings[columns->offsets[i]])) + 1))
+
+    for (i = 0; i < count; i++) {
+        stringsSize += (string_size(keyOffsets, i) +
+                        string_size(eTagOffsets, i) +
+                        string_size(ownerIdOffsets, i) +
+                        string_size(ownerDisplayNameOffsets, i));
+    }
+
+    // The arrays and strings follow the batch, the 8 byte ones first
+    int size = (sizeof(CrawlBatch) +
+                (count * (sizeof(int64_t) + sizeof(uint64_t) +
+                          (4 * sizeof(int)))) + stringsSize);
+
+    CrawlBatch *batch = (CrawlBatch *) malloc(size);
+    if (!batch) {
+        return S3StatusOutOfMemory;
+    }
+
+    int64_t *lastModifieds = (int64_t *) &(batch[1]);
+    uint64_t *sizes = (uint64_t *) &(lastModifieds[count]);
+    int *keyOffsets = (int *) &(sizes[count]);
+    int *eTagOffsets = &(keyOffsets[count]);
+    int *ownerIdOffsets = &(eTagOffsets[count]);
+    int *ownerDisplayNameOffsets = &(ownerIdOffsets[count]);
+    char *strings = (char *) &(ownerDisplayNameOffsets[count]);
+    int offset = 0;
+
+#define copy_string(offsets, i)                                         \
+    do {                                                                \
+        if (columns->offsets[i] < 0) {                                  \
+            offsets[i] = -1;                                            \
+        }                                                               \
+        else {                                                          \
+            const char *str = &(columns->strings[columns->offsets[i]]); \
+            int len = strlen(str) + 1;                                  \
+            memcpy(&(strings[offset]), str, len);                       \
+            offsets[i] = offset;                                        \
+            offset += len;                                              \
+        }                                                               \
+    } while (0)
+
+    for (i = 0; i < count; i++) {
+        copy_string(keyOffsets, i);
+        copy_string(eTagOffsets, i);
+        copy_string(ownerIdOffsets, i);
+        copy_string(ownerDisplayNameOffsets, i);
+    }
+
+    memcpy(lastModifieds, columns->lastModifieds, count * sizeof(int64_t));
+    memcpy(sizes, columns->sizes, count * sizeof(uint64_t));
+
+    batch->next = 0;
+    batch->size = size;
+    batch->columns.count = count;
+    batch->columns.strings = strings;
+    batch->columns.keyOffsets = keyOffsets;
+    batch->columns.eTagOffsets = eTagOffsets;
+    batch->columns.ownerIdOffsets = ownerIdOffsets;
+    batch->columns.ownerDisplayNameOffsets = ownerDisplayNameOffsets;
+    batch->columns.lastModifieds = lastModifieds;
+    batch->columns.sizes = sizes;
+
+    if (part->batchesTail) {
+        part->batchesTail->next = batch;
+    }
+    else {
+        part->batches = batch;
+    }
+    part->batchesTail = batch;
+    crawl->buffered += size;
+
+    return S3StatusOK;
+}
+
+
+// Delivers the batches of the partition at the head of the line, and frees
+// the partitions which have been completely listed and delivered
+static void crawl_deliver(Crawl *crawl)
+{
+    CrawlPartition **link = &(crawl->partitions);
+
+    while (*link) {
+        CrawlPartition *part = *link;
+        if (crawl->sorted && (part != crawl->partitions)) {
+            break;
+        }
+        while (part->batches) {
+            CrawlBatch *batch = part->batches;
+            S3Status status = crawl_callback(crawl, &(batch->columns));
+            part->batches = batch->next;
+            crawl->buffered -= batch->size;
+            free(batch);
+            if (status != S3StatusOK) {
+                transfer_error_set(&(crawl->error), status, 0);
+                return;
+            }
+        }
+        part->batchesTail = 0;
+        if (part->finished) {
+            *link = part->next;
+            free_partition(part);
+        }
+        else if (crawl->sorted) {
+            break;
+        }
+        else {
+            link = &(part->next);
+        }
+    }
+}
+
+
+// splitting -----------------------------------------------------------------
+
+// Returns the 7 bytes of [key] starting at [offset], padded with zeros, as a
+// number, so that keys which agree before offset compare as their numbers do
+static uint64_t key_digits(const char *key, int offset)
+{
+    uint64_t digits = 0;
+    int i, ended = 0;
+
+    for (i = 0; i < offset; i++) {
+        if (!key[i]) {
+            ended = 1;
+            break;
+        }
+    }
+
+    key = &(key[offset]);
+    for (i = 0; i < 7; i++) {
+        digits <<= 8;
+        if (!ended && *key) {
+            digits |= (unsigned char) *key++;
+        }
+        else {
+            ended = 1;
+        }
+    }
+
+    return digits;
+}
+
+
+// Splits off the keys after [after] plus [step] into a new partition
+// following [part].  Keys are added as numbers with a digit per byte, the
+// lowest digit of [step] being the 7th byte from [offset].  The new key is
+// cut short at the first byte which is not printable ASCII, so that it is
+// valid UTF-8 without a NUL.  [offset] + 7 may be no more than
+// S3_MAX_KEY_SIZE.  Returns nonzero if the partition was split.
+static int split_at(Crawl *crawl, CrawlPartition *part, int offset,
+                    uint64_t step)
+{
+    char mid[S3_MAX_KEY_SIZE + 1];
+    int len = offset + 7, i;
+
+    for (i = 0; (i < len) && part->after[i]; i++) {
+        mid[i] = part->after[i];
+    }
+    for (; i < len; i++) {
+        mid[i] = 0;
+    }
+
+    uint64_t carry = step;
+    for (i = len - 1; carry && (i >= 0); i--) {
+        uint64_t sum = ((unsigned char) mid[i]) + (carry & 0xff);
+        mid[i] = (char) (sum & 0xff);
+        carry = (carry >> 8) + (sum >> 8);
+    }
+
+    // A carry into the prefix gives a key past every key of the crawl
+    if (carry || ((i + 1) < crawl->prefixLen)) {
+        return 0;
+    }
+
+    for (i++; i < len; i++) {
+        if ((mid[i] < 0x20) || (mid[i] > 0x7e)) {
+            break;
+        }
+    }
+    mid[i] = 0;
+
+    if ((strcmp(part->after, mid) >= 0) ||
+        (part->hasHi && (strcmp(mid, part->hi) >= 0))) {
+        return 0;
+    }
+
+    CrawlPartition *next = new_partition(crawl, mid);
+    if (!next) {
+        return 0;
+    }
+
+    next->hasHi = part->hasHi;
+    strcpy(next->hi, part->hi);
+    part->hasHi = 1;
+    strcpy(part->hi, mid);
+
+    next->next = part->next;
+    part->next = next;
+
+    return 1;
+}
+
+
+// Splits the rest of [part], the keys after its after key, into as many as
+// [count] + 1 partitions, taking the keys to be spread out as they were in
+// its last page.  Returns the number of partitions added.
+static int crawl_split(Crawl *crawl, CrawlPartition *part, int count)
+{
+    const char *after = part->after, *first = part->pageFirst;
+
+    // The page is measured from the first byte at which its keys differ
+    int offset = 0;
+    while (first[offset] && (first[offset] == after[offset])) {
+        offset++;
+    }
+    if (!first[0] || ((offset + 7) > S3_MAX_KEY_SIZE)) {
+        return 0;
+    }
+
+    uint64_t lo = key_digits(after, offset);
+    uint64_t span = lo - key_digits(first, offset);
+    if (!span) {
+        return 0;
+    }
+
+    // Splitting at the larger keys first leaves the new partitions in order
+    int added = 0, j;
+
+    if (part->hasHi && !strncmp(part->hi, after, offset)) {
+        // The rest of the partition is divided evenly, into pieces expected
+        // to hold at least CRAWL_SPLIT_PAGES pages each
+        uint64_t rest = key_digits(part->hi, offset) - lo;
+        uint64_t pieces = rest / (CRAWL_SPLIT_PAGES * span);
+        if (pieces > (uint64_t) (count + 1)) {
+            pieces = count + 1;
+        }
+        for (j = ((int) pieces) - 1; j > 0; j--) {
+            added += split_at(crawl, part, offset, (rest / pieces) * j);
+        }
+    }
+    else {
+        // The end of the partition is further than the page can measure,
+        // so the new partitions reach ahead twice as far as each other, the
+        // first CRAWL_SPLIT_PAGES pages ahead
+        uint64_t step = CRAWL_SPLIT_PAGES * span;
+        int n = 1;
+        while ((n < count) && (step < (1ULL << (62 - n)))) {
+            n++;
+        }
+        for (j = n - 1; j >= 0; j--) {
+            added += split_at(crawl, part, offset, step << j);
+        }
+    }
+
+    return added;
+}
+
+
+// fan out -------------------------------------------------------------------
+
+static S3Status fanOutPropertiesCallback
+    (const S3ResponseProperties *responseProperties, void *callbackData)
+{
+    return report_properties((Crawl *) callbackData, responseProperties);
+}
+
+
+static S3Status fanOutColumnsCallback(int isTruncated, const char *nextMarker,
+                                      const S3ListBucketColumns *columns,
+                                      int commonPrefixesCount,
+                                      const char **commonPrefixes,
+                                      void *callbackData)
+{
+    Crawl *crawl = (Crawl *) callbackData;
+
+    (void) isTruncated;
+    (void) nextMarker;
+    (void) columns;
+
+    // Each common prefix ends the last partition and starts a new one; the
+    // keys directly under the prefix are left to the partitions to list
+    int i;
+    for (i = 0; i < commonPrefixesCount; i++) {
+        CrawlPartition *last = crawl->lastPartition;
+        // A retried listing returns again the common prefixes already seen
+        if ((strcmp(commonPrefixes[i], last->after) <= 0) ||
+            (strlen(commonPrefixes[i]) > S3_MAX_KEY_SIZE)) {
+            continue;
+        }
+        CrawlPartition *part = new_partition(crawl, commonPrefixes[i]);
+        if (!part) {
+            return S3StatusOutOfMemory;
+        }
+        last->hasHi = 1;
+        strcpy(last->hi, commonPrefixes[i]);
+        last->next = part;
+        crawl->lastPartition = part;
+    }
+
+    return S3StatusOK;
+}
+
+
+static void fanOutCompleteCallback(S3Status requestStatus,
+                                   const S3ErrorDetails *s3ErrorDetails,
+                                   void *callbackData)
+{
+    Crawl *crawl = (Crawl *) callbackData;
+
+    crawl->fanOutActive = 0;
+    crawl->requestsActive--;
+
+    if (requestStatus == S3StatusOK) {
+        crawl->fanOutPending = 0;
+    }
+    else if (!S3_status_is_retryable(requestStatus) ||
+             (crawl->fanOutRetries++ == crawl->maxRetries)) {
+        transfer_error_set(&(crawl->error), requestStatus, s3ErrorDetails);
+    }
+
+    crawl_advance(crawl);
+}
+
+
+static const S3ListBucketHandler fanOutHandlerG =
+{
+    { &fanOutPropertiesCallback, &fanOutCompleteCallback },
+    0,
+    0,
+    &fanOutColumnsCallback
+};
+
+
+// Lists the first page of the prefix with the delimiter, only for its common
+// prefixes
+static void crawl_fan_out(Crawl *crawl)
+{
+    crawl->fanOutActive = 1;
+    crawl->requestsActive++;
+
+    S3_list_bucket_v2(&(crawl->bucketContext), crawl->prefix, 0, 0,
+                      crawl->delimiter, 0, 0, crawl->requestContext,
+                      &fanOutHandlerG, crawl);
+}
+
+
+// partitions ----------------------------------------------------------------
+
+static S3Status partitionPropertiesCallback
+    (const S3ResponseProperties *responseProperties, void *callbackData)
+{
+    return report_properties(((CrawlPartition *) callbackData)->crawl,
+                             responseProperties);
+}
+
+
+static S3Status partitionColumnsCallback(int isTruncated,
+                                         const char *nextMarker,
+                                         const S3ListBucketColumns *columns,
+                                         int commonPrefixesCount,
+                                         const char **commonPrefixes,
+                                         void *callbackData)
+{
+    CrawlPartition *part = (CrawlPartition *) callbackData;
+    Crawl *crawl = part->crawl;
+
+    (void) nextMarker;
+    (void) commonPrefixesCount;
+    (void) commonPrefixes;
+
+    if (crawl->error.status != S3StatusOK) {
+        return crawl->error.status;
+    }
+
+    part->truncated = isTruncated;
+
+    // Leave out the keys past the end of the partition, which belong to the
+    // partitions after it
+    int count = columns->count;
+    if (part->hasHi) {
+        while (count && (strcmp(&(columns->strings
+                                  [columns->keyOffsets[count - 1]]),
+                                part->hi) > 0)) {
+            count--;
+            part->reachedEnd = 1;
+        }
+    }
+
+    if (!count) {
+        return S3StatusOK;
+    }
+
+    if (!part->pageFirst[0]) {
+        snprintf(part->pageFirst, sizeof(part->pageFirst), "%s",
+                 &(columns->strings[columns->keyOffsets[0]]));
+    }
+    snprintf(part->after, sizeof(part->after), "%s",
+             &(columns->strings[columns->keyOffsets[count - 1]]));
+
+    S3ListBucketColumns delivered = *columns;
+    delivered.count = count;
+
+    S3Status status;
+    if (!crawl->sorted || (part == crawl->partitions)) {
+        status = crawl_callback(crawl, &delivered);
+    }
+    else {
+        status = crawl_buffer(crawl, part, &delivered);
+    }
+
+    // The status returned by the last callback of a page is not reported by
+    // the request, so it is recorded here
+    if (status != S3StatusOK) {
+        transfer_error_set(&(crawl->error), status, 0);
+    }
+
+    return status;
+}
+
+
+static void partitionCompleteCallback(S3Status requestStatus,
+                                      const S3ErrorDetails *s3ErrorDetails,
+                                      void *callbackData)
+{
+    CrawlPartition *part = (CrawlPartition *) callbackData;
+    Crawl *crawl = part->crawl;
+
+    part->requestActive = 0;
+    crawl->requestsActive--;
+
+    if (requestStatus == S3StatusOK) {
+        part->retries = 0;
+        if (part->reachedEnd || !part->truncated) {
+            part->finished = 1;
+        }
+        else {
+            part->splittable = 1;
+        }
+    }
+    else if (S3_status_is_retryable(requestStatus) &&
+             (part->retries < crawl->maxRetries) &&
+             (crawl->error.status == S3StatusOK)) {
+        // The next page starts after the last key delivered, so nothing is
+        // delivered twice
+        part->retries++;
+    }
+    else {
+        transfer_error_set(&(crawl->error), requestStatus, s3ErrorDetails);
+    }
+
+    crawl_advance(crawl);
+}
+
+
+// Lists the next page of [part]
+static void crawl_list(Crawl *crawl, CrawlPartition *part)
+{
+    part->requestActive = 1;
+    part->truncated = 0;
+    part->splittable = 0;
+    part->pageFirst[0] = 0;
+    crawl->requestsActive++;
+
+    S3_list_bucket_v2(&(crawl->bucketContext), crawl->prefix, 0,
+                      part->after[0] ? part->after : 0, 0, 0,
+                      crawl->fetchOwner, crawl->requestContext,
+                      &(crawl->partitionHandler), part);
+}
+
+
+// Returns nonzero if a request for the next page of [part] may be issued
+static int partition_ready(Crawl *crawl, CrawlPartition *part)
+{
+    if (part->requestActive || part->finished) {
+        return 0;
+    }
+
+    // In order, partitions stop listing ahead once enough is buffered
+    return (!crawl->sorted || (part == crawl->partitions) ||
+            (crawl->buffered < CRAWL_MAX_BUFFERED));
+}
+
+
+static void crawl_destroy(Crawl *crawl)
+{
+    while (crawl->partitions) {
+        CrawlPartition *part = crawl->partitions;
+        crawl->partitions = part->next;
+        free_partition(part);
+    }
+
+    free(crawl->contents);
+    free(crawl);
+}
+
+
+static void crawl_advance(Crawl *crawl)
+{
+    if (crawl->advancing) {
+        crawl->advanceAgain = 1;
+        return;
+    }
+
+    crawl->advancing = 1;
+
+    do {
+        crawl->advanceAgain = 0;
+
+        if (crawl->error.status != S3StatusOK) {
+            // Wait for the requests in progress, and then report the failure
+            if (!crawl->requestsActive) {
+                crawl->done = 1;
+            }
+            break;
+        }
+
+        if (crawl->fanOutPending) {
+            if (!crawl->fanOutActive) {
+                crawl_fan_out(crawl);
+            }
+            continue;
+        }
+
+        crawl_deliver(crawl);
+        if (crawl->error.status != S3StatusOK) {
+            crawl->advanceAgain = 1;
+            continue;
+        }
+
+        CrawlPartition *part;
+        int ready = 0;
+        for (part = crawl->partitions; part; part = part->next) {
+            ready += partition_ready(crawl, part);
+        }
+
+        // Requests that would otherwise not be issued go to new partitions
+        // split off the partitions that have further to go
+        int spare = crawl->maxConcurrency - crawl->requestsActive - ready;
+        if (crawl->sorted && (crawl->buffered >= CRAWL_MAX_BUFFERED)) {
+            spare = 0;
+        }
+        for (part = crawl->partitions; part && (spare > 0);
+             part = part->next) {
+            if (part->splittable) {
+                part->splittable = 0;
+                int added = crawl_split(crawl, part, spare);
+                spare -= added;
+                while (added--) {
+                    part = part->next;
+                }
+            }
+        }
+
+        for (part = crawl->partitions;
+             part && (crawl->requestsActive < crawl->maxConcurrency) &&
+                 (crawl->error.status == S3StatusOK); part = part->next) {
+            if (partition_ready(crawl, part)) {
+                crawl_list(crawl, part);
+            }
+        }
+
+        if (!crawl->partitions && !crawl->requestsActive) {
+            crawl->done = 1;
+        }
+    } while (crawl->advanceAgain && !crawl->done);
+
+    crawl->advancing = 0;
+
+    if (crawl->done) {
+        (*(crawl->responseCompleteCallback))
+            (crawl->error.status, transfer_error_details(&(crawl->error)),
+             crawl->callbackData);
+        crawl_destroy(crawl);
+    }
+}
+
+
+void S3_crawl_bucket(const S3BucketContext *bucketContext,
+                     const char *prefix, const char *delimiter, int flags,
+                     const S3TransferProperties *transferProperties,
+                     S3RequestContext *requestContext,
+                     const S3ListBucketHandler *handler, void *callbackData)
+{
+    uint64_t partSize;
+    int maxConcurrency, maxRetries;
+    transfer_get_properties(transferProperties, &partSize, &maxConcurrency,
+                            &maxRetries);
+
+    if (delimiter && !delimiter[0]) {
+        delimiter = 0;
+    }
+
+    // The crawl is allocated along with copies of the strings of the bucket
+    // context, the prefix and the delimiter
+    int size = sizeof(Crawl);
+    int stringsSize = transfer_target_size(bucketContext, prefix);
+    if (delimiter) {
+        stringsSize += strlen(delimiter) + 1;
+    }
+
+    Crawl *crawl = (Crawl *) malloc(size + stringsSize);
+    if (!crawl) {
+        (*(handler->responseHandler.completeCallback))
+            (S3StatusOutOfMemory, 0, callbackData);
+        return;
+    }
+    memset(crawl, 0, size);
+
+    char *strings = &(((char *) crawl)[size]);
+    transfer_copy_target(&(crawl->bucketContext), &(crawl->prefix),
+                         bucketContext, prefix, strings);
+    strings += transfer_target_size(bucketContext, prefix);
+    if (delimiter) {
+        crawl->delimiter = strcpy(strings, delimiter);
+    }
+    crawl->prefixLen = prefix ? strlen(prefix) : 0;
+
+    crawl->sorted = (flags & S3_CRAWL_SORTED) ? 1 : 0;
+    crawl->fetchOwner = (flags & S3_CRAWL_FETCH_OWNER) ? 1 : 0;
+    crawl->listBucketCallback = handler->listBucketCallback;
+    crawl->listBucketColumnsCallback = handler->listBucketColumnsCallback;
+    crawl->responsePropertiesCallback =
+        handler->responseHandler.propertiesCallback;
+    crawl->responseCompleteCallback =
+        handler->responseHandler.completeCallback;
+    crawl->callbackData = callbackData;
+    crawl->partitionHandler.responseHandler.propertiesCallback =
+        &partitionPropertiesCallback;
+    crawl->partitionHandler.responseHandler.completeCallback =
+        &partitionCompleteCallback;
+    crawl->partitionHandler.batchSize = handler->batchSize;
+    crawl->partitionHandler.listBucketColumnsCallback =
+        &partitionColumnsCallback;
+    crawl->fanOutPending = (delimiter != 0);
+    crawl->maxConcurrency = maxConcurrency;
+    crawl->maxRetries = maxRetries;
+    transfer_error_initialize(&(crawl->error));
+
+    // Until the delimiter listing divides it, one partition covers every key
+    if (!(crawl->partitions = new_partition(crawl, ""))) {
+        crawl_destroy(crawl);
+        (*(handler->responseHandler.completeCallback))
+            (S3StatusOutOfMemory, 0, callbackData);
+        return;
+    }
+    crawl->lastPartition = crawl->partitions;
+
+    // If there is no request context, run the crawl to completion in a
+    // private one
+    S3RequestContext *privateContext = 0;
+    if (!requestContext) {
+        S3Status status = S3_create_request_context(&privateContext);
+        if (status != S3StatusOK) {
+            crawl_destroy(crawl);
+            (*(handler->responseHandler.completeCallback))
+                (status, 0, callbackData);
+            return;
+        }
+        requestContext = privateContext;
+    }
+    crawl->requestContext = requestContext;
+
+    crawl_advance(crawl);
+
+    if (privateContext) {
+        S3_runall_request_context(privateContext);
+        S3_destroy_request_context(privateContext);
+    }
+}
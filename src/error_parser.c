@@ -28,8 +28,9 @@
 #include "error_parser.h"
 
 
-static S3Status errorXmlCallback(const char *elementPath, const char *data,
-                                 int dataLen, void *callbackData)
+static S3Status errorXmlCallback(const char *elementPath, SimpleXmlPath path,
+                                 const char *data, int dataLen,
+                                 void *callbackData)
 {
     // We ignore end of element callbacks because we don't care about them
     if (!data) {
@@ -40,21 +41,21 @@ static S3Status errorXmlCallback(const char *elementPath, const char *data,
 
     int fit;
 
-    if (!strcmp(elementPath, "Error")) {
+    if (path == SimpleXmlPathError) {
         // Ignore, this is the Error element itself, we only care about subs
     }
-    else if (!strcmp(elementPath, "Error/Code")) {
+    else if (path == SimpleXmlPathErrorCode) {
         string_buffer_append(errorParser->code, data, dataLen, fit);
     }
-    else if (!strcmp(elementPath, "Error/Message")) {
+    else if (path == SimpleXmlPathErrorMessage) {
         string_buffer_append(errorParser->message, data, dataLen, fit);
         errorParser->s3ErrorDetails.message = errorParser->message;
     }
-    else if (!strcmp(elementPath, "Error/Resource")) {
+    else if (path == SimpleXmlPathErrorResource) {
         string_buffer_append(errorParser->resource, data, dataLen, fit);
         errorParser->s3ErrorDetails.resource = errorParser->resource;
     }
-    else if (!strcmp(elementPath, "Error/FurtherDetails")) {
+    else if (path == SimpleXmlPathErrorFurtherDetails) {
         string_buffer_append(errorParser->furtherDetails, data, dataLen, fit);
         errorParser->s3ErrorDetails.furtherDetails = 
             errorParser->furtherDetails;
@@ -39,6 +39,8 @@ S3Status S3_initialize(const char *userAgentInfo, int flags,
         return S3StatusOK;
     }
 
+    util_initialize();
+
     return request_api_initialize(userAgentInfo, flags, defaultS3HostName);
 }
 
@@ -107,6 +109,11 @@ const char *S3_get_status_name(S3Status status)
         handlecase(ServerFailedVerification);
         handlecase(ConnectionFailed);
         handlecase(AbortedByCallback);
+        handlecase(UploadIdTooLong);
+        handlecase(BadPartNumber);
+        handlecase(BufferTooSmall);
+        handlecase(AuthRegionTooLong);
+        handlecase(DigestMismatch);
         handlecase(ErrorAccessDenied);
         handlecase(ErrorAccountProblem);
         handlecase(ErrorAmbiguousGrantByEmailAddress);
@@ -286,15 +293,17 @@ typedef struct ConvertAclData
 
 
 static S3Status convertAclXmlCallback(const char *elementPath,
-                                      const char *data, int dataLen,
-                                      void *callbackData)
+                                      SimpleXmlPath path, const char *data,
+                                      int dataLen, void *callbackData)
 {
+    (void) elementPath;
+
     ConvertAclData *caData = (ConvertAclData *) callbackData;
 
     int fit;
 
     if (data) {
-        if (!strcmp(elementPath, "AccessControlPolicy/Owner/ID")) {
+        if (path == SimpleXmlPathAclOwnerID) {
             caData->ownerIdLen += 
                 snprintf(&(caData->ownerId[caData->ownerIdLen]),
                          S3_MAX_GRANTEE_USER_ID_SIZE - caData->ownerIdLen - 1,
@@ -303,8 +312,7 @@ static S3Status convertAclXmlCallback(const char *elementPath,
                 return S3StatusUserIdTooLong;
             }
         }
-        else if (!strcmp(elementPath, "AccessControlPolicy/Owner/"
-                         "DisplayName")) {
+        else if (path == SimpleXmlPathAclOwnerDisplayName) {
             caData->ownerDisplayNameLen += 
                 snprintf(&(caData->ownerDisplayName
                            [caData->ownerDisplayNameLen]),
@@ -316,45 +324,35 @@ static S3Status convertAclXmlCallback(const char *elementPath,
                 return S3StatusUserDisplayNameTooLong;
             }
         }
-        else if (!strcmp(elementPath, 
-                    "AccessControlPolicy/AccessControlList/Grant/"
-                    "Grantee/EmailAddress")) {
+        else if (path == SimpleXmlPathAclGranteeEmailAddress) {
             // AmazonCustomerByEmail
             string_buffer_append(caData->emailAddress, data, dataLen, fit);
             if (!fit) {
                 return S3StatusEmailAddressTooLong;
             }
         }
-        else if (!strcmp(elementPath,
-                         "AccessControlPolicy/AccessControlList/Grant/"
-                         "Grantee/ID")) {
+        else if (path == SimpleXmlPathAclGranteeID) {
             // CanonicalUser
             string_buffer_append(caData->userId, data, dataLen, fit);
             if (!fit) {
                 return S3StatusUserIdTooLong;
             }
         }
-        else if (!strcmp(elementPath,
-                         "AccessControlPolicy/AccessControlList/Grant/"
-                         "Grantee/DisplayName")) {
+        else if (path == SimpleXmlPathAclGranteeDisplayName) {
             // CanonicalUser
             string_buffer_append(caData->userDisplayName, data, dataLen, fit);
             if (!fit) {
                 return S3StatusUserDisplayNameTooLong;
             }
         }
-        else if (!strcmp(elementPath,
-                         "AccessControlPolicy/AccessControlList/Grant/"
-                         "Grantee/URI")) {
+        else if (path == SimpleXmlPathAclGranteeURI) {
             // Group
             string_buffer_append(caData->groupUri, data, dataLen, fit);
             if (!fit) {
                 return S3StatusGroupUriTooLong;
             }
         }
-        else if (!strcmp(elementPath,
-                         "AccessControlPolicy/AccessControlList/Grant/"
-                         "Permission")) {
+        else if (path == SimpleXmlPathAclGrantPermission) {
             // Permission
             string_buffer_append(caData->permission, data, dataLen, fit);
             if (!fit) {
@@ -363,8 +361,7 @@ static S3Status convertAclXmlCallback(const char *elementPath,
         }
     }
     else {
-        if (!strcmp(elementPath, "AccessControlPolicy/AccessControlList/"
-                    "Grant")) {
+        if (path == SimpleXmlPathAclGrant) {
             // A grant has just been completed; so add the next S3AclGrant
             // based on the values read
             if (*(caData->aclGrantCountReturn) == S3_MAX_ACL_GRANT_COUNT) {
@@ -480,8 +477,15 @@ int S3_status_is_retryable(S3Status status)
     case S3StatusErrorInternalError:
     case S3StatusErrorOperationAborted:
     case S3StatusErrorRequestTimeout:
+    case S3StatusDigestMismatch:
         return 1;
     default:
         return 0;
     }
 }
+
+
+int64_t S3_parse_iso8601_time(const char *str)
+{
+    return parseIso8601Time(str);
+}
@@ -67,6 +67,32 @@ int pthread_mutex_destroy(pthread_mutex_t *mutex)
 }
 
 
+int pthread_key_create(pthread_key_t *key, void (*destructor)(void *))
+{
+    (void) destructor;
+
+    return ((*key = TlsAlloc()) == TLS_OUT_OF_INDEXES) ? -1 : 0;
+}
+
+
+int pthread_key_delete(pthread_key_t key)
+{
+    return TlsFree(key) ? 0 : -1;
+}
+
+
+void *pthread_getspecific(pthread_key_t key)
+{
+    return TlsGetValue(key);
+}
+
+
+int pthread_setspecific(pthread_key_t key, const void *value)
+{
+    return TlsSetValue(key, (LPVOID) value) ? 0 : -1;
+}
+
+
 int uname(struct utsname *u)
 {
     OSVERSIONINFO info;
@@ -0,0 +1,1425 @@
+/** **************************************************************************
+ * multipart.c
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License version 3
+ * along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+#include <stdlib.h>
+#include <string.h>
+#include "libs3.h"
+#include "request.h"
+#include "simplexml.h"
+#include "transfer.h"
+
+
+// initiate multipart --------------------------------------------------------
+
+typedef struct InitiateMultipartData
+{
+    SimpleXml simpleXml;
+
+    S3ResponsePropertiesCallback *responsePropertiesCallback;
+    S3ResponseCompleteCallback *responseCompleteCallback;
+    void *callbackData;
+
+    char *uploadIdReturn;
+    int uploadIdReturnLen;
+} InitiateMultipartData;
+
+
+static S3Status initiateMultipartXmlCallback(const char *elementPath,
+                                             SimpleXmlPath path,
+                                             const char *data, int dataLen,
+                                             void *callbackData)
+{
+    (void) elementPath;
+
+    InitiateMultipartData *imData = (InitiateMultipartData *) callbackData;
+
+    if (data && (path == SimpleXmlPathInitiateUploadId)) {
+        if ((imData->uploadIdReturnLen + dataLen) >= S3_MAX_UPLOAD_ID_SIZE) {
+            return S3StatusUploadIdTooLong;
+        }
+        memcpy(&(imData->uploadIdReturn[imData->uploadIdReturnLen]), data,
+               dataLen);
+        imData->uploadIdReturnLen += dataLen;
+        imData->uploadIdReturn[imData->uploadIdReturnLen] = 0;
+    }
+
+    return S3StatusOK;
+}
+
+
+static S3Status initiateMultipartPropertiesCallback
+    (const S3ResponseProperties *responseProperties, void *callbackData)
+{
+    InitiateMultipartData *imData = (InitiateMultipartData *) callbackData;
+
+    if (!imData->responsePropertiesCallback) {
+        return S3StatusOK;
+    }
+
+    return (*(imData->responsePropertiesCallback))
+        (responseProperties, imData->callbackData);
+}
+
+
+static S3Status initiateMultipartDataCallback(int bufferSize,
+                                              const char *buffer,
+                                              void *callbackData)
+{
+    InitiateMultipartData *imData = (InitiateMultipartData *) callbackData;
+
+    return simplexml_add(&(imData->simpleXml), buffer, bufferSize);
+}
+
+
+static void initiateMultipartCompleteCallback
+    (S3Status requestStatus, const S3ErrorDetails *s3ErrorDetails,
+     void *callbackData)
+{
+    InitiateMultipartData *imData = (InitiateMultipartData *) callbackData;
+
+    // A successful response must have supplied the upload ID
+    if ((requestStatus == S3StatusOK) && !imData->uploadIdReturnLen) {
+        requestStatus = S3StatusXmlParseFailure;
+    }
+
+    (*(imData->responseCompleteCallback))
+        (requestStatus, s3ErrorDetails, imData->callbackData);
+
+    simplexml_deinitialize(&(imData->simpleXml));
+
+    free(imData);
+}
+
+
+void S3_initiate_multipart(const S3BucketContext *bucketContext,
+                           const char *key,
+                           const S3PutProperties *putProperties,
+                           char *uploadIdReturn,
+                           S3RequestContext *requestContext,
+                           const S3ResponseHandler *handler,
+                           void *callbackData)
+{
+    // Create the callback data
+    InitiateMultipartData *data =
+        (InitiateMultipartData *) malloc(sizeof(InitiateMultipartData));
+    if (!data) {
+        (*(handler->completeCallback))(S3StatusOutOfMemory, 0, callbackData);
+        return;
+    }
+
+    simplexml_initialize(&(data->simpleXml), &initiateMultipartXmlCallback,
+                         data);
+
+    data->responsePropertiesCallback = handler->propertiesCallback;
+    data->responseCompleteCallback = handler->completeCallback;
+    data->callbackData = callbackData;
+
+    data->uploadIdReturn = uploadIdReturn;
+    data->uploadIdReturn[0] = 0;
+    data->uploadIdReturnLen = 0;
+
+    // An MD5 of the (empty) initiate request would never match, so don't
+    // send one
+    S3PutProperties properties;
+    if (putProperties) {
+        properties = *putProperties;
+        properties.md5 = 0;
+    }
+
+    // Set up the RequestParams
+    RequestParams params =
+    {
+        HttpRequestTypePOST,                          // httpRequestType
+        { bucketContext->hostName,                    // hostName
+          bucketContext->bucketName,                  // bucketName
+          bucketContext->protocol,                    // protocol
+          bucketContext->uriStyle,                    // uriStyle
+          bucketContext->accessKeyId,                 // accessKeyId
+          bucketContext->secretAccessKey,             // secretAccessKey
+          bucketContext->signatureVersion,            // signatureVersion
+          bucketContext->authRegion,                  // authRegion
+          bucketContext->preparedBucket },            // preparedBucket
+        key,                                          // key
+        0,                                            // queryParams
+        "uploads",                                    // subResource
+        0,                                            // copySourceBucketName
+        0,                                            // copySourceKey
+        0,                                            // getConditions
+        0,                                            // startByte
+        0,                                            // byteCount
+        putProperties ? &properties : 0,              // putProperties
+        &initiateMultipartPropertiesCallback,         // propertiesCallback
+        0,                                            // toS3Callback
+        0,                                            // toS3CallbackTotalSize
+        &initiateMultipartDataCallback,               // fromS3Callback
+        &initiateMultipartCompleteCallback,           // completeCallback
+        data                                          // callbackData
+    };
+
+    // Perform the request
+    request_perform(&params, requestContext);
+}
+
+
+// upload part ---------------------------------------------------------------
+
+// Uploads a part, computing the digests requested by [payloadDigests] of its
+// data if that is non-NULL
+static void upload_part(const S3BucketContext *bucketContext, const char *key,
+                        const char *uploadId, int partNumber,
+                        uint64_t partContentLength,
+                        S3PayloadDigests *payloadDigests,
+                        S3RequestContext *requestContext,
+                        const S3PutObjectHandler *handler, void *callbackData)
+{
+    if ((partNumber < 1) || (partNumber > S3_MULTIPART_MAX_PART_COUNT)) {
+        (*(handler->responseHandler.completeCallback))
+            (S3StatusBadPartNumber, 0, callbackData);
+        return;
+    }
+
+    // The sub resource carries both the part number and the upload ID; they
+    // are in the alphabetical order which signing requires
+    char subResource[MAX_SUB_RESOURCE_SIZE];
+    if (snprintf(subResource, sizeof(subResource), "partNumber=%d&uploadId=%s",
+                 partNumber, uploadId) >= (int) sizeof(subResource)) {
+        (*(handler->responseHandler.completeCallback))
+            (S3StatusUploadIdTooLong, 0, callbackData);
+        return;
+    }
+
+    // Put properties only carry the digests, so that no headers are added
+    S3PutProperties properties;
+    if (payloadDigests) {
+        memset(&properties, 0, sizeof(properties));
+        properties.payloadDigests = payloadDigests;
+    }
+
+    // Set up the RequestParams
+    RequestParams params =
+    {
+        HttpRequestTypePUT,                           // httpRequestType
+        { bucketContext->hostName,                    // hostName
+          bucketContext->bucketName,                  // bucketName
+          bucketContext->protocol,                    // protocol
+          bucketContext->uriStyle,                    // uriStyle
+          bucketContext->accessKeyId,                 // accessKeyId
+          bucketContext->secretAccessKey,             // secretAccessKey
+          bucketContext->signatureVersion,            // signatureVersion
+          bucketContext->authRegion,                  // authRegion
+          bucketContext->preparedBucket },            // preparedBucket
+        key,                                          // key
+        0,                                            // queryParams
+        subResource,                                  // subResource
+        0,                                            // copySourceBucketName
+        0,                                            // copySourceKey
+        0,                                            // getConditions
+        0,                                            // startByte
+        0,                                            // byteCount
+        payloadDigests ? &properties : 0,             // putProperties
+        handler->responseHandler.propertiesCallback,  // propertiesCallback
+        handler->putObjectDataCallback,               // toS3Callback
+        partContentLength,                            // toS3CallbackTotalSize
+        0,                                            // fromS3Callback
+        handler->responseHandler.completeCallback,    // completeCallback
+        callbackData                                  // callbackData
+    };
+
+    // Perform the request
+    request_perform(&params, requestContext);
+}
+
+
+void S3_upload_part(const S3BucketContext *bucketContext, const char *key,
+                    const char *uploadId, int partNumber,
+                    uint64_t partContentLength,
+                    S3RequestContext *requestContext,
+                    const S3PutObjectHandler *handler, void *callbackData)
+{
+    upload_part(bucketContext, key, uploadId, partNumber, partContentLength,
+                0, requestContext, handler, callbackData);
+}
+
+
+// complete multipart upload -------------------------------------------------
+
+typedef struct CompleteMultipartData
+{
+    SimpleXml simpleXml;
+
+    // S3 may send a 200 response whose body is an Error document, if it
+    // fails while assembling the parts; this parses such errors
+    ErrorParser errorParser;
+
+    S3ResponsePropertiesCallback *responsePropertiesCallback;
+    S3ResponseCompleteCallback *responseCompleteCallback;
+    void *callbackData;
+
+    int eTagReturnSize;
+    char *eTagReturn;
+    int eTagReturnLen;
+
+    // The CompleteMultipartUpload document, which is allocated along with
+    // this structure
+    char *xmlDocument;
+    int xmlDocumentLen;
+    int xmlDocumentBytesWritten;
+} CompleteMultipartData;
+
+
+static S3Status completeMultipartXmlCallback(const char *elementPath,
+                                             SimpleXmlPath path,
+                                             const char *data, int dataLen,
+                                             void *callbackData)
+{
+    (void) elementPath;
+
+    CompleteMultipartData *cmData = (CompleteMultipartData *) callbackData;
+
+    if (data && (path == SimpleXmlPathCompleteETag)) {
+        if (cmData->eTagReturnSize && cmData->eTagReturn) {
+            cmData->eTagReturnLen +=
+                snprintf(&(cmData->eTagReturn[cmData->eTagReturnLen]),
+                         cmData->eTagReturnSize - cmData->eTagReturnLen - 1,
+                         "%.*s", dataLen, data);
+            if (cmData->eTagReturnLen >= cmData->eTagReturnSize) {
+                return S3StatusXmlParseFailure;
+            }
+        }
+    }
+
+    return S3StatusOK;
+}
+
+
+static S3Status completeMultipartPropertiesCallback
+    (const S3ResponseProperties *responseProperties, void *callbackData)
+{
+    CompleteMultipartData *cmData = (CompleteMultipartData *) callbackData;
+
+    if (!cmData->responsePropertiesCallback) {
+        return S3StatusOK;
+    }
+
+    return (*(cmData->responsePropertiesCallback))
+        (responseProperties, cmData->callbackData);
+}
+
+
+static int completeMultipartToS3Callback(int bufferSize, char *buffer,
+                                         void *callbackData)
+{
+    CompleteMultipartData *cmData = (CompleteMultipartData *) callbackData;
+
+    int remaining = (cmData->xmlDocumentLen -
+                     cmData->xmlDocumentBytesWritten);
+
+    int toCopy = bufferSize > remaining ? remaining : bufferSize;
+
+    if (!toCopy) {
+        return 0;
+    }
+
+    memcpy(buffer, &(cmData->xmlDocument
+                     [cmData->xmlDocumentBytesWritten]), toCopy);
+
+    cmData->xmlDocumentBytesWritten += toCopy;
+
+    return toCopy;
+}
+
+
+static S3Status completeMultipartFromS3Callback(int bufferSize,
+                                                const char *buffer,
+                                                void *callbackData)
+{
+    CompleteMultipartData *cmData = (CompleteMultipartData *) callbackData;
+
+    S3Status status = error_parser_add(&(cmData->errorParser),
+                                       (char *) buffer, bufferSize);
+    if (status != S3StatusOK) {
+        return status;
+    }
+
+    return simplexml_add(&(cmData->simpleXml), buffer, bufferSize);
+}
+
+
+static void completeMultipartCompleteCallback
+    (S3Status requestStatus, const S3ErrorDetails *s3ErrorDetails,
+     void *callbackData)
+{
+    CompleteMultipartData *cmData = (CompleteMultipartData *) callbackData;
+
+    // Check for an error document in a successful response
+    if (requestStatus == S3StatusOK) {
+        error_parser_convert_status(&(cmData->errorParser), &requestStatus);
+        if (requestStatus != S3StatusOK) {
+            s3ErrorDetails = &(cmData->errorParser.s3ErrorDetails);
+        }
+    }
+
+    (*(cmData->responseCompleteCallback))
+        (requestStatus, s3ErrorDetails, cmData->callbackData);
+
+    error_parser_deinitialize(&(cmData->errorParser));
+
+    simplexml_deinitialize(&(cmData->simpleXml));
+
+    free(cmData);
+}
+
+
+#define COMPLETE_MULTIPART_HEADER "<CompleteMultipartUpload>"
+#define COMPLETE_MULTIPART_PART \
+    "<Part><PartNumber>%d</PartNumber><ETag>%s</ETag></Part>"
+#define COMPLETE_MULTIPART_FOOTER "</CompleteMultipartUpload>"
+
+void S3_complete_multipart_upload(const S3BucketContext *bucketContext,
+                                  const char *key, const char *uploadId,
+                                  int partCount, const char **partETags,
+                                  int eTagReturnSize, char *eTagReturn,
+                                  S3RequestContext *requestContext,
+                                  const S3ResponseHandler *handler,
+                                  void *callbackData)
+{
+    if ((partCount < 1) || (partCount > S3_MULTIPART_MAX_PART_COUNT)) {
+        (*(handler->completeCallback))
+            (S3StatusBadPartNumber, 0, callbackData);
+        return;
+    }
+
+    char subResource[MAX_SUB_RESOURCE_SIZE];
+    if (snprintf(subResource, sizeof(subResource), "uploadId=%s", uploadId)
+        >= (int) sizeof(subResource)) {
+        (*(handler->completeCallback))
+            (S3StatusUploadIdTooLong, 0, callbackData);
+        return;
+    }
+
+    // Size the document; the part format is a bit bigger than a formatted
+    // part, which leaves room for the five digit part number
+    int xmlDocumentSize = (sizeof(COMPLETE_MULTIPART_HEADER) +
+                           sizeof(COMPLETE_MULTIPART_FOOTER));
+    int i;
+    for (i = 0; i < partCount; i++) {
+        xmlDocumentSize += sizeof(COMPLETE_MULTIPART_PART) +
+            strlen(partETags[i]);
+    }
+
+    // Create the callback data, along with the document
+    CompleteMultipartData *data = (CompleteMultipartData *)
+        malloc(sizeof(CompleteMultipartData) + xmlDocumentSize);
+    if (!data) {
+        (*(handler->completeCallback))(S3StatusOutOfMemory, 0, callbackData);
+        return;
+    }
+
+    simplexml_initialize(&(data->simpleXml), &completeMultipartXmlCallback,
+                         data);
+    error_parser_initialize(&(data->errorParser));
+
+    data->responsePropertiesCallback = handler->propertiesCallback;
+    data->responseCompleteCallback = handler->completeCallback;
+    data->callbackData = callbackData;
+
+    data->eTagReturnSize = eTagReturnSize;
+    data->eTagReturn = eTagReturn;
+    if (data->eTagReturnSize && data->eTagReturn) {
+        data->eTagReturn[0] = 0;
+    }
+    data->eTagReturnLen = 0;
+
+    data->xmlDocument = (char *) &(data[1]);
+    data->xmlDocumentLen =
+        sprintf(data->xmlDocument, "%s", COMPLETE_MULTIPART_HEADER);
+    for (i = 0; i < partCount; i++) {
+        data->xmlDocumentLen +=
+            sprintf(&(data->xmlDocument[data->xmlDocumentLen]),
+                    COMPLETE_MULTIPART_PART, i + 1, partETags[i]);
+    }
+    data->xmlDocumentLen +=
+        sprintf(&(data->xmlDocument[data->xmlDocumentLen]), "%s",
+                COMPLETE_MULTIPART_FOOTER);
+    data->xmlDocumentBytesWritten = 0;
+
+    // Set up the RequestParams
+    RequestParams params =
+    {
+        HttpRequestTypePOST,                          // httpRequestType
+        { bucketContext->hostName,                    // hostName
+          bucketContext->bucketName,                  // bucketName
+          bucketContext->protocol,                    // protocol
+          bucketContext->uriStyle,                    // uriStyle
+          bucketContext->accessKeyId,                 // accessKeyId
+          bucketContext->secretAccessKey,             // secretAccessKey
+          bucketContext->signatureVersion,            // signatureVersion
+          bucketContext->authRegion,                  // authRegion
+          bucketContext->preparedBucket },            // preparedBucket
+        key,                                          // key
+        0,                                            // queryParams
+        subResource,                                  // subResource
+        0,                                            // copySourceBucketName
+        0,                                            // copySourceKey
+        0,                                            // getConditions
+        0,                                            // startByte
+        0,                                            // byteCount
+        0,                                            // putProperties
+        &completeMultipartPropertiesCallback,         // propertiesCallback
+        &completeMultipartToS3Callback,               // toS3Callback
+        data->xmlDocumentLen,                         // toS3CallbackTotalSize
+        &completeMultipartFromS3Callback,             // fromS3Callback
+        &completeMultipartCompleteCallback,           // completeCallback
+        data                                          // callbackData
+    };
+
+    // Perform the request
+    request_perform(&params, requestContext);
+}
+
+
+// abort multipart upload ----------------------------------------------------
+
+void S3_abort_multipart_upload(const S3BucketContext *bucketContext,
+                               const char *key, const char *uploadId,
+                               S3RequestContext *requestContext,
+                               const S3ResponseHandler *handler,
+                               void *callbackData)
+{
+    char subResource[MAX_SUB_RESOURCE_SIZE];
+    if (snprintf(subResource, sizeof(subResource), "uploadId=%s", uploadId)
+        >= (int) sizeof(subResource)) {
+        (*(handler->completeCallback))
+            (S3StatusUploadIdTooLong, 0, callbackData);
+        return;
+    }
+
+    // Set up the RequestParams
+    RequestParams params =
+    {
+        HttpRequestTypeDELETE,                        // httpRequestType
+        { bucketContext->hostName,                    // hostName
+          bucketContext->bucketName,                  // bucketName
+          bucketContext->protocol,                    // protocol
+          bucketContext->uriStyle,                    // uriStyle
+          bucketContext->accessKeyId,                 // accessKeyId
+          bucketContext->secretAccessKey,             // secretAccessKey
+          bucketContext->signatureVersion,            // signatureVersion
+          bucketContext->authRegion,                  // authRegion
+          bucketContext->preparedBucket },            // preparedBucket
+        key,                                          // key
+        0,                                            // queryParams
+        subResource,                                  // subResource
+        0,                                            // copySourceBucketName
+        0,                                            // copySourceKey
+        0,                                            // getConditions
+        0,                                            // startByte
+        0,                                            // byteCount
+        0,                                            // putProperties
+        handler->propertiesCallback,                  // propertiesCallback
+        0,                                            // toS3Callback
+        0,                                            // toS3CallbackTotalSize
+        0,                                            // fromS3Callback
+        handler->completeCallback,                    // completeCallback
+        callbackData                                  // callbackData
+    };
+
+    // Perform the request
+    request_perform(&params, requestContext);
+}
+
+
+// put object multipart ------------------------------------------------------
+
+// The managed upload is a small state machine driven by the completion of
+// its requests.  Requests are only ever issued from multipart_advance(), and
+// callbacks only record their results and then call multipart_advance(),
+// which copes with being re-entered by a request which completes (with an
+// error) before request_perform() has returned.
+
+typedef enum
+{
+    MultipartPhaseInitiate,
+    MultipartPhaseParts,
+    MultipartPhaseComplete,
+    MultipartPhaseAbort,
+    MultipartPhaseDone
+} MultipartPhase;
+
+
+typedef struct MultipartUpload MultipartUpload;
+
+// One of the maxConcurrency slots through which parts are uploaded.  When
+// the data comes from a data callback, each slot owns a part-sized buffer
+// which is re-used for every part uploaded through it; when it comes from a
+// file, parts are read from the file as they are sent, and need no buffer.
+typedef struct MultipartSlot
+{
+    MultipartUpload *upload;
+
+    // The part being uploaded through this slot, 0 if the slot is idle
+    int partNumber;
+
+    // Set when the part failed with a retryable error and must be sent again
+    int retryPending;
+
+    int retries;
+
+    char *buffer;
+
+    // The size of buffer, when the upload is of unknown length and so its
+    // parts vary in size
+    uint64_t bufferSize;
+
+    // The offset in the file of the part, when uploading from a file
+    uint64_t fileOffset;
+
+    uint64_t length;
+
+    uint64_t bytesSent;
+
+    char eTag[256];
+
+    // For checking the MD5 of the part against its ETag
+    S3PayloadDigests digests;
+} MultipartSlot;
+
+
+struct MultipartUpload
+{
+    // Copies of the caller's bucket context and key, since requests are
+    // issued long after S3_put_object_multipart() has returned
+    S3BucketContext bucketContext;
+    char *key;
+
+    // The source of the data: either dataCallback, or if that is NULL, the
+    // file open as fd, starting at fileOffset
+    S3PutObjectDataCallback *dataCallback;
+    int fd;
+    uint64_t fileOffset;
+
+    S3ResponsePropertiesCallback *responsePropertiesCallback;
+    S3ResponseCompleteCallback *responseCompleteCallback;
+    void *callbackData;
+
+    S3RequestContext *requestContext;
+
+    MultipartPhase phase;
+
+    // Set while a request of the current phase (other than a part) is in
+    // progress, and when that request must be re-issued
+    int requestActive, requestRetryPending, requestRetries;
+
+    // Set while multipart_advance() is running, and when it must run again
+    int advancing, advanceAgain;
+
+    // contentLength is S3_CONTENT_LENGTH_UNKNOWN if the upload is of data of
+    // unknown length, which is read until the source ends, setting
+    // endOfData; partCount is then the number of parts read so far
+    uint64_t contentLength, bytesRead, partSize;
+
+    int endOfData;
+
+    int maxConcurrency, maxRetries;
+
+    // Set if the MD5 of each part is checked against its ETag
+    int verifyParts;
+
+    // A copy of the caller's put properties, whose strings and meta data
+    // follow the slots, for the initiate request and any retries of it;
+    // hasPutProperties is 0 if there were none
+    S3PutProperties putProperties;
+    int hasPutProperties;
+
+    int partCount, nextPartNumber, partsActive, partsDone;
+
+    // ETags of the uploaded parts, indexed by part number - 1, with room
+    // for partETagsSize of them
+    char **partETags;
+
+    int partETagsSize;
+
+    char uploadId[S3_MAX_UPLOAD_ID_SIZE];
+
+    char eTag[256];
+
+    TransferError error;
+
+    MultipartSlot slots[1];
+};
+
+
+static void multipart_advance(MultipartUpload *mu);
+
+
+static S3Status partPropertiesCallback
+    (const S3ResponseProperties *responseProperties, void *callbackData)
+{
+    MultipartSlot *slot = (MultipartSlot *) callbackData;
+
+    snprintf(slot->eTag, sizeof(slot->eTag), "%s",
+             responseProperties->eTag ? responseProperties->eTag : "");
+
+    return S3StatusOK;
+}
+
+
+static int partDataCallback(int bufferSize, char *buffer, void *callbackData)
+{
+    MultipartSlot *slot = (MultipartSlot *) callbackData;
+
+    uint64_t remaining = slot->length - slot->bytesSent;
+
+    int toCopy = ((remaining > (unsigned) bufferSize) ?
+                  bufferSize : (int) remaining);
+
+    if (slot->buffer) {
+        memcpy(buffer, &(slot->buffer[slot->bytesSent]), toCopy);
+    }
+    else {
+        int ret = transfer_read_fd(slot->upload->fd,
+                                   slot->fileOffset + slot->bytesSent,
+                                   buffer, toCopy);
+        if (ret < toCopy) {
+            transfer_error_set(&(slot->upload->error), (ret < 0) ?
+                               S3StatusAbortedByCallback :
+                               S3StatusErrorIncompleteBody, 0);
+            return -1;
+        }
+    }
+
+    slot->bytesSent += toCopy;
+
+    return toCopy;
+}
+
+
+static void partCompleteCallback(S3Status requestStatus,
+                                 const S3ErrorDetails *s3ErrorDetails,
+                                 void *callbackData)
+{
+    MultipartSlot *slot = (MultipartSlot *) callbackData;
+    MultipartUpload *mu = slot->upload;
+
+    if ((requestStatus == S3StatusOK) && !slot->eTag[0]) {
+        requestStatus = S3StatusInternalError;
+    }
+
+    if (requestStatus == S3StatusOK) {
+        char *eTag = (char *) malloc(strlen(slot->eTag) + 1);
+        if (eTag) {
+            mu->partETags[slot->partNumber - 1] = strcpy(eTag, slot->eTag);
+            mu->partsDone++;
+        }
+        else {
+            transfer_error_set(&(mu->error), S3StatusOutOfMemory, 0);
+        }
+        slot->partNumber = 0;
+    }
+    else if (S3_status_is_retryable(requestStatus) &&
+             (slot->retries < mu->maxRetries) &&
+             (mu->error.status == S3StatusOK)) {
+        slot->retries++;
+        slot->retryPending = 1;
+    }
+    else {
+        transfer_error_set(&(mu->error), requestStatus, s3ErrorDetails);
+        slot->partNumber = 0;
+    }
+
+    mu->partsActive--;
+
+    multipart_advance(mu);
+}
+
+
+static S3Status completePropertiesCallback
+    (const S3ResponseProperties *responseProperties, void *callbackData)
+{
+    (void) responseProperties;
+    (void) callbackData;
+
+    // The properties are reported along with the ETag from the response
+    // document, once it has been parsed
+    return S3StatusOK;
+}
+
+
+static void completeCompleteCallback(S3Status requestStatus,
+                                     const S3ErrorDetails *s3ErrorDetails,
+                                     void *callbackData)
+{
+    MultipartUpload *mu = (MultipartUpload *) callbackData;
+
+    mu->requestActive = 0;
+
+    if ((requestStatus != S3StatusOK) &&
+        S3_status_is_retryable(requestStatus) &&
+        (mu->requestRetries < mu->maxRetries)) {
+        mu->requestRetries++;
+        mu->requestRetryPending = 1;
+    }
+    else if (requestStatus != S3StatusOK) {
+        transfer_error_set(&(mu->error), requestStatus, s3ErrorDetails);
+        mu->phase = MultipartPhaseAbort;
+    }
+    else {
+        if (mu->responsePropertiesCallback) {
+            S3ResponseProperties properties;
+            memset(&properties, 0, sizeof(properties));
+            properties.contentLength = mu->bytesRead;
+            properties.eTag = mu->eTag;
+            properties.lastModified = -1;
+            S3Status status = (*(mu->responsePropertiesCallback))
+                (&properties, mu->callbackData);
+            if (status != S3StatusOK) {
+                transfer_error_set(&(mu->error), status, 0);
+            }
+        }
+        mu->phase = MultipartPhaseDone;
+    }
+
+    multipart_advance(mu);
+}
+
+
+static S3Status initiatePropertiesCallback
+    (const S3ResponseProperties *responseProperties, void *callbackData)
+{
+    (void) responseProperties;
+    (void) callbackData;
+
+    return S3StatusOK;
+}
+
+
+static void initiateCompleteCallback(S3Status requestStatus,
+                                     const S3ErrorDetails *s3ErrorDetails,
+                                     void *callbackData)
+{
+    MultipartUpload *mu = (MultipartUpload *) callbackData;
+
+    mu->requestActive = 0;
+
+    if ((requestStatus != S3StatusOK) &&
+        S3_status_is_retryable(requestStatus) &&
+        (mu->requestRetries < mu->maxRetries)) {
+        mu->requestRetries++;
+        mu->requestRetryPending = 1;
+    }
+    else if (requestStatus != S3StatusOK) {
+        // There is no upload to abort
+        transfer_error_set(&(mu->error), requestStatus, s3ErrorDetails);
+        mu->phase = MultipartPhaseDone;
+    }
+    else {
+        mu->phase = MultipartPhaseParts;
+        mu->requestRetries = 0;
+    }
+
+    multipart_advance(mu);
+}
+
+
+static void abortCompleteCallback(S3Status requestStatus,
+                                  const S3ErrorDetails *s3ErrorDetails,
+                                  void *callbackData)
+{
+    MultipartUpload *mu = (MultipartUpload *) callbackData;
+
+    (void) requestStatus;
+    (void) s3ErrorDetails;
+
+    // The status of the upload is that of the failure which caused the
+    // abort; nothing more can be done if the abort itself fails
+    mu->requestActive = 0;
+    mu->phase = MultipartPhaseDone;
+
+    multipart_advance(mu);
+}
+
+
+static const S3ResponseHandler initiateHandlerG =
+{
+    &initiatePropertiesCallback, &initiateCompleteCallback
+};
+
+
+static const S3PutObjectHandler partHandlerG =
+{
+    { &partPropertiesCallback, &partCompleteCallback },
+    &partDataCallback
+};
+
+
+static const S3ResponseHandler completeHandlerG =
+{
+    &completePropertiesCallback, &completeCompleteCallback
+};
+
+
+static const S3ResponseHandler abortHandlerG =
+{
+    0, &abortCompleteCallback
+};
+
+
+// Parts of uploads of unknown length double in size every this many parts,
+// so that the most parts that S3 allows can hold an object of any size that
+// it accepts, while short streams use small parts
+#define STREAM_PARTS_PER_DOUBLING 1000
+
+// The largest part that S3 accepts
+#define MAX_PART_SIZE (5LL * 1024 * 1024 * 1024)
+
+// Room is first made for the ETags of this many parts of an upload of
+// unknown length
+#define STREAM_INITIAL_PART_ETAGS 64
+
+#define multipart_streaming(mu) \
+    ((mu)->contentLength == S3_CONTENT_LENGTH_UNKNOWN)
+
+
+// Reads the next part of an upload of unknown length into a slot, from the
+// caller or the file, up to the end of the data.  Returns S3StatusOK on
+// success.
+static S3Status multipart_read_stream_part(MultipartUpload *mu,
+                                           MultipartSlot *slot)
+{
+    if (mu->nextPartNumber > S3_MULTIPART_MAX_PART_COUNT) {
+        // Data which ends exactly at the end of the last part is not too
+        // large, so look for one more byte before failing; the upload is
+        // then aborted, so the byte is not needed
+        char byte;
+        int ret = mu->dataCallback ?
+            (*(mu->dataCallback))(1, &byte, mu->callbackData) :
+            transfer_read_fd(mu->fd, mu->fileOffset + mu->bytesRead,
+                             &byte, 1);
+        if (ret < 0) {
+            return S3StatusAbortedByCallback;
+        }
+        else if (ret > 0) {
+            return S3StatusErrorEntityTooLarge;
+        }
+        mu->endOfData = 1;
+        slot->length = 0;
+        return S3StatusOK;
+    }
+
+    uint64_t size = mu->partSize;
+    int doublings = (mu->nextPartNumber - 1) / STREAM_PARTS_PER_DOUBLING;
+    while (doublings-- && (size < MAX_PART_SIZE)) {
+        size *= 2;
+    }
+    if (size > MAX_PART_SIZE) {
+        size = MAX_PART_SIZE;
+    }
+
+    if (slot->bufferSize < size) {
+        free(slot->buffer);
+        slot->bufferSize = 0;
+        if (!(slot->buffer = (char *) malloc(size))) {
+            return S3StatusOutOfMemory;
+        }
+        slot->bufferSize = size;
+    }
+
+    if (mu->nextPartNumber > mu->partETagsSize) {
+        int newSize = mu->partETagsSize * 2;
+        if (newSize > S3_MULTIPART_MAX_PART_COUNT) {
+            newSize = S3_MULTIPART_MAX_PART_COUNT;
+        }
+        char **partETags = 
+            (char **) realloc(mu->partETags, newSize * sizeof(char *));
+        if (!partETags) {
+            return S3StatusOutOfMemory;
+        }
+        memset(&(partETags[mu->partETagsSize]), 0,
+               (newSize - mu->partETagsSize) * sizeof(char *));
+        mu->partETags = partETags;
+        mu->partETagsSize = newSize;
+    }
+
+    uint64_t filled = 0;
+    while (filled < size) {
+        uint64_t toRead = size - filled;
+        if (toRead > (1 << 30)) {
+            toRead = (1 << 30);
+        }
+        int ret = mu->dataCallback ?
+            (*(mu->dataCallback))
+            ((int) toRead, &(slot->buffer[filled]), mu->callbackData) :
+            transfer_read_fd(mu->fd, mu->fileOffset + mu->bytesRead + filled,
+                             &(slot->buffer[filled]), (int) toRead);
+        if (ret < 0) {
+            return S3StatusAbortedByCallback;
+        }
+        else if (ret == 0) {
+            mu->endOfData = 1;
+            break;
+        }
+        filled += ((uint64_t) ret > toRead) ? toRead : (uint64_t) ret;
+    }
+
+    slot->length = filled;
+    mu->bytesRead += filled;
+
+    return S3StatusOK;
+}
+
+
+// Reads the next part from the caller into a slot, or when uploading from a
+// file, just notes where in the file it is.  Returns S3StatusOK on success.
+static S3Status multipart_read_part(MultipartUpload *mu, MultipartSlot *slot)
+{
+    if (multipart_streaming(mu)) {
+        return multipart_read_stream_part(mu, slot);
+    }
+
+    slot->length = mu->contentLength - mu->bytesRead;
+    if (slot->length > mu->partSize) {
+        slot->length = mu->partSize;
+    }
+
+    if (!mu->dataCallback) {
+        slot->fileOffset = mu->fileOffset + mu->bytesRead;
+        mu->bytesRead += slot->length;
+        return S3StatusOK;
+    }
+
+    if (!slot->buffer && !(slot->buffer = (char *) malloc(mu->partSize))) {
+        return S3StatusOutOfMemory;
+    }
+
+    uint64_t filled = 0;
+    while (filled < slot->length) {
+        uint64_t toRead = slot->length - filled;
+        if (toRead > (1 << 30)) {
+            toRead = (1 << 30);
+        }
+        int ret = (*(mu->dataCallback))
+            ((int) toRead, &(slot->buffer[filled]), mu->callbackData);
+        if (ret < 0) {
+            return S3StatusAbortedByCallback;
+        }
+        else if (ret == 0) {
+            // The caller supplied less data than it said it would
+            return S3StatusErrorIncompleteBody;
+        }
+        filled += ((uint64_t) ret > toRead) ? toRead : (uint64_t) ret;
+    }
+
+    mu->bytesRead += slot->length;
+
+    return S3StatusOK;
+}
+
+
+static void multipart_upload_slot(MultipartUpload *mu, MultipartSlot *slot)
+{
+    slot->retryPending = 0;
+    slot->bytesSent = 0;
+    slot->eTag[0] = 0;
+
+    mu->partsActive++;
+
+    slot->digests.digests = S3_DIGEST_MD5;
+
+    upload_part(&(mu->bucketContext), mu->key, mu->uploadId,
+                slot->partNumber, slot->length,
+                mu->verifyParts ? &(slot->digests) : 0, mu->requestContext,
+                &partHandlerG, slot);
+}
+
+
+static void multipart_destroy(MultipartUpload *mu)
+{
+    int i;
+    for (i = 0; i < mu->maxConcurrency; i++) {
+        free(mu->slots[i].buffer);
+    }
+
+    if (mu->partETags) {
+        for (i = 0; i < mu->partETagsSize; i++) {
+            free(mu->partETags[i]);
+        }
+        free(mu->partETags);
+    }
+
+    free(mu);
+}
+
+
+static void multipart_advance(MultipartUpload *mu)
+{
+    if (mu->advancing) {
+        mu->advanceAgain = 1;
+        return;
+    }
+
+    mu->advancing = 1;
+
+    do {
+        mu->advanceAgain = 0;
+
+        // Once the request context is being destroyed, nothing further may
+        // be added to it
+        if (mu->error.status == S3StatusInterrupted) {
+            if (mu->requestActive || mu->partsActive) {
+                continue;
+            }
+            mu->phase = MultipartPhaseDone;
+        }
+
+        switch (mu->phase) {
+        case MultipartPhaseInitiate:
+            if (!mu->requestActive) {
+                mu->requestActive = 1;
+                S3_initiate_multipart(&(mu->bucketContext), mu->key,
+                                      mu->hasPutProperties ?
+                                      &(mu->putProperties) : 0,
+                                      mu->uploadId, mu->requestContext,
+                                      &initiateHandlerG, mu);
+            }
+            break;
+        case MultipartPhaseParts: {
+            int i;
+            if (mu->error.status != S3StatusOK) {
+                // Wait for the parts in progress before aborting
+                if (!mu->partsActive) {
+                    mu->phase = MultipartPhaseAbort;
+                    mu->advanceAgain = 1;
+                }
+                break;
+            }
+            if ((mu->partsDone == mu->partCount) &&
+                (!multipart_streaming(mu) || mu->endOfData)) {
+                mu->phase = MultipartPhaseComplete;
+                mu->advanceAgain = 1;
+                break;
+            }
+            for (i = 0; (i < mu->maxConcurrency) &&
+                     (mu->error.status == S3StatusOK); i++) {
+                MultipartSlot *slot = &(mu->slots[i]);
+                if (slot->retryPending) {
+                    multipart_upload_slot(mu, slot);
+                }
+                else if (!slot->partNumber &&
+                         (multipart_streaming(mu) ? !mu->endOfData :
+                          (mu->nextPartNumber <= mu->partCount))) {
+                    S3Status status = multipart_read_part(mu, slot);
+                    if (status != S3StatusOK) {
+                        transfer_error_set(&(mu->error), status, 0);
+                        mu->advanceAgain = 1;
+                        break;
+                    }
+                    if (multipart_streaming(mu)) {
+                        // Data which ends exactly at the end of a part
+                        // leaves nothing for the next one, which is then
+                        // only uploaded if the data was empty
+                        if (!slot->length && (mu->nextPartNumber > 1)) {
+                            mu->advanceAgain = 1;
+                            break;
+                        }
+                        mu->partCount = mu->nextPartNumber;
+                    }
+                    slot->partNumber = mu->nextPartNumber++;
+                    slot->retries = 0;
+                    multipart_upload_slot(mu, slot);
+                }
+            }
+            break;
+        }
+        case MultipartPhaseComplete:
+            if (!mu->requestActive) {
+                mu->requestActive = 1;
+                mu->requestRetryPending = 0;
+                S3_complete_multipart_upload
+                    (&(mu->bucketContext), mu->key, mu->uploadId,
+                     mu->partCount, (const char **) mu->partETags,
+                     sizeof(mu->eTag), mu->eTag, mu->requestContext,
+                     &completeHandlerG, mu);
+            }
+            break;
+        case MultipartPhaseAbort:
+            if (!mu->requestActive) {
+                mu->requestActive = 1;
+                S3_abort_multipart_upload(&(mu->bucketContext), mu->key,
+                                          mu->uploadId, mu->requestContext,
+                                          &abortHandlerG, mu);
+            }
+            break;
+        default: // MultipartPhaseDone
+            break;
+        }
+    } while (mu->advanceAgain);
+
+    mu->advancing = 0;
+
+    if (mu->phase == MultipartPhaseDone) {
+        (*(mu->responseCompleteCallback))
+            (mu->error.status, transfer_error_details(&(mu->error)),
+             mu->callbackData);
+        multipart_destroy(mu);
+    }
+}
+
+
+#define string_size(str) ((str) ? (strlen(str) + 1) : 0)
+
+// Returns the number of bytes needed by multipart_copy_properties() to copy
+// [putProperties], including its meta data array
+static int multipart_properties_size(const S3PutProperties *putProperties)
+{
+    if (!putProperties) {
+        return 0;
+    }
+
+    int size = (string_size(putProperties->contentType) +
+                string_size(putProperties->md5) +
+                string_size(putProperties->cacheControl) +
+                string_size(putProperties->contentDispositionFilename) +
+                string_size(putProperties->contentEncoding) +
+                (putProperties->metaDataCount * sizeof(S3NameValue)));
+
+    int i;
+    for (i = 0; i < putProperties->metaDataCount; i++) {
+        size += (string_size(putProperties->metaData[i].name) +
+                 string_size(putProperties->metaData[i].value));
+    }
+
+    return size;
+}
+
+
+// Copies [putProperties] into the putProperties of [mu], placing the meta
+// data array and the strings in [buffer], which must be suitably aligned and
+// have multipart_properties_size() bytes.  The payload digests are not kept,
+// since the initiate request sends no data.
+static void multipart_copy_properties(MultipartUpload *mu,
+                                      const S3PutProperties *putProperties,
+                                      char *buffer)
+{
+    if (!putProperties) {
+        return;
+    }
+
+    S3PutProperties *properties = &(mu->putProperties);
+    *properties = *putProperties;
+    properties->payloadDigests = 0;
+    mu->hasPutProperties = 1;
+
+    S3NameValue *metaData = (S3NameValue *) buffer;
+    char *strings = &(buffer[putProperties->metaDataCount *
+                             sizeof(S3NameValue)]);
+
+#define copy_string(dest, src)                                          \
+    do {                                                                \
+        if (src) {                                                      \
+            dest = strcpy(strings, src);                                \
+            strings += (strlen(src) + 1);                               \
+        }                                                               \
+        else {                                                          \
+            dest = 0;                                                   \
+        }                                                               \
+    } while (0)
+
+    copy_string(properties->contentType, putProperties->contentType);
+    copy_string(properties->md5, putProperties->md5);
+    copy_string(properties->cacheControl, putProperties->cacheControl);
+    copy_string(properties->contentDispositionFilename,
+                putProperties->contentDispositionFilename);
+    copy_string(properties->contentEncoding, putProperties->contentEncoding);
+
+    int i;
+    for (i = 0; i < putProperties->metaDataCount; i++) {
+        copy_string(metaData[i].name, putProperties->metaData[i].name);
+        copy_string(metaData[i].value, putProperties->metaData[i].value);
+    }
+    properties->metaData = putProperties->metaDataCount ? metaData : 0;
+
+#undef copy_string
+}
+
+
+// Starts a managed upload whose data comes from [dataCallback], or if that is
+// NULL, from the file open as [fd] starting at [fileOffset]
+static void multipart_start(const S3BucketContext *bucketContext,
+                            const char *key, uint64_t contentLength,
+                            const S3PutProperties *putProperties,
+                            const S3TransferProperties *transferProperties,
+                            S3RequestContext *requestContext,
+                            const S3ResponseHandler *handler,
+                            S3PutObjectDataCallback *dataCallback, int fd,
+                            uint64_t fileOffset, void *callbackData)
+{
+    uint64_t partSize;
+    int maxConcurrency, maxRetries;
+    transfer_get_properties(transferProperties, &partSize, &maxConcurrency,
+                            &maxRetries);
+
+    int streaming = (contentLength == S3_CONTENT_LENGTH_UNKNOWN);
+
+    if (partSize < S3_MULTIPART_MIN_PART_SIZE) {
+        partSize = S3_MULTIPART_MIN_PART_SIZE;
+    }
+    if (!streaming && (((contentLength + partSize - 1) / partSize) >
+                       S3_MULTIPART_MAX_PART_COUNT)) {
+        partSize = ((contentLength + S3_MULTIPART_MAX_PART_COUNT - 1) /
+                    S3_MULTIPART_MAX_PART_COUNT);
+    }
+
+    // An object which fits in one part is just put
+    if (!streaming && (contentLength <= partSize)) {
+        if (dataCallback) {
+            S3PutObjectHandler putObjectHandler =
+                { *handler, dataCallback };
+            S3_put_object(bucketContext, key, contentLength, putProperties,
+                          requestContext, &putObjectHandler, callbackData);
+        }
+        else {
+            S3_put_object_from_fd(bucketContext, key, fd, fileOffset,
+                                  contentLength, putProperties,
+                                  requestContext, handler, callbackData);
+        }
+        return;
+    }
+
+    int partCount = 
+        streaming ? 0 : (int) ((contentLength + partSize - 1) / partSize);
+    if (!streaming && (maxConcurrency > partCount)) {
+        maxConcurrency = partCount;
+    }
+
+    // The upload is allocated along with its slots, a copy of the put
+    // properties, and copies of the strings of the bucket context and the
+    // key
+    int size = (sizeof(MultipartUpload) +
+                ((maxConcurrency - 1) * sizeof(MultipartSlot)));
+    int propertiesSize = multipart_properties_size(putProperties);
+
+    MultipartUpload *mu = (MultipartUpload *)
+        malloc(size + propertiesSize +
+               transfer_target_size(bucketContext, key));
+    if (!mu) {
+        (*(handler->completeCallback))(S3StatusOutOfMemory, 0, callbackData);
+        return;
+    }
+    memset(mu, 0, size);
+
+    multipart_copy_properties(mu, putProperties, &(((char *) mu)[size]));
+    transfer_copy_target(&(mu->bucketContext), &(mu->key), bucketContext,
+                         key, &(((char *) mu)[size + propertiesSize]));
+
+    mu->dataCallback = dataCallback;
+    mu->fd = fd;
+    mu->fileOffset = fileOffset;
+    mu->responsePropertiesCallback = handler->propertiesCallback;
+    mu->responseCompleteCallback = handler->completeCallback;
+    mu->callbackData = callbackData;
+    mu->phase = MultipartPhaseInitiate;
+    mu->contentLength = contentLength;
+    mu->partSize = partSize;
+    mu->maxConcurrency = maxConcurrency;
+    mu->maxRetries = maxRetries;
+    mu->verifyParts = 
+        (putProperties && putProperties->payloadDigests &&
+         (putProperties->payloadDigests->digests & S3_DIGEST_MD5));
+    mu->partCount = partCount;
+    mu->nextPartNumber = 1;
+    transfer_error_initialize(&(mu->error));
+
+    int i;
+    for (i = 0; i < maxConcurrency; i++) {
+        mu->slots[i].upload = mu;
+    }
+
+    mu->partETagsSize = streaming ? STREAM_INITIAL_PART_ETAGS : partCount;
+    if (!(mu->partETags = 
+          (char **) calloc(mu->partETagsSize, sizeof(char *)))) {
+        free(mu);
+        (*(handler->completeCallback))(S3StatusOutOfMemory, 0, callbackData);
+        return;
+    }
+
+    // If there is no request context, run the upload to completion in a
+    // private one
+    S3RequestContext *privateContext = 0;
+    if (!requestContext) {
+        S3Status status = S3_create_request_context(&privateContext);
+        if (status != S3StatusOK) {
+            multipart_destroy(mu);
+            (*(handler->completeCallback))(status, 0, callbackData);
+            return;
+        }
+        requestContext = privateContext;
+    }
+    mu->requestContext = requestContext;
+
+    mu->requestActive = 1;
+    mu->advancing = 1;
+    S3_initiate_multipart(&(mu->bucketContext), mu->key,
+                          mu->hasPutProperties ? &(mu->putProperties) : 0,
+                          mu->uploadId, requestContext, &initiateHandlerG, mu);
+    mu->advancing = 0;
+    if (mu->advanceAgain || (mu->phase == MultipartPhaseDone)) {
+        multipart_advance(mu);
+    }
+
+    if (privateContext) {
+        S3_runall_request_context(privateContext);
+        S3_destroy_request_context(privateContext);
+    }
+}
+
+
+void S3_put_object_multipart(const S3BucketContext *bucketContext,
+                             const char *key, uint64_t contentLength,
+                             const S3PutProperties *putProperties,
+                             const S3TransferProperties *transferProperties,
+                             S3RequestContext *requestContext,
+                             const S3PutObjectHandler *handler,
+                             void *callbackData)
+{
+    multipart_start(bucketContext, key, contentLength, putProperties,
+                    transferProperties, requestContext,
+                    &(handler->responseHandler),
+                    handler->putObjectDataCallback, -1, 0, callbackData);
+}
+
+
+void S3_put_object_multipart_from_fd
+    (const S3BucketContext *bucketContext, const char *key, int fd,
+     uint64_t offset, uint64_t contentLength,
+     const S3PutProperties *putProperties,
+     const S3TransferProperties *transferProperties,
+     S3RequestContext *requestContext, const S3ResponseHandler *handler,
+     void *callbackData)
+{
+    multipart_start(bucketContext, key, contentLength, putProperties,
+                    transferProperties, requestContext, handler, 0, fd,
+                    offset, callbackData);
+}
@@ -28,6 +28,7 @@
 #include <string.h>
 #include "libs3.h"
 #include "request.h"
+#include "transfer.h"
 
 
 // put object ----------------------------------------------------------------
@@ -47,7 +48,10 @@ void S3_put_object(const S3BucketContext *bucketContext, const char *key,
           bucketContext->protocol,                    // protocol
           bucketContext->uriStyle,                    // uriStyle
           bucketContext->accessKeyId,                 // accessKeyId
-          bucketContext->secretAccessKey },           // secretAccessKey
+          bucketContext->secretAccessKey,             // secretAccessKey
+          bucketContext->signatureVersion,            // signatureVersion
+          bucketContext->authRegion,                  // authRegion
+          bucketContext->preparedBucket },            // preparedBucket
         key,                                          // key
         0,                                            // queryParams
         0,                                            // subResource
@@ -70,6 +74,148 @@ void S3_put_object(const S3BucketContext *bucketContext, const char *key,
 }
 
 
+// put object from fd --------------------------------------------------------
+
+typedef struct PutObjectFdData
+{
+    S3ResponsePropertiesCallback *responsePropertiesCallback;
+    S3ResponseCompleteCallback *responseCompleteCallback;
+    void *callbackData;
+
+    int fd;
+
+    // The offset in the file of the next byte to send
+    uint64_t offset;
+
+    uint64_t remaining;
+
+    // Set if the file could not supply the data, which is then reported
+    // instead of the request being aborted by callback
+    S3Status readStatus;
+} PutObjectFdData;
+
+
+static S3Status putObjectFdPropertiesCallback
+    (const S3ResponseProperties *responseProperties, void *callbackData)
+{
+    PutObjectFdData *pofData = (PutObjectFdData *) callbackData;
+    
+    if (pofData->responsePropertiesCallback) {
+        return (*(pofData->responsePropertiesCallback))
+            (responseProperties, pofData->callbackData);
+    }
+
+    return S3StatusOK;
+}
+
+
+// The data is read from the file straight into curl's buffer, rather than
+// through a buffer of our own
+static int putObjectFdDataCallback(int bufferSize, char *buffer,
+                                   void *callbackData)
+{
+    PutObjectFdData *pofData = (PutObjectFdData *) callbackData;
+
+    if ((uint64_t) bufferSize > pofData->remaining) {
+        bufferSize = (int) pofData->remaining;
+    }
+
+    int ret = transfer_read_fd(pofData->fd, pofData->offset, buffer,
+                               bufferSize);
+    if (ret < 0) {
+        pofData->readStatus = S3StatusAbortedByCallback;
+        return -1;
+    }
+    else if (ret < bufferSize) {
+        pofData->readStatus = S3StatusErrorIncompleteBody;
+        return -1;
+    }
+
+    pofData->offset += ret;
+    pofData->remaining -= ret;
+
+    return ret;
+}
+
+
+static void putObjectFdCompleteCallback(S3Status requestStatus, 
+                                        const S3ErrorDetails *s3ErrorDetails,
+                                        void *callbackData)
+{
+    PutObjectFdData *pofData = (PutObjectFdData *) callbackData;
+
+    if (pofData->readStatus != S3StatusOK) {
+        requestStatus = pofData->readStatus;
+        s3ErrorDetails = 0;
+    }
+
+    (*(pofData->responseCompleteCallback))
+        (requestStatus, s3ErrorDetails, pofData->callbackData);
+
+    free(pofData);
+}
+
+
+void S3_put_object_from_fd(const S3BucketContext *bucketContext,
+                           const char *key, int fd, uint64_t offset,
+                           uint64_t contentLength,
+                           const S3PutProperties *putProperties,
+                           S3RequestContext *requestContext,
+                           const S3ResponseHandler *handler,
+                           void *callbackData)
+{
+    // Create the callback data
+    PutObjectFdData *data = 
+        (PutObjectFdData *) malloc(sizeof(PutObjectFdData));
+    if (!data) {
+        (*(handler->completeCallback))(S3StatusOutOfMemory, 0, callbackData);
+        return;
+    }
+
+    data->responsePropertiesCallback = handler->propertiesCallback;
+    data->responseCompleteCallback = handler->completeCallback;
+    data->callbackData = callbackData;
+
+    data->fd = fd;
+    data->offset = offset;
+    data->remaining = contentLength;
+    data->readStatus = S3StatusOK;
+
+    // Set up the RequestParams
+    RequestParams params =
+    {
+        HttpRequestTypePUT,                           // httpRequestType
+        { bucketContext->hostName,                    // hostName
+          bucketContext->bucketName,                  // bucketName
+          bucketContext->protocol,                    // protocol
+          bucketContext->uriStyle,                    // uriStyle
+          bucketContext->accessKeyId,                 // accessKeyId
+          bucketContext->secretAccessKey,             // secretAccessKey
+          bucketContext->signatureVersion,            // signatureVersion
+          bucketContext->authRegion,                  // authRegion
+          bucketContext->preparedBucket },            // preparedBucket
+        key,                                          // key
+        0,                                            // queryParams
+        0,                                            // subResource
+        0,                                            // copySourceBucketName
+        0,                                            // copySourceKey
+        0,                                            // getConditions
+        0,                                            // startByte
+        0,                                            // byteCount
+        putProperties,                                // putProperties
+        &putObjectFdPropertiesCallback,               // propertiesCallback
+        &putObjectFdDataCallback,                     // toS3Callback
+        contentLength,                                // toS3CallbackTotalSize
+        0,                                            // fromS3Callback
+        &putObjectFdCompleteCallback,                 // completeCallback
+        data                                          // callbackData
+    };
+
+    // Perform the request
+    request_perform(&params, requestContext);
+}
+
+
 // copy object ---------------------------------------------------------------
 
 
@@ -91,18 +237,20 @@ typedef struct CopyObjectData
 
 
 static S3Status copyObjectXmlCallback(const char *elementPath,
-                                      const char *data, int dataLen,
-                                      void *callbackData)
+                                      SimpleXmlPath path, const char *data,
+                                      int dataLen, void *callbackData)
 {
+    (void) elementPath;
+
     CopyObjectData *coData = (CopyObjectData *) callbackData;
 
     int fit;
 
     if (data) {
-        if (!strcmp(elementPath, "CopyObjectResult/LastModified")) {
+        if (path == SimpleXmlPathCopyObjectLastModified) {
             string_buffer_append(coData->lastModified, data, dataLen, fit);
         }
-        else if (!strcmp(elementPath, "CopyObjectResult/ETag")) {
+        else if (path == SimpleXmlPathCopyObjectETag) {
             if (coData->eTagReturnSize && coData->eTagReturn) {
                 coData->eTagReturnLen +=
                     snprintf(&(coData->eTagReturn[coData->eTagReturnLen]),
@@ -196,17 +344,31 @@ void S3_copy_object(const S3BucketContext *bucketContext, const char *key,
     data->eTagReturnLen = 0;
     string_buffer_initialize(data->lastModified);
 
+    // The prepared bucket, if any, is that of the source bucket, and so may
+    // only be used to address the destination if it is the same bucket
+    const S3PreparedBucket *preparedBucket = bucketContext->preparedBucket;
+    if (destinationBucket && (!bucketContext->bucketName ||
+                              strcmp(destinationBucket,
+                                     bucketContext->bucketName))) {
+        preparedBucket = 0;
+    }
+    else {
+        destinationBucket = bucketContext->bucketName;
+    }
+
     // Set up the RequestParams
     RequestParams params =
     {
         HttpRequestTypeCOPY,                          // httpRequestType
         { bucketContext->hostName,                    // hostName
-          destinationBucket ? destinationBucket : 
-          bucketContext->bucketName,                  // bucketName
+          destinationBucket,                          // bucketName
           bucketContext->protocol,                    // protocol
           bucketContext->uriStyle,                    // uriStyle
           bucketContext->accessKeyId,                 // accessKeyId
-          bucketContext->secretAccessKey },           // secretAccessKey
+          bucketContext->secretAccessKey,             // secretAccessKey
+          bucketContext->signatureVersion,            // signatureVersion
+          bucketContext->authRegion,                  // authRegion
+          preparedBucket },                           // preparedBucket
         destinationKey ? destinationKey : key,        // key
         0,                                            // queryParams
         0,                                            // subResource
@@ -246,7 +408,10 @@ void S3_get_object(const S3BucketContext *bucketContext, const char *key,
           bucketContext->protocol,                    // protocol
           bucketContext->uriStyle,                    // uriStyle
           bucketContext->accessKeyId,                 // accessKeyId
-          bucketContext->secretAccessKey },           // secretAccessKey
+          bucketContext->secretAccessKey,             // secretAccessKey
+          bucketContext->signatureVersion,            // signatureVersion
+          bucketContext->authRegion,                  // authRegion
+          bucketContext->preparedBucket },            // preparedBucket
         key,                                          // key
         0,                                            // queryParams
         0,                                            // subResource
@@ -269,6 +434,198 @@ void S3_get_object(const S3BucketContext *bucketContext, const char *key,
 }
 
 
+// get object to buffer or fd ------------------------------------------------
+
+typedef struct GetObjectSinkData
+{
+    S3ResponsePropertiesCallback *responsePropertiesCallback;
+    S3ResponseCompleteCallback *responseCompleteCallback;
+    void *callbackData;
+
+    TransferSink sink;
+
+    // The number of bytes received so far, which is the offset of the next
+    // byte in the sink
+    uint64_t received;
+
+    // Set if the sink could not take the data, which is then reported
+    // instead of the request being aborted by callback
+    S3Status sinkStatus;
+} GetObjectSinkData;
+
+
+static S3Status getObjectSinkPropertiesCallback
+    (const S3ResponseProperties *responseProperties, void *callbackData)
+{
+    GetObjectSinkData *gosData = (GetObjectSinkData *) callbackData;
+
+    // Don't start on data which is known not to fit
+    if (gosData->sink.buffer &&
+        (responseProperties->contentLength > gosData->sink.bufferSize)) {
+        gosData->sinkStatus = S3StatusBufferTooSmall;
+        return S3StatusBufferTooSmall;
+    }
+
+    if (gosData->responsePropertiesCallback) {
+        return (*(gosData->responsePropertiesCallback))
+            (responseProperties, gosData->callbackData);
+    }
+
+    return S3StatusOK;
+}
+
+
+static S3Status getObjectSinkDataCallback(int bufferSize, const char *buffer,
+                                          void *callbackData)
+{
+    GetObjectSinkData *gosData = (GetObjectSinkData *) callbackData;
+
+    S3Status status = transfer_sink_write(&(gosData->sink), gosData->received,
+                                          buffer, bufferSize);
+    if (status != S3StatusOK) {
+        gosData->sinkStatus = status;
+        return status;
+    }
+
+    gosData->received += bufferSize;
+
+    return S3StatusOK;
+}
+
+
+static void getObjectSinkCompleteCallback(S3Status requestStatus,
+                                          const S3ErrorDetails *s3ErrorDetails,
+                                          void *callbackData)
+{
+    GetObjectSinkData *gosData = (GetObjectSinkData *) callbackData;
+
+    // Whatever was received is written, even if the request failed
+    S3Status status = transfer_sink_flush(&(gosData->sink));
+    if ((status != S3StatusOK) && (gosData->sinkStatus == S3StatusOK)) {
+        gosData->sinkStatus = status;
+    }
+
+    if (gosData->sinkStatus != S3StatusOK) {
+        requestStatus = gosData->sinkStatus;
+        s3ErrorDetails = 0;
+    }
+
+    (*(gosData->responseCompleteCallback))
+        (requestStatus, s3ErrorDetails, gosData->callbackData);
+
+    transfer_sink_deinitialize(&(gosData->sink));
+
+    free(gosData);
+}
+
+
+static void get_object_to_sink(const S3BucketContext *bucketContext,
+                               const char *key,
+                               const S3GetConditions *getConditions,
+                               uint64_t startByte, uint64_t byteCount,
+                               GetObjectSinkData *data,
+                               S3RequestContext *requestContext,
+                               const S3ResponseHandler *handler,
+                               void *callbackData)
+{
+    data->responsePropertiesCallback = handler->propertiesCallback;
+    data->responseCompleteCallback = handler->completeCallback;
+    data->callbackData = callbackData;
+
+    data->received = 0;
+    data->sinkStatus = S3StatusOK;
+
+    // Set up the RequestParams
+    RequestParams params =
+    {
+        HttpRequestTypeGET,                           // httpRequestType
+        { bucketContext->hostName,                    // hostName
+          bucketContext->bucketName,                  // bucketName
+          bucketContext->protocol,                    // protocol
+          bucketContext->uriStyle,                    // uriStyle
+          bucketContext->accessKeyId,                 // accessKeyId
+          bucketContext->secretAccessKey,             // secretAccessKey
+          bucketContext->signatureVersion,            // signatureVersion
+          bucketContext->authRegion,                  // authRegion
+          bucketContext->preparedBucket },            // preparedBucket
+        key,                                          // key
+        0,                                            // queryParams
+        0,                                            // subResource
+        0,                                            // copySourceBucketName
+        0,                                            // copySourceKey
+        getConditions,                                // getConditions
+        startByte,                                    // startByte
+        byteCount,                                    // byteCount
+        0,                                            // putProperties
+        &getObjectSinkPropertiesCallback,             // propertiesCallback
+        0,                                            // toS3Callback
+        0,                                            // toS3CallbackTotalSize
+        &getObjectSinkDataCallback,                   // fromS3Callback
+        &getObjectSinkCompleteCallback,               // completeCallback
+        data                                          // callbackData
+    };
+
+    // Perform the request
+    request_perform(&params, requestContext);
+}
+
+
+void S3_get_object_to_buffer(const S3BucketContext *bucketContext,
+                             const char *key,
+                             const S3GetConditions *getConditions,
+                             uint64_t startByte, uint64_t byteCount,
+                             uint64_t bufferSize, char *buffer,
+                             S3RequestContext *requestContext,
+                             const S3ResponseHandler *handler,
+                             void *callbackData)
+{
+    // A range which is known not to fit is not even requested
+    if (byteCount > bufferSize) {
+        (*(handler->completeCallback))
+            (S3StatusBufferTooSmall, 0, callbackData);
+        return;
+    }
+
+    // Create the callback data
+    GetObjectSinkData *data = 
+        (GetObjectSinkData *) malloc(sizeof(GetObjectSinkData));
+    if (!data) {
+        (*(handler->completeCallback))(S3StatusOutOfMemory, 0, callbackData);
+        return;
+    }
+
+    transfer_sink_initialize_buffer(&(data->sink), buffer, bufferSize);
+
+    get_object_to_sink(bucketContext, key, getConditions, startByte,
+                       byteCount, data, requestContext, handler,
+                       callbackData);
+}
+
+
+void S3_get_object_to_fd(const S3BucketContext *bucketContext,
+                         const char *key,
+                         const S3GetConditions *getConditions,
+                         uint64_t startByte, uint64_t byteCount, int fd,
+                         uint64_t offset, S3RequestContext *requestContext,
+                         const S3ResponseHandler *handler,
+                         void *callbackData)
+{
+    // Create the callback data
+    GetObjectSinkData *data = 
+        (GetObjectSinkData *) malloc(sizeof(GetObjectSinkData));
+    if (!data) {
+        (*(handler->completeCallback))(S3StatusOutOfMemory, 0, callbackData);
+        return;
+    }
+
+    transfer_sink_initialize_fd(&(data->sink), fd, offset);
+
+    get_object_to_sink(bucketContext, key, getConditions, startByte,
+                       byteCount, data, requestContext, handler,
+                       callbackData);
+}
+
+
 // head object ---------------------------------------------------------------
 
 void S3_head_object(const S3BucketContext *bucketContext, const char *key,
@@ -284,7 +641,10 @@ void S3_head_object(const S3BucketContext *bucketContext, const char *key,
           bucketContext->protocol,                    // protocol
           bucketContext->uriStyle,                    // uriStyle
           bucketContext->accessKeyId,                 // accessKeyId
-          bucketContext->secretAccessKey },           // secretAccessKey
+          bucketContext->secretAccessKey,             // secretAccessKey
+          bucketContext->signatureVersion,            // signatureVersion
+          bucketContext->authRegion,                  // authRegion
+          bucketContext->preparedBucket },            // preparedBucket
         key,                                          // key
         0,                                            // queryParams
         0,                                            // subResource
@@ -322,7 +682,10 @@ void S3_delete_object(const S3BucketContext *bucketContext, const char *key,
           bucketContext->protocol,                    // protocol
           bucketContext->uriStyle,                    // uriStyle
           bucketContext->accessKeyId,                 // accessKeyId
-          bucketContext->secretAccessKey },           // secretAccessKey
+          bucketContext->secretAccessKey,             // secretAccessKey
+          bucketContext->signatureVersion,            // signatureVersion
+          bucketContext->authRegion,                  // authRegion
+          bucketContext->preparedBucket },            // preparedBucket
         key,                                          // key
         0,                                            // queryParams
         0,                                            // subResource
@@ -0,0 +1,608 @@
+/** **************************************************************************
+ * parallel_get.c
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License version 3
+ * along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+#include <stdlib.h>
+#include <string.h>
+#include "libs3.h"
+#include "request.h"
+#include "transfer.h"
+
+
+// The parallel get is a small state machine driven by the completion of its
+// requests, in the same way as the managed multipart upload: requests are
+// only ever issued from parallel_get_advance(), and callbacks only record
+// their results and then call parallel_get_advance().
+
+typedef struct ParallelGet ParallelGet;
+
+// One of the maxConcurrency slots through which ranges are fetched.  When
+// the contents are delivered in order, a slot keeps its range until every
+// byte of it has been delivered, buffering whatever arrives before the range
+// is at the head of the line.  When the contents go to a sink, each slot has
+// its own, so that the writes to a file follow on within a range.
+typedef struct RangeSlot
+{
+    ParallelGet *get;
+
+    // Set while the slot holds a range
+    int active;
+
+    // Set while a request for the range is in progress
+    int requestActive;
+
+    // Set when the range failed with a retryable error and must be resumed
+    int retryPending;
+
+    int retries;
+
+    uint64_t start, length;
+
+    // The number of bytes of the range received, and delivered to the caller
+    uint64_t received, delivered;
+
+    char *buffer;
+
+    TransferSink sink;
+} RangeSlot;
+
+
+struct ParallelGet
+{
+    // Copies of the caller's bucket context, key and get conditions
+    S3BucketContext bucketContext;
+    char *key;
+    S3GetConditions getConditions;
+    int hasGetConditions;
+
+    S3GetObjectDataCallback *dataCallback;
+    S3GetObjectRangeDataCallback *rangeDataCallback;
+    S3ResponsePropertiesCallback *responsePropertiesCallback;
+    S3ResponseCompleteCallback *responseCompleteCallback;
+    void *callbackData;
+
+    // Set if the contents go into the sinks of the slots rather than to
+    // either data callback
+    int toSink;
+
+    S3RequestContext *requestContext;
+
+    // Set until the HEAD has succeeded, and while it is in progress
+    int headPending, headActive, headRetries;
+
+    // Set once the caller has been given the properties of the object
+    int propertiesReported;
+
+    // Set while parallel_get_advance() is running, and when it must run
+    // again
+    int advancing, advanceAgain;
+
+    // Set once the complete callback has been made
+    int done;
+
+    uint64_t contentLength, partSize;
+
+    // The start of the next range to be fetched, and the offset of the next
+    // byte to be delivered in order
+    uint64_t nextStart, deliveredOffset;
+
+    int maxConcurrency, maxRetries, requestsActive;
+
+    char eTag[256];
+
+    TransferError error;
+
+    RangeSlot slots[1];
+};
+
+
+static void parallel_get_advance(ParallelGet *pg);
+
+
+// head ----------------------------------------------------------------------
+
+static S3Status headPropertiesCallback
+    (const S3ResponseProperties *responseProperties, void *callbackData)
+{
+    ParallelGet *pg = (ParallelGet *) callbackData;
+
+    pg->contentLength = responseProperties->contentLength;
+
+    // Every slot has a copy of the same buffer
+    if (pg->toSink && pg->slots[0].sink.buffer &&
+        (pg->contentLength > pg->slots[0].sink.bufferSize)) {
+        return S3StatusBufferTooSmall;
+    }
+
+    snprintf(pg->eTag, sizeof(pg->eTag), "%s",
+             responseProperties->eTag ? responseProperties->eTag : "");
+
+    if (pg->propertiesReported || !pg->responsePropertiesCallback) {
+        return S3StatusOK;
+    }
+
+    pg->propertiesReported = 1;
+
+    return (*(pg->responsePropertiesCallback))
+        (responseProperties, pg->callbackData);
+}
+
+
+static void headCompleteCallback(S3Status requestStatus,
+                                 const S3ErrorDetails *s3ErrorDetails,
+                                 void *callbackData)
+{
+    ParallelGet *pg = (ParallelGet *) callbackData;
+
+    pg->headActive = 0;
+    pg->requestsActive--;
+
+    if (requestStatus == S3StatusOK) {
+        pg->headPending = 0;
+    }
+    else if (!S3_status_is_retryable(requestStatus) ||
+             (pg->headRetries++ == pg->maxRetries)) {
+        transfer_error_set(&(pg->error), requestStatus, s3ErrorDetails);
+    }
+
+    parallel_get_advance(pg);
+}
+
+
+static void parallel_get_head(ParallelGet *pg)
+{
+    pg->headActive = 1;
+    pg->requestsActive++;
+
+    // Set up the RequestParams
+    RequestParams params =
+    {
+        HttpRequestTypeHEAD,                          // httpRequestType
+        { pg->bucketContext.hostName,                 // hostName
+          pg->bucketContext.bucketName,               // bucketName
+          pg->bucketContext.protocol,                 // protocol
+          pg->bucketContext.uriStyle,                 // uriStyle
+          pg->bucketContext.accessKeyId,              // accessKeyId
+          pg->bucketContext.secretAccessKey,          // secretAccessKey
+          pg->bucketContext.signatureVersion,         // signatureVersion
+          pg->bucketContext.authRegion,               // authRegion
+          pg->bucketContext.preparedBucket },         // preparedBucket
+        pg->key,                                      // key
+        0,                                            // queryParams
+        0,                                            // subResource
+        0,                                            // copySourceBucketName
+        0,                                            // copySourceKey
+        pg->hasGetConditions ? &(pg->getConditions) : 0, // getConditions
+        0,                                            // startByte
+        0,                                            // byteCount
+        0,                                            // putProperties
+        &headPropertiesCallback,                      // propertiesCallback
+        0,                                            // toS3Callback
+        0,                                            // toS3CallbackTotalSize
+        0,                                            // fromS3Callback
+        &headCompleteCallback,                        // completeCallback
+        pg                                            // callbackData
+    };
+
+    // Perform the request
+    request_perform(&params, pg->requestContext);
+}
+
+
+// ranges --------------------------------------------------------------------
+
+static S3Status rangeDataCallback(int bufferSize, const char *buffer,
+                                  void *callbackData)
+{
+    RangeSlot *slot = (RangeSlot *) callbackData;
+    ParallelGet *pg = slot->get;
+
+    // Guard against a server which ignores the Range header
+    if ((slot->received + bufferSize) > slot->length) {
+        return S3StatusErrorInvalidRange;
+    }
+
+    S3Status status = S3StatusOK;
+
+    if (pg->toSink) {
+        status = transfer_sink_write(&(slot->sink),
+                                     slot->start + slot->received, buffer,
+                                     bufferSize);
+        slot->delivered += bufferSize;
+    }
+    else if (pg->rangeDataCallback) {
+        status = (*(pg->rangeDataCallback))
+            (slot->start + slot->received, bufferSize, buffer,
+             pg->callbackData);
+        slot->delivered += bufferSize;
+    }
+    else if (((slot->start + slot->delivered) == pg->deliveredOffset) &&
+             (slot->delivered == slot->received)) {
+        // This range is at the head of the line and has nothing buffered, so
+        // the data can go straight to the caller
+        status = (*(pg->dataCallback))(bufferSize, buffer, pg->callbackData);
+        slot->delivered += bufferSize;
+        pg->deliveredOffset += bufferSize;
+    }
+    else {
+        if (!slot->buffer &&
+            !(slot->buffer = (char *) malloc(pg->partSize))) {
+            return S3StatusOutOfMemory;
+        }
+        memcpy(&(slot->buffer[slot->received]), buffer, bufferSize);
+    }
+
+    slot->received += bufferSize;
+
+    return status;
+}
+
+
+static void rangeCompleteCallback(S3Status requestStatus,
+                                  const S3ErrorDetails *s3ErrorDetails,
+                                  void *callbackData)
+{
+    RangeSlot *slot = (RangeSlot *) callbackData;
+    ParallelGet *pg = slot->get;
+
+    slot->requestActive = 0;
+    pg->requestsActive--;
+
+    if ((requestStatus == S3StatusOK) && (slot->received != slot->length)) {
+        requestStatus = S3StatusErrorIncompleteBody;
+    }
+
+    // Whatever was received must be in the file before the range is
+    // resumed, or the slot moves on to another range
+    if (pg->toSink) {
+        S3Status status = transfer_sink_flush(&(slot->sink));
+        if (status != S3StatusOK) {
+            requestStatus = status;
+            s3ErrorDetails = 0;
+        }
+    }
+
+    if (requestStatus == S3StatusOK) {
+        // In order, the slot is released once its data has been delivered
+        if (!pg->dataCallback) {
+            slot->active = 0;
+        }
+    }
+    else if (S3_status_is_retryable(requestStatus) &&
+             (slot->retries < pg->maxRetries) &&
+             (pg->error.status == S3StatusOK)) {
+        slot->retries++;
+        slot->retryPending = 1;
+    }
+    else {
+        transfer_error_set(&(pg->error), requestStatus, s3ErrorDetails);
+    }
+
+    parallel_get_advance(pg);
+}
+
+
+static const S3GetObjectHandler rangeHandlerG =
+{
+    { 0, &rangeCompleteCallback },
+    &rangeDataCallback
+};
+
+
+// Fetches whatever of the range of [slot] has not yet been received
+static void parallel_get_range(ParallelGet *pg, RangeSlot *slot)
+{
+    slot->requestActive = 1;
+    slot->retryPending = 0;
+    pg->requestsActive++;
+
+    // Every range must come from the object that was HEADed
+    S3GetConditions getConditions =
+    {
+        -1,                                           // ifModifiedSince
+        -1,                                           // ifNotModifiedSince
+        pg->eTag[0] ? pg->eTag : 0,                   // ifMatchETag
+        0                                             // ifNotMatchETag
+    };
+
+    S3_get_object(&(pg->bucketContext), pg->key, &getConditions,
+                  slot->start + slot->received, slot->length - slot->received,
+                  pg->requestContext, &rangeHandlerG, slot);
+}
+
+
+// Delivers, in order, the buffered data of the range at the head of the line
+// and releases the slots of fully delivered ranges.  Returns nonzero if
+// anything was done.
+static int parallel_get_deliver(ParallelGet *pg)
+{
+    int progress = 0, i;
+
+    for (i = 0; i < pg->maxConcurrency; i++) {
+        RangeSlot *slot = &(pg->slots[i]);
+        if (!slot->active) {
+            continue;
+        }
+        if (((slot->start + slot->delivered) == pg->deliveredOffset) &&
+            (slot->delivered < slot->received)) {
+            // The buffered data is delivered in chunks that fit in an int
+            uint64_t count = slot->received - slot->delivered;
+            if (count > (1 << 30)) {
+                count = (1 << 30);
+            }
+            S3Status status = (*(pg->dataCallback))
+                ((int) count, &(slot->buffer[slot->delivered]),
+                 pg->callbackData);
+            if (status != S3StatusOK) {
+                transfer_error_set(&(pg->error), status, 0);
+                return 1;
+            }
+            slot->delivered += count;
+            pg->deliveredOffset += count;
+            progress = 1;
+        }
+        if ((slot->delivered == slot->length) && !slot->requestActive) {
+            slot->active = 0;
+            progress = 1;
+        }
+    }
+
+    return progress;
+}
+
+
+static void parallel_get_destroy(ParallelGet *pg)
+{
+    int i;
+    for (i = 0; i < pg->maxConcurrency; i++) {
+        free(pg->slots[i].buffer);
+        transfer_sink_deinitialize(&(pg->slots[i].sink));
+    }
+
+    free(pg);
+}
+
+
+static void parallel_get_advance(ParallelGet *pg)
+{
+    if (pg->advancing) {
+        pg->advanceAgain = 1;
+        return;
+    }
+
+    pg->advancing = 1;
+
+    do {
+        pg->advanceAgain = 0;
+
+        if (pg->error.status != S3StatusOK) {
+            // Wait for the requests in progress, and then report the failure
+            if (!pg->requestsActive) {
+                pg->done = 1;
+            }
+            break;
+        }
+
+        if (pg->headPending) {
+            if (!pg->headActive) {
+                parallel_get_head(pg);
+            }
+            continue;
+        }
+
+        if (pg->dataCallback) {
+            while ((pg->error.status == S3StatusOK) &&
+                   parallel_get_deliver(pg)) {
+            }
+            if (pg->error.status != S3StatusOK) {
+                pg->advanceAgain = 1;
+                continue;
+            }
+        }
+
+        int i, idle = 1;
+        for (i = 0; (i < pg->maxConcurrency) &&
+                 (pg->error.status == S3StatusOK); i++) {
+            RangeSlot *slot = &(pg->slots[i]);
+            if (slot->retryPending) {
+                parallel_get_range(pg, slot);
+            }
+            else if (!slot->active && (pg->nextStart < pg->contentLength)) {
+                slot->active = 1;
+                slot->retries = 0;
+                slot->start = pg->nextStart;
+                slot->length = pg->contentLength - pg->nextStart;
+                if (slot->length > pg->partSize) {
+                    slot->length = pg->partSize;
+                }
+                slot->received = slot->delivered = 0;
+                pg->nextStart += slot->length;
+                parallel_get_range(pg, slot);
+            }
+            if (slot->active) {
+                idle = 0;
+            }
+        }
+
+        if (idle && (pg->nextStart == pg->contentLength)) {
+            pg->done = 1;
+        }
+    } while (pg->advanceAgain && !pg->done);
+
+    pg->advancing = 0;
+
+    if (pg->done) {
+        (*(pg->responseCompleteCallback))
+            (pg->error.status, transfer_error_details(&(pg->error)),
+             pg->callbackData);
+        parallel_get_destroy(pg);
+    }
+}
+
+
+// Starts a parallel get which delivers the contents to [dataCallback] or
+// [rangeCallback], or to a copy of [sink] in each slot if [sink] is
+// non-NULL
+static void parallel_get_start
+    (const S3BucketContext *bucketContext, const char *key,
+     const S3GetConditions *getConditions,
+     const S3TransferProperties *transferProperties,
+     S3RequestContext *requestContext,
+     S3GetObjectDataCallback *dataCallback,
+     S3GetObjectRangeDataCallback *rangeCallback,
+     const TransferSink *sink, const S3ResponseHandler *handler,
+     void *callbackData)
+{
+    uint64_t partSize;
+    int maxConcurrency, maxRetries;
+    transfer_get_properties(transferProperties, &partSize, &maxConcurrency,
+                            &maxRetries);
+
+    // The get is allocated along with its slots and copies of the strings of
+    // the bucket context, the key and the get conditions
+    int size = (sizeof(ParallelGet) +
+                ((maxConcurrency - 1) * sizeof(RangeSlot)));
+    int stringsSize = transfer_target_size(bucketContext, key);
+    if (getConditions) {
+        if (getConditions->ifMatchETag) {
+            stringsSize += strlen(getConditions->ifMatchETag) + 1;
+        }
+        if (getConditions->ifNotMatchETag) {
+            stringsSize += strlen(getConditions->ifNotMatchETag) + 1;
+        }
+    }
+
+    ParallelGet *pg = (ParallelGet *) malloc(size + stringsSize);
+    if (!pg) {
+        (*(handler->completeCallback))(S3StatusOutOfMemory, 0, callbackData);
+        return;
+    }
+    memset(pg, 0, size);
+
+    char *strings = &(((char *) pg)[size]);
+    transfer_copy_target(&(pg->bucketContext), &(pg->key), bucketContext,
+                         key, strings);
+    strings += transfer_target_size(bucketContext, key);
+
+    if (getConditions) {
+        pg->hasGetConditions = 1;
+        pg->getConditions = *getConditions;
+        if (getConditions->ifMatchETag) {
+            pg->getConditions.ifMatchETag =
+                strcpy(strings, getConditions->ifMatchETag);
+            strings += strlen(getConditions->ifMatchETag) + 1;
+        }
+        if (getConditions->ifNotMatchETag) {
+            pg->getConditions.ifNotMatchETag =
+                strcpy(strings, getConditions->ifNotMatchETag);
+        }
+    }
+
+    pg->dataCallback = dataCallback;
+    pg->rangeDataCallback = rangeCallback;
+    pg->responsePropertiesCallback = handler->propertiesCallback;
+    pg->responseCompleteCallback = handler->completeCallback;
+    pg->callbackData = callbackData;
+    pg->toSink = (sink != 0);
+    pg->headPending = 1;
+    pg->partSize = partSize;
+    pg->maxConcurrency = maxConcurrency;
+    pg->maxRetries = maxRetries;
+    transfer_error_initialize(&(pg->error));
+
+    int i;
+    for (i = 0; i < maxConcurrency; i++) {
+        pg->slots[i].get = pg;
+        if (sink) {
+            pg->slots[i].sink = *sink;
+        }
+    }
+
+    // If there is no request context, run the get to completion in a
+    // private one
+    S3RequestContext *privateContext = 0;
+    if (!requestContext) {
+        S3Status status = S3_create_request_context(&privateContext);
+        if (status != S3StatusOK) {
+            parallel_get_destroy(pg);
+            (*(handler->completeCallback))(status, 0, callbackData);
+            return;
+        }
+        requestContext = privateContext;
+    }
+    pg->requestContext = requestContext;
+
+    parallel_get_advance(pg);
+
+    if (privateContext) {
+        S3_runall_request_context(privateContext);
+        S3_destroy_request_context(privateContext);
+    }
+}
+
+
+void S3_get_object_parallel(const S3BucketContext *bucketContext,
+                            const char *key,
+                            const S3GetConditions *getConditions,
+                            const S3TransferProperties *transferProperties,
+                            S3RequestContext *requestContext,
+                            const S3GetObjectParallelHandler *handler,
+                            void *callbackData)
+{
+    parallel_get_start(bucketContext, key, getConditions, transferProperties,
+                       requestContext, handler->getObjectDataCallback,
+                       handler->getObjectRangeDataCallback, 0,
+                       &(handler->responseHandler), callbackData);
+}
+
+
+void S3_get_object_parallel_to_buffer
+    (const S3BucketContext *bucketContext, const char *key,
+     const S3GetConditions *getConditions,
+     const S3TransferProperties *transferProperties, uint64_t bufferSize,
+     char *buffer, S3RequestContext *requestContext,
+     const S3ResponseHandler *handler, void *callbackData)
+{
+    TransferSink sink;
+    transfer_sink_initialize_buffer(&sink, buffer, bufferSize);
+
+    parallel_get_start(bucketContext, key, getConditions, transferProperties,
+                       requestContext, 0, 0, &sink, handler, callbackData);
+}
+
+
+void S3_get_object_parallel_to_fd
+    (const S3BucketContext *bucketContext, const char *key,
+     const S3GetConditions *getConditions,
+     const S3TransferProperties *transferProperties, int fd, uint64_t offset,
+     S3RequestContext *requestContext, const S3ResponseHandler *handler,
+     void *callbackData)
+{
+    TransferSink sink;
+    transfer_sink_initialize_fd(&sink, fd, offset);
+
+    parallel_get_start(bucketContext, key, getConditions, transferProperties,
+                       requestContext, 0, 0, &sink, handler, callbackData);
+}
@@ -0,0 +1,239 @@
+/** **************************************************************************
+ * presign.c
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License version 3
+ * along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libs3.h"
+#include "request.h"
+
+// The number of keys that a thread claims at a time
+#define PRESIGN_CLAIM_KEYS 64
+
+// The most tasks that a batch submits to an S3WorkerPool; tasks beyond the
+// pool's thread count just find no keys left
+#define PRESIGN_MAX_TASKS 64
+
+
+// A batch of query strings being generated, which the calling thread and any
+// tasks submitted to an S3WorkerPool share.  Tasks may still be queued after
+// every key has been done, so the batch is freed by whichever of them and
+// the calling thread is last done with it.
+typedef struct PresignBatch
+{
+    RequestPresigner presigner;
+
+    const char **keys;
+
+    int keyCount;
+
+    char **queryStrings;
+
+    char *arena;
+
+    uint64_t arenaSize;
+
+    // The following are updated atomically
+
+    // The index of the next key to be claimed
+    int nextKey;
+
+    // The number of bytes of the arena in use
+    uint64_t arenaUsed;
+
+    // The status of the first key that failed, else S3StatusOK
+    S3Status status;
+
+    // The following are protected by mutex
+
+    pthread_mutex_t mutex;
+
+    // Signalled when running drops to 0
+    pthread_cond_t idleCond;
+
+    // The number of tasks generating query strings
+    int running;
+
+    // The number of tasks which have been submitted and not yet run, plus 1
+    // for the calling thread until it returns
+    int references;
+} PresignBatch;
+
+
+// Claims and generates query strings until every key has been claimed
+static void presign_keys(PresignBatch *batch)
+{
+    char buffer[S3_MAX_AUTHENTICATED_QUERY_STRING_SIZE];
+
+    while (1) {
+        int i = __atomic_fetch_add(&(batch->nextKey), PRESIGN_CLAIM_KEYS,
+                                   __ATOMIC_RELAXED);
+        if (i >= batch->keyCount) {
+            return;
+        }
+        int end = i + PRESIGN_CLAIM_KEYS;
+        if (end > batch->keyCount) {
+            end = batch->keyCount;
+        }
+
+        for (; i < end; i++) {
+            int len;
+            batch->queryStrings[i] = 0;
+            S3Status status = request_presign
+                (&(batch->presigner), batch->keys[i], buffer, sizeof(buffer),
+                 &len);
+            if (status == S3StatusOK) {
+                // Space is only reserved if it fits, so that arenaUsed never
+                // passes arenaSize and shorter query strings may still fit
+                uint64_t offset = __atomic_load_n(&(batch->arenaUsed),
+                                                  __ATOMIC_RELAXED);
+                while (((offset + len + 1) <= batch->arenaSize) &&
+                       !__atomic_compare_exchange_n
+                       (&(batch->arenaUsed), &offset, offset + len + 1, 1,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                }
+                if ((offset + len + 1) <= batch->arenaSize) {
+                    memcpy(&(batch->arena[offset]), buffer, len + 1);
+                    batch->queryStrings[i] = &(batch->arena[offset]);
+                    continue;
+                }
+                status = S3StatusBufferTooSmall;
+            }
+            S3Status ok = S3StatusOK;
+            __atomic_compare_exchange_n(&(batch->status), &ok, status, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+
+// Drops a reference to [batch], with its mutex locked, freeing it if that
+// was the last one
+static void presign_release(PresignBatch *batch)
+{
+    int references = --(batch->references);
+
+    pthread_mutex_unlock(&(batch->mutex));
+
+    if (!references) {
+        pthread_mutex_destroy(&(batch->mutex));
+        pthread_cond_destroy(&(batch->idleCond));
+        free(batch);
+    }
+}
+
+
+static void presign_task(S3RequestContext *requestContext, void *data)
+{
+    (void) requestContext;
+
+    PresignBatch *batch = (PresignBatch *) data;
+
+    pthread_mutex_lock(&(batch->mutex));
+
+    // Once every key has been claimed, the calling thread may already have
+    // returned, so this task has nothing to do but let go of the batch
+    if (__atomic_load_n(&(batch->nextKey), __ATOMIC_RELAXED) <
+        batch->keyCount) {
+        batch->running++;
+        pthread_mutex_unlock(&(batch->mutex));
+
+        presign_keys(batch);
+
+        pthread_mutex_lock(&(batch->mutex));
+        if (!--(batch->running)) {
+            pthread_cond_broadcast(&(batch->idleCond));
+        }
+    }
+
+    presign_release(batch);
+}
+
+
+S3Status S3_generate_authenticated_query_strings
+    (char *arena, uint64_t arenaSize, char **queryStringsReturn,
+     const S3BucketContext *bucketContext, int keyCount, const char **keys,
+     int64_t expires, const char *resource, S3WorkerPool *workerPool)
+{
+    PresignBatch *batch = (PresignBatch *) malloc(sizeof(PresignBatch));
+    if (!batch) {
+        return S3StatusOutOfMemory;
+    }
+
+    S3Status status = request_presigner_initialize
+        (&(batch->presigner), bucketContext, expires, resource);
+    if (status != S3StatusOK) {
+        free(batch);
+        return status;
+    }
+
+    batch->keys = keys;
+    batch->keyCount = keyCount;
+    batch->queryStrings = queryStringsReturn;
+    batch->arena = arena;
+    batch->arenaSize = arenaSize;
+    batch->nextKey = 0;
+    batch->arenaUsed = 0;
+    batch->status = S3StatusOK;
+    pthread_mutex_init(&(batch->mutex), 0);
+    pthread_cond_init(&(batch->idleCond), 0);
+    batch->running = 0;
+    batch->references = 1;
+
+    if (workerPool) {
+        // The calling thread takes a share of the keys too
+        int tasks = ((keyCount + PRESIGN_CLAIM_KEYS - 1) /
+                     PRESIGN_CLAIM_KEYS) - 1;
+        if (tasks > PRESIGN_MAX_TASKS) {
+            tasks = PRESIGN_MAX_TASKS;
+        }
+        while (tasks-- > 0) {
+            pthread_mutex_lock(&(batch->mutex));
+            batch->references++;
+            pthread_mutex_unlock(&(batch->mutex));
+            if (S3_submit_worker_pool_task(workerPool, &presign_task, batch)
+                != S3StatusOK) {
+                // Fewer threads will do; the caller does whatever is left
+                pthread_mutex_lock(&(batch->mutex));
+                batch->references--;
+                pthread_mutex_unlock(&(batch->mutex));
+                break;
+            }
+        }
+    }
+
+    presign_keys(batch);
+
+    // Every key has been claimed; wait for those claimed by tasks
+    pthread_mutex_lock(&(batch->mutex));
+    while (batch->running) {
+        pthread_cond_wait(&(batch->idleCond), &(batch->mutex));
+    }
+    status = batch->status;
+    presign_release(batch);
+
+    return status;
+}
@@ -32,37 +32,164 @@
 #include "request.h"
 #include "request_context.h"
 #include "response_headers_handler.h"
+#include "transfer.h"
 #include "util.h"
 
 
 #define USER_AGENT_SIZE 256
-#define REQUEST_STACK_SIZE 32
+#define DEFAULT_REQUEST_THREAD_CACHE_SIZE 4
+#define DEFAULT_REQUEST_SHARED_CACHE_SIZE 32
 
 static char userAgentG[USER_AGENT_SIZE];
 
-static pthread_mutex_t requestStackMutexG;
+// Requests which have completed are kept for re-use, along with their curl
+// handles and thus their connections.  Each thread keeps a few in a cache of
+// its own, which it can use without any locking; the rest go to a lock-free
+// cache shared by all threads, and if that is full, are destroyed.
 
-static Request *requestStackG[REQUEST_STACK_SIZE];
+// The sizes of the caches, as set by S3_set_request_cache_size; these take
+// effect at the next S3_initialize
+static int requestThreadCacheSizeG = DEFAULT_REQUEST_THREAD_CACHE_SIZE;
 
-static int requestStackCountG;
+static int requestSharedCacheSizeG = DEFAULT_REQUEST_SHARED_CACHE_SIZE;
+
+// Secret access keys of up to this many characters have their signing keys
+// cached
+#define REQUEST_SIGNING_SECRET_SIZE 128
+
+// The hash of an empty payload, for Signature Version 4
+#define EMPTY_PAYLOAD_SHA256 \
+    "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"
+
+// The cache of a single thread, which is only ever touched by that thread
+// except when S3_deinitialize destroys it.  Besides requests, it keeps the
+// signing key of the secret access key that the thread last signed with,
+// since a thread usually signs every request with the same one.
+typedef struct RequestThreadCache
+{
+    // All thread caches are kept on a list, so that S3_deinitialize can
+    // destroy the requests in the caches of threads which are still running
+    struct RequestThreadCache *prev, *next;
+
+    // Set once signingSecret and signingKey have been filled in
+    int hasSigningKey;
+
+    char signingSecret[REQUEST_SIGNING_SECRET_SIZE];
+
+    HMACSHA1Key signingKey;
+
+    // Likewise for Signature Version 4, whose signing key is derived from
+    // the secret access key, the date and the region, and so changes at most
+    // once a day
+    int hasV4SigningKey;
+
+    char v4SigningSecret[REQUEST_SIGNING_SECRET_SIZE];
+
+    char v4SigningDate[9];
+
+    char v4SigningRegion[S3_MAX_AUTH_REGION_SIZE];
+
+    HMACSHA256Key v4SigningKey;
+
+    int count;
+
+    Request *requests[1];
+} RequestThreadCache;
+
+// Holds the RequestThreadCache of each thread
+static pthread_key_t requestThreadCacheKeyG;
+
+// The size of each RequestThreadCache, fixed at S3_initialize time
+static int requestThreadCacheSizeInUseG;
+
+// Protects the list of thread caches; only taken when a thread creates or
+// destroys its cache
+static pthread_mutex_t requestThreadCachesMutexG;
+
+static RequestThreadCache *requestThreadCachesG;
+
+// The shared cache is a bounded multi-producer, multi-consumer queue.  Each
+// slot has a sequence number which tells producers and consumers, for the
+// position that they have claimed, whether the slot is ready for them yet.
+typedef struct RequestCacheSlot
+{
+    unsigned long sequence;
+
+    Request *request;
+} RequestCacheSlot;
+
+static RequestCacheSlot *requestSharedCacheG;
+
+// The size of requestSharedCacheG, which is a power of 2, minus 1; or -1 if
+// there is no shared cache
+static long requestSharedCacheMaskG;
+
+// The positions at which the next request will be put into and taken from
+// the shared cache.  These are kept on separate cache lines so that
+// producers and consumers do not contend.
+static struct
+{
+    unsigned long position;
+
+    char pad[64 - sizeof(unsigned long)];
+} requestSharedCachePutG, requestSharedCacheTakeG;
+
+// Connection re-use statistics, updated atomically
+static uint64_t requestCountG, connectionReuseCountG;
+
+// Every curl handle is attached to this share, so that DNS lookups and TLS
+// sessions are shared by all requests, whichever thread or request context
+// performs them.  The connection cache is not shared, because libcurl does
+// not support sharing connections between threads; the handles of a request
+// context already share connections through its curl multi.
+static CURLSH *curlShareG;
+
+// One mutex for each kind of data in the share
+static pthread_mutex_t curlShareMutexesG[CURL_LOCK_DATA_LAST];
 
 char defaultHostNameG[S3_MAX_HOSTNAME_SIZE];
 
+// The signature version and region, as set by
+// S3_set_default_signature_version, of requests which do not give their own
+static S3SignatureVersion defaultSignatureVersionG = S3SignatureV2;
+
+static char defaultAuthRegionG[S3_MAX_AUTH_REGION_SIZE] = "us-east-1";
+
+// The most query string parameters that a request signed with Signature
+// Version 4 may have
+#define REQUEST_MAX_QUERY_PARAMS 64
+
 
 typedef struct RequestComputedValues
 {
+    // The signature version that the request is signed with, and for
+    // Signature Version 4, the region it is signed for
+    S3SignatureVersion signatureVersion;
+
+    const char *authRegion;
+
+    // The S3PreparedBucket of the bucket context, if it has one
+    const S3PreparedBucket *preparedBucket;
+
+    // The time of the request in the ISO 8601 basic format of Signature
+    // Version 4, which is also the value of its x-amz-date header
+    char amzDate[17];
+
     // All x-amz- headers, in normalized form (i.e. NAME: VALUE, no other ws)
-    char *amzHeaders[S3_MAX_METADATA_COUNT + 2]; // + 2 for acl and date
+    // (+ 6 for acl, server-side encryption, date, content-sha256,
+    // copy-source and metadata-directive)
+    char *amzHeaders[S3_MAX_METADATA_COUNT + 6];
 
     // The number of x-amz- headers
     int amzHeadersCount;
 
-    // Storage for amzHeaders (the +256 is for x-amz-acl and x-amz-date)
-    char amzHeadersRaw[COMPACTED_METADATA_BUFFER_SIZE + 256 + 1];
+    // Storage for amzHeaders (the +512 is for the headers other than
+    // x-amz-meta-)
+    char amzHeadersRaw[COMPACTED_METADATA_BUFFER_SIZE + 512 + 1];
 
     // Canonicalized x-amz- headers
     string_multibuffer(canonicalizedAmzHeaders,
-                       COMPACTED_METADATA_BUFFER_SIZE + 256 + 1);
+                       COMPACTED_METADATA_BUFFER_SIZE + 512 + 1);
 
     // URL-Encoded key
     char urlEncodedKey[MAX_URLENCODED_KEY_SIZE + 1];
@@ -70,6 +197,10 @@ typedef struct RequestComputedValues
     // Canonicalized resource
     char canonicalizedResource[MAX_CANONICALIZED_RESOURCE_SIZE + 1];
 
+    // Canonical query string of Signature Version 4, which is also the query
+    // string sent
+    char canonicalQueryString[MAX_URI_SIZE + 1];
+
     // Cache-Control header (or empty)
     char cacheControlHeader[128];
 
@@ -103,8 +234,9 @@ typedef struct RequestComputedValues
     // Range header
     char rangeHeader[128];
 
-    // Authorization header
-    char authorizationHeader[128];
+    // Authorization header, which for Signature Version 4 lists the name
+    // of every signed header
+    char authorizationHeader[1024 + COMPACTED_METADATA_BUFFER_SIZE];
 } RequestComputedValues;
 
 
@@ -201,6 +333,20 @@ static size_t curl_read_func(void *ptr, size_t size, size_t nmemb, void *data)
             ret = request->toS3CallbackBytesRemaining;
         }
         request->toS3CallbackBytesRemaining -= ret;
+        if (request->payloadDigests) {
+            int digests = request->payloadDigests->digests;
+            if (digests & S3_DIGEST_MD5) {
+                MD5_update(&(request->md5Context), (unsigned char *) ptr, ret);
+            }
+            if (digests & S3_DIGEST_SHA256) {
+                SHA256_update(&(request->sha256Context),
+                              (unsigned char *) ptr, ret);
+            }
+            if (digests & S3_DIGEST_CRC32C) {
+                request->crc32c = crc32c_update
+                    (request->crc32c, (unsigned char *) ptr, ret);
+            }
+        }
         return ret;
     }
 }
@@ -340,10 +486,21 @@ static S3Status compose_amz_headers(const RequestParams *params,
     }
 
     // Add the x-amz-date header
-    time_t now = time(NULL);
-    char date[64];
-    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&now));
-    headers_append(1, "x-amz-date: %s", date);
+    if (values->signatureVersion == S3SignatureV4) {
+        currentTime(values->amzDate, 0);
+        headers_append(1, "x-amz-date: %s", values->amzDate);
+
+        // The payload is streamed, so it cannot be hashed before the request
+        // is sent
+        headers_append(1, "x-amz-content-sha256: %s",
+                       params->toS3Callback ? "UNSIGNED-PAYLOAD" :
+                       EMPTY_PAYLOAD_SHA256);
+    }
+    else {
+        char date[30];
+        currentTime(0, date);
+        headers_append(1, "x-amz-date: %s", date);
+    }
 
     if (params->httpRequestType == HttpRequestTypeCOPY) {
         // Add the x-amz-copy-source header
@@ -440,6 +597,16 @@ static S3Status compose_standard_headers(const RequestParams *params,
     do_put_header("Content-MD5: %s", md5, md5Header, S3StatusBadMD5,
                   S3StatusMD5TooLong);
 
+    // An MD5 that isn't 16 bytes of base64 would only get the whole upload
+    // rejected after it had been sent
+    if (values->md5Header[0]) {
+        const char *md5 = &(values->md5Header[sizeof("Content-MD5: ") - 1]);
+        unsigned char digest[(3 * sizeof(values->md5Header)) / 4];
+        if (base64Decode(md5, strlen(md5), digest) != 16) {
+            return S3StatusBadMD5;
+        }
+    }
+
     // Content-Disposition
     do_put_header("Content-Disposition: attachment; filename=\"%s\"",
                   contentDispositionFilename, contentDispositionHeader,
@@ -453,9 +620,10 @@ static S3Status compose_standard_headers(const RequestParams *params,
     
     // Expires
     if (params->putProperties && (params->putProperties->expires >= 0)) {
-        time_t t = (time_t) params->putProperties->expires;
-        strftime(values->expiresHeader, sizeof(values->expiresHeader),
-                 "Expires: %a, %d %b %Y %H:%M:%S UTC", gmtime(&t));
+        char date[26];
+        formatHttpDate(date, params->putProperties->expires);
+        snprintf(values->expiresHeader, sizeof(values->expiresHeader),
+                 "Expires: %s UTC", date);
     }
     else {
         values->expiresHeader[0] = 0;
@@ -464,10 +632,11 @@ static S3Status compose_standard_headers(const RequestParams *params,
     // If-Modified-Since
     if (params->getConditions &&
         (params->getConditions->ifModifiedSince >= 0)) {
-        time_t t = (time_t) params->getConditions->ifModifiedSince;
-        strftime(values->ifModifiedSinceHeader,
+        char date[26];
+        formatHttpDate(date, params->getConditions->ifModifiedSince);
+        snprintf(values->ifModifiedSinceHeader,
                  sizeof(values->ifModifiedSinceHeader),
-                 "If-Modified-Since: %a, %d %b %Y %H:%M:%S UTC", gmtime(&t));
+                 "If-Modified-Since: %s UTC", date);
     }
     else {
         values->ifModifiedSinceHeader[0] = 0;
@@ -476,10 +645,11 @@ static S3Status compose_standard_headers(const RequestParams *params,
     // If-Unmodified-Since header
     if (params->getConditions &&
         (params->getConditions->ifNotModifiedSince >= 0)) {
-        time_t t = (time_t) params->getConditions->ifNotModifiedSince;
-        strftime(values->ifUnmodifiedSinceHeader,
+        char date[26];
+        formatHttpDate(date, params->getConditions->ifNotModifiedSince);
+        snprintf(values->ifUnmodifiedSinceHeader,
                  sizeof(values->ifUnmodifiedSinceHeader),
-                 "If-Unmodified-Since: %a, %d %b %Y %H:%M:%S UTC", gmtime(&t));
+                 "If-Unmodified-Since: %s UTC", date);
     }
     else {
         values->ifUnmodifiedSinceHeader[0] = 0;
@@ -517,12 +687,21 @@ static S3Status compose_standard_headers(const RequestParams *params,
 }
 
 
-// URL encodes the params->key value into params->urlEncodedKey
+// URL encodes the params->key value into params->urlEncodedKey.  Signature
+// Version 4 signs the encoded key, so for it the key is encoded exactly as
+// the signature requires.
 static S3Status encode_key(const RequestParams *params,
                            RequestComputedValues *values)
 {
-    return (urlEncode(values->urlEncodedKey, params->key, S3_MAX_KEY_SIZE) ?
-            S3StatusOK : S3StatusUriTooLong);
+    if (values->signatureVersion == S3SignatureV4) {
+        return ((uriEncode(values->urlEncodedKey, params->key,
+                           S3_MAX_KEY_SIZE, 0) < 0) ?
+                S3StatusUriTooLong : S3StatusOK);
+    }
+
+    return ((urlEncode(values->urlEncodedKey, params->key,
+                       S3_MAX_KEY_SIZE) < 0) ?
+            S3StatusUriTooLong : S3StatusOK);
 }
 
 
@@ -578,7 +757,8 @@ static void header_gnome_sort(const char **headers, int size)
 static void canonicalize_amz_headers(RequestComputedValues *values)
 {
     // Make a copy of the headers that will be sorted
-    const char *sortedHeaders[S3_MAX_METADATA_COUNT];
+    const char *sortedHeaders[sizeof(values->amzHeaders) /
+                              sizeof(values->amzHeaders[0])];
 
     memcpy(sortedHeaders, values->amzHeaders,
            (values->amzHeadersCount * sizeof(sortedHeaders[0])));
@@ -590,6 +770,9 @@ static void canonicalize_amz_headers(RequestComputedValues *values)
     // - folding repeated headers into single lines, and
     // - folding multiple lines
     // - removing the space after the colon
+    // - for Signature Version 4, trimming values and collapsing runs of
+    //   spaces in them into one
+    int v4 = (values->signatureVersion == S3SignatureV4);
     int lastHeaderLen = 0, i;
     char *buffer = values->canonicalizedAmzHeaders;
     for (i = 0; i < values->amzHeadersCount; i++) {
@@ -615,7 +798,13 @@ static void canonicalize_amz_headers(RequestComputedValues *values)
             c++;
         }
         // Now copy in the value, folding the lines
+        char *value = buffer;
         while (*c) {
+            if (v4 && is_blank(*c) &&
+                ((buffer == value) || is_blank(*(buffer - 1)))) {
+                c++;
+                continue;
+            }
             // If c points to a \r\n[whitespace] sequence, then fold
             // this newline out
             if ((*c == '\r') && (*(c + 1) == '\n') && is_blank(*(c + 2))) {
@@ -634,6 +823,9 @@ static void canonicalize_amz_headers(RequestComputedValues *values)
             }
             *buffer++ = *c++;
         }
+        while (v4 && (buffer > value) && is_blank(*(buffer - 1))) {
+            buffer--;
+        }
         // Finally, add the newline
         *buffer++ = '\n';
     }
@@ -644,23 +836,31 @@ static void canonicalize_amz_headers(RequestComputedValues *values)
 
 
 // Canonicalizes the resource into params->canonicalizedResource
-static void canonicalize_resource(const char *bucketName,
+static void canonicalize_resource(const S3BucketContext *bucketContext,
                                   const char *subResource,
                                   const char *urlEncodedKey,
                                   char *buffer)
 {
+    const char *bucketName = bucketContext->bucketName;
     int len = 0;
 
     *buffer = 0;
 
 #define append(str) len += sprintf(&(buffer[len]), "%s", str)
 
-    if (bucketName && bucketName[0]) {
-        buffer[len++] = '/';
-        append(bucketName);
+    if (bucketContext->preparedBucket) {
+        len = bucketContext->preparedBucket->resourcePrefixLen;
+        memcpy(buffer, bucketContext->preparedBucket->resourcePrefix,
+               len + 1);
     }
+    else {
+        if (bucketName && bucketName[0]) {
+            buffer[len++] = '/';
+            append(bucketName);
+        }
 
-    append("/");
+        append("/");
+    }
 
     if (urlEncodedKey && urlEncodedKey[0]) {
         append(urlEncodedKey);
@@ -684,16 +884,382 @@ static const char *http_request_type_to_verb(HttpRequestType requestType)
     case HttpRequestTypePUT:
     case HttpRequestTypeCOPY:
         return "PUT";
+    case HttpRequestTypePOST:
+        return "POST";
     default: // HttpRequestTypeDELETE
         return "DELETE";
     }
 }
 
 
+static RequestThreadCache *request_thread_cache();
+
+// Fills in [hmacKeyReturn] with the signing key for [secretAccessKey], which
+// is only computed if the calling thread did not last sign with the same
+// secret access key
+static void request_signing_key(const char *secretAccessKey,
+                                HMACSHA1Key *hmacKeyReturn)
+{
+    RequestThreadCache *threadCache = request_thread_cache();
+    int len = strlen(secretAccessKey);
+
+    if (!threadCache || (len >= REQUEST_SIGNING_SECRET_SIZE)) {
+        HMAC_SHA1_key_initialize(hmacKeyReturn,
+                                 (const unsigned char *) secretAccessKey, len);
+        return;
+    }
+
+    if (!threadCache->hasSigningKey ||
+        strcmp(threadCache->signingSecret, secretAccessKey)) {
+        HMAC_SHA1_key_initialize(&(threadCache->signingKey),
+                                 (const unsigned char *) secretAccessKey, len);
+        memcpy(threadCache->signingSecret, secretAccessKey, len + 1);
+        threadCache->hasSigningKey = 1;
+    }
+
+    *hmacKeyReturn = threadCache->signingKey;
+}
+
+
+// Fills in [hmacKeyReturn] with the Signature Version 4 signing key for
+// [secretAccessKey], [date] and [authRegion]:
+// HMAC(HMAC(HMAC(HMAC("AWS4" + secret, date), region), "s3"), "aws4_request").
+// As for request_signing_key, it is only computed if the calling thread did
+// not last sign with the same values.
+static void request_v4_signing_key(const char *secretAccessKey,
+                                   const char *date, const char *authRegion,
+                                   HMACSHA256Key *hmacKeyReturn)
+{
+    RequestThreadCache *threadCache = request_thread_cache();
+    int len = strlen(secretAccessKey);
+    int cacheable = (threadCache && (len < REQUEST_SIGNING_SECRET_SIZE));
+
+    if (cacheable && threadCache->hasV4SigningKey &&
+        !strcmp(threadCache->v4SigningDate, date) &&
+        !strcmp(threadCache->v4SigningRegion, authRegion) &&
+        !strcmp(threadCache->v4SigningSecret, secretAccessKey)) {
+        *hmacKeyReturn = threadCache->v4SigningKey;
+        return;
+    }
+
+    // Keys longer than a block are hashed first, so only those short enough
+    // need to be copied to put "AWS4" in front of them
+    unsigned char secret[64];
+    int secretLen = 4 + len;
+    if (secretLen > (int) sizeof(secret)) {
+        SHA256Context context;
+        SHA256_init(&context);
+        SHA256_update(&context, (const unsigned char *) "AWS4", 4);
+        SHA256_update(&context, (const unsigned char *) secretAccessKey, len);
+        SHA256_final(secret, &context);
+        secretLen = 32;
+    }
+    else {
+        memcpy(secret, "AWS4", 4);
+        memcpy(&(secret[4]), secretAccessKey, len);
+    }
+
+    unsigned char key[32];
+    HMAC_SHA256(key, secret, secretLen, (const unsigned char *) date,
+                strlen(date));
+    HMAC_SHA256(key, key, sizeof(key), (const unsigned char *) authRegion,
+                strlen(authRegion));
+    HMAC_SHA256(key, key, sizeof(key), (const unsigned char *) "s3", 2);
+    HMAC_SHA256(key, key, sizeof(key), (const unsigned char *) "aws4_request",
+                sizeof("aws4_request") - 1);
+    HMAC_SHA256_key_initialize(hmacKeyReturn, key, sizeof(key));
+
+    if (cacheable) {
+        threadCache->v4SigningKey = *hmacKeyReturn;
+        memcpy(threadCache->v4SigningSecret, secretAccessKey, len + 1);
+        strcpy(threadCache->v4SigningDate, date);
+        strcpy(threadCache->v4SigningRegion, authRegion);
+        threadCache->hasV4SigningKey = 1;
+    }
+}
+
+
+// Signs the hash of a Signature Version 4 canonical request, made at
+// [amzDate] for [authRegion], writing the signature as 64 hex digits to
+// [signature]
+static void compose_v4_signature(char *signature,
+                                 const char *secretAccessKey,
+                                 const char *authRegion, const char *amzDate,
+                                 const unsigned char canonicalRequestHash[32])
+{
+    char hash[65];
+    hexEncode(canonicalRequestHash, 32, hash);
+
+    char stringToSign[sizeof("AWS4-HMAC-SHA256\n") + 16 + 1 + 8 + 1 +
+                      S3_MAX_AUTH_REGION_SIZE + sizeof("/s3/aws4_request\n") +
+                      64];
+    int len = snprintf(stringToSign, sizeof(stringToSign),
+                       "AWS4-HMAC-SHA256\n%s\n%.8s/%s/s3/aws4_request\n%s",
+                       amzDate, amzDate, authRegion, hash);
+
+    char date[9];
+    snprintf(date, sizeof(date), "%.8s", amzDate);
+
+    HMACSHA256Key hmacKey;
+    request_v4_signing_key(secretAccessKey, date, authRegion, &hmacKey);
+
+    unsigned char hmac[32];
+    HMAC_SHA256_with_key(hmac, &hmacKey, (unsigned char *) stringToSign, len);
+
+    hexEncode(hmac, 32, signature);
+}
+
+
+// Appends the characters of a query string parameter name or value from
+// [start] up to [end] to [buffer] at [*lenP], decoding them and then
+// URI-encoding them as Signature Version 4 requires.  Returns zero if the
+// [bufferSize] bytes of [buffer] are not enough.
+static int append_query_component(char *buffer, int *lenP, int bufferSize,
+                                  const char *start, const char *end)
+{
+    static const char *hex = "0123456789ABCDEF";
+    int len = *lenP;
+
+    char decoded[MAX_URI_SIZE + 1];
+    if ((end - start) >= (int) sizeof(decoded)) {
+        return 0;
+    }
+    int decodedLen = urlDecode(decoded, start, end - start), i;
+
+    for (i = 0; i < decodedLen; i++) {
+        unsigned char c = decoded[i];
+        if ((len + 3) >= bufferSize) {
+            return 0;
+        }
+        if (isalnum(c) || (c == '-') || (c == '_') || (c == '.') || 
+            (c == '~')) {
+            buffer[len++] = c;
+        }
+        else {
+            buffer[len++] = '%';
+            buffer[len++] = hex[c >> 4];
+            buffer[len++] = hex[c & 15];
+        }
+    }
+
+    *lenP = len;
+
+    return 1;
+}
+
+
+// Orders query string parameters, each NAME=VALUE, by name and then value
+static int query_param_compare(const void *a, const void *b)
+{
+    const char *param1 = *(const char **) a, *param2 = *(const char **) b;
+
+    while (*param1 == *param2) {
+        if (!*param1) {
+            return 0;
+        }
+        param1++, param2++;
+    }
+
+    // '=' ends the name, so sorts before any character of a longer name
+    if (*param1 == '=') {
+        return -1;
+    }
+    if (*param2 == '=') {
+        return 1;
+    }
+
+    return ((unsigned char) *param1 < (unsigned char) *param2) ? -1 : 1;
+}
+
+
+// Composes into [buffer] the canonical query string of Signature Version 4
+// from the sub resource and query parameters of a request: every parameter,
+// URI-encoded, in the form NAME=VALUE, sorted.  The result is also a valid
+// query string to send.
+static S3Status canonicalize_query(char *buffer, int bufferSize,
+                                   const char *subResource,
+                                   const char *queryParams)
+{
+    char encoded[MAX_URI_SIZE + 1];
+    int len = 0;
+    const char *params[REQUEST_MAX_QUERY_PARAMS];
+    int count = 0;
+    const char *sources[2] = { subResource, queryParams };
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        const char *param = sources[i];
+        if (!param) {
+            continue;
+        }
+        if (*param == '?') {
+            param++;
+        }
+        while (*param) {
+            const char *end = param, *equals;
+            while (*end && (*end != '&')) {
+                end++;
+            }
+            if (end > param) {
+                if (count == REQUEST_MAX_QUERY_PARAMS) {
+                    return S3StatusQueryParamsTooLong;
+                }
+                params[count++] = &(encoded[len]);
+                equals = param;
+                while ((equals < end) && (*equals != '=')) {
+                    equals++;
+                }
+                if (!append_query_component(encoded, &len, sizeof(encoded),
+                                            param, equals) ||
+                    ((len + 2) >= (int) sizeof(encoded))) {
+                    return S3StatusUriTooLong;
+                }
+                encoded[len++] = '=';
+                if ((equals < end) &&
+                    !append_query_component(encoded, &len, sizeof(encoded),
+                                            equals + 1, end)) {
+                    return S3StatusUriTooLong;
+                }
+                encoded[len++] = 0;
+            }
+            param = *end ? (end + 1) : end;
+        }
+    }
+
+    qsort(params, count, sizeof(const char *), &query_param_compare);
+
+    len = 0;
+    buffer[0] = 0;
+    for (i = 0; i < count; i++) {
+        len += snprintf(&(buffer[len]), bufferSize - len, "%s%s",
+                        i ? "&" : "", params[i]);
+        if (len >= bufferSize) {
+            return S3StatusUriTooLong;
+        }
+    }
+
+    return S3StatusOK;
+}
+
+
+// Composes the Signature Version 4 Authorization header for the request.
+// The canonical request is hashed as it is composed, rather than being
+// written out first.
+static S3Status compose_v4_auth_header(const RequestParams *params,
+                                       RequestComputedValues *values)
+{
+    const S3BucketContext *bucketContext = &(params->bucketContext);
+    const char *hostName =
+        bucketContext->hostName ? bucketContext->hostName : defaultHostNameG;
+    int hasBucket = (bucketContext->bucketName && bucketContext->bucketName[0]);
+    int virtualHost = 
+        (hasBucket && (bucketContext->uriStyle == S3UriStyleVirtualHost));
+
+    SHA256Context context;
+    SHA256_init(&context);
+
+#define canonical_append(str)                                            \
+    SHA256_update(&context, (const unsigned char *) (str), strlen(str))
+
+    canonical_append(http_request_type_to_verb(params->httpRequestType));
+    canonical_append("\n");
+    if (bucketContext->preparedBucket) {
+        canonical_append(bucketContext->preparedBucket->canonicalUriPrefix);
+    }
+    else {
+        canonical_append("/");
+        if (hasBucket && !virtualHost) {
+            canonical_append(bucketContext->bucketName);
+            canonical_append("/");
+        }
+    }
+    canonical_append(values->urlEncodedKey);
+    canonical_append("\n");
+    canonical_append(values->canonicalQueryString);
+    canonical_append("\n");
+
+    // The signed headers, in order: Content-MD5 and Content-Type if present,
+    // Host, and then the x-amz- headers, which are already canonicalized.
+    // For Content-MD5 and Content-Type, use the value in the actual header,
+    // because it's already been trimmed.
+    char signedHeaders[sizeof(values->canonicalizedAmzHeaders) + 64];
+    int len = 0;
+
+    if (values->md5Header[0]) {
+        canonical_append("content-md5:");
+        canonical_append(&(values->md5Header[sizeof("Content-MD5: ") - 1]));
+        canonical_append("\n");
+        len += sprintf(&(signedHeaders[len]), "content-md5;");
+    }
+
+    if (values->contentTypeHeader[0]) {
+        canonical_append("content-type:");
+        canonical_append
+            (&(values->contentTypeHeader[sizeof("Content-Type: ") - 1]));
+        canonical_append("\n");
+        len += sprintf(&(signedHeaders[len]), "content-type;");
+    }
+
+    canonical_append("host:");
+    if (bucketContext->preparedBucket) {
+        canonical_append(bucketContext->preparedBucket->host);
+    }
+    else {
+        if (virtualHost) {
+            canonical_append(bucketContext->bucketName);
+            canonical_append(".");
+        }
+        canonical_append(hostName);
+    }
+    canonical_append("\n");
+    len += sprintf(&(signedHeaders[len]), "host");
+
+    canonical_append(values->canonicalizedAmzHeaders);
+
+    // Each canonicalized x-amz- header is NAME:VALUE\n
+    const char *header = values->canonicalizedAmzHeaders;
+    while (*header) {
+        signedHeaders[len++] = ';';
+        while (*header != ':') {
+            signedHeaders[len++] = *header++;
+        }
+        while (*header && (*header++ != '\n'))
+            ;
+    }
+    signedHeaders[len] = 0;
+
+    canonical_append("\n");
+    canonical_append(signedHeaders);
+    canonical_append("\n");
+    canonical_append(params->toS3Callback ? "UNSIGNED-PAYLOAD" :
+                     EMPTY_PAYLOAD_SHA256);
+
+    unsigned char canonicalRequestHash[32];
+    SHA256_final(canonicalRequestHash, &context);
+
+    char signature[65];
+    compose_v4_signature(signature, bucketContext->secretAccessKey,
+                         values->authRegion, values->amzDate,
+                         canonicalRequestHash);
+
+    snprintf(values->authorizationHeader, sizeof(values->authorizationHeader),
+             "Authorization: AWS4-HMAC-SHA256 Credential=%s/%.8s/%s/s3/"
+             "aws4_request, SignedHeaders=%s, Signature=%s",
+             bucketContext->accessKeyId, values->amzDate, values->authRegion,
+             signedHeaders, signature);
+
+    return S3StatusOK;
+}
+
+
 // Composes the Authorization header for the request
 static S3Status compose_auth_header(const RequestParams *params,
                                     RequestComputedValues *values)
 {
+    if (values->signatureVersion == S3SignatureV4) {
+        return compose_v4_auth_header(params, values);
+    }
+
     // We allow for:
     // 17 bytes for HTTP-Verb + \n
     // 129 bytes for Content-MD5 + \n
@@ -730,9 +1296,16 @@ static S3Status compose_auth_header(const RequestParams *params,
     // Generate an HMAC-SHA-1 of the signbuf
     unsigned char hmac[20];
 
-    HMAC_SHA1(hmac, (unsigned char *) params->bucketContext.secretAccessKey,
-              strlen(params->bucketContext.secretAccessKey),
-              (unsigned char *) signbuf, len);
+    HMACSHA1Key hmacKey;
+    const HMACSHA1Key *signingKey = &hmacKey;
+    if (params->bucketContext.preparedBucket) {
+        signingKey = &(params->bucketContext.preparedBucket->signingKey);
+    }
+    else {
+        request_signing_key(params->bucketContext.secretAccessKey, &hmacKey);
+    }
+
+    HMAC_SHA1_with_key(hmac, signingKey, (unsigned char *) signbuf, len);
 
     // Now base-64 encode the results
     char b64[((20 + 1) * 4) / 3];
@@ -762,26 +1335,35 @@ static S3Status compose_uri(char *buffer, int bufferSize,
         }                                                                    \
     } while (0)
 
-    uri_append("http%s://", 
-               (bucketContext->protocol == S3ProtocolHTTP) ? "" : "s");
+    if (bucketContext->preparedBucket) {
+        len = bucketContext->preparedBucket->uriPrefixLen;
+        if (len >= bufferSize) {
+            return S3StatusUriTooLong;
+        }
+        memcpy(buffer, bucketContext->preparedBucket->uriPrefix, len + 1);
+    }
+    else {
+        uri_append("http%s://", 
+                   (bucketContext->protocol == S3ProtocolHTTP) ? "" : "s");
 
-    const char *hostName = 
-        bucketContext->hostName ? bucketContext->hostName : defaultHostNameG;
+        const char *hostName = bucketContext->hostName ? 
+            bucketContext->hostName : defaultHostNameG;
 
-    if (bucketContext->bucketName && 
-        bucketContext->bucketName[0]) {
-        if (bucketContext->uriStyle == S3UriStyleVirtualHost) {
-            uri_append("%s.%s", bucketContext->bucketName, hostName);
+        if (bucketContext->bucketName && 
+            bucketContext->bucketName[0]) {
+            if (bucketContext->uriStyle == S3UriStyleVirtualHost) {
+                uri_append("%s.%s", bucketContext->bucketName, hostName);
+            }
+            else {
+                uri_append("%s/%s", hostName, bucketContext->bucketName);
+            }
         }
         else {
-            uri_append("%s/%s", hostName, bucketContext->bucketName);
+            uri_append("%s", hostName);
         }
-    }
-    else {
-        uri_append("%s", hostName);
-    }
 
-    uri_append("%s", "/");
+        uri_append("%s", "/");
+    }
 
     uri_append("%s", urlEncodedKey);
     
@@ -798,10 +1380,10 @@ static S3Status compose_uri(char *buffer, int bufferSize,
 }
 
 
-// Sets up the curl handle given the completely computed RequestParams
-static S3Status setup_curl(Request *request,
-                           const RequestParams *params,
-                           const RequestComputedValues *values)
+// Sets up the options of a newly created curl handle which are the same for
+// every request performed with it.  These survive the handle being re-used
+// from the request stack.
+static S3Status setup_curl_handle(Request *request)
 {
     CURLcode status;
 
@@ -816,6 +1398,9 @@ static S3Status setup_curl(Request *request,
     
     // Set private data to request for the benefit of S3RequestContext
     curl_easy_setopt_safe(CURLOPT_PRIVATE, request);
+
+    // Share DNS results and TLS sessions with every other handle
+    curl_easy_setopt_safe(CURLOPT_SHARE, curlShareG);
     
     // Set header callback and data
     curl_easy_setopt_safe(CURLOPT_HEADERDATA, request);
@@ -875,6 +1460,47 @@ static S3Status setup_curl(Request *request,
     curl_easy_setopt_safe(CURLOPT_LOW_SPEED_LIMIT, 1024);
     curl_easy_setopt_safe(CURLOPT_LOW_SPEED_TIME, 15);
 
+    return S3StatusOK;
+}
+
+
+// Sets up the curl handle given the completely computed RequestParams, and
+// the transport properties of the request context performing the request,
+// if any
+static S3Status setup_curl(Request *request,
+                           const RequestParams *params,
+                           const S3TransportProperties *transportProperties,
+                           const RequestComputedValues *values)
+{
+    CURLcode status;
+
+    // The handle may have been used for a request of another type, so
+    // return it to a plain GET before setting the options of this request.
+    // CURLOPT_HTTPGET also turns off CURLOPT_NOBODY, CURLOPT_UPLOAD and
+    // CURLOPT_POST.
+    curl_easy_setopt_safe(CURLOPT_HTTPGET, 1L);
+    curl_easy_setopt_safe(CURLOPT_CUSTOMREQUEST, (char *) 0);
+
+    // Set the HTTP version.  HTTP/2 requests wait for a connection which is
+    // already being set up to see whether they can be multiplexed over it,
+    // rather than each opening a new connection.
+    long httpVersion = CURL_HTTP_VERSION_1_1;
+    if (transportProperties) {
+        switch (transportProperties->httpVersion) {
+        case S3HttpVersion2:
+            httpVersion = CURL_HTTP_VERSION_2TLS;
+            break;
+        case S3HttpVersion2PriorKnowledge:
+            httpVersion = CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE;
+            break;
+        default: // S3HttpVersion1_1
+            break;
+        }
+    }
+    curl_easy_setopt_safe(CURLOPT_HTTP_VERSION, httpVersion);
+    curl_easy_setopt_safe(CURLOPT_PIPEWAIT, 
+                          (httpVersion == CURL_HTTP_VERSION_1_1) ? 0L : 1L);
+
     // Append standard headers
 #define append_standard_header(fieldName)                               \
     if (values-> fieldName [0]) {                                       \
@@ -895,6 +1521,24 @@ static S3Status setup_curl(Request *request,
         request->headers = curl_slist_append(request->headers, 
                                              "Transfer-Encoding:");
     }
+    else if (params->httpRequestType == HttpRequestTypePOST) {
+        // Curl would otherwise supply a form Content-Type, which is not
+        // part of the signature
+        if (!values->contentTypeHeader[0]) {
+            request->headers = curl_slist_append(request->headers,
+                                                 "Content-Type:");
+        }
+        curl_easy_setopt_safe(CURLOPT_POSTFIELDSIZE_LARGE,
+                              (curl_off_t) params->toS3CallbackTotalSize);
+    }
+
+    // An empty Expect header stops curl from sending
+    // "Expect: 100-continue" and waiting for the server's go-ahead
+    if (transportProperties && transportProperties->disableExpectContinue &&
+        ((params->httpRequestType == HttpRequestTypePUT) ||
+         (params->httpRequestType == HttpRequestTypePOST))) {
+        request->headers = curl_slist_append(request->headers, "Expect:");
+    }
     
     append_standard_header(cacheControlHeader);
     append_standard_header(contentTypeHeader);
@@ -934,6 +1578,9 @@ static S3Status setup_curl(Request *request,
     case HttpRequestTypeDELETE:
     curl_easy_setopt_safe(CURLOPT_CUSTOMREQUEST, "DELETE");
         break;
+    case HttpRequestTypePOST:
+        curl_easy_setopt_safe(CURLOPT_POST, 1L);
+        break;
     default: // HttpRequestTypeGET
         break;
     }
@@ -950,70 +1597,317 @@ static void request_deinitialize(Request *request)
     
     error_parser_deinitialize(&(request->errorParser));
 
-    // curl_easy_reset prevents connections from being re-used for some
-    // reason.  This makes HTTP Keep-Alive meaningless and is very bad for
-    // performance.  But it is necessary to allow curl to work properly.
-    // xxx todo figure out why
-    curl_easy_reset(request->curl);
+    // The curl handle is deliberately not reset, because curl_easy_reset
+    // also drops the handle's connections, which would prevent HTTP
+    // Keep-Alive from re-using them.  setup_curl() instead overrides every
+    // option that varies from one request to the next.
 }
 
 
-static S3Status request_get(const RequestParams *params, 
-                            const RequestComputedValues *values,
-                            Request **reqReturn)
+static void request_destroy(Request *request)
 {
-    Request *request = 0;
-    
-    // Try to get one from the request stack.  We hold the lock for the
-    // shortest time possible here.
-    pthread_mutex_lock(&requestStackMutexG);
+    request_deinitialize(request);
+    curl_easy_cleanup(request->curl);
+    free(request);
+}
 
-    if (requestStackCountG) {
-        request = requestStackG[--requestStackCountG];
-    }
-    
-    pthread_mutex_unlock(&requestStackMutexG);
 
-    // If we got one, deinitialize it for re-use
-    if (request) {
-        request_deinitialize(request);
+// Puts a request into the shared cache; returns zero if it is full
+static int request_shared_cache_put(Request *request)
+{
+    if (requestSharedCacheMaskG < 0) {
+        return 0;
     }
-    // Else there wasn't one available in the request stack, so create one
-    else {
-        if (!(request = (Request *) malloc(sizeof(Request)))) {
-            return S3StatusOutOfMemory;
+
+    unsigned long position = 
+        __atomic_load_n(&(requestSharedCachePutG.position), __ATOMIC_RELAXED);
+
+    while (1) {
+        RequestCacheSlot *slot = 
+            &(requestSharedCacheG[position & requestSharedCacheMaskG]);
+        long diff = (long) (__atomic_load_n(&(slot->sequence),
+                                            __ATOMIC_ACQUIRE) - position);
+        // The slot is free for this position, so try to claim the position
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n
+                (&(requestSharedCachePutG.position), &position, position + 1,
+                 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                slot->request = request;
+                __atomic_store_n(&(slot->sequence), position + 1,
+                                 __ATOMIC_RELEASE);
+                return 1;
+            }
+            // position has been updated to the current one by the failed
+            // exchange
         }
-        if (!(request->curl = curl_easy_init())) {
-            free(request);
-            return S3StatusFailedToInitializeRequest;
+        // The slot still holds the request put there a full cycle ago, so
+        // the cache is full
+        else if (diff < 0) {
+            return 0;
+        }
+        // Another thread claimed this position first
+        else {
+            position = __atomic_load_n(&(requestSharedCachePutG.position),
+                                       __ATOMIC_RELAXED);
         }
     }
+}
 
-    // Initialize the request
-    request->prev = 0;
-    request->next = 0;
 
-    // Request status is initialized to no error, will be updated whenever
-    // an error occurs
-    request->status = S3StatusOK;
+// Takes a request from the shared cache; returns 0 if it is empty
+static Request *request_shared_cache_take()
+{
+    if (requestSharedCacheMaskG < 0) {
+        return 0;
+    }
 
-    S3Status status;
-                        
-    // Start out with no headers
+    unsigned long position = 
+        __atomic_load_n(&(requestSharedCacheTakeG.position), __ATOMIC_RELAXED);
+
+    while (1) {
+        RequestCacheSlot *slot = 
+            &(requestSharedCacheG[position & requestSharedCacheMaskG]);
+        long diff = (long) (__atomic_load_n(&(slot->sequence),
+                                            __ATOMIC_ACQUIRE) - 
+                            (position + 1));
+        // The slot holds the request for this position, so try to claim it
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n
+                (&(requestSharedCacheTakeG.position), &position, position + 1,
+                 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                Request *request = slot->request;
+                // Free the slot for the put a full cycle from now
+                __atomic_store_n(&(slot->sequence),
+                                 position + requestSharedCacheMaskG + 1,
+                                 __ATOMIC_RELEASE);
+                return request;
+            }
+        }
+        // Nothing has been put at this position yet, so the cache is empty
+        else if (diff < 0) {
+            return 0;
+        }
+        else {
+            position = __atomic_load_n(&(requestSharedCacheTakeG.position),
+                                       __ATOMIC_RELAXED);
+        }
+    }
+}
+
+
+// Returns this thread's cache, creating it if necessary; returns 0 if
+// threads are not to have caches or it could not be created
+static RequestThreadCache *request_thread_cache()
+{
+    RequestThreadCache *threadCache = 
+        (RequestThreadCache *) pthread_getspecific(requestThreadCacheKeyG);
+
+    if (threadCache) {
+        return threadCache;
+    }
+
+    // A thread cache which holds no requests is still made, for the signing
+    // key
+    int extra = (requestThreadCacheSizeInUseG > 1) ?
+        (requestThreadCacheSizeInUseG - 1) : 0;
+    threadCache = (RequestThreadCache *) 
+        malloc(sizeof(RequestThreadCache) + (extra * sizeof(Request *)));
+    if (!threadCache) {
+        return 0;
+    }
+
+    threadCache->hasSigningKey = 0;
+    threadCache->hasV4SigningKey = 0;
+    threadCache->count = 0;
+
+    if (pthread_setspecific(requestThreadCacheKeyG, threadCache)) {
+        free(threadCache);
+        return 0;
+    }
+
+    pthread_mutex_lock(&requestThreadCachesMutexG);
+    threadCache->prev = 0;
+    threadCache->next = requestThreadCachesG;
+    if (requestThreadCachesG) {
+        requestThreadCachesG->prev = threadCache;
+    }
+    requestThreadCachesG = threadCache;
+    pthread_mutex_unlock(&requestThreadCachesMutexG);
+
+    return threadCache;
+}
+
+
+// Called when a thread with a cache exits; hands the thread's requests to the
+// shared cache so that other threads can use them
+static void request_thread_cache_destroy(void *data)
+{
+    RequestThreadCache *threadCache = (RequestThreadCache *) data;
+
+    pthread_mutex_lock(&requestThreadCachesMutexG);
+    if (threadCache->prev) {
+        threadCache->prev->next = threadCache->next;
+    }
+    else {
+        requestThreadCachesG = threadCache->next;
+    }
+    if (threadCache->next) {
+        threadCache->next->prev = threadCache->prev;
+    }
+    pthread_mutex_unlock(&requestThreadCachesMutexG);
+
+    while (threadCache->count) {
+        Request *request = threadCache->requests[--(threadCache->count)];
+        if (!request_shared_cache_put(request)) {
+            request_destroy(request);
+        }
+    }
+
+    free(threadCache);
+}
+
+
+static S3Status request_cache_initialize()
+{
+    requestSharedCacheG = 0;
+    requestSharedCacheMaskG = -1;
+    requestSharedCachePutG.position = requestSharedCacheTakeG.position = 0;
+
+    if (requestSharedCacheSizeG > 0) {
+        // The shared cache size is rounded up to a power of 2, so that
+        // positions can simply wrap around
+        long size = 1;
+        while (size < requestSharedCacheSizeG) {
+            size <<= 1;
+        }
+        if (!(requestSharedCacheG = (RequestCacheSlot *) 
+              malloc(size * sizeof(RequestCacheSlot)))) {
+            return S3StatusOutOfMemory;
+        }
+        long i;
+        for (i = 0; i < size; i++) {
+            requestSharedCacheG[i].sequence = i;
+        }
+        requestSharedCacheMaskG = size - 1;
+    }
+
+    if (pthread_key_create(&requestThreadCacheKeyG, 
+                           &request_thread_cache_destroy)) {
+        free(requestSharedCacheG);
+        return S3StatusInternalError;
+    }
+
+    pthread_mutex_init(&requestThreadCachesMutexG, 0);
+
+    requestThreadCachesG = 0;
+
+    requestThreadCacheSizeInUseG = requestThreadCacheSizeG;
+
+    return S3StatusOK;
+}
+
+
+static void request_cache_deinitialize()
+{
+    // Threads which exit from now on will not hand their caches back, which
+    // is just as well, because the caches are all destroyed here
+    pthread_key_delete(requestThreadCacheKeyG);
+
+    while (requestThreadCachesG) {
+        RequestThreadCache *threadCache = requestThreadCachesG;
+        requestThreadCachesG = threadCache->next;
+        while (threadCache->count) {
+            request_destroy(threadCache->requests[--(threadCache->count)]);
+        }
+        free(threadCache);
+    }
+
+    pthread_mutex_destroy(&requestThreadCachesMutexG);
+
+    Request *request;
+    while ((request = request_shared_cache_take())) {
+        request_destroy(request);
+    }
+
+    free(requestSharedCacheG);
+    requestSharedCacheG = 0;
+    requestSharedCacheMaskG = -1;
+}
+
+
+static S3Status request_get(const RequestParams *params, 
+                            const S3TransportProperties *transportProperties,
+                            const RequestComputedValues *values,
+                            Request **reqReturn)
+{
+    Request *request = 0;
+    S3Status status;
+    
+    // Try this thread's cache first, then the shared cache
+    RequestThreadCache *threadCache = 
+        (RequestThreadCache *) pthread_getspecific(requestThreadCacheKeyG);
+
+    if (threadCache && threadCache->count) {
+        request = threadCache->requests[--(threadCache->count)];
+    }
+    else {
+        request = request_shared_cache_take();
+    }
+    
+    // If we got one, deinitialize it for re-use
+    if (request) {
+        request_deinitialize(request);
+    }
+    // Else there wasn't one available in the caches, so create one
+    else {
+        if (!(request = (Request *) malloc(sizeof(Request)))) {
+            return S3StatusOutOfMemory;
+        }
+        if (!(request->curl = curl_easy_init())) {
+            free(request);
+            return S3StatusFailedToInitializeRequest;
+        }
+        if ((status = setup_curl_handle(request)) != S3StatusOK) {
+            curl_easy_cleanup(request->curl);
+            free(request);
+            return status;
+        }
+    }
+
+    // Initialize the request
+    request->prev = 0;
+    request->next = 0;
+
+    // Request status is initialized to no error, will be updated whenever
+    // an error occurs
+    request->status = S3StatusOK;
+
+    // Start out with no headers
     request->headers = 0;
 
-    // Compute the URL
+    // Compute the URL; with Signature Version 4, the query string sent must
+    // be the one that was signed, and is left off if empty
+    const char *queryParams = params->queryParams;
+    if (values->signatureVersion == S3SignatureV4) {
+        queryParams = values->canonicalQueryString[0] ?
+            values->canonicalQueryString : 0;
+    }
     if ((status = compose_uri
          (request->uri, sizeof(request->uri), 
           &(params->bucketContext), values->urlEncodedKey,
-          params->subResource, params->queryParams)) != S3StatusOK) {
+          (values->signatureVersion == S3SignatureV4) ? 0 :
+          params->subResource, queryParams)) != S3StatusOK) {
         curl_easy_cleanup(request->curl);
         free(request);
         return status;
     }
 
     // Set all of the curl handle options
-    if ((status = setup_curl(request, params, values)) != S3StatusOK) {
+    if ((status = setup_curl(request, params, transportProperties,
+                             values)) != S3StatusOK) {
+        if (request->headers) {
+            curl_slist_free_all(request->headers);
+        }
         curl_easy_cleanup(request->curl);
         free(request);
         return status;
@@ -1025,6 +1919,16 @@ static S3Status request_get(const RequestParams *params,
 
     request->toS3CallbackBytesRemaining = params->toS3CallbackTotalSize;
 
+    request->payloadDigests = 
+        (params->toS3Callback && params->putProperties) ?
+        params->putProperties->payloadDigests : 0;
+
+    if (request->payloadDigests) {
+        MD5_init(&(request->md5Context));
+        SHA256_init(&(request->sha256Context));
+        request->crc32c = 0;
+    }
+
     request->fromS3Callback = params->fromS3Callback;
 
     request->completeCallback = params->completeCallback;
@@ -1043,31 +1947,90 @@ static S3Status request_get(const RequestParams *params,
 }
 
 
-static void request_destroy(Request *request)
+static void request_release(Request *request)
 {
-    request_deinitialize(request);
-    curl_easy_cleanup(request->curl);
-    free(request);
+    // A request which got a response without making any new connection
+    // must have re-used one
+    if (request->httpResponseCode) {
+        long connects = -1;
+        curl_easy_getinfo(request->curl, CURLINFO_NUM_CONNECTS, &connects);
+        __atomic_fetch_add(&requestCountG, 1, __ATOMIC_RELAXED);
+        if (connects == 0) {
+            __atomic_fetch_add(&connectionReuseCountG, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    // Keep the request in this thread's cache if there is room; the most
+    // recently used requests are re-used first, to maximize our chances of
+    // re-using a TCP connection before it times out
+    RequestThreadCache *threadCache = request_thread_cache();
+
+    if (threadCache && (threadCache->count < requestThreadCacheSizeInUseG)) {
+        threadCache->requests[(threadCache->count)++] = request;
+    }
+    // Else put it in the shared cache, or if that is full, destroy it
+    else if (!request_shared_cache_put(request)) {
+        request_destroy(request);
+    }
 }
 
 
-static void request_release(Request *request)
+static void curl_share_lock_func(CURL *curl, curl_lock_data data,
+                                 curl_lock_access access, void *userptr)
 {
-    pthread_mutex_lock(&requestStackMutexG);
+    (void) curl;
+    (void) access;
+    (void) userptr;
 
-    // If the request stack is full, destroy this one
-    if (requestStackCountG == REQUEST_STACK_SIZE) {
-        pthread_mutex_unlock(&requestStackMutexG);
-        request_destroy(request);
+    pthread_mutex_lock(&(curlShareMutexesG[data]));
+}
+
+
+static void curl_share_unlock_func(CURL *curl, curl_lock_data data,
+                                   void *userptr)
+{
+    (void) curl;
+    (void) userptr;
+
+    pthread_mutex_unlock(&(curlShareMutexesG[data]));
+}
+
+
+static void share_deinitialize()
+{
+    curl_share_cleanup(curlShareG);
+
+    int i;
+    for (i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_destroy(&(curlShareMutexesG[i]));
     }
-    // Else put this one at the front of the request stack; we do this because
-    // we want the most-recently-used curl handle to be re-used on the next
-    // request, to maximize our chances of re-using a TCP connection before it
-    // times out
-    else {
-        requestStackG[requestStackCountG++] = request;
-        pthread_mutex_unlock(&requestStackMutexG);
+}
+
+
+static S3Status share_initialize()
+{
+    if (!(curlShareG = curl_share_init())) {
+        return S3StatusOutOfMemory;
     }
+
+    int i;
+    for (i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&(curlShareMutexesG[i]), 0);
+    }
+
+    if ((curl_share_setopt(curlShareG, CURLSHOPT_LOCKFUNC,
+                           &curl_share_lock_func) != CURLSHE_OK) ||
+        (curl_share_setopt(curlShareG, CURLSHOPT_UNLOCKFUNC,
+                           &curl_share_unlock_func) != CURLSHE_OK) ||
+        (curl_share_setopt(curlShareG, CURLSHOPT_SHARE,
+                           CURL_LOCK_DATA_DNS) != CURLSHE_OK) ||
+        (curl_share_setopt(curlShareG, CURLSHOPT_SHARE,
+                           CURL_LOCK_DATA_SSL_SESSION) != CURLSHE_OK)) {
+        share_deinitialize();
+        return S3StatusInternalError;
+    }
+
+    return S3StatusOK;
 }
 
 
@@ -1089,9 +2052,17 @@ S3Status request_api_initialize(const char *userAgentInfo, int flags,
         return S3StatusUriTooLong;
     }
 
-    pthread_mutex_init(&requestStackMutexG, 0);
+    S3Status status = share_initialize();
+    if (status != S3StatusOK) {
+        return status;
+    }
+
+    if ((status = request_cache_initialize()) != S3StatusOK) {
+        share_deinitialize();
+        return status;
+    }
 
-    requestStackCountG = 0;
+    requestCountG = connectionReuseCountG = 0;
 
     if (!userAgentInfo || !*userAgentInfo) {
         userAgentInfo = "Unknown";
@@ -1119,11 +2090,47 @@ S3Status request_api_initialize(const char *userAgentInfo, int flags,
 
 void request_api_deinitialize()
 {
-    pthread_mutex_destroy(&requestStackMutexG);
+    request_cache_deinitialize();
+
+    // The share can only be cleaned up once no handle is attached to it
+    share_deinitialize();
+}
+
+
+void S3_get_connection_stats(S3ConnectionStats *statsReturn)
+{
+    statsReturn->requestCount = 
+        __atomic_load_n(&requestCountG, __ATOMIC_RELAXED);
+    statsReturn->connectionReuseCount = 
+        __atomic_load_n(&connectionReuseCountG, __ATOMIC_RELAXED);
+}
+
+
+void S3_set_request_cache_size(int threadCacheSize, int sharedCacheSize)
+{
+    requestThreadCacheSizeG = (threadCacheSize < 0) ? 0 : threadCacheSize;
+    requestSharedCacheSizeG = (sharedCacheSize < 0) ? 0 : sharedCacheSize;
+}
+
+
+S3Status S3_set_default_signature_version(S3SignatureVersion signatureVersion,
+                                          const char *authRegion)
+{
+    if (!authRegion) {
+        authRegion = "us-east-1";
+    }
 
-    while (requestStackCountG--) {
-        request_destroy(requestStackG[requestStackCountG]);
+    if (strlen(authRegion) >= sizeof(defaultAuthRegionG)) {
+        return S3StatusAuthRegionTooLong;
     }
+
+    if (signatureVersion != S3SignatureDefault) {
+        defaultSignatureVersionG = signatureVersion;
+    }
+
+    strcpy(defaultAuthRegionG, authRegion);
+
+    return S3StatusOK;
 }
 
 
@@ -1139,12 +2146,32 @@ void request_perform(const RequestParams *params, S3RequestContext *context)
     // These will hold the computed values
     RequestComputedValues computed;
 
-    // Validate the bucket name
-    if (params->bucketContext.bucketName && 
-        ((status = S3_validate_bucket_name
-          (params->bucketContext.bucketName, 
-           params->bucketContext.uriStyle)) != S3StatusOK)) {
-        return_status(status);
+    // A prepared bucket has already validated the bucket name and worked
+    // out how to sign the request
+    computed.preparedBucket = params->bucketContext.preparedBucket;
+    if (computed.preparedBucket) {
+        computed.signatureVersion = computed.preparedBucket->signatureVersion;
+        computed.authRegion = computed.preparedBucket->authRegion;
+    }
+    else {
+        // Validate the bucket name
+        if (params->bucketContext.bucketName && 
+            ((status = S3_validate_bucket_name
+              (params->bucketContext.bucketName, 
+               params->bucketContext.uriStyle)) != S3StatusOK)) {
+            return_status(status);
+        }
+
+        // Work out how to sign the request
+        computed.signatureVersion = params->bucketContext.signatureVersion;
+        if (computed.signatureVersion == S3SignatureDefault) {
+            computed.signatureVersion = defaultSignatureVersionG;
+        }
+        computed.authRegion = params->bucketContext.authRegion ?
+            params->bucketContext.authRegion : defaultAuthRegionG;
+        if (strlen(computed.authRegion) >= S3_MAX_AUTH_REGION_SIZE) {
+            return_status(S3StatusAuthRegionTooLong);
+        }
     }
 
     // Compose the amz headers
@@ -1166,10 +2193,21 @@ void request_perform(const RequestParams *params, S3RequestContext *context)
     // Compute the canonicalized amz headers
     canonicalize_amz_headers(&computed);
 
-    // Compute the canonicalized resource
-    canonicalize_resource(params->bucketContext.bucketName,
-                          params->subResource, computed.urlEncodedKey,
-                          computed.canonicalizedResource);
+    // Compute the canonical query string, or for Signature Version 2, the
+    // canonicalized resource
+    if (computed.signatureVersion == S3SignatureV4) {
+        if ((status = canonicalize_query
+             (computed.canonicalQueryString,
+              sizeof(computed.canonicalQueryString), params->subResource,
+              params->queryParams)) != S3StatusOK) {
+            return_status(status);
+        }
+    }
+    else {
+        canonicalize_resource(&(params->bucketContext),
+                              params->subResource, computed.urlEncodedKey,
+                              computed.canonicalizedResource);
+    }
 
     // Compose Authorization header
     if ((status = compose_auth_header(params, &computed)) != S3StatusOK) {
@@ -1177,7 +2215,9 @@ void request_perform(const RequestParams *params, S3RequestContext *context)
     }
     
     // Get an initialized Request structure now
-    if ((status = request_get(params, &computed, &request)) != S3StatusOK) {
+    if ((status = request_get
+         (params, context ? &(context->transportProperties) : 0,
+          &computed, &request)) != S3StatusOK) {
         return_status(status);
     }
 
@@ -1194,6 +2234,7 @@ void request_perform(const RequestParams *params, S3RequestContext *context)
             else {
                 context->requests = request->next = request->prev = request;
             }
+            context->requestCount++;
         }
         else {
             if (request->status == S3StatusOK) {
@@ -1216,6 +2257,56 @@ void request_perform(const RequestParams *params, S3RequestContext *context)
 }
 
 
+// Reports the digests of the data sent by a request which succeeded, failing
+// it if the ETag returned is an MD5 which differs from that of the data
+static void request_finish_digests(Request *request)
+{
+    S3PayloadDigests *payloadDigests = request->payloadDigests;
+
+    if (payloadDigests->digests & S3_DIGEST_SHA256) {
+        SHA256_final(payloadDigests->sha256, &(request->sha256Context));
+    }
+
+    if (payloadDigests->digests & S3_DIGEST_CRC32C) {
+        payloadDigests->crc32c = request->crc32c;
+    }
+
+    if (!(payloadDigests->digests & S3_DIGEST_MD5)) {
+        return;
+    }
+
+    MD5_final(payloadDigests->md5, &(request->md5Context));
+
+    // The ETag of an object encrypted with KMS or customer keys is not an
+    // MD5, even though it looks like one
+    const ResponseHeadersHandler *headers = &(request->responseHeadersHandler);
+    if (headers->customerEncryption || 
+        (headers->serverSideEncryption[0] &&
+         strcmp(headers->serverSideEncryption, "AES256"))) {
+        return;
+    }
+
+    // An ETag of anything other than 32 hex digits, such as that of an
+    // object uploaded in parts, is not an MD5
+    const char *eTag = headers->responseProperties.eTag;
+    if (!eTag) {
+        return;
+    }
+    if (*eTag == '"') {
+        eTag++;
+    }
+    unsigned char md5[16];
+    if ((hexDecode(eTag, 32, md5) != 16) ||
+        (eTag[32] && (eTag[32] != '"'))) {
+        return;
+    }
+
+    if (memcmp(md5, payloadDigests->md5, 16)) {
+        request->status = S3StatusDigestMismatch;
+    }
+}
+
+
 void request_finish(Request *request)
 {
     // If we haven't detected this already, we now know that the headers are
@@ -1288,6 +2379,10 @@ void request_finish(Request *request)
         }
     }
 
+    if (request->payloadDigests && (request->status == S3StatusOK)) {
+        request_finish_digests(request);
+    }
+
     (*(request->completeCallback))
         (request->status, &(request->errorParser.s3ErrorDetails),
          request->callbackData);
@@ -1319,9 +2414,106 @@ S3Status request_curl_code_to_status(CURLcode code)
 }
 
 
-S3Status S3_generate_authenticated_query_string
-    (char *buffer, const S3BucketContext *bucketContext,
-     const char *key, int64_t expires, const char *resource)
+// Fills in the parts of [presigner] which are particular to Signature
+// Version 4, whose query strings are valid for at most a week
+static S3Status presigner_initialize_v4(RequestPresigner *presigner,
+                                        const S3BucketContext *bucketContext,
+                                        int64_t expires, const char *resource)
+{
+    const char *authRegion = 
+        bucketContext->authRegion ? bucketContext->authRegion :
+        defaultAuthRegionG;
+    if (strlen(authRegion) >= S3_MAX_AUTH_REGION_SIZE) {
+        return S3StatusAuthRegionTooLong;
+    }
+
+    char amzDate[17];
+    int64_t now = currentTime(amzDate, 0);
+
+    int64_t seconds = expires - now;
+    if (seconds < 1) {
+        seconds = 1;
+    }
+    else if (seconds > (7 * 24 * 60 * 60)) {
+        seconds = 7 * 24 * 60 * 60;
+    }
+
+    // The authentication parameters, which are signed along with the sub
+    // resource
+    char queryParams[S3_MAX_AUTHENTICATED_QUERY_STRING_SIZE];
+    if (snprintf(queryParams, sizeof(queryParams),
+                 "X-Amz-Algorithm=AWS4-HMAC-SHA256&X-Amz-Credential=%s/%.8s/"
+                 "%s/s3/aws4_request&X-Amz-Date=%s&X-Amz-Expires=%lld&"
+                 "X-Amz-SignedHeaders=host", bucketContext->accessKeyId,
+                 amzDate, authRegion, amzDate, (long long) seconds) >=
+        (int) sizeof(queryParams)) {
+        return S3StatusUriTooLong;
+    }
+
+    char canonicalQueryString[S3_MAX_AUTHENTICATED_QUERY_STRING_SIZE];
+    S3Status status = canonicalize_query
+        (canonicalQueryString, sizeof(canonicalQueryString) - 
+         (sizeof("&X-Amz-Signature=") + 64), resource, queryParams);
+    if (status != S3StatusOK) {
+        return status;
+    }
+
+    const char *hostName =
+        bucketContext->hostName ? bucketContext->hostName : defaultHostNameG;
+    int hasBucket = (bucketContext->bucketName && bucketContext->bucketName[0]);
+    int virtualHost = 
+        (hasBucket && (bucketContext->uriStyle == S3UriStyleVirtualHost));
+
+    // The canonical request is the key between these
+    int len = snprintf(presigner->signPrefix, sizeof(presigner->signPrefix),
+                       "GET\n/%s%s", (hasBucket && !virtualHost) ?
+                       bucketContext->bucketName : "",
+                       (hasBucket && !virtualHost) ? "/" : "");
+    if (len >= (int) sizeof(presigner->signPrefix)) {
+        return S3StatusUriTooLong;
+    }
+    presigner->signPrefixLen = len;
+
+    len = snprintf(presigner->signSuffix, sizeof(presigner->signSuffix),
+                   "\n%s\nhost:%s%s%s\n\nhost\nUNSIGNED-PAYLOAD",
+                   canonicalQueryString,
+                   virtualHost ? bucketContext->bucketName : "",
+                   virtualHost ? "." : "", hostName);
+    if (len >= (int) sizeof(presigner->signSuffix)) {
+        return S3StatusUriTooLong;
+    }
+    presigner->signSuffixLen = len;
+
+    SHA256_init(&(presigner->canonicalRequestPrefix));
+    SHA256_update(&(presigner->canonicalRequestPrefix),
+                  (const unsigned char *) presigner->signPrefix,
+                  presigner->signPrefixLen);
+
+    presigner->stringToSignPrefixLen =
+        snprintf(presigner->stringToSignPrefix,
+                 sizeof(presigner->stringToSignPrefix),
+                 "AWS4-HMAC-SHA256\n%s\n%.8s/%s/s3/aws4_request\n",
+                 amzDate, amzDate, authRegion);
+
+    char date[9];
+    snprintf(date, sizeof(date), "%.8s", amzDate);
+    request_v4_signing_key(bucketContext->secretAccessKey, date, authRegion,
+                           &(presigner->v4SigningKey));
+
+    len = snprintf(presigner->uriSuffix, sizeof(presigner->uriSuffix),
+                   "?%s&X-Amz-Signature=", canonicalQueryString);
+    if (len >= (int) sizeof(presigner->uriSuffix)) {
+        return S3StatusUriTooLong;
+    }
+    presigner->uriSuffixLen = len;
+
+    return S3StatusOK;
+}
+
+
+S3Status request_presigner_initialize(RequestPresigner *presigner,
+                                      const S3BucketContext *bucketContext,
+                                      int64_t expires, const char *resource)
 {
 #define MAX_EXPIRES (((int64_t) 1 << 31) - 1)
     // S3 seems to only accept expiration dates up to the number of seconds
@@ -1333,68 +2525,258 @@ S3Status S3_generate_authenticated_query_string
         expires = MAX_EXPIRES;
     }
 
-    // xxx todo: rework this so that it can be incorporated into shared code
-    // with request_perform().  It's really unfortunate that this code is not
-    // shared with request_perform().
+    S3SignatureVersion signatureVersion = bucketContext->signatureVersion;
+    if (signatureVersion == S3SignatureDefault) {
+        signatureVersion = defaultSignatureVersionG;
+    }
+    presigner->signatureVersion = signatureVersion;
 
-    // URL encode the key
-    char urlEncodedKey[S3_MAX_KEY_SIZE * 3];
-    if (key) {
-        urlEncode(urlEncodedKey, key, strlen(key));
+    // The URI up to the key is that of the empty key
+    S3Status status = compose_uri
+        (presigner->uriPrefix, sizeof(presigner->uriPrefix), bucketContext,
+         "", 0, 0);
+    if (status != S3StatusOK) {
+        return status;
+    }
+    presigner->uriPrefixLen = strlen(presigner->uriPrefix);
+
+    if (signatureVersion == S3SignatureV4) {
+        return presigner_initialize_v4(presigner, bucketContext, expires,
+                                       resource);
+    }
+
+    // The string to sign is:
+    // GET\n\n\n${EXPIRES}\n/[${BUCKET}]/${KEY}[?${RESOURCE}]
+    int hasBucket = (bucketContext->bucketName && bucketContext->bucketName[0]);
+    int hasResource = (resource && resource[0]);
+
+    int len = snprintf(presigner->signPrefix, sizeof(presigner->signPrefix),
+                       "GET\n\n\n%llu\n%s%s/", (unsigned long long) expires,
+                       hasBucket ? "/" : "",
+                       hasBucket ? bucketContext->bucketName : "");
+    if (len >= (int) sizeof(presigner->signPrefix)) {
+        return S3StatusUriTooLong;
+    }
+    presigner->signPrefixLen = len;
+
+    len = snprintf(presigner->signSuffix, sizeof(presigner->signSuffix),
+                   "%s%s", hasResource ? "?" : "",
+                   hasResource ? resource : "");
+    if (len >= (int) sizeof(presigner->signSuffix)) {
+        return S3StatusUriTooLong;
+    }
+    presigner->signSuffixLen = len;
+
+    request_signing_key(bucketContext->secretAccessKey,
+                        &(presigner->hmacKey));
+
+    // And the params are ?[${RESOURCE}&]AWSAccessKeyId=xxx&Expires=xxx&
+    // Signature=xxx
+    len = snprintf(presigner->uriSuffix, sizeof(presigner->uriSuffix),
+                   "?%s%sAWSAccessKeyId=%s&Expires=%ld&Signature=",
+                   hasResource ? resource : "", hasResource ? "&" : "",
+                   bucketContext->accessKeyId, (long) expires);
+    if (len >= (int) sizeof(presigner->uriSuffix)) {
+        return S3StatusUriTooLong;
+    }
+    presigner->uriSuffixLen = len;
+
+    return S3StatusOK;
+}
+
+
+S3Status request_presign(const RequestPresigner *presigner, const char *key,
+                         char *buffer, int bufferSize, int *lenReturn)
+{
+    char urlEncodedKey[MAX_URLENCODED_KEY_SIZE + 1];
+    int keyLen = (presigner->signatureVersion == S3SignatureV4) ?
+        uriEncode(urlEncodedKey, key, S3_MAX_KEY_SIZE, 0) :
+        urlEncode(urlEncodedKey, key, S3_MAX_KEY_SIZE);
+    if (keyLen < 0) {
+        return S3StatusUriTooLong;
+    }
+
+    // Room for the longest signature: 64 hex digits for Signature Version
+    // 4, or 28 URL-encoded base64 characters for 2
+    char signature[(28 * 3) + 1];
+    int signatureLen;
+
+    if (presigner->signatureVersion == S3SignatureV4) {
+        SHA256Context context = presigner->canonicalRequestPrefix;
+        SHA256_update(&context, (const unsigned char *) urlEncodedKey,
+                      keyLen);
+        SHA256_update(&context, (const unsigned char *) presigner->signSuffix,
+                      presigner->signSuffixLen);
+        unsigned char canonicalRequestHash[32];
+        SHA256_final(canonicalRequestHash, &context);
+
+        char stringToSign[sizeof(presigner->stringToSignPrefix) + 64];
+        memcpy(stringToSign, presigner->stringToSignPrefix,
+               presigner->stringToSignPrefixLen);
+        hexEncode(canonicalRequestHash, 32,
+                  &(stringToSign[presigner->stringToSignPrefixLen]));
+
+        unsigned char hmac[32];
+        HMAC_SHA256_with_key(hmac, &(presigner->v4SigningKey),
+                             (unsigned char *) stringToSign,
+                             presigner->stringToSignPrefixLen + 64);
+        hexEncode(hmac, 32, signature);
+        signatureLen = 64;
     }
     else {
-        urlEncodedKey[0] = 0;
+        char signbuf[sizeof(presigner->signPrefix) + sizeof(urlEncodedKey) +
+                     sizeof(presigner->signSuffix)];
+        int len = presigner->signPrefixLen;
+        memcpy(signbuf, presigner->signPrefix, len);
+        memcpy(&(signbuf[len]), urlEncodedKey, keyLen);
+        len += keyLen;
+        memcpy(&(signbuf[len]), presigner->signSuffix,
+               presigner->signSuffixLen);
+        len += presigner->signSuffixLen;
+
+        // Generate an HMAC-SHA-1 of the signbuf
+        unsigned char hmac[20];
+        HMAC_SHA1_with_key(hmac, &(presigner->hmacKey),
+                           (unsigned char *) signbuf, len);
+
+        // Now base-64 encode the results, and urlEncode that
+        char b64[((20 + 2) / 3) * 4 + 1];
+        b64[base64Encode(hmac, 20, b64)] = 0;
+        signatureLen = urlEncode(signature, b64, sizeof(b64));
+    }
+
+    // Finally, compose the uri
+    int len = presigner->uriPrefixLen + keyLen + presigner->uriSuffixLen +
+        signatureLen;
+    if (len >= bufferSize) {
+        return S3StatusUriTooLong;
     }
 
-    // Compute canonicalized resource
-    char canonicalizedResource[MAX_CANONICALIZED_RESOURCE_SIZE];
-    canonicalize_resource(bucketContext->bucketName, resource, urlEncodedKey,
-                          canonicalizedResource);
-                          
-    // We allow for:
-    // 17 bytes for HTTP-Verb + \n
-    // 1 byte for empty Content-MD5 + \n
-    // 1 byte for empty Content-Type + \n
-    // 20 bytes for Expires + \n
-    // 0 bytes for CanonicalizedAmzHeaders
-    // CanonicalizedResource
-    char signbuf[17 + 1 + 1 + 1 + 20 + sizeof(canonicalizedResource) + 1];
-    int len = 0;
+    char *out = buffer;
+    memcpy(out, presigner->uriPrefix, presigner->uriPrefixLen);
+    out += presigner->uriPrefixLen;
+    memcpy(out, urlEncodedKey, keyLen);
+    out += keyLen;
+    memcpy(out, presigner->uriSuffix, presigner->uriSuffixLen);
+    out += presigner->uriSuffixLen;
+    memcpy(out, signature, signatureLen + 1);
 
-#define signbuf_append(format, ...)                             \
-    len += snprintf(&(signbuf[len]), sizeof(signbuf) - len,     \
-                    format, __VA_ARGS__)
+    if (lenReturn) {
+        *lenReturn = len;
+    }
 
-    signbuf_append("%s\n", "GET"); // HTTP-Verb
-    signbuf_append("%s\n", ""); // Content-MD5
-    signbuf_append("%s\n", ""); // Content-Type
-    signbuf_append("%llu\n", (unsigned long long) expires);
-    signbuf_append("%s", canonicalizedResource);
+    return S3StatusOK;
+}
 
-    // Generate an HMAC-SHA-1 of the signbuf
-    unsigned char hmac[20];
 
-    HMAC_SHA1(hmac, (unsigned char *) bucketContext->secretAccessKey,
-              strlen(bucketContext->secretAccessKey),
-              (unsigned char *) signbuf, len);
+S3Status S3_generate_authenticated_query_string
+    (char *buffer, const S3BucketContext *bucketContext,
+     const char *key, int64_t expires, const char *resource)
+{
+    RequestPresigner presigner;
 
-    // Now base-64 encode the results
-    char b64[((20 + 1) * 4) / 3];
-    int b64Len = base64Encode(hmac, 20, b64);
+    S3Status status = request_presigner_initialize
+        (&presigner, bucketContext, expires, resource);
+    if (status != S3StatusOK) {
+        return status;
+    }
+
+    return request_presign(&presigner, key, buffer,
+                           S3_MAX_AUTHENTICATED_QUERY_STRING_SIZE, 0);
+}
+
+
+S3Status S3_create_prepared_bucket(const S3BucketContext *bucketContext,
+                                   S3PreparedBucket **preparedBucketReturn)
+{
+    S3Status status;
+
+    if (bucketContext->bucketName &&
+        ((status = S3_validate_bucket_name
+          (bucketContext->bucketName, bucketContext->uriStyle)) !=
+         S3StatusOK)) {
+        return status;
+    }
+
+    const char *authRegion = bucketContext->authRegion ?
+        bucketContext->authRegion : defaultAuthRegionG;
+    if (strlen(authRegion) >= S3_MAX_AUTH_REGION_SIZE) {
+        return S3StatusAuthRegionTooLong;
+    }
+
+    S3PreparedBucket *preparedBucket = (S3PreparedBucket *) malloc
+        (sizeof(S3PreparedBucket) + transfer_target_size(bucketContext, 0));
+    if (!preparedBucket) {
+        return S3StatusOutOfMemory;
+    }
 
-    // Now urlEncode that
-    char signature[sizeof(b64) * 3];
-    urlEncode(signature, b64, b64Len);
+    char *key;
+    transfer_copy_target(&(preparedBucket->bucketContext), &key,
+                         bucketContext, 0, (char *) &(preparedBucket[1]));
+    bucketContext = &(preparedBucket->bucketContext);
 
-    // Finally, compose the uri, with params:
-    // ?AWSAccessKeyId=xxx[&Expires=]&Signature=xxx
-    char queryParams[sizeof("AWSAccessKeyId=") + 20 + 
-                     sizeof("&Expires=") + 20 + 
-                     sizeof("&Signature=") + sizeof(signature) + 1];
+    preparedBucket->signatureVersion = bucketContext->signatureVersion;
+    if (preparedBucket->signatureVersion == S3SignatureDefault) {
+        preparedBucket->signatureVersion = defaultSignatureVersionG;
+    }
+    strcpy(preparedBucket->authRegion, authRegion);
+
+    // The URI up to the key is that of the empty key, composed before
+    // preparedBucket is set so that compose_uri does it the long way
+    preparedBucket->bucketContext.preparedBucket = 0;
+    if ((status = compose_uri
+         (preparedBucket->uriPrefix, sizeof(preparedBucket->uriPrefix),
+          bucketContext, "", 0, 0)) != S3StatusOK) {
+        free(preparedBucket);
+        return status;
+    }
+    preparedBucket->uriPrefixLen = strlen(preparedBucket->uriPrefix);
+
+    const char *hostName =
+        bucketContext->hostName ? bucketContext->hostName : defaultHostNameG;
+    int hasBucket = (bucketContext->bucketName && bucketContext->bucketName[0]);
+    int virtualHost = 
+        (hasBucket && (bucketContext->uriStyle == S3UriStyleVirtualHost));
+
+    preparedBucket->resourcePrefixLen = snprintf
+        (preparedBucket->resourcePrefix,
+         sizeof(preparedBucket->resourcePrefix), "%s%s/",
+         hasBucket ? "/" : "", hasBucket ? bucketContext->bucketName : "");
+
+    snprintf(preparedBucket->canonicalUriPrefix,
+             sizeof(preparedBucket->canonicalUriPrefix), "/%s%s",
+             (hasBucket && !virtualHost) ? bucketContext->bucketName : "",
+             (hasBucket && !virtualHost) ? "/" : "");
+
+    if (snprintf(preparedBucket->host, sizeof(preparedBucket->host),
+                 "%s%s%s", virtualHost ? bucketContext->bucketName : "",
+                 virtualHost ? "." : "", hostName) >=
+        (int) sizeof(preparedBucket->host)) {
+        free(preparedBucket);
+        return S3StatusUriTooLong;
+    }
+
+    HMAC_SHA1_key_initialize
+        (&(preparedBucket->signingKey),
+         (const unsigned char *) bucketContext->secretAccessKey,
+         strlen(bucketContext->secretAccessKey));
 
-    sprintf(queryParams, "AWSAccessKeyId=%s&Expires=%ld&Signature=%s",
-            bucketContext->accessKeyId, (long) expires, signature);
+    preparedBucket->bucketContext.preparedBucket = preparedBucket;
 
-    return compose_uri(buffer, S3_MAX_AUTHENTICATED_QUERY_STRING_SIZE,
-                       bucketContext, urlEncodedKey, resource, queryParams);
+    *preparedBucketReturn = preparedBucket;
+
+    return S3StatusOK;
+}
+
+
+void S3_destroy_prepared_bucket(S3PreparedBucket *preparedBucket)
+{
+    free(preparedBucket);
+}
+
+
+const S3BucketContext *S3_get_prepared_bucket_context
+    (const S3PreparedBucket *preparedBucket)
+{
+    return &(preparedBucket->bucketContext);
 }
@@ -25,12 +25,84 @@
  ************************************************************************** **/
 
 #include <curl/curl.h>
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/select.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+#endif
 #include "request.h"
 #include "request_context.h"
 
 
+// The maximum number of socket events processed per epoll_wait
+#define EPOLL_EVENTS_SIZE 256
+
+
+#ifdef __linux__
+
+static int64_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (((int64_t) ts.tv_sec) * 1000) + (ts.tv_nsec / 1000000);
+}
+
+
+// Called by curl whenever the events it is interested in for a socket change
+static int curl_socket_func(CURL *easy, curl_socket_t s, int what,
+                            void *userp, void *socketp)
+{
+    S3RequestContext *requestContext = (S3RequestContext *) userp;
+
+    (void) easy;
+
+    if (what == CURL_POLL_REMOVE) {
+        // The socket may well have been closed already, in which case the
+        // kernel has already removed it from the epoll set
+        epoll_ctl(requestContext->epollFd, EPOLL_CTL_DEL, s, 0);
+        return 0;
+    }
+
+    struct epoll_event event;
+    event.events = (((what & CURL_POLL_IN) ? EPOLLIN : 0) |
+                    ((what & CURL_POLL_OUT) ? EPOLLOUT : 0));
+    event.data.fd = s;
+
+    // socketp is set once the socket has been added to the epoll set
+    if (socketp) {
+        epoll_ctl(requestContext->epollFd, EPOLL_CTL_MOD, s, &event);
+    }
+    else if (!epoll_ctl(requestContext->epollFd, EPOLL_CTL_ADD, s, &event) ||
+             ((errno == EEXIST) &&
+              !epoll_ctl(requestContext->epollFd, EPOLL_CTL_MOD, s, &event))) {
+        curl_multi_assign(requestContext->curlm, s, requestContext);
+    }
+
+    return 0;
+}
+
+
+// Called by curl whenever the time at which it next needs to be run for its
+// timeouts changes
+static int curl_timer_func(CURLM *multi, long timeout_ms, void *userp)
+{
+    S3RequestContext *requestContext = (S3RequestContext *) userp;
+
+    (void) multi;
+
+    requestContext->timerDeadline =
+        (timeout_ms < 0) ? -1 : (now_ms() + timeout_ms);
+
+    return 0;
+}
+
+#endif
+
+
 S3Status S3_create_request_context(S3RequestContext **requestContextReturn)
 {
     *requestContextReturn = 
@@ -47,6 +119,34 @@ S3Status S3_create_request_context(S3RequestContext **requestContextReturn)
 
     (*requestContextReturn)->requests = 0;
 
+    (*requestContextReturn)->requestCount = 0;
+
+    memset(&((*requestContextReturn)->transportProperties), 0,
+           sizeof(S3TransportProperties));
+
+#ifdef __linux__
+    S3RequestContext *requestContext = *requestContextReturn;
+
+    requestContext->timerDeadline = -1;
+
+    if ((requestContext->epollFd = epoll_create(EPOLL_EVENTS_SIZE)) == -1) {
+        curl_multi_cleanup(requestContext->curlm);
+        free(requestContext);
+        return (errno == ENOMEM) ? S3StatusOutOfMemory : S3StatusInternalError;
+    }
+
+    // Have curl tell us about its sockets and timeouts as they change, so
+    // that only the sockets which are ready need to be looked at
+    curl_multi_setopt(requestContext->curlm, CURLMOPT_SOCKETFUNCTION,
+                      &curl_socket_func);
+    curl_multi_setopt(requestContext->curlm, CURLMOPT_SOCKETDATA,
+                      requestContext);
+    curl_multi_setopt(requestContext->curlm, CURLMOPT_TIMERFUNCTION,
+                      &curl_timer_func);
+    curl_multi_setopt(requestContext->curlm, CURLMOPT_TIMERDATA,
+                      requestContext);
+#endif
+
     return S3StatusOK;
 }
 
@@ -55,6 +155,10 @@ void S3_destroy_request_context(S3RequestContext *requestContext)
 {
     curl_multi_cleanup(requestContext->curlm);
 
+#ifdef __linux__
+    close(requestContext->epollFd);
+#endif
+
     // For each request in the context, call back its done method with
     // 'interrupted' status
     Request *r = requestContext->requests, *rFirst = r;
@@ -70,32 +174,112 @@ void S3_destroy_request_context(S3RequestContext *requestContext)
 }
 
 
+// Finishes every request that curl has completed.  Returns nonzero in
+// [requestsFinishedReturn] if any were finished, since their callbacks may
+// have added new requests to the context.
+static S3Status finish_completed_requests(S3RequestContext *requestContext,
+                                          int *requestsFinishedReturn)
+{
+    CURLMsg *msg;
+    int junk;
+
+    *requestsFinishedReturn = 0;
+
+    while ((msg = curl_multi_info_read(requestContext->curlm, &junk))) {
+        if (msg->msg != CURLMSG_DONE) {
+            return S3StatusInternalError;
+        }
+        Request *request;
+        if (curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, 
+                              (char **) (char *) &request) != CURLE_OK) {
+            return S3StatusInternalError;
+        }
+        // Remove the request from the list of requests
+        if (request->next == request) {
+            // It was the only one on the list
+            requestContext->requests = 0;
+        }
+        else {
+            // It doesn't matter what the order of them are, so just in
+            // case request was at the head of the list, put the one after
+            // request to the head of the list
+            requestContext->requests = request->next;
+            request->prev->next = request->next;
+            request->next->prev = request->prev;
+        }
+        requestContext->requestCount--;
+        if ((msg->data.result != CURLE_OK) &&
+            (request->status == S3StatusOK)) {
+            request->status = request_curl_code_to_status
+                (msg->data.result);
+        }
+        if (curl_multi_remove_handle(requestContext->curlm, 
+                                     msg->easy_handle) != CURLM_OK) {
+            return S3StatusInternalError;
+        }
+        // Finish the request, ensuring that all callbacks have been made,
+        // and also releases the request
+        request_finish(request);
+        *requestsFinishedReturn = 1;
+    }
+
+    return S3StatusOK;
+}
+
+
+#ifndef __linux__
+
+// Waits for up to [timeout] milliseconds (-1 for no limit) for I/O on the
+// fdsets of the context
+static S3Status select_request_context(S3RequestContext *requestContext,
+                                       int64_t timeout)
+{
+    fd_set readfds, writefds, exceptfds;
+    FD_ZERO(&readfds);
+    FD_ZERO(&writefds);
+    FD_ZERO(&exceptfds);
+    int maxfd;
+    S3Status status = S3_get_request_context_fdsets
+        (requestContext, &readfds, &writefds, &exceptfds, &maxfd);
+    if (status != S3StatusOK) {
+        return status;
+    }
+    int64_t curlTimeout = S3_get_request_context_timeout(requestContext);
+    if ((timeout == -1) ||
+        ((curlTimeout != -1) && (curlTimeout < timeout))) {
+        timeout = curlTimeout;
+    }
+    // curl will return -1 if it hasn't even created any fds yet because
+    // none of the connections have started yet.  In this case, don't
+    // do the select at all, because it will wait forever; instead, just
+    // skip it and go straight to running the underlying CURL handles
+    if (maxfd != -1) {
+        struct timeval tv = { timeout / 1000, (timeout % 1000) * 1000 };
+        select(maxfd + 1, &readfds, &writefds, &exceptfds,
+               (timeout == -1) ? 0 : &tv);
+    }
+
+    return S3StatusOK;
+}
+
+#endif
+
+
 S3Status S3_runall_request_context(S3RequestContext *requestContext)
 {
     int requestsRemaining;
     do {
-        fd_set readfds, writefds, exceptfds;
-        FD_ZERO(&readfds);
-        FD_ZERO(&writefds);
-        FD_ZERO(&exceptfds);
-        int maxfd;
-        S3Status status = S3_get_request_context_fdsets
-            (requestContext, &readfds, &writefds, &exceptfds, &maxfd);
+#ifdef __linux__
+        S3Status status = S3_process_request_context
+            (requestContext, -1, &requestsRemaining);
+#else
+        S3Status status = select_request_context(requestContext, -1);
         if (status != S3StatusOK) {
             return status;
         }
-        // curl will return -1 if it hasn't even created any fds yet because
-        // none of the connections have started yet.  In this case, don't
-        // do the select at all, because it will wait forever; instead, just
-        // skip it and go straight to running the underlying CURL handles
-        if (maxfd != -1) {
-            int64_t timeout = S3_get_request_context_timeout(requestContext);
-            struct timeval tv = { timeout / 1000, (timeout % 1000) * 1000 };
-            select(maxfd + 1, &readfds, &writefds, &exceptfds,
-                   (timeout == -1) ? 0 : &tv);
-        }
         status = S3_runonce_request_context(requestContext,
                                             &requestsRemaining);
+#endif
         if (status != S3StatusOK) {
             return status;
         }
@@ -124,44 +308,15 @@ S3Status S3_runonce_request_context(S3RequestContext *requestContext,
             return S3StatusInternalError;
         }
 
-        CURLMsg *msg;
-        int junk;
-        while ((msg = curl_multi_info_read(requestContext->curlm, &junk))) {
-            if (msg->msg != CURLMSG_DONE) {
-                return S3StatusInternalError;
-            }
-            Request *request;
-            if (curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, 
-                                  (char **) (char *) &request) != CURLE_OK) {
-                return S3StatusInternalError;
-            }
-            // Remove the request from the list of requests
-            if (request->prev == request->next) {
-                // It was the only one on the list
-                requestContext->requests = 0;
-            }
-            else {
-                // It doesn't matter what the order of them are, so just in
-                // case request was at the head of the list, put the one after
-                // request to the head of the list
-                requestContext->requests = request->next;
-                request->prev->next = request->next;
-                request->next->prev = request->prev;
-            }
-            if ((msg->data.result != CURLE_OK) &&
-                (request->status == S3StatusOK)) {
-                request->status = request_curl_code_to_status
-                    (msg->data.result);
-            }
-            if (curl_multi_remove_handle(requestContext->curlm, 
-                                         msg->easy_handle) != CURLM_OK) {
-                return S3StatusInternalError;
-            }
-            // Finish the request, ensuring that all callbacks have been made,
-            // and also releases the request
-            request_finish(request);
-            // Now, since a callback was made, there may be new requests 
-            // queued up to be performed immediately, so do so
+        int requestsFinished;
+        S3Status s3Status = finish_completed_requests(requestContext,
+                                                      &requestsFinished);
+        if (s3Status != S3StatusOK) {
+            return s3Status;
+        }
+        // Now, since a callback was made, there may be new requests queued
+        // up to be performed immediately, so do so
+        if (requestsFinished) {
             status = CURLM_CALL_MULTI_PERFORM;
         }
     } while (status == CURLM_CALL_MULTI_PERFORM);
@@ -169,6 +324,133 @@ S3Status S3_runonce_request_context(S3RequestContext *requestContext,
     return S3StatusOK;
 }
 
+
+S3Status S3_process_request_context(S3RequestContext *requestContext,
+                                    int timeout, int *requestsRemainingReturn)
+{
+#ifdef __linux__
+    if (!requestContext->requestCount) {
+        *requestsRemainingReturn = 0;
+        return S3StatusOK;
+    }
+
+    // Wait no longer than curl's next timeout
+    int64_t now = now_ms();
+    if (requestContext->timerDeadline != -1) {
+        int64_t untilDeadline = requestContext->timerDeadline - now;
+        if (untilDeadline < 0) {
+            untilDeadline = 0;
+        }
+        if ((timeout < 0) || (untilDeadline < timeout)) {
+            timeout = (int) untilDeadline;
+        }
+    }
+
+    struct epoll_event events[EPOLL_EVENTS_SIZE];
+    int count = epoll_wait(requestContext->epollFd, events,
+                           EPOLL_EVENTS_SIZE, timeout);
+    if (count == -1) {
+        if (errno != EINTR) {
+            return S3StatusInternalError;
+        }
+        count = 0;
+    }
+
+    int running, i;
+    CURLMcode code = CURLM_OK;
+    for (i = 0; (i < count) && (code == CURLM_OK); i++) {
+        int mask = (((events[i].events & EPOLLIN) ? CURL_CSELECT_IN : 0) |
+                    ((events[i].events & EPOLLOUT) ? CURL_CSELECT_OUT : 0) |
+                    ((events[i].events & (EPOLLERR | EPOLLHUP)) ?
+                     CURL_CSELECT_ERR : 0));
+        code = curl_multi_socket_action(requestContext->curlm,
+                                        events[i].data.fd, mask, &running);
+    }
+
+    if ((code == CURLM_OK) && (requestContext->timerDeadline != -1) &&
+        (requestContext->timerDeadline <= now_ms())) {
+        requestContext->timerDeadline = -1;
+        code = curl_multi_socket_action(requestContext->curlm,
+                                        CURL_SOCKET_TIMEOUT, 0, &running);
+    }
+
+    switch (code) {
+    case CURLM_OK:
+        break;
+    case CURLM_OUT_OF_MEMORY:
+        return S3StatusOutOfMemory;
+    default:
+        return S3StatusInternalError;
+    }
+
+    // Requests added by the callbacks of finished requests have set curl's
+    // timer to expire immediately, so they are started by the next call
+    int requestsFinished;
+    S3Status status = finish_completed_requests(requestContext,
+                                                &requestsFinished);
+
+    *requestsRemainingReturn = requestContext->requestCount;
+
+    return status;
+#else
+    S3Status status = select_request_context(requestContext, timeout);
+    if (status != S3StatusOK) {
+        return status;
+    }
+
+    return S3_runonce_request_context(requestContext,
+                                      requestsRemainingReturn);
+#endif
+}
+
+
+int S3_get_request_context_epoll_fd(S3RequestContext *requestContext)
+{
+#ifdef __linux__
+    return requestContext->epollFd;
+#else
+    (void) requestContext;
+    return -1;
+#endif
+}
+
+
+S3Status S3_set_request_context_transport
+    (S3RequestContext *requestContext,
+     const S3TransportProperties *transportProperties)
+{
+    S3TransportProperties defaults;
+
+    if (!transportProperties) {
+        memset(&defaults, 0, sizeof(defaults));
+        transportProperties = &defaults;
+    }
+
+    // Multiplexing only ever happens over HTTP/2 connections, but make the
+    // policy explicit rather than relying on the libcurl default
+    long pipelining = (transportProperties->httpVersion == S3HttpVersion1_1) ?
+        CURLPIPE_NOTHING : CURLPIPE_MULTIPLEX;
+    long maxStreams = transportProperties->maxStreamsPerConnection ?
+        transportProperties->maxStreamsPerConnection : 100;
+
+    if ((curl_multi_setopt(requestContext->curlm, CURLMOPT_PIPELINING,
+                           pipelining) != CURLM_OK) ||
+        (curl_multi_setopt(requestContext->curlm,
+                           CURLMOPT_MAX_HOST_CONNECTIONS, (long) 
+                           transportProperties->maxConnectionsPerHost)
+         != CURLM_OK) ||
+        (curl_multi_setopt(requestContext->curlm,
+                           CURLMOPT_MAX_CONCURRENT_STREAMS, maxStreams)
+         != CURLM_OK)) {
+        return S3StatusInternalError;
+    }
+
+    requestContext->transportProperties = *transportProperties;
+
+    return S3StatusOK;
+}
+
+
 S3Status S3_get_request_context_fdsets(S3RequestContext *requestContext,
                                        fd_set *readFdSet, fd_set *writeFdSet,
                                        fd_set *exceptFdSet, int *maxFd)
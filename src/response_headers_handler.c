@@ -25,6 +25,7 @@
  ************************************************************************** **/
 
 #include <ctype.h>
+#include <stdio.h>
 #include <string.h>
 #include "response_headers_handler.h"
 
@@ -42,6 +43,8 @@ void response_headers_handler_initialize(ResponseHeadersHandler *handler)
     handler->responseProperties.metaData = 0;
     handler->responseProperties.usesServerSideEncryption = 0;
     handler->done = 0;
+    handler->serverSideEncryption[0] = 0;
+    handler->customerEncryption = 0;
     string_multibuffer_initialize(handler->responsePropertyStrings);
     string_multibuffer_initialize(handler->responseMetaDataStrings);
 }
@@ -193,9 +196,14 @@ void response_headers_handler_add(ResponseHeadersHandler *handler,
         if (!strncmp(c, "AES256", sizeof("AES256") - 1)) {
             responseProperties->usesServerSideEncryption = 1;
         }
-        // Ignore other values - only AES256 is expected, anything else is
-        // assumed to be "None" or some other value indicating no server-side
-        // encryption
+        // Other values, such as aws:kms, are not reported as server-side
+        // encryption, but are kept so that the ETag is not taken as an MD5
+        snprintf(handler->serverSideEncryption,
+                 sizeof(handler->serverSideEncryption), "%s", c);
+    }
+    else if (!strncmp(header, "x-amz-server-side-encryption-customer-"
+                      "algorithm", namelen)) {
+        handler->customerEncryption = 1;
     }
 }
 
@@ -51,9 +51,6 @@
 #define SLEEP_UNITS_PER_SECOND 1
 #endif
 
-// Also needed for Windows, because somehow MinGW doesn't define this
-extern int putenv(char *);
-
 
 // Command-line options, saved as globals ------------------------------------
 
@@ -62,6 +59,8 @@ static int showResponsePropertiesG = 0;
 static S3Protocol protocolG = S3ProtocolHTTPS;
 static S3UriStyle uriStyleG = S3UriStylePath;
 static int retriesG = 5;
+static S3SignatureVersion signatureVersionG = S3SignatureV2;
+static const char *authRegionG = 0;
 
 
 // Environment variables, saved as globals ----------------------------------
@@ -76,11 +75,6 @@ static int statusG = 0;
 static char errorDetailsG[4096] = { 0 };
 
 
-// Other globals -------------------------------------------------------------
-
-static char putenvBufG[256];
-
-
 // Option prefixes -----------------------------------------------------------
 
 #define LOCATION_PREFIX "location="
@@ -132,8 +126,14 @@ static char putenvBufG[256];
 #define BYTE_COUNT_PREFIX_LEN (sizeof(BYTE_COUNT_PREFIX) - 1)
 #define ALL_DETAILS_PREFIX "allDetails="
 #define ALL_DETAILS_PREFIX_LEN (sizeof(ALL_DETAILS_PREFIX) - 1)
+#define PART_SIZE_PREFIX "partSize="
+#define PART_SIZE_PREFIX_LEN (sizeof(PART_SIZE_PREFIX) - 1)
+#define CONCURRENCY_PREFIX "concurrency="
+#define CONCURRENCY_PREFIX_LEN (sizeof(CONCURRENCY_PREFIX) - 1)
 #define NO_STATUS_PREFIX "noStatus="
 #define NO_STATUS_PREFIX_LEN (sizeof(NO_STATUS_PREFIX) - 1)
+#define VERIFY_MD5_PREFIX "verifyMd5="
+#define VERIFY_MD5_PREFIX_LEN (sizeof(VERIFY_MD5_PREFIX) - 1)
 #define RESOURCE_PREFIX "resource="
 #define RESOURCE_PREFIX_LEN (sizeof(RESOURCE_PREFIX) - 1)
 #define TARGET_BUCKET_PREFIX "targetBucket="
@@ -155,6 +155,13 @@ static void S3_init()
                 S3_get_status_name(status));
         exit(-1);
     }
+
+    if ((status = S3_set_default_signature_version
+         (signatureVersionG, authRegionG)) != S3StatusOK) {
+        fprintf(stderr, "Failed to set signature version: %s\n",
+                S3_get_status_name(status));
+        exit(-1);
+    }
 }
 
 
@@ -184,6 +191,10 @@ static void usageExit(FILE *out)
 "   -s/--show-properties : show response properties on stdout\n"
 "   -r/--retries         : retry retryable failures this number of times\n"
 "                          (default is 5)\n"
+"   -4/--sigv4           : sign requests with AWS Signature Version 4\n"
+"                          (default is Signature Version 2)\n"
+"   -R/--region          : region to sign requests for with Signature\n"
+"                          Version 4 (default is us-east-1)\n"
 "\n"
 "   Environment:\n"
 "\n"
@@ -243,8 +254,10 @@ static void usageExit(FILE *out)
 "     <bucket>/<key>     : Bucket/key to put object to\n"
 "     [filename]         : Filename to read source data from "
                           "(default is stdin)\n"
-"     [contentLength]    : How many bytes of source data to put (required if\n"
-"                          source file is stdin)\n"
+"     [contentLength]    : How many bytes of source data to put; if not\n"
+"                          given when the source is stdin, stdin is read\n"
+"                          to its end and, if it is longer than one part,\n"
+"                          uploaded in parts as it is read\n"
 "     [cacheControl]     : Cache-Control HTTP header string to associate with\n"
 "                          object\n"
 "     [contentType]      : Content-Type HTTP header string to associate with\n"
@@ -259,6 +272,16 @@ static void usageExit(FILE *out)
 "     [x-amz-meta-...]]  : Metadata headers to associate with the object\n"
 "     [useServerSideEncryption] : Whether or not to use server-side\n"
 "                          encryption for the object\n"
+"     [partSize]         : Upload the object in parts of this many bytes\n"
+"                          (objects larger than 5 GB are always uploaded in\n"
+"                          parts); when stdin of unknown length is uploaded,\n"
+"                          parts double in size every 1000 parts, up to\n"
+"                          5 GB, and the upload is aborted if stdin does not\n"
+"                          fit in 10000 parts\n"
+"     [concurrency]      : Maximum number of parts to upload at once\n"
+"     [verifyMd5]        : Whether or not to check the MD5 of the data sent\n"
+"                          against the ETag returned, where the ETag is an\n"
+"                          MD5\n"
 "\n"
 "   copy                 : Copies an object; if any options are set, the "
                           "entire\n"
@@ -294,6 +317,10 @@ static void usageExit(FILE *out)
 "                          match this string\n"
 "     [startByte]        : First byte of byte range to return\n"
 "     [byteCount]        : Number of bytes of byte range to return\n"
+"     [partSize]         : Get the object with concurrent requests for "
+                          "ranges\n"
+"                          of this many bytes\n"
+"     [concurrency]      : Maximum number of ranges to get at once\n"
 "\n"
 "   head                 : Gets only the headers of an object, implies -s\n"
 "     <bucket>/<key>     : Bucket/key of object to get headers of\n"
@@ -357,192 +384,6 @@ static uint64_t convertInt(const char *str, const char *paramName)
 }
 
 
-typedef struct growbuffer
-{
-    // The total number of bytes, and the start byte
-    int size;
-    // The start byte
-    int start;
-    // The blocks
-    char data[64 * 1024];
-    struct growbuffer *prev, *next;
-} growbuffer;
-
-
-// returns nonzero on success, zero on out of memory
-static int growbuffer_append(growbuffer **gb, const char *data, int dataLen)
-{
-    while (dataLen) {
-        growbuffer *buf = *gb ? (*gb)->prev : 0;
-        if (!buf || (buf->size == sizeof(buf->data))) {
-            buf = (growbuffer *) malloc(sizeof(growbuffer));
-            if (!buf) {
-                return 0;
-            }
-            buf->size = 0;
-            buf->start = 0;
-            if (*gb) {
-                buf->prev = (*gb)->prev;
-                buf->next = *gb;
-                (*gb)->prev->next = buf;
-                (*gb)->prev = buf;
-            }
-            else {
-                buf->prev = buf->next = buf;
-                *gb = buf;
-            }
-        }
-
-        int toCopy = (sizeof(buf->data) - buf->size);
-        if (toCopy > dataLen) {
-            toCopy = dataLen;
-        }
-
-        memcpy(&(buf->data[buf->size]), data, toCopy);
-        
-        buf->size += toCopy, data += toCopy, dataLen -= toCopy;
-    }
-
-    return 1;
-}
-
-
-static void growbuffer_read(growbuffer **gb, int amt, int *amtReturn, 
-                            char *buffer)
-{
-    *amtReturn = 0;
-
-    growbuffer *buf = *gb;
-
-    if (!buf) {
-        return;
-    }
-
-    *amtReturn = (buf->size > amt) ? amt : buf->size;
-
-    memcpy(buffer, &(buf->data[buf->start]), *amtReturn);
-    
-    buf->start += *amtReturn, buf->size -= *amtReturn;
-
-    if (buf->size == 0) {
-        if (buf->next == buf) {
-            *gb = 0;
-        }
-        else {
-            *gb = buf->next;
-            buf->prev->next = buf->next;
-            buf->next->prev = buf->prev;
-        }
-        free(buf);
-    }
-}
-
-
-static void growbuffer_destroy(growbuffer *gb)
-{
-    growbuffer *start = gb;
-
-    while (gb) {
-        growbuffer *next = gb->next;
-        free(gb);
-        gb = (next == start) ? 0 : next;
-    }
-}
-
-
-// Convenience utility for making the code look nicer.  Tests a string
-// against a format; only the characters specified in the format are
-// checked (i.e. if the string is longer than the format, the string still
-// checks out ok).  Format characters are:
-// d - is a digit
-// anything else - is that character
-// Returns nonzero the string checks out, zero if it does not.
-static int checkString(const char *str, const char *format)
-{
-    while (*format) {
-        if (*format == 'd') {
-            if (!isdigit(*str)) {
-                return 0;
-            }
-        }
-        else if (*str != *format) {
-            return 0;
-        }
-        str++, format++;
-    }
-
-    return 1;
-}
-
-
-static int64_t parseIso8601Time(const char *str)
-{
-    // Check to make sure that it has a valid format
-    if (!checkString(str, "dddd-dd-ddTdd:dd:dd")) {
-        return -1;
-    }
-
-#define nextnum() (((*str - '0') * 10) + (*(str + 1) - '0'))
-
-    // Convert it
-    struct tm stm;
-    memset(&stm, 0, sizeof(stm));
-
-    stm.tm_year = (nextnum() - 19) * 100;
-    str += 2;
-    stm.tm_year += nextnum();
-    str += 3;
-
-    stm.tm_mon = nextnum() - 1;
-    str += 3;
-
-    stm.tm_mday = nextnum();
-    str += 3;
-
-    stm.tm_hour = nextnum();
-    str += 3;
-
-    stm.tm_min = nextnum();
-    str += 3;
-
-    stm.tm_sec = nextnum();
-    str += 2;
-
-    stm.tm_isdst = -1;
-
-    // This is hokey but it's the recommended way ...
-    char *tz = getenv("TZ");
-    snprintf(putenvBufG, sizeof(putenvBufG), "TZ=UTC");
-    putenv(putenvBufG);
-
-    int64_t ret = mktime(&stm);
-
-    snprintf(putenvBufG, sizeof(putenvBufG), "TZ=%s", tz ? tz : "");
-    putenv(putenvBufG);
-
-    // Skip the millis
-
-    if (*str == '.') {
-        str++;
-        while (isdigit(*str)) {
-            str++;
-        }
-    }
-    
-    if (checkString(str, "-dd:dd") || checkString(str, "+dd:dd")) {
-        int sign = (*str++ == '-') ? -1 : 1;
-        int hours = nextnum();
-        str += 3;
-        int minutes = nextnum();
-        ret += (-sign * (((hours * 60) + minutes) * 60));
-    }
-    // Else it should be Z to be a conformant time string, but we just assume
-    // that it is rather than enforcing that
-
-    return ret;
-}
-
-
 // Simple ACL format:  Lines of this format:
 // Type - ignored
 // Starting with a dash - ignored
@@ -702,6 +543,8 @@ static struct option longOptionsG[] =
     { "unencrypted",          no_argument,        0,  'u' },
     { "show-properties",      no_argument,        0,  's' },
     { "retries",              required_argument,  0,  'r' },
+    { "sigv4",                no_argument,        0,  '4' },
+    { "region",               required_argument,  0,  'R' },
     { 0,                      0,                  0,   0  }
 };
 
@@ -1212,13 +1055,18 @@ static void list_bucket(const char *bucketName, const char *prefix,
         protocolG,
         uriStyleG,
         accessKeyIdG,
-        secretAccessKeyG
+        secretAccessKeyG,
+        S3SignatureDefault,
+        0,
+        0
     };
 
     S3ListBucketHandler listBucketHandler =
     {
         { &responsePropertiesCallback, &responseCompleteCallback },
-        &listBucketCallback
+        &listBucketCallback,
+        0,
+        0
     };
 
     list_bucket_callback_data data;
@@ -1332,7 +1180,10 @@ static void delete_object(int argc, char **argv, int optindex)
         protocolG,
         uriStyleG,
         accessKeyIdG,
-        secretAccessKeyG
+        secretAccessKeyG,
+        S3SignatureDefault,
+        0,
+        0
     };
 
     S3ResponseHandler responseHandler =
@@ -1356,15 +1207,43 @@ static void delete_object(int argc, char **argv, int optindex)
 
 // put object ----------------------------------------------------------------
 
+// How much of data of unknown length is read before deciding whether to put
+// it as a single object or in parts, when no partSize is given; this is the
+// default part size of S3_put_object_multipart()
+#define STREAM_FIRST_PART_SIZE (8LL * 1024 * 1024)
+
 typedef struct put_object_callback_data
 {
     FILE *infile;
-    growbuffer *gb;
+    // Set if the data is read until the end of infile, its length being
+    // unknown
+    int streaming;
     uint64_t contentLength, originalContentLength;
     int noStatus;
+    // The data read from infile ahead of the upload, which is sent before
+    // anything further is read from infile
+    char *buffer;
+    uint64_t bufferLength, bufferOffset;
 } put_object_callback_data;
 
 
+static int put_object_read(put_object_callback_data *data, char *buffer,
+                           int size)
+{
+    if (data->bufferOffset < data->bufferLength) {
+        uint64_t remaining = data->bufferLength - data->bufferOffset;
+        if (remaining < (unsigned) size) {
+            size = remaining;
+        }
+        memcpy(buffer, &(data->buffer[data->bufferOffset]), size);
+        data->bufferOffset += size;
+        return size;
+    }
+
+    return data->infile ? fread(buffer, 1, size, data->infile) : 0;
+}
+
+
 static int putObjectDataCallback(int bufferSize, char *buffer,
                                  void *callbackData)
 {
@@ -1373,15 +1252,14 @@ static int putObjectDataCallback(int bufferSize, char *buffer,
     
     int ret = 0;
 
+    if (data->streaming) {
+        return put_object_read(data, buffer, bufferSize);
+    }
+
     if (data->contentLength) {
         int toRead = ((data->contentLength > (unsigned) bufferSize) ?
                       (unsigned) bufferSize : data->contentLength);
-        if (data->gb) {
-            growbuffer_read(&(data->gb), toRead, &ret, buffer);
-        }
-        else if (data->infile) {
-            ret = fread(buffer, 1, toRead, data->infile);
-        }
+        ret = put_object_read(data, buffer, toRead);
     }
 
     data->contentLength -= ret;
@@ -1432,7 +1310,10 @@ static void put_object(int argc, char **argv, int optindex)
     int metaPropertiesCount = 0;
     S3NameValue metaProperties[S3_MAX_METADATA_COUNT];
     char useServerSideEncryption = 0;
+    uint64_t partSize = 0;
+    int concurrency = 0;
     int noStatus = 0;
+    int verifyMd5 = 0;
 
     while (optindex < argc) {
         char *param = argv[optindex++];
@@ -1443,11 +1324,6 @@ static void put_object(int argc, char **argv, int optindex)
                           CONTENT_LENGTH_PREFIX_LEN)) {
             contentLength = convertInt(&(param[CONTENT_LENGTH_PREFIX_LEN]),
                                        "contentLength");
-            if (contentLength > (5LL * 1024 * 1024 * 1024)) {
-                fprintf(stderr, "\nERROR: contentLength must be no greater "
-                        "than 5 GB\n");
-                usageExit(stderr);
-            }
         }
         else if (!strncmp(param, CACHE_CONTROL_PREFIX, 
                           CACHE_CONTROL_PREFIX_LEN)) {
@@ -1470,7 +1346,7 @@ static void put_object(int argc, char **argv, int optindex)
             contentEncoding = &(param[CONTENT_ENCODING_PREFIX_LEN]);
         }
         else if (!strncmp(param, EXPIRES_PREFIX, EXPIRES_PREFIX_LEN)) {
-            expires = parseIso8601Time(&(param[EXPIRES_PREFIX_LEN]));
+            expires = S3_parse_iso8601_time(&(param[EXPIRES_PREFIX_LEN]));
             if (expires < 0) {
                 fprintf(stderr, "\nERROR: Invalid expires time "
                         "value; ISO 8601 time format required\n");
@@ -1528,6 +1404,18 @@ static void put_object(int argc, char **argv, int optindex)
                 usageExit(stderr);
             }
         }
+        else if (!strncmp(param, PART_SIZE_PREFIX, PART_SIZE_PREFIX_LEN)) {
+            partSize = convertInt(&(param[PART_SIZE_PREFIX_LEN]), "partSize");
+            if (partSize < S3_MULTIPART_MIN_PART_SIZE) {
+                fprintf(stderr, "\nERROR: partSize must be at least %llu\n",
+                        (unsigned long long) S3_MULTIPART_MIN_PART_SIZE);
+                usageExit(stderr);
+            }
+        }
+        else if (!strncmp(param, CONCURRENCY_PREFIX, CONCURRENCY_PREFIX_LEN)) {
+            concurrency = convertInt(&(param[CONCURRENCY_PREFIX_LEN]),
+                                     "concurrency");
+        }
         else if (!strncmp(param, NO_STATUS_PREFIX, NO_STATUS_PREFIX_LEN)) {
             const char *ns = &(param[NO_STATUS_PREFIX_LEN]);
             if (!strcmp(ns, "true") || !strcmp(ns, "TRUE") || 
@@ -1536,6 +1424,14 @@ static void put_object(int argc, char **argv, int optindex)
                 noStatus = 1;
             }
         }
+        else if (!strncmp(param, VERIFY_MD5_PREFIX, VERIFY_MD5_PREFIX_LEN)) {
+            const char *val = &(param[VERIFY_MD5_PREFIX_LEN]);
+            if (!strcmp(val, "true") || !strcmp(val, "TRUE") || 
+                !strcmp(val, "yes") || !strcmp(val, "YES") ||
+                !strcmp(val, "1")) {
+                verifyMd5 = 1;
+            }
+        }
         else {
             fprintf(stderr, "\nERROR: Unknown param: %s\n", param);
             usageExit(stderr);
@@ -1545,8 +1441,10 @@ static void put_object(int argc, char **argv, int optindex)
     put_object_callback_data data;
 
     data.infile = 0;
-    data.gb = 0;
+    data.streaming = 0;
     data.noStatus = noStatus;
+    data.buffer = 0;
+    data.bufferLength = data.bufferOffset = 0;
 
     if (filename) {
         if (!contentLength) {
@@ -1569,29 +1467,34 @@ static void put_object(int argc, char **argv, int optindex)
         }
     }
     else {
-        // Read from stdin.  If contentLength is not provided, we have
-        // to read it all in to get contentLength.
-        if (!contentLength) {
-            // Read all if stdin to get the data
-            char buffer[64 * 1024];
-            while (1) {
-                int amtRead = fread(buffer, 1, sizeof(buffer), stdin);
-                if (amtRead == 0) {
-                    break;
-                }
-                if (!growbuffer_append(&(data.gb), buffer, amtRead)) {
-                    fprintf(stderr, "\nERROR: Out of memory while reading "
-                            "stdin\n");
-                    exit(-1);
-                }
-                contentLength += amtRead;
-                if (amtRead < (int) sizeof(buffer)) {
-                    break;
-                }
-            }
+        // Read from stdin.  If contentLength is not provided, the data is
+        // streamed up to the end of stdin in a multipart upload, unless it
+        // ends within the first part, in which case it is put as a single
+        // object, which costs one request rather than three.
+        data.infile = stdin;
+        data.streaming = !contentLength;
+    }
+
+    if (data.streaming) {
+        uint64_t firstPartSize = partSize ? partSize : STREAM_FIRST_PART_SIZE;
+        if (!(data.buffer = (char *) malloc(firstPartSize))) {
+            fprintf(stderr, "\nERROR: Out of memory\n");
+            exit(-1);
+        }
+        data.bufferLength = fread(data.buffer, 1, firstPartSize, data.infile);
+        if (ferror(data.infile)) {
+            fprintf(stderr, "\nERROR: Failed to read input: ");
+            perror(0);
+            exit(-1);
+        }
+        int c;
+        if ((data.bufferLength < firstPartSize) ||
+            ((c = getc(data.infile)) == EOF)) {
+            data.streaming = 0;
+            contentLength = data.bufferLength;
         }
         else {
-            data.infile = stdin;
+            ungetc(c, data.infile);
         }
     }
 
@@ -1606,9 +1509,18 @@ static void put_object(int argc, char **argv, int optindex)
         protocolG,
         uriStyleG,
         accessKeyIdG,
-        secretAccessKeyG
+        secretAccessKeyG,
+        S3SignatureDefault,
+        0,
+        0
     };
 
+    // With verifyMd5, the MD5 of the data is computed as it is sent, and
+    // checked against the ETag, so that the data is checked even when no md5
+    // was given
+    S3PayloadDigests payloadDigests;
+    payloadDigests.digests = verifyMd5 ? S3_DIGEST_MD5 : 0;
+
     S3PutProperties putProperties =
     {
         contentType,
@@ -1620,7 +1532,8 @@ static void put_object(int argc, char **argv, int optindex)
         cannedAcl,
         metaPropertiesCount,
         metaProperties,
-        useServerSideEncryption
+        useServerSideEncryption,
+        &payloadDigests
     };
 
     S3PutObjectHandler putObjectHandler =
@@ -1629,17 +1542,63 @@ static void put_object(int argc, char **argv, int optindex)
         &putObjectDataCallback
     };
 
-    do {
-        S3_put_object(&bucketContext, key, contentLength, &putProperties, 0,
-                      &putObjectHandler, &data);
-    } while (S3_status_is_retryable(statusG) && should_retry());
+    // A file is uploaded straight from its file descriptor, which libs3
+    // reads at explicit offsets, so that retries start from the right place;
+    // only stdin goes through putObjectDataCallback
+    int fd = filename ? fileno(data.infile) : -1;
+    if (fd != -1) {
+        data.contentLength = 0;
+    }
+
+    if (data.streaming || partSize ||
+        (contentLength > (5LL * 1024 * 1024 * 1024))) {
+        // The multipart upload retries each failed part itself, and the
+        // source data can't be rewound to retry the whole upload anyway
+        S3TransferProperties transferProperties =
+        {
+            partSize,
+            concurrency,
+            retriesG
+        };
+
+        if (fd != -1) {
+            S3_put_object_multipart_from_fd
+                (&bucketContext, key, fd, 0, contentLength, &putProperties,
+                 &transferProperties, 0, &(putObjectHandler.responseHandler),
+                 &data);
+        }
+        else {
+            S3_put_object_multipart(&bucketContext, key, data.streaming ?
+                                    S3_CONTENT_LENGTH_UNKNOWN : contentLength,
+                                    &putProperties, &transferProperties, 0,
+                                    &putObjectHandler, &data);
+        }
+    }
+    else {
+        do {
+            // Data read ahead is all in the buffer, so can be sent again
+            if (data.buffer) {
+                data.bufferOffset = 0;
+                data.contentLength = contentLength;
+            }
+            if (fd != -1) {
+                S3_put_object_from_fd(&bucketContext, key, fd, 0,
+                                      contentLength, &putProperties, 0,
+                                      &(putObjectHandler.responseHandler),
+                                      &data);
+            }
+            else {
+                S3_put_object(&bucketContext, key, contentLength,
+                              &putProperties, 0, &putObjectHandler, &data);
+            }
+        } while (S3_status_is_retryable(statusG) && should_retry());
+    }
 
     if (data.infile) {
         fclose(data.infile);
     }
-    else if (data.gb) {
-        growbuffer_destroy(data.gb);
-    }
+
+    free(data.buffer);
 
     if (statusG != S3StatusOK) {
         printError();
@@ -1648,6 +1607,15 @@ static void put_object(int argc, char **argv, int optindex)
         fprintf(stderr, "\nERROR: Failed to read remaining %llu bytes from "
                 "input\n", (unsigned long long) data.contentLength);
     }
+    else if (showResponsePropertiesG && verifyMd5 && !data.streaming &&
+             !partSize && (contentLength <= (5LL * 1024 * 1024 * 1024))) {
+        int i;
+        printf("Content-MD5 (computed): ");
+        for (i = 0; i < 16; i++) {
+            printf("%02x", payloadDigests.md5[i]);
+        }
+        printf("\n");
+    }
 
     S3_deinitialize();
 }
@@ -1731,7 +1699,7 @@ static void copy_object(int argc, char **argv, int optindex)
             anyPropertiesSet = 1;
         }
         else if (!strncmp(param, EXPIRES_PREFIX, EXPIRES_PREFIX_LEN)) {
-            expires = parseIso8601Time(&(param[EXPIRES_PREFIX_LEN]));
+            expires = S3_parse_iso8601_time(&(param[EXPIRES_PREFIX_LEN]));
             if (expires < 0) {
                 fprintf(stderr, "\nERROR: Invalid expires time "
                         "value; ISO 8601 time format required\n");
@@ -1807,7 +1775,10 @@ static void copy_object(int argc, char **argv, int optindex)
         protocolG,
         uriStyleG,
         accessKeyIdG,
-        secretAccessKeyG
+        secretAccessKeyG,
+        S3SignatureDefault,
+        0,
+        0
     };
 
     S3PutProperties putProperties =
@@ -1821,7 +1792,8 @@ static void copy_object(int argc, char **argv, int optindex)
         cannedAcl,
         metaPropertiesCount,
         metaProperties,
-        useServerSideEncryption
+        useServerSideEncryption,
+        0
     };
 
     S3ResponseHandler responseHandler =
@@ -1900,6 +1872,8 @@ static void get_object(int argc, char **argv, int optindex)
     int64_t ifModifiedSince = -1, ifNotModifiedSince = -1;
     const char *ifMatch = 0, *ifNotMatch = 0;
     uint64_t startByte = 0, byteCount = 0;
+    uint64_t partSize = 0;
+    int concurrency = 0;
 
     while (optindex < argc) {
         char *param = argv[optindex++];
@@ -1909,7 +1883,7 @@ static void get_object(int argc, char **argv, int optindex)
         else if (!strncmp(param, IF_MODIFIED_SINCE_PREFIX, 
                      IF_MODIFIED_SINCE_PREFIX_LEN)) {
             // Parse ifModifiedSince
-            ifModifiedSince = parseIso8601Time
+            ifModifiedSince = S3_parse_iso8601_time
                 (&(param[IF_MODIFIED_SINCE_PREFIX_LEN]));
             if (ifModifiedSince < 0) {
                 fprintf(stderr, "\nERROR: Invalid ifModifiedSince time "
@@ -1920,7 +1894,7 @@ static void get_object(int argc, char **argv, int optindex)
         else if (!strncmp(param, IF_NOT_MODIFIED_SINCE_PREFIX, 
                           IF_NOT_MODIFIED_SINCE_PREFIX_LEN)) {
             // Parse ifModifiedSince
-            ifNotModifiedSince = parseIso8601Time
+            ifNotModifiedSince = S3_parse_iso8601_time
                 (&(param[IF_NOT_MODIFIED_SINCE_PREFIX_LEN]));
             if (ifNotModifiedSince < 0) {
                 fprintf(stderr, "\nERROR: Invalid ifNotModifiedSince time "
@@ -1943,12 +1917,25 @@ static void get_object(int argc, char **argv, int optindex)
             byteCount = convertInt
                 (&(param[BYTE_COUNT_PREFIX_LEN]), "byteCount");
         }
+        else if (!strncmp(param, PART_SIZE_PREFIX, PART_SIZE_PREFIX_LEN)) {
+            partSize = convertInt(&(param[PART_SIZE_PREFIX_LEN]), "partSize");
+        }
+        else if (!strncmp(param, CONCURRENCY_PREFIX, CONCURRENCY_PREFIX_LEN)) {
+            concurrency = convertInt(&(param[CONCURRENCY_PREFIX_LEN]),
+                                     "concurrency");
+        }
         else {
             fprintf(stderr, "\nERROR: Unknown param: %s\n", param);
             usageExit(stderr);
         }
     }
 
+    if (partSize && (startByte || byteCount)) {
+        fprintf(stderr, "\nERROR: partSize cannot be used with startByte or "
+                "byteCount\n");
+        usageExit(stderr);
+    }
+
     FILE *outfile = 0;
 
     if (filename) {
@@ -1988,7 +1975,10 @@ static void get_object(int argc, char **argv, int optindex)
         protocolG,
         uriStyleG,
         accessKeyIdG,
-        secretAccessKeyG
+        secretAccessKeyG,
+        S3SignatureDefault,
+        0,
+        0
     };
 
     S3GetConditions getConditions =
@@ -2005,10 +1995,49 @@ static void get_object(int argc, char **argv, int optindex)
         &getObjectDataCallback
     };
 
-    do {
-        S3_get_object(&bucketContext, key, &getConditions, startByte,
-                      byteCount, 0, &getObjectHandler, outfile);
-    } while (S3_status_is_retryable(statusG) && should_retry());
+    // A file is written straight from the network buffers at the offsets of
+    // the data, and stdout is given the data in order through the callbacks
+    if (partSize) {
+        S3TransferProperties transferProperties =
+        {
+            partSize,
+            concurrency,
+            retriesG
+        };
+
+        if (filename) {
+            S3_get_object_parallel_to_fd
+                (&bucketContext, key, &getConditions, &transferProperties,
+                 fileno(outfile), 0, 0, &(getObjectHandler.responseHandler),
+                 0);
+        }
+        else {
+            S3GetObjectParallelHandler getObjectParallelHandler =
+            {
+                { &responsePropertiesCallback, &responseCompleteCallback },
+                &getObjectDataCallback,
+                0
+            };
+
+            S3_get_object_parallel(&bucketContext, key, &getConditions,
+                                   &transferProperties, 0,
+                                   &getObjectParallelHandler, outfile);
+        }
+    }
+    else {
+        do {
+            if (filename) {
+                S3_get_object_to_fd(&bucketContext, key, &getConditions,
+                                    startByte, byteCount, fileno(outfile), 0,
+                                    0, &(getObjectHandler.responseHandler),
+                                    0);
+            }
+            else {
+                S3_get_object(&bucketContext, key, &getConditions, startByte,
+                              byteCount, 0, &getObjectHandler, outfile);
+            }
+        } while (S3_status_is_retryable(statusG) && should_retry());
+    }
 
     if (statusG != S3StatusOK) {
         printError();
@@ -2062,7 +2091,10 @@ static void head_object(int argc, char **argv, int optindex)
         protocolG,
         uriStyleG,
         accessKeyIdG,
-        secretAccessKeyG
+        secretAccessKeyG,
+        S3SignatureDefault,
+        0,
+        0
     };
 
     S3ResponseHandler responseHandler =
@@ -2116,7 +2148,7 @@ static void generate_query_string(int argc, char **argv, int optindex)
     while (optindex < argc) {
         char *param = argv[optindex++];
         if (!strncmp(param, EXPIRES_PREFIX, EXPIRES_PREFIX_LEN)) {
-            expires = parseIso8601Time(&(param[EXPIRES_PREFIX_LEN]));
+            expires = S3_parse_iso8601_time(&(param[EXPIRES_PREFIX_LEN]));
             if (expires < 0) {
                 fprintf(stderr, "\nERROR: Invalid expires time "
                         "value; ISO 8601 time format required\n");
@@ -2141,7 +2173,10 @@ static void generate_query_string(int argc, char **argv, int optindex)
         protocolG,
         uriStyleG,
         accessKeyIdG,
-        secretAccessKeyG
+        secretAccessKeyG,
+        S3SignatureDefault,
+        0,
+        0
     };
 
     char buffer[S3_MAX_AUTHENTICATED_QUERY_STRING_SIZE];
@@ -2243,7 +2278,10 @@ void get_acl(int argc, char **argv, int optindex)
         protocolG,
         uriStyleG,
         accessKeyIdG,
-        secretAccessKeyG
+        secretAccessKeyG,
+        S3SignatureDefault,
+        0,
+        0
     };
 
     S3ResponseHandler responseHandler =
@@ -2406,7 +2444,10 @@ void set_acl(int argc, char **argv, int optindex)
         protocolG,
         uriStyleG,
         accessKeyIdG,
-        secretAccessKeyG
+        secretAccessKeyG,
+        S3SignatureDefault,
+        0,
+        0
     };
 
     S3ResponseHandler responseHandler =
@@ -2498,7 +2539,10 @@ void get_logging(int argc, char **argv, int optindex)
         protocolG,
         uriStyleG,
         accessKeyIdG,
-        secretAccessKeyG
+        secretAccessKeyG,
+        S3SignatureDefault,
+        0,
+        0
     };
 
     S3ResponseHandler responseHandler =
@@ -2664,7 +2708,10 @@ void set_logging(int argc, char **argv, int optindex)
         protocolG,
         uriStyleG,
         accessKeyIdG,
-        secretAccessKeyG
+        secretAccessKeyG,
+        S3SignatureDefault,
+        0,
+        0
     };
 
     S3ResponseHandler responseHandler =
@@ -2694,7 +2741,7 @@ int main(int argc, char **argv)
     // Parse args
     while (1) {
         int idx = 0;
-        int c = getopt_long(argc, argv, "fhusr:", longOptionsG, &idx);
+        int c = getopt_long(argc, argv, "fhusr:4R:", longOptionsG, &idx);
 
         if (c == -1) {
             // End of options
@@ -2724,6 +2771,12 @@ int main(int argc, char **argv)
             }
             break;
         }
+        case '4':
+            signatureVersionG = S3SignatureV4;
+            break;
+        case 'R':
+            authRegionG = optarg;
+            break;
         default:
             fprintf(stderr, "\nERROR: Unknown option: -%c\n", c);
             // Usage exit
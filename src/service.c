@@ -47,33 +47,31 @@ typedef struct XmlCallbackData
 } XmlCallbackData;
 
 
-static S3Status xmlCallback(const char *elementPath, const char *data,
-                            int dataLen, void *callbackData)
+static S3Status xmlCallback(const char *elementPath, SimpleXmlPath path,
+                            const char *data, int dataLen, void *callbackData)
 {
+    (void) elementPath;
+
     XmlCallbackData *cbData = (XmlCallbackData *) callbackData;
 
     int fit;
 
     if (data) {
-        if (!strcmp(elementPath, "ListAllMyBucketsResult/Owner/ID")) {
+        if (path == SimpleXmlPathServiceOwnerID) {
             string_buffer_append(cbData->ownerId, data, dataLen, fit);
         }
-        else if (!strcmp(elementPath, 
-                         "ListAllMyBucketsResult/Owner/DisplayName")) {
+        else if (path == SimpleXmlPathServiceOwnerDisplayName) {
             string_buffer_append(cbData->ownerDisplayName, data, dataLen, fit);
         }
-        else if (!strcmp(elementPath, 
-                         "ListAllMyBucketsResult/Buckets/Bucket/Name")) {
+        else if (path == SimpleXmlPathServiceBucketName) {
             string_buffer_append(cbData->bucketName, data, dataLen, fit);
         }
-        else if (!strcmp
-                 (elementPath, 
-                  "ListAllMyBucketsResult/Buckets/Bucket/CreationDate")) {
+        else if (path == SimpleXmlPathServiceBucketCreationDate) {
             string_buffer_append(cbData->creationDate, data, dataLen, fit);
         }
     }
     else {
-        if (!strcmp(elementPath, "ListAllMyBucketsResult/Buckets/Bucket")) {
+        if (path == SimpleXmlPathServiceBucket) {
             // Parse date.  Assume ISO-8601 date format.
             time_t creationDate = parseIso8601Time(cbData->creationDate);
 
@@ -166,7 +164,10 @@ void S3_list_service(S3Protocol protocol, const char *accessKeyId,
           protocol,                                   // protocol
           S3UriStylePath,                             // uriStyle
           accessKeyId,                                // accessKeyId
-          secretAccessKey },                          // secretAccessKey
+          secretAccessKey,                            // secretAccessKey
+          S3SignatureDefault,                         // signatureVersion
+          0,                                          // authRegion
+          0 },                                        // preparedBucket
         0,                                            // key
         0,                                            // queryParams
         0,                                            // subResource
@@ -50,16 +50,17 @@ typedef struct ConvertBlsData
 
 
 static S3Status convertBlsXmlCallback(const char *elementPath,
-                                      const char *data, int dataLen,
-                                      void *callbackData)
+                                      SimpleXmlPath path, const char *data,
+                                      int dataLen, void *callbackData)
 {
+    (void) elementPath;
+
     ConvertBlsData *caData = (ConvertBlsData *) callbackData;
 
     int fit;
 
     if (data) {
-        if (!strcmp(elementPath, "BucketLoggingStatus/LoggingEnabled/"
-                    "TargetBucket")) {
+        if (path == SimpleXmlPathBlsTargetBucket) {
             caData->targetBucketReturnLen += 
                 snprintf(&(caData->targetBucketReturn
                            [caData->targetBucketReturnLen]),
@@ -69,8 +70,7 @@ static S3Status convertBlsXmlCallback(const char *elementPath,
                 return S3StatusTargetBucketTooLong;
             }
         }
-        else if (!strcmp(elementPath, "BucketLoggingStatus/LoggingEnabled/"
-                    "TargetPrefix")) {
+        else if (path == SimpleXmlPathBlsTargetPrefix) {
             caData->targetPrefixReturnLen += 
                 snprintf(&(caData->targetPrefixReturn
                            [caData->targetPrefixReturnLen]),
@@ -80,41 +80,35 @@ static S3Status convertBlsXmlCallback(const char *elementPath,
                 return S3StatusTargetPrefixTooLong;
             }
         }
-        else if (!strcmp(elementPath, "BucketLoggingStatus/LoggingEnabled/"
-                         "TargetGrants/Grant/Grantee/EmailAddress")) {
+        else if (path == SimpleXmlPathBlsGranteeEmailAddress) {
             // AmazonCustomerByEmail
             string_buffer_append(caData->emailAddress, data, dataLen, fit);
             if (!fit) {
                 return S3StatusEmailAddressTooLong;
             }
         }
-        else if (!strcmp(elementPath,
-                         "AccessControlPolicy/AccessControlList/Grant/"
-                         "Grantee/ID")) {
+        else if (path == SimpleXmlPathBlsGranteeID) {
             // CanonicalUser
             string_buffer_append(caData->userId, data, dataLen, fit);
             if (!fit) {
                 return S3StatusUserIdTooLong;
             }
         }
-        else if (!strcmp(elementPath, "BucketLoggingStatus/LoggingEnabled/"
-                         "TargetGrants/Grant/Grantee/DisplayName")) {
+        else if (path == SimpleXmlPathBlsGranteeDisplayName) {
             // CanonicalUser
             string_buffer_append(caData->userDisplayName, data, dataLen, fit);
             if (!fit) {
                 return S3StatusUserDisplayNameTooLong;
             }
         }
-        else if (!strcmp(elementPath, "BucketLoggingStatus/LoggingEnabled/"
-                         "TargetGrants/Grant/Grantee/URI")) {
+        else if (path == SimpleXmlPathBlsGranteeURI) {
             // Group
             string_buffer_append(caData->groupUri, data, dataLen, fit);
             if (!fit) {
                 return S3StatusGroupUriTooLong;
             }
         }
-        else if (!strcmp(elementPath, "BucketLoggingStatus/LoggingEnabled/"
-                         "TargetGrants/Grant/Permission")) {
+        else if (path == SimpleXmlPathBlsGrantPermission) {
             // Permission
             string_buffer_append(caData->permission, data, dataLen, fit);
             if (!fit) {
@@ -123,8 +117,7 @@ static S3Status convertBlsXmlCallback(const char *elementPath,
         }
     }
     else {
-        if (!strcmp(elementPath, "BucketLoggingStatus/LoggingEnabled/"
-                    "TargetGrants/Grant")) {
+        if (path == SimpleXmlPathBlsGrant) {
             // A grant has just been completed; so add the next S3AclGrant
             // based on the values read
             if (*(caData->aclGrantCountReturn) == S3_MAX_ACL_GRANT_COUNT) {
@@ -328,7 +321,10 @@ void S3_get_server_access_logging(const S3BucketContext *bucketContext,
           bucketContext->protocol,                    // protocol
           bucketContext->uriStyle,                    // uriStyle
           bucketContext->accessKeyId,                 // accessKeyId
-          bucketContext->secretAccessKey },           // secretAccessKey
+          bucketContext->secretAccessKey,             // secretAccessKey
+          bucketContext->signatureVersion,            // signatureVersion
+          bucketContext->authRegion,                  // authRegion
+          bucketContext->preparedBucket },            // preparedBucket
         0,                                            // key
         0,                                            // queryParams
         "logging",                                    // subResource
@@ -532,7 +528,10 @@ void S3_set_server_access_logging(const S3BucketContext *bucketContext,
           bucketContext->protocol,                    // protocol
           bucketContext->uriStyle,                    // uriStyle
           bucketContext->accessKeyId,                 // accessKeyId
-          bucketContext->secretAccessKey },           // secretAccessKey
+          bucketContext->secretAccessKey,             // secretAccessKey
+          bucketContext->signatureVersion,            // signatureVersion
+          bucketContext->authRegion,                  // authRegion
+          bucketContext->preparedBucket },            // preparedBucket
         0,                                            // key
         0,                                            // queryParams
         "logging",                                    // subResource
@@ -24,80 +24,155 @@
  *
  ************************************************************************** **/
 
-#include <libxml/parser.h>
 #include <string.h>
 #include "simplexml.h"
 
-// Use libxml2 for parsing XML.  XML is severely overused in modern
-// computing.  It is useful for only a very small subset of tasks, but
-// software developers who don't know better and are afraid to go against the
-// grain use it for everything, and in most cases, it is completely
-// inappropriate.  Usually, the document structure is severely under-specified
-// as well, as is the case with S3.  We do our best by just caring about the
-// most important aspects of the S3 "XML document" responses: the elements and
-// their values.  The SAX API (just about the lamest API ever devised and
-// proof that XML sucks - well, the real proof is how crappy all of the XML
-// parsing libraries are, including libxml2 - but I digress) is used here
-// because we don't need much from the parser and SAX is fast and low memory.
+// A streaming tokenizer for the XML documents that S3 returns.  XML is
+// severely overused in modern computing, and the document structure is
+// severely under-specified as well, as is the case with S3.  We do our best
+// by just caring about the most important aspects of the S3 "XML document"
+// responses: the elements and their values.  So rather than a general
+// purpose parser, this is a small state machine which walks the bytes of
+// each chunk exactly once, builds the element path in place, and hands
+// character data to the callback straight out of the chunk.  Nothing is
+// allocated, and because all of the state lives in the SimpleXml, a
+// document may be split between calls to simplexml_add anywhere at all.
+//
+// What is handled: elements (including empty element tags), attributes,
+// which are skipped, the five predefined entities and character references,
+// CDATA sections, comments, processing instructions (including the XML
+// declaration) and document type declarations, which are skipped, and line
+// end normalization.  Character data outside of the document element is
+// ignored.  Names are not checked beyond making sure that end tags match
+// their start tags.
 //
 // Note that for simplicity we assume all ASCII here.  No attempts are made to
 // detect non-ASCII sequences in utf-8 and convert them into ASCII in any way.
 // S3 appears to only use ASCII anyway.
 
-
-static xmlEntityPtr saxGetEntity(void *user_data, const xmlChar *name)
+typedef enum
 {
-    (void) user_data;
+    SimpleXmlStateText,                  // In character data
+    SimpleXmlStateEntity,                // After the '&' of a reference
+    SimpleXmlStateTagOpen,               // After '<'
+    SimpleXmlStateStartName,             // In the name of a start tag
+    SimpleXmlStateAttributes,            // After the name of a start tag
+    SimpleXmlStateAttributeValue,        // In a quoted attribute value
+    SimpleXmlStateEmptyTag,              // After the '/' of "<name/>"
+    SimpleXmlStateEndName,               // In the name of an end tag
+    SimpleXmlStateEndSpace,              // After the name of an end tag
+    SimpleXmlStateProcessingInstruction, // In "<?...?>"
+    SimpleXmlStateMarkup,                // After "<!"
+    SimpleXmlStateCommentOpen,           // After "<!-"
+    SimpleXmlStateComment,               // In "<!--...-->"
+    SimpleXmlStateCdataOpen,             // In "<![CDATA["
+    SimpleXmlStateCdata,                 // In a CDATA section
+    SimpleXmlStateDeclaration            // In "<!DOCTYPE...>" and the like
+} SimpleXmlState;
+
+
+#define is_space(c) (((c) == ' ') || ((c) == '\t') || ((c) == '\n') ||  \
+                     ((c) == '\r'))
+
+
+// The characters which end a run of character data, and those which end a
+// name, so that each can be found with one lookup per character
+#define ENDS_TEXT 1
+#define ENDS_NAME 2
+
+static const unsigned char charClassG[256] =
+{
+    ['\t'] = ENDS_NAME, ['\n'] = ENDS_NAME, ['\r'] = ENDS_TEXT | ENDS_NAME,
+    [' '] = ENDS_NAME, ['/'] = ENDS_NAME, ['>'] = ENDS_NAME,
+    ['<'] = ENDS_TEXT | ENDS_NAME, ['&'] = ENDS_TEXT
+};
 
-    return xmlGetPredefinedEntity(name);
-}
+#define char_class(c) (charClassG[(unsigned char) (c)])
 
 
-static void saxStartElement(void *user_data, const xmlChar *nameUtf8,
-                            const xmlChar **attr)
+// The parent of each SimpleXmlPath
+static const SimpleXmlPath parentPathsG[SimpleXmlPathCount] =
 {
-    (void) attr;
+    SimpleXmlPathNone,
+    SimpleXmlPathNone,
+#define SIMPLEXML_PATH_PARENT(id, parent, element) SimpleXmlPath##parent,
+    SIMPLEXML_PATHS(SIMPLEXML_PATH_PARENT)
+#undef SIMPLEXML_PATH_PARENT
+};
 
-    SimpleXml *simpleXml = (SimpleXml *) user_data;
 
-    if (simpleXml->status != S3StatusOK) {
-        return;
+// Returns the path of the element named by the [len] characters of [name]
+// inside of [parent].  SIMPLEXML_PATHS is a trie whose edges are each
+// element's parent and name, so this compiles into a chain of integer
+// compares which only compares names for the children of [parent].
+static SimpleXmlPath child_path(SimpleXmlPath parent, const char *name,
+                                int len)
+{
+#define SIMPLEXML_PATH_CHILD(id, parentId, element)                          \
+    if ((parent == SimpleXmlPath##parentId) &&                               \
+        (len == (int) (sizeof(element) - 1)) &&                              \
+        !memcmp(name, element, len)) {                                       \
+        return SimpleXmlPath##id;                                            \
     }
-    
-    // Assume that name has no non-ASCII in it
-    char *name = (char *) nameUtf8;
+    SIMPLEXML_PATHS(SIMPLEXML_PATH_CHILD)
+#undef SIMPLEXML_PATH_CHILD
 
-    // Append the element to the element path
-    int len = strlen(name);
+    return SimpleXmlPathUnknown;
+}
 
-    if ((simpleXml->elementPathLen + len + 1) >= 
-        (int) sizeof(simpleXml->elementPath)) {
-        // Cannot handle this element, stop!
-        simpleXml->status = S3StatusXmlParseFailure;
-        return;
-    }
 
-    if (simpleXml->elementPathLen) {
-        simpleXml->elementPath[simpleXml->elementPathLen++] = '/';
+// The SimpleXmlPath of elementPath
+#define current_path(simpleXml)                                         \
+    ((simpleXml)->unknownDepth ? SimpleXmlPathUnknown : (simpleXml)->path)
+
+
+// Passes [len] characters of data to the callback, if they are inside the
+// document element
+static void deliver(SimpleXml *simpleXml, const char *data, int len)
+{
+    if (len && simpleXml->elementPathLen) {
+        simpleXml->status = (*(simpleXml->callback))
+            (simpleXml->elementPath, current_path(simpleXml), data, len,
+             simpleXml->callbackData);
     }
-    strcpy(&(simpleXml->elementPath[simpleXml->elementPathLen]), name);
-    simpleXml->elementPathLen += len;
 }
 
 
-static void saxEndElement(void *user_data, const xmlChar *name)
+// Adds the element whose name starts at [nameStart] of the element path
+static void start_element(SimpleXml *simpleXml, int nameStart)
 {
-    (void) name;
+    if (simpleXml->unknownDepth) {
+        simpleXml->unknownDepth++;
+        return;
+    }
 
-    SimpleXml *simpleXml = (SimpleXml *) user_data;
+    SimpleXmlPath path = child_path
+        (simpleXml->path, &(simpleXml->elementPath[nameStart]),
+         simpleXml->elementPathLen - nameStart);
 
-    if (simpleXml->status != S3StatusOK) {
-        return;
+    if (path == SimpleXmlPathUnknown) {
+        simpleXml->unknownDepth = 1;
+    }
+    else {
+        simpleXml->path = path;
     }
+}
+
 
-    // Call back with 0 data
+// Calls back with 0 data for the end of the innermost element, and removes
+// it from the element path
+static void end_element(SimpleXml *simpleXml)
+{
     simpleXml->status = (*(simpleXml->callback))
-        (simpleXml->elementPath, 0, 0, simpleXml->callbackData);
+        (simpleXml->elementPath, current_path(simpleXml), 0, 0,
+         simpleXml->callbackData);
+
+    if (simpleXml->unknownDepth) {
+        simpleXml->unknownDepth--;
+    }
+    else {
+        simpleXml->path = parentPathsG[simpleXml->path];
+    }
 
     while ((simpleXml->elementPathLen > 0) &&
            (simpleXml->elementPath[simpleXml->elementPathLen] != '/')) {
@@ -108,68 +183,95 @@ static void saxEndElement(void *user_data, const xmlChar *name)
 }
 
 
-static void saxCharacters(void *user_data, const xmlChar *ch, int len)
+// Delivers the value of the entity or character reference named by
+// simpleXml->entity
+static void deliver_entity(SimpleXml *simpleXml)
 {
-    SimpleXml *simpleXml = (SimpleXml *) user_data;
-
-    if (simpleXml->status != S3StatusOK) {
+    const char *entity = simpleXml->entity;
+    int len = simpleXml->entityLen;
+
+    if (entity[0] != '#') {
+        static const char *names[] = { "lt", "gt", "amp", "quot", "apos" };
+        static const char values[] = "<>&\"'";
+        unsigned int i;
+        for (i = 0; i < (sizeof(names) / sizeof(names[0])); i++) {
+            if (((int) strlen(names[i]) == len) &&
+                !memcmp(names[i], entity, len)) {
+                deliver(simpleXml, &(values[i]), 1);
+                return;
+            }
+        }
+        simpleXml->status = S3StatusXmlParseFailure;
         return;
     }
 
-    simpleXml->status = (*(simpleXml->callback))
-        (simpleXml->elementPath, (char *) ch, len, simpleXml->callbackData);
-}
-
-
-static void saxError(void *user_data, const char *msg, ...)
-{
-    (void) msg;
-
-    SimpleXml *simpleXml = (SimpleXml *) user_data;
+    // A character reference, which is written to the data as utf-8
+    unsigned int value = 0, base = 10;
+    int i = 1;
+    if ((len > 1) && (entity[1] == 'x')) {
+        base = 16, i = 2;
+    }
+    if (i == len) {
+        simpleXml->status = S3StatusXmlParseFailure;
+        return;
+    }
+    for (; i < len; i++) {
+        char c = entity[i];
+        unsigned int digit;
+        if ((c >= '0') && (c <= '9')) {
+            digit = c - '0';
+        }
+        else if ((base == 16) && (c >= 'a') && (c <= 'f')) {
+            digit = c - 'a' + 10;
+        }
+        else if ((base == 16) && (c >= 'A') && (c <= 'F')) {
+            digit = c - 'A' + 10;
+        }
+        else {
+            simpleXml->status = S3StatusXmlParseFailure;
+            return;
+        }
+        value = (value * base) + digit;
+        // Stop before the value can wrap around to a valid character
+        if (value > 0x10FFFF) {
+            simpleXml->status = S3StatusXmlParseFailure;
+            return;
+        }
+    }
 
-    if (simpleXml->status != S3StatusOK) {
+    if (!value || (value > 0x10FFFF) ||
+        ((value >= 0xD800) && (value <= 0xDFFF))) {
+        simpleXml->status = S3StatusXmlParseFailure;
         return;
     }
 
-    simpleXml->status = S3StatusXmlParseFailure;
-}
+    char utf8[4];
+    if (value < 0x80) {
+        utf8[0] = value;
+        len = 1;
+    }
+    else if (value < 0x800) {
+        utf8[0] = 0xC0 | (value >> 6);
+        utf8[1] = 0x80 | (value & 0x3F);
+        len = 2;
+    }
+    else if (value < 0x10000) {
+        utf8[0] = 0xE0 | (value >> 12);
+        utf8[1] = 0x80 | ((value >> 6) & 0x3F);
+        utf8[2] = 0x80 | (value & 0x3F);
+        len = 3;
+    }
+    else {
+        utf8[0] = 0xF0 | (value >> 18);
+        utf8[1] = 0x80 | ((value >> 12) & 0x3F);
+        utf8[2] = 0x80 | ((value >> 6) & 0x3F);
+        utf8[3] = 0x80 | (value & 0x3F);
+        len = 4;
+    }
 
+    deliver(simpleXml, utf8, len);
+}
 
-static struct _xmlSAXHandler saxHandlerG =
-{
-    0, // internalSubsetSAXFunc
-    0, // isStandaloneSAXFunc
-    0, // hasInternalSubsetSAXFunc
-    0, // hasExternalSubsetSAXFunc
-    0, // resolveEntitySAXFunc
-    &saxGetEntity, // getEntitySAXFunc
-    0, // entityDeclSAXFunc
-    0, // notationDeclSAXFunc
-    0, // attributeDeclSAXFunc
-    0, // elementDeclSAXFunc
-    0, // unparsedEntityDeclSAXFunc
-    0, // setDocumentLocatorSAXFunc
-    0, // startDocumentSAXFunc
-    0, // endDocumentSAXFunc
-    &saxStartElement, // startElementSAXFunc
-    &saxEndElement, // endElementSAXFunc
-    0, // referenceSAXFunc
-    &saxCharacters, // charactersSAXFunc
-    0, // ignorableWhitespaceSAXFunc
-    0, // processingInstructionSAXFunc
-    0, // commentSAXFunc
-    0, // warningSAXFunc
-    &saxError, // errorSAXFunc
-    &saxError, // fatalErrorSAXFunc
-    0, // getParameterEntitySAXFunc
-    &saxCharacters, // cdataBlockSAXFunc
-    0, // externalSubsetSAXFunc
-    0, // initialized
-    0, // _private
-    0, // startElementNsSAX2Func
-    0, // endElementNsSAX2Func
-    0 // xmlStructuredErrorFunc serror;
-};
 
 void simplexml_initialize(SimpleXml *simpleXml, 
                           SimpleXmlCallback *callback, void *callbackData)
@@ -177,30 +279,330 @@ void simplexml_initialize(SimpleXml *simpleXml,
     simpleXml->callback = callback;
     simpleXml->callbackData = callbackData;
     simpleXml->elementPathLen = 0;
+    simpleXml->elementPath[0] = 0;
     simpleXml->status = S3StatusOK;
-    simpleXml->xmlParser = 0;
+    simpleXml->path = SimpleXmlPathNone;
+    simpleXml->unknownDepth = 0;
+    simpleXml->state = SimpleXmlStateText;
+    simpleXml->count = 0;
+    simpleXml->quote = 0;
+    simpleXml->skipLineFeed = 0;
+    simpleXml->entityLen = 0;
 }
 
 
 void simplexml_deinitialize(SimpleXml *simpleXml)
 {
-    if (simpleXml->xmlParser) {
-        xmlFreeParserCtxt(simpleXml->xmlParser);
-    }
+    (void) simpleXml;
 }
 
 
 S3Status simplexml_add(SimpleXml *simpleXml, const char *data, int dataLen)
 {
-    if (!simpleXml->xmlParser &&
-        (!(simpleXml->xmlParser = xmlCreatePushParserCtxt
-           (&saxHandlerG, simpleXml, 0, 0, 0)))) {
-        return S3StatusInternalError;
-    }
-
-    if (xmlParseChunk((xmlParserCtxtPtr) simpleXml->xmlParser, 
-                      data, dataLen, 0)) {
-        return S3StatusXmlParseFailure;
+    const char *end = &(data[dataLen]);
+
+#define fail()                                          \
+    do {                                                \
+        simpleXml->status = S3StatusXmlParseFailure;    \
+        return simpleXml->status;                       \
+    } while (0)
+
+    while ((simpleXml->status == S3StatusOK) && (data < end)) {
+        // A "\r\n" is delivered as just the '\n' that the '\r' became
+        if (simpleXml->skipLineFeed) {
+            simpleXml->skipLineFeed = 0;
+            if (*data == '\n') {
+                data++;
+                continue;
+            }
+        }
+
+        char c;
+        const char *p;
+
+        switch (simpleXml->state) {
+        case SimpleXmlStateText:
+            p = data;
+            while ((p < end) && !(char_class(*p) & ENDS_TEXT)) {
+                p++;
+            }
+            deliver(simpleXml, data, p - data);
+            if (p == end) {
+                return simpleXml->status;
+            }
+            data = p + 1;
+            if (*p == '<') {
+                simpleXml->state = SimpleXmlStateTagOpen;
+            }
+            else if (*p == '&') {
+                simpleXml->entityLen = 0;
+                simpleXml->state = SimpleXmlStateEntity;
+            }
+            else {
+                deliver(simpleXml, "\n", 1);
+                simpleXml->skipLineFeed = 1;
+            }
+            break;
+        case SimpleXmlStateEntity:
+            c = *data++;
+            if (c == ';') {
+                deliver_entity(simpleXml);
+                simpleXml->state = SimpleXmlStateText;
+            }
+            else if (simpleXml->entityLen < 
+                     (int) sizeof(simpleXml->entity)) {
+                simpleXml->entity[simpleXml->entityLen++] = c;
+            }
+            else {
+                fail();
+            }
+            break;
+        case SimpleXmlStateTagOpen:
+            c = *data;
+            if (c == '/') {
+                data++;
+                if (!simpleXml->elementPathLen) {
+                    fail();
+                }
+                // Match the end tag's name against the innermost element's
+                int start = simpleXml->elementPathLen;
+                while ((start > 0) &&
+                       (simpleXml->elementPath[start - 1] != '/')) {
+                    start--;
+                }
+                simpleXml->count = start;
+                simpleXml->state = SimpleXmlStateEndName;
+            }
+            else if (c == '?') {
+                data++;
+                simpleXml->count = 0;
+                simpleXml->state = SimpleXmlStateProcessingInstruction;
+            }
+            else if (c == '!') {
+                data++;
+                simpleXml->state = SimpleXmlStateMarkup;
+            }
+            else if (is_space(c) || (c == '>') || (c == '<') || (c == '&')) {
+                fail();
+            }
+            else {
+                // Append the element to the element path
+                if (simpleXml->elementPathLen) {
+                    if ((simpleXml->elementPathLen + 2) >=
+                        (int) sizeof(simpleXml->elementPath)) {
+                        // Cannot handle this element, stop!
+                        fail();
+                    }
+                    simpleXml->elementPath[simpleXml->elementPathLen++] = '/';
+                }
+                simpleXml->count = simpleXml->elementPathLen;
+                simpleXml->state = SimpleXmlStateStartName;
+            }
+            break;
+        case SimpleXmlStateStartName:
+            p = data;
+            while ((p < end) && !(char_class(*p) & ENDS_NAME)) {
+                p++;
+            }
+            if ((simpleXml->elementPathLen + (p - data)) >=
+                (int) sizeof(simpleXml->elementPath)) {
+                // Cannot handle this element, stop!
+                fail();
+            }
+            memcpy(&(simpleXml->elementPath[simpleXml->elementPathLen]), data,
+                   p - data);
+            simpleXml->elementPathLen += (p - data);
+            simpleXml->elementPath[simpleXml->elementPathLen] = 0;
+            if (p == end) {
+                return simpleXml->status;
+            }
+            data = p + 1;
+            if (*p == '<') {
+                fail();
+            }
+            start_element(simpleXml, simpleXml->count);
+            if (*p == '/') {
+                simpleXml->state = SimpleXmlStateEmptyTag;
+            }
+            else if (*p == '>') {
+                simpleXml->state = SimpleXmlStateText;
+            }
+            else {
+                simpleXml->state = SimpleXmlStateAttributes;
+            }
+            break;
+        case SimpleXmlStateAttributes:
+            while ((data < end) && (*data != '"') && (*data != '\'') &&
+                   (*data != '/') && (*data != '>') && (*data != '<')) {
+                data++;
+            }
+            if (data == end) {
+                return simpleXml->status;
+            }
+            c = *data++;
+            if ((c == '"') || (c == '\'')) {
+                simpleXml->quote = c;
+                simpleXml->state = SimpleXmlStateAttributeValue;
+            }
+            else if (c == '/') {
+                simpleXml->state = SimpleXmlStateEmptyTag;
+            }
+            else if (c == '>') {
+                simpleXml->state = SimpleXmlStateText;
+            }
+            else if (c == '<') {
+                fail();
+            }
+            break;
+        case SimpleXmlStateAttributeValue:
+            p = (const char *) memchr(data, simpleXml->quote, end - data);
+            if (!p) {
+                return simpleXml->status;
+            }
+            data = p + 1;
+            simpleXml->state = SimpleXmlStateAttributes;
+            break;
+        case SimpleXmlStateEmptyTag:
+            if (*data++ != '>') {
+                fail();
+            }
+            end_element(simpleXml);
+            simpleXml->state = SimpleXmlStateText;
+            break;
+        case SimpleXmlStateEndName:
+            while ((data < end) &&
+                   (simpleXml->count < simpleXml->elementPathLen) &&
+                   (simpleXml->elementPath[simpleXml->count] == *data)) {
+                simpleXml->count++, data++;
+            }
+            if (data == end) {
+                return simpleXml->status;
+            }
+            c = *data++;
+            if ((c == '>') || is_space(c)) {
+                if (simpleXml->count != simpleXml->elementPathLen) {
+                    fail();
+                }
+                if (c == '>') {
+                    end_element(simpleXml);
+                    simpleXml->state = SimpleXmlStateText;
+                }
+                else {
+                    simpleXml->state = SimpleXmlStateEndSpace;
+                }
+            }
+            else {
+                fail();
+            }
+            break;
+        case SimpleXmlStateEndSpace:
+            c = *data++;
+            if (c == '>') {
+                end_element(simpleXml);
+                simpleXml->state = SimpleXmlStateText;
+            }
+            else if (!is_space(c)) {
+                fail();
+            }
+            break;
+        case SimpleXmlStateProcessingInstruction:
+            c = *data++;
+            if ((c == '>') && simpleXml->count) {
+                simpleXml->state = SimpleXmlStateText;
+            }
+            simpleXml->count = (c == '?');
+            break;
+        case SimpleXmlStateMarkup:
+            c = *data++;
+            simpleXml->count = 0;
+            if (c == '-') {
+                simpleXml->state = SimpleXmlStateCommentOpen;
+            }
+            else if (c == '[') {
+                simpleXml->state = SimpleXmlStateCdataOpen;
+            }
+            else if ((c >= 'A') && (c <= 'Z')) {
+                simpleXml->state = SimpleXmlStateDeclaration;
+            }
+            else {
+                fail();
+            }
+            break;
+        case SimpleXmlStateCommentOpen:
+            if (*data++ != '-') {
+                fail();
+            }
+            simpleXml->state = SimpleXmlStateComment;
+            break;
+        case SimpleXmlStateComment:
+            c = *data++;
+            if ((c == '>') && (simpleXml->count >= 2)) {
+                simpleXml->state = SimpleXmlStateText;
+            }
+            simpleXml->count = (c == '-') ? (simpleXml->count + 1) : 0;
+            break;
+        case SimpleXmlStateCdataOpen:
+            if (*data++ != "CDATA["[simpleXml->count]) {
+                fail();
+            }
+            if (++(simpleXml->count) == 6) {
+                simpleXml->count = 0;
+                simpleXml->state = SimpleXmlStateCdata;
+            }
+            break;
+        case SimpleXmlStateCdata:
+            // count is the number of ']' just seen, which may start the
+            // closing "]]>"; they are delivered once it is clear that
+            // they don't
+            if (!simpleXml->count) {
+                p = data;
+                while ((p < end) && (*p != ']') && (*p != '\r')) {
+                    p++;
+                }
+                deliver(simpleXml, data, p - data);
+                if (p == end) {
+                    return simpleXml->status;
+                }
+                data = p + 1;
+                if (*p == ']') {
+                    simpleXml->count = 1;
+                }
+                else {
+                    deliver(simpleXml, "\n", 1);
+                    simpleXml->skipLineFeed = 1;
+                }
+            }
+            else if (*data == ']') {
+                data++;
+                if (simpleXml->count == 2) {
+                    deliver(simpleXml, "]", 1);
+                }
+                simpleXml->count = 2;
+            }
+            else if ((*data == '>') && (simpleXml->count == 2)) {
+                data++;
+                simpleXml->count = 0;
+                simpleXml->state = SimpleXmlStateText;
+            }
+            else {
+                deliver(simpleXml, "]]", simpleXml->count);
+                simpleXml->count = 0;
+            }
+            break;
+        default: // SimpleXmlStateDeclaration
+            // count is the depth of '[' of an internal subset
+            c = *data++;
+            if (c == '[') {
+                simpleXml->count++;
+            }
+            else if ((c == ']') && simpleXml->count) {
+                simpleXml->count--;
+            }
+            else if ((c == '>') && !simpleXml->count) {
+                simpleXml->state = SimpleXmlStateText;
+            }
+            break;
+        }
     }
 
     return simpleXml->status;
@@ -30,9 +30,11 @@
 #include <time.h>
 #include "simplexml.h"
 
-static S3Status simpleXmlCallback(const char *elementPath, const char *data,
-                                  int dataLen, void *callbackData)
+static S3Status simpleXmlCallback(const char *elementPath, SimpleXmlPath path,
+                                  const char *data, int dataLen,
+                                  void *callbackData)
 {
+    (void) path;
     (void) callbackData;
 
     printf("[%s]: [%.*s]\n", elementPath, dataLen, data);
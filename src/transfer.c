@@ -0,0 +1,298 @@
+/** **************************************************************************
+ * transfer.c
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License version 3
+ * along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+// For pread
+#define _XOPEN_SOURCE 600
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "transfer.h"
+
+
+void transfer_get_properties(const S3TransferProperties *transferProperties,
+                             uint64_t *partSizeReturn,
+                             int *maxConcurrencyReturn, int *maxRetriesReturn)
+{
+    *partSizeReturn = DEFAULT_TRANSFER_PART_SIZE;
+    *maxConcurrencyReturn = DEFAULT_TRANSFER_CONCURRENCY;
+    *maxRetriesReturn = DEFAULT_TRANSFER_RETRIES;
+
+    if (transferProperties) {
+        if (transferProperties->partSize) {
+            *partSizeReturn = transferProperties->partSize;
+        }
+        if (transferProperties->maxConcurrency > 0) {
+            *maxConcurrencyReturn = transferProperties->maxConcurrency;
+        }
+        *maxRetriesReturn = transferProperties->maxRetries;
+    }
+}
+
+
+#define string_size(str) ((str) ? (strlen(str) + 1) : 0)
+
+int transfer_target_size(const S3BucketContext *bucketContext,
+                         const char *key)
+{
+    return (string_size(bucketContext->hostName) +
+            string_size(bucketContext->bucketName) +
+            string_size(bucketContext->accessKeyId) +
+            string_size(bucketContext->secretAccessKey) +
+            string_size(bucketContext->authRegion) + string_size(key));
+}
+
+
+void transfer_copy_target(S3BucketContext *bucketContextReturn,
+                          char **keyReturn,
+                          const S3BucketContext *bucketContext,
+                          const char *key, char *strings)
+{
+#define copy_string(dest, src)                                          \
+    do {                                                                \
+        if (src) {                                                      \
+            dest = strcpy(strings, src);                                \
+            strings += (strlen(src) + 1);                               \
+        }                                                               \
+        else {                                                          \
+            dest = 0;                                                   \
+        }                                                               \
+    } while (0)
+
+    copy_string(bucketContextReturn->hostName, bucketContext->hostName);
+    copy_string(bucketContextReturn->bucketName, bucketContext->bucketName);
+    bucketContextReturn->protocol = bucketContext->protocol;
+    bucketContextReturn->uriStyle = bucketContext->uriStyle;
+    copy_string(bucketContextReturn->accessKeyId,
+                bucketContext->accessKeyId);
+    copy_string(bucketContextReturn->secretAccessKey,
+                bucketContext->secretAccessKey);
+    bucketContextReturn->signatureVersion = bucketContext->signatureVersion;
+    copy_string(bucketContextReturn->authRegion, bucketContext->authRegion);
+    bucketContextReturn->preparedBucket = bucketContext->preparedBucket;
+    copy_string(*keyReturn, key);
+}
+
+
+void transfer_error_initialize(TransferError *error)
+{
+    error->status = S3StatusOK;
+    error->hasErrorDetails = 0;
+    string_buffer_initialize(error->message);
+    string_buffer_initialize(error->resource);
+    string_buffer_initialize(error->furtherDetails);
+}
+
+
+void transfer_error_set(TransferError *error, S3Status status,
+                        const S3ErrorDetails *errorDetails)
+{
+    // Only the first failure is reported
+    if (error->status != S3StatusOK) {
+        return;
+    }
+
+    error->status = status;
+
+    if (!errorDetails) {
+        return;
+    }
+
+    int fit;
+    error->hasErrorDetails = 1;
+    memset(&(error->errorDetails), 0, sizeof(error->errorDetails));
+    if (errorDetails->message) {
+        string_buffer_append(error->message, errorDetails->message,
+                             strlen(errorDetails->message), fit);
+        error->errorDetails.message = error->message;
+    }
+    if (errorDetails->resource) {
+        string_buffer_append(error->resource, errorDetails->resource,
+                             strlen(errorDetails->resource), fit);
+        error->errorDetails.resource = error->resource;
+    }
+    if (errorDetails->furtherDetails) {
+        string_buffer_append(error->furtherDetails,
+                             errorDetails->furtherDetails,
+                             strlen(errorDetails->furtherDetails), fit);
+        error->errorDetails.furtherDetails = error->furtherDetails;
+    }
+    /* Avoid compiler error about variable set but not used */
+    (void) fit;
+}
+
+
+const S3ErrorDetails *transfer_error_details(const TransferError *error)
+{
+    return error->hasErrorDetails ? &(error->errorDetails) : 0;
+}
+
+
+int transfer_read_fd(int fd, uint64_t offset, char *buffer, int bufferSize)
+{
+    int total = 0;
+
+    while (total < bufferSize) {
+#ifdef _WIN32
+        // Windows has no pread; the callers never read an fd from more than
+        // one thread at a time
+        if (_lseeki64(fd, offset + total, SEEK_SET) == -1) {
+            return -1;
+        }
+        int ret = read(fd, &(buffer[total]), bufferSize - total);
+#else
+        ssize_t ret = pread(fd, &(buffer[total]), bufferSize - total,
+                            (off_t) (offset + total));
+#endif
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (ret == 0) {
+            break;
+        }
+        total += ret;
+    }
+
+    return total;
+}
+
+
+int transfer_write_fd(int fd, uint64_t offset, const char *buffer, int size)
+{
+    int total = 0;
+
+    while (total < size) {
+#ifdef _WIN32
+        if (_lseeki64(fd, offset + total, SEEK_SET) == -1) {
+            return -1;
+        }
+        int ret = write(fd, &(buffer[total]), size - total);
+#else
+        ssize_t ret = pwrite(fd, &(buffer[total]), size - total,
+                             (off_t) (offset + total));
+#endif
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        total += ret;
+    }
+
+    return 0;
+}
+
+
+void transfer_sink_initialize_buffer(TransferSink *sink, char *buffer,
+                                     uint64_t bufferSize)
+{
+    memset(sink, 0, sizeof(TransferSink));
+
+    sink->buffer = buffer;
+    sink->bufferSize = bufferSize;
+    sink->fd = -1;
+}
+
+
+void transfer_sink_initialize_fd(TransferSink *sink, int fd, uint64_t offset)
+{
+    memset(sink, 0, sizeof(TransferSink));
+
+    sink->fd = fd;
+    sink->fdOffset = offset;
+}
+
+
+S3Status transfer_sink_write(TransferSink *sink, uint64_t offset,
+                             const char *data, int size)
+{
+    if (sink->buffer) {
+        if ((offset > sink->bufferSize) ||
+            ((uint64_t) size > (sink->bufferSize - offset))) {
+            return S3StatusBufferTooSmall;
+        }
+        memcpy(&(sink->buffer[offset]), data, size);
+        return S3StatusOK;
+    }
+
+    // Data which does not follow on from, or fit with, the data being held
+    // back has to wait for that to be written first
+    if (sink->pendingLength &&
+        (((sink->pendingOffset + sink->pendingLength) != offset) ||
+         ((sink->pendingLength + size) > TRANSFER_SINK_WRITE_SIZE))) {
+        S3Status status = transfer_sink_flush(sink);
+        if (status != S3StatusOK) {
+            return status;
+        }
+    }
+
+    // Data that makes a large write on its own is not copied
+    if (size >= TRANSFER_SINK_WRITE_SIZE) {
+        return (transfer_write_fd(sink->fd, sink->fdOffset + offset, data,
+                                  size) ? S3StatusAbortedByCallback :
+                S3StatusOK);
+    }
+
+    if (!sink->pending &&
+        !(sink->pending = (char *) malloc(TRANSFER_SINK_WRITE_SIZE))) {
+        return S3StatusOutOfMemory;
+    }
+
+    if (!sink->pendingLength) {
+        sink->pendingOffset = offset;
+    }
+    memcpy(&(sink->pending[sink->pendingLength]), data, size);
+    sink->pendingLength += size;
+
+    return S3StatusOK;
+}
+
+
+S3Status transfer_sink_flush(TransferSink *sink)
+{
+    if (!sink->pendingLength) {
+        return S3StatusOK;
+    }
+
+    int ret = transfer_write_fd(sink->fd, sink->fdOffset + sink->pendingOffset,
+                                sink->pending, sink->pendingLength);
+    sink->pendingLength = 0;
+
+    return ret ? S3StatusAbortedByCallback : S3StatusOK;
+}
+
+
+void transfer_sink_deinitialize(TransferSink *sink)
+{
+    free(sink->pending);
+    sink->pending = 0;
+    sink->pendingLength = 0;
+}
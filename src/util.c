@@ -26,8 +26,18 @@
 
 #include <ctype.h>
 #include <string.h>
+#include <time.h>
 #include "util.h"
 
+// The accelerated SHA-1 transforms, CRC32C, URL encoding and base64 and hex
+// codecs are built for x86 with any compiler that can target instruction
+// sets per function, and are only used if the CPU has the instructions
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HASH_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
 
 // Convenience utility for making the code look nicer.  Tests a string
 // against a format; only the characters specified in the format are
@@ -54,25 +64,123 @@ static int checkString(const char *str, const char *format)
 }
 
 
-int urlEncode(char *dest, const char *src, int maxSrcSize)
+// URL encoding ---------------------------------------------------------------
+
+// The classes of characters that are left as they are by urlEncode
+// (URL_SAFE), by uriEncode (URI_SAFE), and by uriEncode when it leaves '/'
+// alone (URI_SLASH)
+#define URL_SAFE  1
+#define URI_SAFE  2
+#define URI_SLASH 4
+
+#define L URL_SAFE
+#define R (URL_SAFE | URI_SAFE)
+#define S (URL_SAFE | URI_SLASH)
+static const unsigned char urlSafeG[256] =
 {
-    static const char *hex = "0123456789ABCDEF";
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, L, 0, 0, 0, 0, 0, L, L, L, L, 0, 0, R, R, S,
+    R, R, R, R, R, R, R, R, R, R, 0, 0, 0, 0, 0, 0,
+    0, R, R, R, R, R, R, R, R, R, R, R, R, R, R, R,
+    R, R, R, R, R, R, R, R, R, R, R, 0, 0, 0, 0, R,
+    0, R, R, R, R, R, R, R, R, R, R, R, R, R, R, R,
+    R, R, R, R, R, R, R, R, R, R, R, 0, 0, 0, R, 0
+};
+#undef L
+#undef R
+#undef S
+
+
+#ifdef HASH_X86
+
+// For each combination of the classes above, the pshufb lookup tables that
+// find the characters of those classes 16 at a time: a character is in
+// them if the entry for its low nibble has the bit for its high nibble set
+// (all of the characters are ASCII, so the high nibble is at most 7).  Set
+// by util_initialize().
+static unsigned char urlSafeLoG[8][16];
+
+static void url_tables_initialize()
+{
+    int classes, c;
+
+    for (classes = 0; classes < 8; classes++) {
+        for (c = 0; c < 128; c++) {
+            if (urlSafeG[c] & classes) {
+                urlSafeLoG[classes][c & 15] |= (1 << (c >> 4));
+            }
+        }
+    }
+}
 
-    int len = 0;
 
-    if (src) while (*src) {
-        if (++len > maxSrcSize) {
-            *dest = 0;
-            return 0;
+// Returns the number of characters at the start of the [len] characters of
+// [src] that are all in [classes]
+__attribute__((target("ssse3")))
+static int url_safe_span_ssse3(const char *src, int len, int classes)
+{
+    const __m128i lut_lo =
+        _mm_loadu_si128((const __m128i *) urlSafeLoG[classes]);
+    const __m128i lut_hi =
+        _mm_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char) 0x80,
+                      0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    int span = 0;
+
+    while ((len - span) >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) &(src[span]));
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+        __m128i lo = _mm_and_si128(v, nibble);
+        __m128i in = _mm_and_si128(_mm_shuffle_epi8(lut_lo, lo),
+                                   _mm_shuffle_epi8(lut_hi, hi));
+        int mask = _mm_movemask_epi8
+            (_mm_cmpeq_epi8(in, _mm_setzero_si128()));
+        if (mask) {
+            return span + __builtin_ctz(mask);
         }
-        unsigned char c = *src;
-        if (isalnum(c) ||
-            (c == '-') || (c == '_') || (c == '.') || (c == '!') || 
-            (c == '~') || (c == '*') || (c == '\'') || (c == '(') ||
-            (c == ')') || (c == '/')) {
+        span += 16;
+    }
+
+    return span;
+}
+
+
+static int ssse3G = 0;
+
+#endif /* HASH_X86 */
+
+
+// Encodes the [len] characters of [src] into [dest], leaving those in
+// [classes] as they are, turning ' ' into '+' if [plus] is set, and
+// %-encoding all others.  Returns the length of [dest], which is
+// terminated.
+static int url_encode(char *dest, const char *src, int len, int classes,
+                      int plus)
+{
+    static const char *hex = "0123456789ABCDEF";
+
+    const unsigned char *u = (const unsigned char *) src;
+    char *original_dest = dest;
+
+    while (len) {
+#ifdef HASH_X86
+        // Runs of characters that need no encoding are copied in bulk
+        if (ssse3G && (len >= 16)) {
+            int span = url_safe_span_ssse3((const char *) u, len, classes);
+            memcpy(dest, u, span);
+            dest += span, u += span, len -= span;
+            if (!len) {
+                break;
+            }
+        }
+#endif
+        unsigned char c = *u++;
+        len--;
+        if (urlSafeG[c] & classes) {
             *dest++ = c;
         }
-        else if (*src == ' ') {
+        else if (plus && (c == ' ')) {
             *dest++ = '+';
         }
         else {
@@ -80,12 +188,121 @@ int urlEncode(char *dest, const char *src, int maxSrcSize)
             *dest++ = hex[c >> 4];
             *dest++ = hex[c & 15];
         }
-        src++;
     }
 
     *dest = 0;
 
-    return 1;
+    return (dest - original_dest);
+}
+
+
+int urlEncode(char *dest, const char *src, int maxSrcSize)
+{
+    int len = src ? strlen(src) : 0;
+
+    if (len > maxSrcSize) {
+        *dest = 0;
+        return -1;
+    }
+
+    return url_encode(dest, src, len, URL_SAFE, 1);
+}
+
+
+int uriEncode(char *dest, const char *src, int maxSrcSize, int encodeSlash)
+{
+    int len = src ? strlen(src) : 0;
+
+    if (len > maxSrcSize) {
+        *dest = 0;
+        return -1;
+    }
+
+    return url_encode(dest, src, len, 
+                      encodeSlash ? URI_SAFE : (URI_SAFE | URI_SLASH), 0);
+}
+
+
+int urlDecode(char *dest, const char *src, int srcLen)
+{
+    char *original_dest = dest;
+    unsigned char byte;
+
+    while (srcLen) {
+        char c = *src++;
+        srcLen--;
+        if (c == '+') {
+            c = ' ';
+        }
+        else if ((c == '%') && (srcLen >= 2) && 
+                 (hexDecode(src, 2, &byte) == 1)) {
+            c = byte;
+            src += 2, srcLen -= 2;
+        }
+        *dest++ = c;
+    }
+
+    *dest = 0;
+
+    return (dest - original_dest);
+}
+
+
+uint64_t parseUnsignedInt(const char *str)
+{
+    // Skip whitespace
+    while (is_blank(*str)) {
+        str++;
+    }
+
+    uint64_t ret = 0;
+
+    while (isdigit(*str)) {
+        ret *= 10;
+        ret += (*str++ - '0');
+    }
+
+    return ret;
+}
+
+
+// Dates ---------------------------------------------------------------------
+
+// Returns the number of days between 1970-01-01 and [year]-[month]-[day] of
+// the proleptic Gregorian calendar, counting in 400-year eras so that no
+// table or time zone is needed
+static int64_t days_from_civil(int64_t year, unsigned int month,
+                               unsigned int day)
+{
+    year -= (month <= 2);
+    int64_t era = ((year >= 0) ? year : (year - 399)) / 400;
+    unsigned int yearOfEra = (unsigned int) (year - (era * 400));
+    unsigned int dayOfYear =
+        (((153 * ((month > 2) ? (month - 3) : (month + 9))) + 2) / 5) +
+        day - 1;
+    unsigned int dayOfEra = (yearOfEra * 365) + (yearOfEra / 4) -
+        (yearOfEra / 100) + dayOfYear;
+
+    return (era * 146097) + dayOfEra - 719468;
+}
+
+
+// The inverse of days_from_civil
+static void civil_from_days(int64_t days, int64_t *yearReturn,
+                            unsigned int *monthReturn, unsigned int *dayReturn)
+{
+    days += 719468;
+    int64_t era = ((days >= 0) ? days : (days - 146096)) / 146097;
+    unsigned int dayOfEra = (unsigned int) (days - (era * 146097));
+    unsigned int yearOfEra = (dayOfEra - (dayOfEra / 1460) +
+                              (dayOfEra / 36524) - (dayOfEra / 146096)) / 365;
+    unsigned int dayOfYear = dayOfEra -
+        ((365 * yearOfEra) + (yearOfEra / 4) - (yearOfEra / 100));
+    unsigned int monthIndex = ((5 * dayOfYear) + 2) / 153;
+
+    *dayReturn = dayOfYear - (((153 * monthIndex) + 2) / 5) + 1;
+    *monthReturn = (monthIndex < 10) ? (monthIndex + 3) : (monthIndex - 9);
+    *yearReturn = yearOfEra + (era * 400) + (*monthReturn <= 2);
 }
 
 
@@ -98,34 +315,33 @@ int64_t parseIso8601Time(const char *str)
 
 #define nextnum() (((*str - '0') * 10) + (*(str + 1) - '0'))
 
-    // Convert it
-    struct tm stm;
-    memset(&stm, 0, sizeof(stm));
-
-    stm.tm_year = (nextnum() - 19) * 100;
+    // Convert it; this is always UTC, whatever the local time zone is
+    int64_t year = nextnum() * 100;
     str += 2;
-    stm.tm_year += nextnum();
+    year += nextnum();
     str += 3;
 
-    stm.tm_mon = nextnum() - 1;
+    unsigned int month = nextnum();
     str += 3;
 
-    stm.tm_mday = nextnum();
+    unsigned int day = nextnum();
     str += 3;
 
-    stm.tm_hour = nextnum();
+    if ((month < 1) || (month > 12) || (day < 1) || (day > 31)) {
+        return -1;
+    }
+
+    int64_t ret = days_from_civil(year, month, day) * (24 * 60 * 60);
+
+    ret += nextnum() * (60 * 60);
     str += 3;
 
-    stm.tm_min = nextnum();
+    ret += nextnum() * 60;
     str += 3;
 
-    stm.tm_sec = nextnum();
+    ret += nextnum();
     str += 2;
 
-    stm.tm_isdst = -1;
-    
-    int64_t ret = mktime(&stm);
-
     // Skip the millis
 
     if (*str == '.') {
@@ -149,62 +365,473 @@ int64_t parseIso8601Time(const char *str)
 }
 
 
-uint64_t parseUnsignedInt(const char *str)
+// Writes [value] as [count] decimal digits, most significant first
+static char *put_digits(char *dest, unsigned int value, int count)
 {
-    // Skip whitespace
-    while (is_blank(*str)) {
-        str++;
+    int i;
+    for (i = count - 1; i >= 0; i--) {
+        dest[i] = '0' + (value % 10);
+        value /= 10;
     }
 
-    uint64_t ret = 0;
+    return dest + count;
+}
 
-    while (isdigit(*str)) {
-        ret *= 10;
-        ret += (*str++ - '0');
+
+// Splits [t] into its UTC date, time of day and day of the week (0 is
+// Sunday)
+static void break_down_time(int64_t t, int64_t *year, unsigned int *month,
+                            unsigned int *day, unsigned int *secondOfDay,
+                            unsigned int *weekday)
+{
+    int64_t days = t / (24 * 60 * 60);
+    int64_t seconds = t % (24 * 60 * 60);
+    if (seconds < 0) {
+        days--;
+        seconds += (24 * 60 * 60);
     }
 
-    return ret;
+    civil_from_days(days, year, month, day);
+    *secondOfDay = (unsigned int) seconds;
+    // 1970-01-01 was a Thursday
+    *weekday = (unsigned int) (((days % 7) + 11) % 7);
 }
 
 
-int base64Encode(const unsigned char *in, int inLen, char *out)
+void formatAmzDate(char *dest, int64_t t)
+{
+    int64_t year;
+    unsigned int month, day, seconds, weekday;
+    break_down_time(t, &year, &month, &day, &seconds, &weekday);
+
+    dest = put_digits(dest, (unsigned int) year, 4);
+    dest = put_digits(dest, month, 2);
+    dest = put_digits(dest, day, 2);
+    *dest++ = 'T';
+    dest = put_digits(dest, seconds / (60 * 60), 2);
+    dest = put_digits(dest, (seconds / 60) % 60, 2);
+    dest = put_digits(dest, seconds % 60, 2);
+    *dest++ = 'Z';
+    *dest = 0;
+}
+
+
+void formatHttpDate(char *dest, int64_t t)
+{
+    static const char days[] = "SunMonTueWedThuFriSat";
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+    int64_t year;
+    unsigned int month, day, seconds, weekday;
+    break_down_time(t, &year, &month, &day, &seconds, &weekday);
+
+    memcpy(dest, &(days[weekday * 3]), 3);
+    dest[3] = ',';
+    dest[4] = ' ';
+    dest = put_digits(dest + 5, day, 2);
+    *dest++ = ' ';
+    memcpy(dest, &(months[(month - 1) * 3]), 3);
+    dest[3] = ' ';
+    dest = put_digits(dest + 4, (unsigned int) year, 4);
+    *dest++ = ' ';
+    dest = put_digits(dest, seconds / (60 * 60), 2);
+    *dest++ = ':';
+    dest = put_digits(dest, (seconds / 60) % 60, 2);
+    *dest++ = ':';
+    dest = put_digits(dest, seconds % 60, 2);
+    *dest = 0;
+}
+
+
+// The date strings of the current second, shared by every thread so that
+// each is formatted once a second rather than once a request.  The strings
+// are published seqlock style: [sequence] is odd while a thread is updating
+// them, and a reader which sees it change while it copies the strings
+// formats its own instead.  The strings are kept in words so that each can
+// be copied atomically.
+static struct
 {
-    static const char *ENC = 
-        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    uint64_t sequence;
+
+    int64_t second;
+
+    // The 16 characters of the amz date, then the 29 of the HTTP date
+    uint64_t dates[6];
+} dateCacheG;
 
+
+int64_t currentTime(char *amzDate, char *httpDate)
+{
+    int64_t now = (int64_t) time(NULL);
+
+    union
+    {
+        uint64_t words[6];
+        char chars[48];
+    } dates;
+
+    uint64_t sequence = __atomic_load_n(&dateCacheG.sequence, __ATOMIC_ACQUIRE);
+    int cached = !(sequence & 1) &&
+        (__atomic_load_n(&dateCacheG.second, __ATOMIC_RELAXED) == now);
+
+    if (cached) {
+        int i;
+        for (i = 0; i < 6; i++) {
+            dates.words[i] = 
+                __atomic_load_n(&(dateCacheG.dates[i]), __ATOMIC_RELAXED);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        cached = (__atomic_load_n(&dateCacheG.sequence, __ATOMIC_RELAXED) ==
+                  sequence);
+    }
+
+    if (!cached) {
+        formatAmzDate(dates.chars, now);
+        formatHttpDate(&(dates.chars[16]), now);
+        memcpy(&(dates.chars[41]), " GMT", 4);
+        dates.chars[45] = dates.chars[46] = dates.chars[47] = 0;
+
+        // Publish them unless another thread is already doing so
+        if (!(sequence & 1) && 
+            __atomic_compare_exchange_n(&dateCacheG.sequence, &sequence,
+                                        sequence + 1, 0, __ATOMIC_RELAXED,
+                                        __ATOMIC_RELAXED)) {
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            int i;
+            for (i = 0; i < 6; i++) {
+                __atomic_store_n(&(dateCacheG.dates[i]), dates.words[i],
+                                 __ATOMIC_RELAXED);
+            }
+            __atomic_store_n(&dateCacheG.second, now, __ATOMIC_RELAXED);
+            __atomic_store_n(&dateCacheG.sequence, sequence + 2,
+                             __ATOMIC_RELEASE);
+        }
+    }
+
+    if (amzDate) {
+        memcpy(amzDate, dates.chars, 16);
+        amzDate[16] = 0;
+    }
+    if (httpDate) {
+        memcpy(httpDate, &(dates.chars[16]), 29);
+        httpDate[29] = 0;
+    }
+
+    return now;
+}
+
+
+// base64 and hex codecs ------------------------------------------------------
+
+static const char base64EncG[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// The 6-bit value of each base64 character, or B64_BAD for any other byte
+#define B64_BAD 0xFF
+#define X B64_BAD
+static const unsigned char base64DecG[256] =
+{
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+    X, X, X, X, X, X, X, X, X, X, X, 62, X, X, X, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, X, X, X, X, X, X,
+    X, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, X, X, X, X, X,
+    X, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, X, X, X, X, X,
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X
+};
+#undef X
+
+
+static int base64_encode_scalar(const unsigned char *in, int inLen, char *out)
+{
     char *original_out = out;
 
-    while (inLen) {
-        // first 6 bits of char 1
-        *out++ = ENC[*in >> 2];
-        if (!--inLen) {
-            // last 2 bits of char 1, 4 bits of 0
-            *out++ = ENC[(*in & 0x3) << 4];
-            *out++ = '=';
-            *out++ = '=';
-            break;
-        }
-        // last 2 bits of char 1, first 4 bits of char 2
-        *out++ = ENC[((*in & 0x3) << 4) | (*(in + 1) >> 4)];
-        in++;
-        if (!--inLen) {
-            // last 4 bits of char 2, 2 bits of 0
-            *out++ = ENC[(*in & 0xF) << 2];
-            *out++ = '=';
-            break;
-        }
-        // last 4 bits of char 2, first 2 bits of char 3
-        *out++ = ENC[((*in & 0xF) << 2) | (*(in + 1) >> 6)];
-        in++;
-        // last 6 bits of char 3
-        *out++ = ENC[*in & 0x3F];
-        in++, inLen--;
+    // Whole groups of 3 bytes become 4 characters each
+    while (inLen >= 3) {
+        uint32_t v = (in[0] << 16) | (in[1] << 8) | in[2];
+        out[0] = base64EncG[v >> 18];
+        out[1] = base64EncG[(v >> 12) & 0x3F];
+        out[2] = base64EncG[(v >> 6) & 0x3F];
+        out[3] = base64EncG[v & 0x3F];
+        in += 3, inLen -= 3, out += 4;
+    }
+
+    // And any 1 or 2 remaining bytes are padded out to 4 characters
+    if (inLen) {
+        uint32_t v = (in[0] << 16) | ((inLen == 2) ? (in[1] << 8) : 0);
+        out[0] = base64EncG[v >> 18];
+        out[1] = base64EncG[(v >> 12) & 0x3F];
+        out[2] = (inLen == 2) ? base64EncG[(v >> 6) & 0x3F] : '=';
+        out[3] = '=';
+        out += 4;
+    }
+
+    return (out - original_out);
+}
+
+
+static int base64_decode_scalar(const char *in, int inLen, unsigned char *out)
+{
+    const unsigned char *u = (const unsigned char *) in;
+    unsigned char *original_out = out;
+
+    // Padding may only appear at the very end, and only to fill out a group
+    // of 4
+    if (inLen && (u[inLen - 1] == '=')) {
+        if (inLen & 3) {
+            return -1;
+        }
+        inLen--;
+        if (u[inLen - 1] == '=') {
+            inLen--;
+        }
+    }
+
+    while (inLen >= 4) {
+        uint32_t a = base64DecG[u[0]], b = base64DecG[u[1]],
+            c = base64DecG[u[2]], d = base64DecG[u[3]];
+        if ((a | b | c | d) == B64_BAD) {
+            return -1;
+        }
+        uint32_t v = (a << 18) | (b << 12) | (c << 6) | d;
+        out[0] = v >> 16;
+        out[1] = v >> 8;
+        out[2] = v;
+        u += 4, inLen -= 4, out += 3;
+    }
+
+    // A final group of 2 or 3 characters holds 1 or 2 bytes; 1 character
+    // can't hold a whole byte
+    if (inLen == 1) {
+        return -1;
+    }
+    if (inLen) {
+        uint32_t a = base64DecG[u[0]], b = base64DecG[u[1]],
+            c = (inLen == 3) ? base64DecG[u[2]] : 0;
+        if ((a | b | c) == B64_BAD) {
+            return -1;
+        }
+        // The bits past the last whole byte must be zero, so that every
+        // byte string has just one encoding
+        if ((inLen == 2) ? (b & 0x0F) : (c & 0x03)) {
+            return -1;
+        }
+        uint32_t v = (a << 18) | (b << 12) | (c << 6);
+        *out++ = v >> 16;
+        if (inLen == 3) {
+            *out++ = v >> 8;
+        }
     }
 
     return (out - original_out);
 }
 
 
+static void hex_encode_scalar(const unsigned char *in, int inLen, char *out)
+{
+    static const char *hex = "0123456789abcdef";
+
+    while (inLen--) {
+        *out++ = hex[*in >> 4];
+        *out++ = hex[*in & 15];
+        in++;
+    }
+
+    *out = 0;
+}
+
+
+#ifdef HASH_X86
+
+// These encode and decode 16 characters of base64 (12 bytes) per step using
+// pshufb as a small lookup table, as described by Wojciech Mula and Daniel
+// Lemire in "Faster Base64 Encoding and Decoding using AVX2 Instructions".
+// Whatever is left over is handled by the scalar code.
+
+__attribute__((target("ssse3")))
+static int base64_encode_ssse3(const unsigned char *in, int inLen, char *out)
+{
+    char *original_out = out;
+
+    const __m128i shuf =
+        _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m128i shift_lut =
+        _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                      '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+    // Each step loads 16 bytes but consumes only 12
+    while (inLen >= 16) {
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) in),
+                                     shuf);
+
+        // Spread the 6-bit groups of every 3 bytes over 4 bytes
+        __m128i t0 = _mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00));
+        __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        __m128i t2 = _mm_and_si128(v, _mm_set1_epi32(0x003f03f0));
+        __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+        __m128i indices = _mm_or_si128(t1, t3);
+
+        // Map each range of 6-bit values to the offset that turns it into
+        // its character
+        __m128i r = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+        __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+        r = _mm_or_si128(r, _mm_and_si128(less, _mm_set1_epi8(13)));
+        r = _mm_add_epi8(_mm_shuffle_epi8(shift_lut, r), indices);
+
+        _mm_storeu_si128((__m128i *) out, r);
+        in += 12, inLen -= 12, out += 16;
+    }
+
+    return (out - original_out) + base64_encode_scalar(in, inLen, out);
+}
+
+
+__attribute__((target("ssse3")))
+static int base64_decode_ssse3(const char *in, int inLen, unsigned char *out)
+{
+    unsigned char *original_out = out;
+
+    const __m128i lut_lo =
+        _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                      0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi =
+        _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                      0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll =
+        _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                      0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i pack =
+        _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+
+    // Each step stores 16 bytes but produces only 12, so stop while there
+    // are still at least 8 characters, and so at least 4 bytes of output,
+    // to come
+    while (inLen >= 24) {
+        __m128i v = _mm_loadu_si128((const __m128i *) in);
+        __m128i hi = _mm_and_si128(_mm_srli_epi32(v, 4), nibble);
+        __m128i lo = _mm_and_si128(v, nibble);
+
+        // A character is valid only if the classes of its high and low
+        // nibbles share no bits; padding isn't valid here either
+        __m128i bad = _mm_and_si128(_mm_shuffle_epi8(lut_lo, lo),
+                                    _mm_shuffle_epi8(lut_hi, hi));
+        if (_mm_movemask_epi8(_mm_cmpgt_epi8(bad, _mm_setzero_si128()))) {
+            return -1;
+        }
+
+        // Turn characters into 6-bit values; '/' is the only character
+        // whose high nibble doesn't determine its offset
+        __m128i eq_slash = _mm_cmpeq_epi8(v, _mm_set1_epi8('/'));
+        __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_slash, hi));
+        v = _mm_add_epi8(v, roll);
+
+        // And pack each 4 6-bit values into 3 bytes
+        v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+        v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+        _mm_storeu_si128((__m128i *) out, _mm_shuffle_epi8(v, pack));
+
+        in += 16, inLen -= 16, out += 12;
+    }
+
+    int len = base64_decode_scalar(in, inLen, out);
+
+    return (len < 0) ? -1 : ((out - original_out) + len);
+}
+
+
+__attribute__((target("ssse3")))
+static void hex_encode_ssse3(const unsigned char *in, int inLen, char *out)
+{
+    const __m128i hex = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+                                      '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+
+    while (inLen >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) in);
+        __m128i hi = _mm_shuffle_epi8
+            (hex, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+        __m128i lo = _mm_shuffle_epi8(hex, _mm_and_si128(v, nibble));
+        _mm_storeu_si128((__m128i *) out, _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *) (out + 16), _mm_unpackhi_epi8(hi, lo));
+        in += 16, inLen -= 16, out += 32;
+    }
+
+    hex_encode_scalar(in, inLen, out);
+}
+
+#endif /* HASH_X86 */
+
+
+// Set by util_initialize() to the fastest implementations that the CPU
+// supports
+static int (*base64EncodeG)(const unsigned char *in, int inLen, char *out) =
+    &base64_encode_scalar;
+static int (*base64DecodeG)(const char *in, int inLen, unsigned char *out) =
+    &base64_decode_scalar;
+static void (*hexEncodeG)(const unsigned char *in, int inLen, char *out) =
+    &hex_encode_scalar;
+
+
+int base64Encode(const unsigned char *in, int inLen, char *out)
+{
+    return (*base64EncodeG)(in, inLen, out);
+}
+
+
+int base64Decode(const char *in, int inLen, unsigned char *out)
+{
+    return (*base64DecodeG)(in, inLen, out);
+}
+
+
+void hexEncode(const unsigned char *in, int inLen, char *out)
+{
+    (*hexEncodeG)(in, inLen, out);
+}
+
+
+int hexDecode(const char *in, int inLen, unsigned char *out)
+{
+    if (inLen & 1) {
+        return -1;
+    }
+
+    int i;
+    for (i = 0; i < inLen; i++) {
+        unsigned char c = in[i];
+        int v;
+        if ((c >= '0') && (c <= '9')) {
+            v = c - '0';
+        }
+        else if (((c | 0x20) >= 'a') && ((c | 0x20) <= 'f')) {
+            v = (c | 0x20) - 'a' + 10;
+        }
+        else {
+            return -1;
+        }
+        if (i & 1) {
+            out[i / 2] |= v;
+        }
+        else {
+            out[i / 2] = v << 4;
+        }
+    }
+
+    return inLen / 2;
+}
+
+
 #define rol(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
 
 #define blk0L(i) (block->l[i] = (rol(block->l[i], 24) & 0xFF00FF00)     \
@@ -328,6 +955,329 @@ static void SHA1_transform(uint32_t state[5], const unsigned char buffer[64])
 }
 
 
+#ifdef HASH_X86
+
+#define F_CH(x, y, z) (((x) & ((y) ^ (z))) ^ (z))
+#define F_PARITY(x, y, z) ((x) ^ (y) ^ (z))
+#define F_MAJ(x, y, z) ((((x) | (y)) & (z)) | ((x) & (y)))
+
+#define RK(f, v, w, x, y, z, i)                                         \
+    z += f(w, x, y) + wk[i] + rol(v, 5);                                \
+    w = rol(w, 30);
+
+#define RK5(f, i)                                                       \
+    RK(f, a, b, c, d, e, i); RK(f, e, a, b, c, d, i + 1);               \
+    RK(f, d, e, a, b, c, i + 2); RK(f, c, d, e, a, b, i + 3);           \
+    RK(f, b, c, d, e, a, i + 4);
+
+#define ROL_EPI32(x, bits)                                              \
+    _mm_or_si128(_mm_slli_epi32(x, bits), _mm_srli_epi32(x, 32 - (bits)))
+
+// The message schedule is computed four words at a time with SSSE3, and the
+// rounds, which are inherently serial, are then run on the words with the
+// round constants already added.  Words 16 - 31 follow the definition, with
+// the last word of each four fixed up since it depends on the first; words
+// 32 - 79 use the equivalent W[t] = rol(W[t-6] ^ W[t-16] ^ W[t-28] ^
+// W[t-32], 2), which has no dependency within four words.
+__attribute__((target("ssse3")))
+static void SHA1_transform_ssse3(uint32_t state[5],
+                                 const unsigned char buffer[64])
+{
+    const __m128i bswap = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11,
+                                       4, 5, 6, 7, 0, 1, 2, 3);
+    const uint32_t k[4] = { 0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6 };
+    __m128i w[20];
+    uint32_t wk[80];
+    uint32_t a, b, c, d, e;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        w[i] = _mm_shuffle_epi8
+            (_mm_loadu_si128((const __m128i *) &(buffer[i * 16])), bswap);
+    }
+
+    for (i = 4; i < 8; i++) {
+        __m128i x = _mm_xor_si128
+            (_mm_xor_si128(w[i - 4], _mm_alignr_epi8(w[i - 3], w[i - 4], 8)),
+             _mm_xor_si128(w[i - 2], _mm_srli_si128(w[i - 1], 4)));
+        x = ROL_EPI32(x, 1);
+        // The last word was computed without W[t-3], which is the first
+        x = _mm_xor_si128(x, ROL_EPI32(_mm_slli_si128(x, 12), 1));
+        w[i] = x;
+    }
+
+    for (i = 8; i < 20; i++) {
+        __m128i x = _mm_xor_si128
+            (_mm_xor_si128(_mm_alignr_epi8(w[i - 1], w[i - 2], 8), w[i - 4]),
+             _mm_xor_si128(w[i - 7], w[i - 8]));
+        w[i] = ROL_EPI32(x, 2);
+    }
+
+    for (i = 0; i < 20; i++) {
+        _mm_storeu_si128((__m128i *) &(wk[i * 4]),
+                         _mm_add_epi32(w[i], _mm_set1_epi32(k[i / 5])));
+    }
+
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+
+    RK5(F_CH, 0); RK5(F_CH, 5); RK5(F_CH, 10); RK5(F_CH, 15);
+    RK5(F_PARITY, 20); RK5(F_PARITY, 25); RK5(F_PARITY, 30);
+    RK5(F_PARITY, 35);
+    RK5(F_MAJ, 40); RK5(F_MAJ, 45); RK5(F_MAJ, 50); RK5(F_MAJ, 55);
+    RK5(F_PARITY, 60); RK5(F_PARITY, 65); RK5(F_PARITY, 70);
+    RK5(F_PARITY, 75);
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+
+// Four rounds with the SHA extensions, for rounds 4 * g to 4 * g + 3.  m0
+// holds the words for these rounds, and m1, m2 and m3 those of the rounds
+// which follow; the schedule for the later rounds is advanced along the
+// way.
+#define SHA_NI_ROUNDS(g, ein, esave, m0, m1, m2, m3)                    \
+    ein = _mm_sha1nexte_epu32(ein, m0);                                 \
+    esave = abcd;                                                       \
+    if (((g) >= 3) && ((g) <= 18)) {                                    \
+        m1 = _mm_sha1msg2_epu32(m1, m0);                                \
+    }                                                                   \
+    abcd = _mm_sha1rnds4_epu32(abcd, ein, (g) / 5);                     \
+    if ((g) <= 16) {                                                    \
+        m3 = _mm_sha1msg1_epu32(m3, m0);                                \
+    }                                                                   \
+    if (((g) >= 2) && ((g) <= 17)) {                                    \
+        m2 = _mm_xor_si128(m2, m0);                                     \
+    }
+
+__attribute__((target("sha,sse4.1")))
+static void SHA1_transform_sha_ni(uint32_t state[5],
+                                  const unsigned char buffer[64])
+{
+    const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+                                       8, 9, 10, 11, 12, 13, 14, 15);
+    __m128i abcd, abcdSave, e0, e0Save, e1, m0, m1, m2, m3;
+
+    abcd = _mm_shuffle_epi32
+        (_mm_loadu_si128((const __m128i *) state), 0x1B);
+    e0 = _mm_set_epi32(state[4], 0, 0, 0);
+    abcdSave = abcd;
+    e0Save = e0;
+
+    m0 = _mm_shuffle_epi8
+        (_mm_loadu_si128((const __m128i *) &(buffer[0])), bswap);
+    m1 = _mm_shuffle_epi8
+        (_mm_loadu_si128((const __m128i *) &(buffer[16])), bswap);
+    m2 = _mm_shuffle_epi8
+        (_mm_loadu_si128((const __m128i *) &(buffer[32])), bswap);
+    m3 = _mm_shuffle_epi8
+        (_mm_loadu_si128((const __m128i *) &(buffer[48])), bswap);
+
+    // The first rounds have no previous e to fold in
+    e0 = _mm_add_epi32(e0, m0);
+    e1 = abcd;
+    abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+    SHA_NI_ROUNDS( 1, e1, e0, m1, m2, m3, m0);
+    SHA_NI_ROUNDS( 2, e0, e1, m2, m3, m0, m1);
+    SHA_NI_ROUNDS( 3, e1, e0, m3, m0, m1, m2);
+    SHA_NI_ROUNDS( 4, e0, e1, m0, m1, m2, m3);
+    SHA_NI_ROUNDS( 5, e1, e0, m1, m2, m3, m0);
+    SHA_NI_ROUNDS( 6, e0, e1, m2, m3, m0, m1);
+    SHA_NI_ROUNDS( 7, e1, e0, m3, m0, m1, m2);
+    SHA_NI_ROUNDS( 8, e0, e1, m0, m1, m2, m3);
+    SHA_NI_ROUNDS( 9, e1, e0, m1, m2, m3, m0);
+    SHA_NI_ROUNDS(10, e0, e1, m2, m3, m0, m1);
+    SHA_NI_ROUNDS(11, e1, e0, m3, m0, m1, m2);
+    SHA_NI_ROUNDS(12, e0, e1, m0, m1, m2, m3);
+    SHA_NI_ROUNDS(13, e1, e0, m1, m2, m3, m0);
+    SHA_NI_ROUNDS(14, e0, e1, m2, m3, m0, m1);
+    SHA_NI_ROUNDS(15, e1, e0, m3, m0, m1, m2);
+    SHA_NI_ROUNDS(16, e0, e1, m0, m1, m2, m3);
+    SHA_NI_ROUNDS(17, e1, e0, m1, m2, m3, m0);
+    SHA_NI_ROUNDS(18, e0, e1, m2, m3, m0, m1);
+    SHA_NI_ROUNDS(19, e1, e0, m3, m0, m1, m2);
+
+    e0 = _mm_sha1nexte_epu32(e0, e0Save);
+    abcd = _mm_add_epi32(abcd, abcdSave);
+
+    _mm_storeu_si128((__m128i *) state, _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = (uint32_t) _mm_extract_epi32(e0, 3);
+}
+
+#endif /* HASH_X86 */
+
+
+// CRC32C -------------------------------------------------------------------
+
+// The tables of the software CRC32C, which handles eight bytes at a time:
+// crc32cTablesG[k][b] is the CRC of byte b followed by k zero bytes
+static uint32_t crc32cTablesG[8][256];
+
+
+static void crc32c_tables_initialize()
+{
+    int i, k;
+
+    for (i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (k = 0; k < 8; k++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? 0x82f63b78 : 0);
+        }
+        crc32cTablesG[0][i] = crc;
+    }
+
+    for (i = 0; i < 256; i++) {
+        for (k = 1; k < 8; k++) {
+            uint32_t crc = crc32cTablesG[k - 1][i];
+            crc32cTablesG[k][i] = (crc >> 8) ^ crc32cTablesG[0][crc & 0xff];
+        }
+    }
+}
+
+
+#define crc32c_byte(crc, b) \
+    (((crc) >> 8) ^ crc32cTablesG[0][((crc) ^ (b)) & 0xff])
+
+static uint32_t crc32c_update_table(uint32_t crc, const unsigned char *data,
+                                    unsigned int len)
+{
+    crc = ~crc;
+
+    while (len >= 8) {
+        uint32_t lo = crc ^ (data[0] | (data[1] << 8) | (data[2] << 16) |
+                             ((uint32_t) data[3] << 24));
+        crc = (crc32cTablesG[7][lo & 0xff] ^
+               crc32cTablesG[6][(lo >> 8) & 0xff] ^
+               crc32cTablesG[5][(lo >> 16) & 0xff] ^
+               crc32cTablesG[4][lo >> 24] ^
+               crc32cTablesG[3][data[4]] ^ crc32cTablesG[2][data[5]] ^
+               crc32cTablesG[1][data[6]] ^ crc32cTablesG[0][data[7]]);
+        data += 8;
+        len -= 8;
+    }
+
+    while (len--) {
+        crc = crc32c_byte(crc, *data++);
+    }
+
+    return ~crc;
+}
+
+
+#ifdef HASH_X86
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_update_sse42(uint32_t crc, const unsigned char *data,
+                                    unsigned int len)
+{
+    crc = ~crc;
+
+    while (len && ((uintptr_t) data & 7)) {
+        crc = _mm_crc32_u8(crc, *data++);
+        len--;
+    }
+
+#ifdef __x86_64__
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        crc64 = _mm_crc32_u64(crc64, *(const uint64_t *) data);
+        data += 8;
+        len -= 8;
+    }
+    crc = (uint32_t) crc64;
+#endif
+
+    while (len >= 4) {
+        crc = _mm_crc32_u32(crc, *(const uint32_t *) data);
+        data += 4;
+        len -= 4;
+    }
+
+    while (len--) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+
+    return ~crc;
+}
+
+#endif /* HASH_X86 */
+
+
+// Set by util_initialize() to the fastest implementation that the CPU
+// supports
+static uint32_t (*crc32c_updateG)(uint32_t crc, const unsigned char *data,
+                                  unsigned int len) = &crc32c_update_table;
+
+
+uint32_t crc32c_update(uint32_t crc, const unsigned char *data,
+                       unsigned int len)
+{
+    return (*crc32c_updateG)(crc, data, len);
+}
+
+
+// SHA-1 dispatch -------------------------------------------------------------
+
+// The transform used for every block; set by util_initialize() to the
+// fastest one that the CPU supports
+static void (*SHA1_transformG)(uint32_t state[5],
+                               const unsigned char buffer[64]) =
+    &SHA1_transform;
+
+
+void util_initialize()
+{
+    crc32c_tables_initialize();
+
+#ifdef HASH_X86
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return;
+    }
+
+    // SSSE3 and SSE4.1 are ecx bits 9 and 19 of leaf 1
+    int ssse3 = (ecx >> 9) & 1, sse41 = (ecx >> 19) & 1;
+
+    // The SHA extensions are ebx bit 29 of leaf 7
+    int sha = 0;
+    if (__get_cpuid_max(0, 0) >= 7) {
+        __cpuid_count(7, 0, eax, ebx, ecx, edx);
+        sha = (ebx >> 29) & 1;
+    }
+
+    if (sha && ssse3 && sse41) {
+        SHA1_transformG = &SHA1_transform_sha_ni;
+    }
+    else if (ssse3) {
+        SHA1_transformG = &SHA1_transform_ssse3;
+    }
+
+    if (ssse3) {
+        url_tables_initialize();
+        ssse3G = 1;
+        base64EncodeG = &base64_encode_ssse3;
+        base64DecodeG = &base64_decode_ssse3;
+        hexEncodeG = &hex_encode_ssse3;
+    }
+
+    // SSE4.2, which has the CRC32C instruction, is ecx bit 20 of leaf 1
+    __cpuid(1, eax, ebx, ecx, edx);
+    if ((ecx >> 20) & 1) {
+        crc32c_updateG = &crc32c_update_sse42;
+    }
+#endif
+}
+
+
 typedef struct
 {
     uint32_t state[5];
@@ -362,9 +1312,9 @@ static void SHA1_update(SHA1Context *context, const unsigned char *data,
 
     if ((j + len) > 63) {
         memcpy(&(context->buffer[j]), data, (i = 64 - j));
-        SHA1_transform(context->state, context->buffer);
+        (*SHA1_transformG)(context->state, context->buffer);
         for ( ; (i + 63) < len; i += 64) {
-            SHA1_transform(context->state, &(data[i]));
+            (*SHA1_transformG)(context->state, &(data[i]));
         }
         j = 0;
     }
@@ -417,8 +1367,11 @@ static void SHA1_final(unsigned char digest[20], SHA1Context *context)
 // IPAD - 0x363636...
 //
 // HMAC(K,m) = SHA1((K ^ OPAD) . SHA1((K ^ IPAD) . m))
-void HMAC_SHA1(unsigned char hmac[20], const unsigned char *key, int key_len,
-               const unsigned char *message, int message_len)
+//
+// (K ^ IPAD) and (K ^ OPAD) are exactly one block each, so the states after
+// hashing them depend only on the key and are kept in an HMACSHA1Key.
+void HMAC_SHA1_key_initialize(HMACSHA1Key *hmacKey, const unsigned char *key,
+                              int key_len)
 {
     unsigned char kopad[64], kipad[64];
     int i;
@@ -437,21 +1390,423 @@ void HMAC_SHA1(unsigned char hmac[20], const unsigned char *key, int key_len,
         kipad[i] = 0 ^ 0x36;
     }
 
-    unsigned char digest[20];
-
     SHA1Context context;
-    
+
     SHA1_init(&context);
     SHA1_update(&context, kipad, 64);
-    SHA1_update(&context, message, message_len);
-    SHA1_final(digest, &context);
+    memcpy(hmacKey->inner, context.state, sizeof(hmacKey->inner));
 
     SHA1_init(&context);
     SHA1_update(&context, kopad, 64);
+    memcpy(hmacKey->outer, context.state, sizeof(hmacKey->outer));
+}
+
+
+// Starts a context as though the block of a padded key had been hashed,
+// leaving it in [state]
+static void SHA1_init_keyed(SHA1Context *context, const uint32_t state[5])
+{
+    memcpy(context->state, state, sizeof(context->state));
+    context->count[0] = 64 << 3;
+    context->count[1] = 0;
+}
+
+
+void HMAC_SHA1_with_key(unsigned char hmac[20], const HMACSHA1Key *hmacKey,
+                        const unsigned char *message, int message_len)
+{
+    unsigned char digest[20];
+
+    SHA1Context context;
+
+    SHA1_init_keyed(&context, hmacKey->inner);
+    SHA1_update(&context, message, message_len);
+    SHA1_final(digest, &context);
+
+    SHA1_init_keyed(&context, hmacKey->outer);
     SHA1_update(&context, digest, 20);
     SHA1_final(hmac, &context);
 }
 
+
+void HMAC_SHA1(unsigned char hmac[20], const unsigned char *key, int key_len,
+               const unsigned char *message, int message_len)
+{
+    HMACSHA1Key hmacKey;
+
+    HMAC_SHA1_key_initialize(&hmacKey, key, key_len);
+
+    HMAC_SHA1_with_key(hmac, &hmacKey, message, message_len);
+}
+
+// SHA-256 -------------------------------------------------------------------
+
+static const uint32_t SHA256_K[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ror(value, bits) (((value) >> (bits)) | ((value) << (32 - (bits))))
+
+static void SHA256_transform(uint32_t state[8],
+                             const unsigned char buffer[64])
+{
+    uint32_t w[64], a, b, c, d, e, f, g, h;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        w[i] = (((uint32_t) buffer[i * 4] << 24) |
+                ((uint32_t) buffer[i * 4 + 1] << 16) |
+                ((uint32_t) buffer[i * 4 + 2] << 8) |
+                ((uint32_t) buffer[i * 4 + 3]));
+    }
+
+    for ( ; i < 64; i++) {
+        uint32_t s0 = (ror(w[i - 15], 7) ^ ror(w[i - 15], 18) ^
+                       (w[i - 15] >> 3));
+        uint32_t s1 = (ror(w[i - 2], 17) ^ ror(w[i - 2], 19) ^
+                       (w[i - 2] >> 10));
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+    f = state[5];
+    g = state[6];
+    h = state[7];
+
+    for (i = 0; i < 64; i++) {
+        uint32_t t1 = (h + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) +
+                       ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i]);
+        uint32_t t2 = ((ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) +
+                       ((a & b) ^ (a & c) ^ (b & c)));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+
+void SHA256_init(SHA256Context *context)
+{
+    context->state[0] = 0x6a09e667;
+    context->state[1] = 0xbb67ae85;
+    context->state[2] = 0x3c6ef372;
+    context->state[3] = 0xa54ff53a;
+    context->state[4] = 0x510e527f;
+    context->state[5] = 0x9b05688c;
+    context->state[6] = 0x1f83d9ab;
+    context->state[7] = 0x5be0cd19;
+    context->count = 0;
+}
+
+
+void SHA256_update(SHA256Context *context, const unsigned char *data,
+                   unsigned int len)
+{
+    unsigned int used = (unsigned int) (context->count & 63);
+
+    context->count += len;
+
+    if (used) {
+        unsigned int fill = 64 - used;
+        if (len < fill) {
+            memcpy(&(context->buffer[used]), data, len);
+            return;
+        }
+        memcpy(&(context->buffer[used]), data, fill);
+        SHA256_transform(context->state, context->buffer);
+        data += fill;
+        len -= fill;
+    }
+
+    // Whole blocks are hashed straight from the data
+    while (len >= 64) {
+        SHA256_transform(context->state, data);
+        data += 64;
+        len -= 64;
+    }
+
+    memcpy(context->buffer, data, len);
+}
+
+
+void SHA256_final(unsigned char digest[32], SHA256Context *context)
+{
+    uint64_t bits = context->count << 3;
+    unsigned char pad[72];
+    // Pad to 56 bytes into a block, leaving room for the 8 byte length
+    unsigned int padLen = 64 - (unsigned int) ((context->count + 8) & 63);
+    int i;
+
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+    for (i = 0; i < 8; i++) {
+        pad[padLen + i] = (unsigned char) (bits >> (56 - (i * 8)));
+    }
+
+    SHA256_update(context, pad, padLen + 8);
+
+    for (i = 0; i < 32; i++) {
+        digest[i] = (unsigned char) (context->state[i >> 2] >>
+                                     ((3 - (i & 3)) * 8));
+    }
+}
+
+
+// HMAC-SHA-256 works as HMAC-SHA-1 does above, except that keys longer than
+// a block are hashed first, as RFC 2104 requires
+void HMAC_SHA256_key_initialize(HMACSHA256Key *hmacKey,
+                                const unsigned char *key, int key_len)
+{
+    unsigned char kopad[64], kipad[64], keyDigest[32];
+    SHA256Context context;
+    int i;
+
+    if (key_len > 64) {
+        SHA256_init(&context);
+        SHA256_update(&context, key, key_len);
+        SHA256_final(keyDigest, &context);
+        key = keyDigest;
+        key_len = 32;
+    }
+
+    for (i = 0; i < key_len; i++) {
+        kopad[i] = key[i] ^ 0x5c;
+        kipad[i] = key[i] ^ 0x36;
+    }
+
+    for ( ; i < 64; i++) {
+        kopad[i] = 0x5c;
+        kipad[i] = 0x36;
+    }
+
+    SHA256_init(&context);
+    SHA256_update(&context, kipad, 64);
+    memcpy(hmacKey->inner, context.state, sizeof(hmacKey->inner));
+
+    SHA256_init(&context);
+    SHA256_update(&context, kopad, 64);
+    memcpy(hmacKey->outer, context.state, sizeof(hmacKey->outer));
+}
+
+
+void HMAC_SHA256_with_key(unsigned char hmac[32],
+                          const HMACSHA256Key *hmacKey,
+                          const unsigned char *message, int message_len)
+{
+    unsigned char digest[32];
+    SHA256Context context;
+
+    memcpy(context.state, hmacKey->inner, sizeof(context.state));
+    context.count = 64;
+    SHA256_update(&context, message, message_len);
+    SHA256_final(digest, &context);
+
+    memcpy(context.state, hmacKey->outer, sizeof(context.state));
+    context.count = 64;
+    SHA256_update(&context, digest, 32);
+    SHA256_final(hmac, &context);
+}
+
+
+void HMAC_SHA256(unsigned char hmac[32], const unsigned char *key,
+                 int key_len, const unsigned char *message, int message_len)
+{
+    HMACSHA256Key hmacKey;
+
+    HMAC_SHA256_key_initialize(&hmacKey, key, key_len);
+
+    HMAC_SHA256_with_key(hmac, &hmacKey, message, message_len);
+}
+
+
+// MD5 (RFC 1321) -------------------------------------------------------------
+
+#define MD5_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define MD5_G(x, y, z) ((y) ^ ((z) & ((x) ^ (y))))
+#define MD5_H(x, y, z) ((x) ^ (y) ^ (z))
+#define MD5_I(x, y, z) ((y) ^ ((x) | ~(z)))
+
+#define MD5_STEP(f, a, b, c, d, x, t, s)                                \
+    (a) += f((b), (c), (d)) + (x) + (t);                                \
+    (a) = ((a) << (s)) | ((a) >> (32 - (s)));                           \
+    (a) += (b)
+
+static void MD5_transform(uint32_t state[4], const unsigned char block[64])
+{
+    uint32_t x[16], a = state[0], b = state[1], c = state[2], d = state[3];
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        x[i] = (block[i * 4] | (block[(i * 4) + 1] << 8) |
+                (block[(i * 4) + 2] << 16) |
+                ((uint32_t) block[(i * 4) + 3] << 24));
+    }
+
+    MD5_STEP(MD5_F, a, b, c, d, x[0], 0xd76aa478, 7);
+    MD5_STEP(MD5_F, d, a, b, c, x[1], 0xe8c7b756, 12);
+    MD5_STEP(MD5_F, c, d, a, b, x[2], 0x242070db, 17);
+    MD5_STEP(MD5_F, b, c, d, a, x[3], 0xc1bdceee, 22);
+    MD5_STEP(MD5_F, a, b, c, d, x[4], 0xf57c0faf, 7);
+    MD5_STEP(MD5_F, d, a, b, c, x[5], 0x4787c62a, 12);
+    MD5_STEP(MD5_F, c, d, a, b, x[6], 0xa8304613, 17);
+    MD5_STEP(MD5_F, b, c, d, a, x[7], 0xfd469501, 22);
+    MD5_STEP(MD5_F, a, b, c, d, x[8], 0x698098d8, 7);
+    MD5_STEP(MD5_F, d, a, b, c, x[9], 0x8b44f7af, 12);
+    MD5_STEP(MD5_F, c, d, a, b, x[10], 0xffff5bb1, 17);
+    MD5_STEP(MD5_F, b, c, d, a, x[11], 0x895cd7be, 22);
+    MD5_STEP(MD5_F, a, b, c, d, x[12], 0x6b901122, 7);
+    MD5_STEP(MD5_F, d, a, b, c, x[13], 0xfd987193, 12);
+    MD5_STEP(MD5_F, c, d, a, b, x[14], 0xa679438e, 17);
+    MD5_STEP(MD5_F, b, c, d, a, x[15], 0x49b40821, 22);
+
+    MD5_STEP(MD5_G, a, b, c, d, x[1], 0xf61e2562, 5);
+    MD5_STEP(MD5_G, d, a, b, c, x[6], 0xc040b340, 9);
+    MD5_STEP(MD5_G, c, d, a, b, x[11], 0x265e5a51, 14);
+    MD5_STEP(MD5_G, b, c, d, a, x[0], 0xe9b6c7aa, 20);
+    MD5_STEP(MD5_G, a, b, c, d, x[5], 0xd62f105d, 5);
+    MD5_STEP(MD5_G, d, a, b, c, x[10], 0x02441453, 9);
+    MD5_STEP(MD5_G, c, d, a, b, x[15], 0xd8a1e681, 14);
+    MD5_STEP(MD5_G, b, c, d, a, x[4], 0xe7d3fbc8, 20);
+    MD5_STEP(MD5_G, a, b, c, d, x[9], 0x21e1cde6, 5);
+    MD5_STEP(MD5_G, d, a, b, c, x[14], 0xc33707d6, 9);
+    MD5_STEP(MD5_G, c, d, a, b, x[3], 0xf4d50d87, 14);
+    MD5_STEP(MD5_G, b, c, d, a, x[8], 0x455a14ed, 20);
+    MD5_STEP(MD5_G, a, b, c, d, x[13], 0xa9e3e905, 5);
+    MD5_STEP(MD5_G, d, a, b, c, x[2], 0xfcefa3f8, 9);
+    MD5_STEP(MD5_G, c, d, a, b, x[7], 0x676f02d9, 14);
+    MD5_STEP(MD5_G, b, c, d, a, x[12], 0x8d2a4c8a, 20);
+
+    MD5_STEP(MD5_H, a, b, c, d, x[5], 0xfffa3942, 4);
+    MD5_STEP(MD5_H, d, a, b, c, x[8], 0x8771f681, 11);
+    MD5_STEP(MD5_H, c, d, a, b, x[11], 0x6d9d6122, 16);
+    MD5_STEP(MD5_H, b, c, d, a, x[14], 0xfde5380c, 23);
+    MD5_STEP(MD5_H, a, b, c, d, x[1], 0xa4beea44, 4);
+    MD5_STEP(MD5_H, d, a, b, c, x[4], 0x4bdecfa9, 11);
+    MD5_STEP(MD5_H, c, d, a, b, x[7], 0xf6bb4b60, 16);
+    MD5_STEP(MD5_H, b, c, d, a, x[10], 0xbebfbc70, 23);
+    MD5_STEP(MD5_H, a, b, c, d, x[13], 0x289b7ec6, 4);
+    MD5_STEP(MD5_H, d, a, b, c, x[0], 0xeaa127fa, 11);
+    MD5_STEP(MD5_H, c, d, a, b, x[3], 0xd4ef3085, 16);
+    MD5_STEP(MD5_H, b, c, d, a, x[6], 0x04881d05, 23);
+    MD5_STEP(MD5_H, a, b, c, d, x[9], 0xd9d4d039, 4);
+    MD5_STEP(MD5_H, d, a, b, c, x[12], 0xe6db99e5, 11);
+    MD5_STEP(MD5_H, c, d, a, b, x[15], 0x1fa27cf8, 16);
+    MD5_STEP(MD5_H, b, c, d, a, x[2], 0xc4ac5665, 23);
+
+    MD5_STEP(MD5_I, a, b, c, d, x[0], 0xf4292244, 6);
+    MD5_STEP(MD5_I, d, a, b, c, x[7], 0x432aff97, 10);
+    MD5_STEP(MD5_I, c, d, a, b, x[14], 0xab9423a7, 15);
+    MD5_STEP(MD5_I, b, c, d, a, x[5], 0xfc93a039, 21);
+    MD5_STEP(MD5_I, a, b, c, d, x[12], 0x655b59c3, 6);
+    MD5_STEP(MD5_I, d, a, b, c, x[3], 0x8f0ccc92, 10);
+    MD5_STEP(MD5_I, c, d, a, b, x[10], 0xffeff47d, 15);
+    MD5_STEP(MD5_I, b, c, d, a, x[1], 0x85845dd1, 21);
+    MD5_STEP(MD5_I, a, b, c, d, x[8], 0x6fa87e4f, 6);
+    MD5_STEP(MD5_I, d, a, b, c, x[15], 0xfe2ce6e0, 10);
+    MD5_STEP(MD5_I, c, d, a, b, x[6], 0xa3014314, 15);
+    MD5_STEP(MD5_I, b, c, d, a, x[13], 0x4e0811a1, 21);
+    MD5_STEP(MD5_I, a, b, c, d, x[4], 0xf7537e82, 6);
+    MD5_STEP(MD5_I, d, a, b, c, x[11], 0xbd3af235, 10);
+    MD5_STEP(MD5_I, c, d, a, b, x[2], 0x2ad7d2bb, 15);
+    MD5_STEP(MD5_I, b, c, d, a, x[9], 0xeb86d391, 21);
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+
+void MD5_init(MD5Context *context)
+{
+    context->state[0] = 0x67452301;
+    context->state[1] = 0xefcdab89;
+    context->state[2] = 0x98badcfe;
+    context->state[3] = 0x10325476;
+    context->count = 0;
+}
+
+
+void MD5_update(MD5Context *context, const unsigned char *data,
+                unsigned int len)
+{
+    unsigned int used = (unsigned int) (context->count & 63);
+
+    context->count += len;
+
+    if (used) {
+        unsigned int fill = 64 - used;
+        if (len < fill) {
+            memcpy(&(context->buffer[used]), data, len);
+            return;
+        }
+        memcpy(&(context->buffer[used]), data, fill);
+        MD5_transform(context->state, context->buffer);
+        data += fill;
+        len -= fill;
+    }
+
+    while (len >= 64) {
+        MD5_transform(context->state, data);
+        data += 64;
+        len -= 64;
+    }
+
+    memcpy(context->buffer, data, len);
+}
+
+
+void MD5_final(unsigned char digest[16], MD5Context *context)
+{
+    uint64_t bits = context->count << 3;
+    unsigned char pad[72];
+    // As for SHA-256, except that the length is little-endian
+    unsigned int padLen = 64 - (unsigned int) ((context->count + 8) & 63);
+    int i;
+
+    memset(pad, 0, sizeof(pad));
+    pad[0] = 0x80;
+    for (i = 0; i < 8; i++) {
+        pad[padLen + i] = (unsigned char) (bits >> (i * 8));
+    }
+
+    MD5_update(context, pad, padLen + 8);
+
+    for (i = 0; i < 16; i++) {
+        digest[i] = (unsigned char) (context->state[i >> 2] >> ((i & 3) * 8));
+    }
+}
+
+
 #define rot(x,k) (((x) << (k)) | ((x) >> (32 - (k))))
 
 uint64_t hash(const unsigned char *k, int length)
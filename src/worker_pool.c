@@ -0,0 +1,349 @@
+/** **************************************************************************
+ * worker_pool.c
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License version 3
+ * along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <poll.h>
+#else
+#include <sys/select.h>
+#endif
+#include "libs3.h"
+
+
+// A task waiting to be run by a worker
+typedef struct WorkerTask
+{
+    S3WorkerPoolTask *task;
+
+    void *callbackData;
+
+    struct WorkerTask *next;
+} WorkerTask;
+
+
+// One event loop thread of the pool, with the S3RequestContext it drives
+typedef struct Worker
+{
+    struct S3WorkerPool *workerPool;
+
+    pthread_t thread;
+
+    S3RequestContext *requestContext;
+
+    // Writing to wakePipe[1] wakes the thread up to run newly queued tasks,
+    // or to exit
+    int wakePipe[2];
+
+    // The following are protected by the pool mutex
+
+    // Tasks queued for this worker
+    WorkerTask *tasks, *tasksTail;
+
+    // The number of tasks submitted to this worker which have not yet been
+    // run
+    int taskCount;
+
+    // The number of requests in progress in requestContext as of the last
+    // time that the worker looked
+    int requestCount;
+} Worker;
+
+
+// The load of a worker; tasks are submitted to the least loaded worker
+#define WORKER_LOAD(worker) ((worker)->taskCount + (worker)->requestCount)
+
+
+struct S3WorkerPool
+{
+    pthread_mutex_t mutex;
+
+    // Signalled whenever totalLoad drops to 0
+    pthread_cond_t idleCond;
+
+    // Sum of the loads of all workers
+    int totalLoad;
+
+    // Set when the pool is being destroyed
+    int stopping;
+
+    int workerCount;
+
+    Worker workers[1];
+};
+
+
+static void wake_worker(Worker *worker)
+{
+    char c = 0;
+
+    // If the pipe is full then the worker is already due to wake up
+    while ((write(worker->wakePipe[1], &c, 1) == -1) && (errno == EINTR)) {
+    }
+}
+
+
+// Waits until the worker's requests have I/O available, its S3RequestContext
+// needs to run its timeouts, or it is woken up
+static void worker_wait(Worker *worker)
+{
+    int64_t timeout = S3_get_request_context_timeout(worker->requestContext);
+
+#ifdef __linux__
+    struct pollfd fds[2];
+    fds[0].fd = S3_get_request_context_epoll_fd(worker->requestContext);
+    fds[0].events = POLLIN;
+    fds[1].fd = worker->wakePipe[0];
+    fds[1].events = POLLIN;
+
+    poll(fds, 2, (int) timeout);
+#else
+    fd_set readfds, writefds, exceptfds;
+    FD_ZERO(&readfds);
+    FD_ZERO(&writefds);
+    FD_ZERO(&exceptfds);
+    int maxfd;
+    if (S3_get_request_context_fdsets(worker->requestContext, &readfds,
+                                      &writefds, &exceptfds,
+                                      &maxfd) != S3StatusOK) {
+        maxfd = -1;
+    }
+    FD_SET(worker->wakePipe[0], &readfds);
+    if (worker->wakePipe[0] > maxfd) {
+        maxfd = worker->wakePipe[0];
+    }
+    struct timeval tv = { timeout / 1000, (timeout % 1000) * 1000 };
+    select(maxfd + 1, &readfds, &writefds, &exceptfds,
+           (timeout == -1) ? 0 : &tv);
+#endif
+}
+
+
+static void *worker_thread(void *data)
+{
+    Worker *worker = (Worker *) data;
+    S3WorkerPool *workerPool = worker->workerPool;
+
+    while (1) {
+        // Empty the wake pipe before taking the queued tasks, so that any
+        // task queued after this wakes the worker up again
+        char buf[64];
+        while (read(worker->wakePipe[0], buf, sizeof(buf)) > 0) {
+        }
+
+        pthread_mutex_lock(&(workerPool->mutex));
+        WorkerTask *tasks = worker->tasks;
+        worker->tasks = worker->tasksTail = 0;
+        int stopping = workerPool->stopping;
+        pthread_mutex_unlock(&(workerPool->mutex));
+
+        int tasksRun = 0;
+        while (tasks) {
+            WorkerTask *next = tasks->next;
+            (*(tasks->task))(worker->requestContext, tasks->callbackData);
+            free(tasks);
+            tasks = next;
+            tasksRun++;
+        }
+
+        if (stopping) {
+            break;
+        }
+
+        // Process whatever I/O is ready, and start any requests which the
+        // tasks added
+        int requestsRemaining;
+        if (S3_process_request_context(worker->requestContext, 0,
+                                       &requestsRemaining) != S3StatusOK) {
+            requestsRemaining = worker->requestCount;
+        }
+
+        pthread_mutex_lock(&(workerPool->mutex));
+        workerPool->totalLoad += 
+            requestsRemaining - worker->requestCount - tasksRun;
+        worker->taskCount -= tasksRun;
+        worker->requestCount = requestsRemaining;
+        if (!workerPool->totalLoad) {
+            pthread_cond_broadcast(&(workerPool->idleCond));
+        }
+        pthread_mutex_unlock(&(workerPool->mutex));
+
+        worker_wait(worker);
+    }
+
+    return 0;
+}
+
+
+S3Status S3_create_worker_pool(int threadCount,
+                               S3WorkerPool **workerPoolReturn)
+{
+    if (threadCount < 1) {
+        threadCount = 1;
+    }
+
+    S3WorkerPool *workerPool = (S3WorkerPool *) 
+        malloc(sizeof(S3WorkerPool) + ((threadCount - 1) * sizeof(Worker)));
+    if (!workerPool) {
+        return S3StatusOutOfMemory;
+    }
+
+    pthread_mutex_init(&(workerPool->mutex), 0);
+    pthread_cond_init(&(workerPool->idleCond), 0);
+    workerPool->totalLoad = 0;
+    workerPool->stopping = 0;
+    workerPool->workerCount = 0;
+
+    S3Status status = S3StatusOK;
+
+    while (workerPool->workerCount < threadCount) {
+        Worker *worker = &(workerPool->workers[workerPool->workerCount]);
+        worker->workerPool = workerPool;
+        worker->tasks = worker->tasksTail = 0;
+        worker->taskCount = 0;
+        worker->requestCount = 0;
+
+        if ((status = S3_create_request_context(&(worker->requestContext)))
+            != S3StatusOK) {
+            break;
+        }
+
+        if (pipe(worker->wakePipe)) {
+            S3_destroy_request_context(worker->requestContext);
+            status = S3StatusInternalError;
+            break;
+        }
+
+        // The worker empties its wake pipe without blocking, and waking it
+        // must never block either
+        fcntl(worker->wakePipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(worker->wakePipe[1], F_SETFL, O_NONBLOCK);
+
+        if (pthread_create(&(worker->thread), 0, &worker_thread, worker)) {
+            close(worker->wakePipe[0]);
+            close(worker->wakePipe[1]);
+            S3_destroy_request_context(worker->requestContext);
+            status = S3StatusInternalError;
+            break;
+        }
+
+        workerPool->workerCount++;
+    }
+
+    if (status != S3StatusOK) {
+        S3_destroy_worker_pool(workerPool);
+        return status;
+    }
+
+    *workerPoolReturn = workerPool;
+
+    return S3StatusOK;
+}
+
+
+void S3_destroy_worker_pool(S3WorkerPool *workerPool)
+{
+    pthread_mutex_lock(&(workerPool->mutex));
+    workerPool->stopping = 1;
+    pthread_mutex_unlock(&(workerPool->mutex));
+
+    int i;
+    for (i = 0; i < workerPool->workerCount; i++) {
+        Worker *worker = &(workerPool->workers[i]);
+        wake_worker(worker);
+        pthread_join(worker->thread, 0);
+        // This interrupts any requests still in progress
+        S3_destroy_request_context(worker->requestContext);
+        close(worker->wakePipe[0]);
+        close(worker->wakePipe[1]);
+    }
+
+    pthread_cond_destroy(&(workerPool->idleCond));
+    pthread_mutex_destroy(&(workerPool->mutex));
+
+    free(workerPool);
+}
+
+
+S3Status S3_submit_worker_pool_task(S3WorkerPool *workerPool,
+                                    S3WorkerPoolTask *task, void *callbackData)
+{
+    WorkerTask *workerTask = (WorkerTask *) malloc(sizeof(WorkerTask));
+    if (!workerTask) {
+        return S3StatusOutOfMemory;
+    }
+
+    workerTask->task = task;
+    workerTask->callbackData = callbackData;
+    workerTask->next = 0;
+
+    pthread_mutex_lock(&(workerPool->mutex));
+
+    if (workerPool->stopping) {
+        pthread_mutex_unlock(&(workerPool->mutex));
+        free(workerTask);
+        return S3StatusInterrupted;
+    }
+
+    Worker *worker = &(workerPool->workers[0]);
+    int i;
+    for (i = 1; i < workerPool->workerCount; i++) {
+        if (WORKER_LOAD(&(workerPool->workers[i])) < WORKER_LOAD(worker)) {
+            worker = &(workerPool->workers[i]);
+        }
+    }
+
+    if (worker->tasksTail) {
+        worker->tasksTail->next = workerTask;
+    }
+    else {
+        worker->tasks = workerTask;
+    }
+    worker->tasksTail = workerTask;
+    worker->taskCount++;
+    workerPool->totalLoad++;
+
+    pthread_mutex_unlock(&(workerPool->mutex));
+
+    wake_worker(worker);
+
+    return S3StatusOK;
+}
+
+
+void S3_wait_worker_pool(S3WorkerPool *workerPool)
+{
+    pthread_mutex_lock(&(workerPool->mutex));
+
+    while (workerPool->totalLoad) {
+        pthread_cond_wait(&(workerPool->idleCond), &(workerPool->mutex));
+    }
+
+    pthread_mutex_unlock(&(workerPool->mutex));
+}